@@ -7,13 +7,54 @@
 #include "analysis.hpp"
 
 #include <algorithm>
+#include <cstring>
+#include "fnv1a.hpp"
 #include "node.hpp"
+#include "octaves.hpp"
 
 namespace hexa
 {
 namespace noise
 {
 
+namespace
+{
+
+// The first element of a key in the value number table tells what kind
+// of key it is: a node, or the position at which nodes are evaluated.
+enum {
+    key_node,
+    key_root,
+    key_frame,
+    key_octave,
+    key_cell
+};
+
+uint64_t bits(double v)
+{
+    uint64_t result;
+    std::memcpy(&result, &v, sizeof(result));
+    return result;
+}
+
+bool is_function(const node& n)
+{
+    return !n.is_const && n.type != node::entry_point;
+}
+
+// The number of octaves of a fractal.  If it is not a constant, assume
+// the most the generators will do.
+double octaves(const node& n)
+{
+    if (n.input[2].type != node::const_var)
+        return INTERPRETER_OCTAVES_LIMIT;
+
+    return std::max(0.0, std::min(n.input[2].aux_var,
+                                  double(INTERPRETER_OCTAVES_LIMIT)));
+}
+
+} // anonymous namespace
+
 size_t fractal_depth(const node& n)
 {
     return 0;
@@ -32,7 +73,7 @@ size_t weight(const node& n)
 
     case node::fractal:
     case node::fractal3:
-        return n.input[2].aux_var * weight(n.input[1]) + weight(n.input[0]);
+        return octaves(n) * weight(n.input[1]) + weight(n.input[0]);
 
     case node::then_else:
         return weight(n.input[0])
@@ -66,6 +107,22 @@ size_t weight(const node& n)
     return result;
 }
 
+// Perlin noise uses the seed as is, all other functions add the global
+// seed to it.  (Same as generator_slowinterpreter.)
+const generator_context::permutation*
+seed_table(const node& n, const generator_context& ctx)
+{
+    if (!ctx.seed_tables() || !n.input[1].is_const)
+        return nullptr;
+
+    double seed = n.input[1].aux_var;
+    if (n.type != node::perlin && n.type != node::perlin3) {
+        seed += static_cast<uint32_t>(
+            boost::get<double>(ctx.get_global("seed")));
+    }
+    return &ctx.get_permutation(static_cast<uint32_t>(seed));
+}
+
 void referred_images(const node& n, std::unordered_set<std::string>& in)
 {
     if (n.type == node::png_lookup)
@@ -98,5 +155,194 @@ std::unordered_set<std::string> referred_scripts(const node& n)
     return result;
 }
 
+namespace
+{
+
+void append(std::string& out, uint64_t v)
+{
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void append(std::string& out, const std::string& v)
+{
+    append(out, v.size());
+    out += v;
+}
+
+void fingerprint(const node& n, const generator_context& ctx,
+                 std::string& out)
+{
+    append(out, n.type);
+    append(out, n.return_type);
+    switch (n.type) {
+    case node::const_var:
+        append(out, bits(n.aux_var));
+        break;
+    case node::const_bool:
+        append(out, n.aux_bool);
+        break;
+    case node::const_str:
+        append(out, n.aux_string);
+        break;
+    case node::external_:
+        append(out, n.aux_string);
+        fingerprint(ctx.get_script(n.aux_string), ctx, out);
+        break;
+    case node::png_lookup: {
+        // Tiles can outlive the process (see tile_store), so the image
+        // itself has to be part of the fingerprint, not just its name.
+        auto& img = ctx.get_image(n.input[1].aux_string);
+        append(out, img.width);
+        append(out, img.height);
+        append(out, img.bitdepth);
+        append(out, fnv1a(img.buffer.data(), img.buffer.size()));
+        break;
+    }
+    case node::curve_linear:
+    case node::curve_spline:
+        append(out, n.curve.size());
+        for (auto& p : n.curve) {
+            append(out, bits(p.in));
+            append(out, bits(p.out));
+        }
+        break;
+    default:
+        break;
+    }
+
+    append(out, n.input.size());
+    for (auto& p : n.input)
+        fingerprint(p, ctx, out);
+}
+
+} // anonymous namespace
+
+std::string fingerprint(const node& n, const generator_context& ctx)
+{
+    std::string result;
+    append(result, bits(boost::get<double>(ctx.get_global("seed"))));
+    append(result, ctx.seed_tables());
+    fingerprint(n, ctx, result);
+    return result;
+}
+
+subexpressions::subexpressions(const node& n)
+    : counts_(1, 0)
+    , functions_(0)
+    , duplicates_(0)
+{
+    number(n, intern({key_root}));
+}
+
+size_t subexpressions::id(const node& n) const
+{
+    auto found = ids_.find(&n);
+    return found == ids_.end() ? 0 : found->second;
+}
+
+size_t subexpressions::count(const node& n) const
+{
+    return counts_[id(n)];
+}
+
+size_t subexpressions::intern(const std::vector<uint64_t>& key)
+{
+    auto found = table_.find(key);
+    if (found != table_.end())
+        return found->second;
+
+    size_t result = table_.size() + 1;
+    table_[key] = result;
+    return result;
+}
+
+size_t subexpressions::number(const node& n, size_t scope)
+{
+    std::vector<uint64_t> key{key_node, static_cast<uint64_t>(n.type),
+                              static_cast<uint64_t>(n.return_type)};
+    switch (n.type) {
+    case node::entry_point:
+        key.push_back(scope);
+        break;
+    case node::const_var:
+        key.push_back(bits(n.aux_var));
+        break;
+    case node::const_bool:
+        key.push_back(n.aux_bool);
+        break;
+    case node::const_str:
+    case node::external_:
+        key.push_back(n.aux_string.size());
+        key.insert(key.end(), n.aux_string.begin(), n.aux_string.end());
+        break;
+    case node::curve_linear:
+    case node::curve_spline:
+        key.push_back(n.curve.size());
+        for (auto& p : n.curve) {
+            key.push_back(bits(p.in));
+            key.push_back(bits(p.out));
+        }
+        break;
+    default:
+        break;
+    }
+
+    // Some functions evaluate their inputs at a different position;
+    // the position is identified by the inputs it was derived from.
+    std::vector<size_t> in(n.input.size(), 0);
+    auto outer = [&](size_t i) { in[i] = number(n.input[i], scope); };
+    auto inner = [&](size_t i, size_t s) { in[i] = number(n.input[i], s); };
+
+    switch (n.type) {
+    case node::map:
+    case node::map3:
+    case node::turbulence:
+    case node::turbulence3:
+    case node::lambda_:
+        outer(0);
+        for (size_t i = 1; i < n.input.size(); ++i)
+            inner(i, intern({key_frame, in[0]}));
+        break;
+
+    // The parameters are evaluated at the starting position, the octaves
+    // at a position that changes in every iteration.
+    case node::fractal:
+    case node::fractal3:
+        outer(0);
+        for (size_t i = 2; i < n.input.size(); ++i)
+            inner(i, intern({key_frame, in[0]}));
+        inner(1, intern({key_octave, in[0], in[3]}));
+        break;
+
+    case node::worley:
+    case node::worley3:
+    case node::voronoi:
+        outer(0);
+        outer(2);
+        inner(1, intern({key_cell, static_cast<uint64_t>(n.type), in[0],
+                         in[2]}));
+        break;
+
+    default:
+        for (size_t i = 0; i < n.input.size(); ++i)
+            outer(i);
+    }
+    key.insert(key.end(), in.begin(), in.end());
+
+    auto result = intern(key);
+    ids_[&n] = result;
+    if (counts_.size() <= result)
+        counts_.resize(result + 1, 0);
+
+    if (is_function(n)) {
+        ++functions_;
+        if (counts_[result] > 0)
+            ++duplicates_;
+    }
+    ++counts_[result];
+
+    return result;
+}
+
 } // namespace noise
 } // namespace hexa
@@ -6,8 +6,14 @@
 //---------------------------------------------------------------------------
 #pragma once
 
+#include <cstdint>
+#include <map>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
+
+#include "generator_context.hpp"
 
 namespace hexa
 {
@@ -33,5 +39,74 @@ std::unordered_set<std::string> referred_images(const node& n);
  * @return  A list of all scripts referenced by the @-operator */
 std::unordered_set<std::string> referred_scripts(const node& n);
 
+/** Turn a script into a string that identifies it.  Two scripts with the
+ *  same fingerprint give the same results.  It covers the whole tree,
+ *  the scripts it calls with the @-operator, the global seed, and
+ *  whether seed tables are enabled.  Images are included by a hash of
+ *  their contents.
+ * @param n    The script
+ * @param ctx  Used to look up the scripts called with the @-operator,
+ *             and the images
+ * @throw std::runtime_error if a script or image was not found
+ * @return A string of bytes (not text) */
+std::string fingerprint(const node& n, const generator_context& ctx);
+
+/** Get the permutation table a gradient noise function uses, if seed
+ *  tables are enabled.  (See generator_context::set_seed_tables().)
+ * @param n    A perlin, perlin3, simplex, simplex3, opensimplex, or
+ *             opensimplex3 node
+ * @param ctx  The table is looked up in this context
+ * @return The table, or null if the function adds its seed to the
+ *         coordinates instead */
+const generator_context::permutation*
+seed_table(const node& n, const generator_context& ctx);
+
+/** Finds the subexpressions that occur more than once in a script.
+ *  Every node gets a value number; two nodes get the same number if they
+ *  are guaranteed to produce the same value.  This is the case if they
+ *  are the same function with the same parameters, and they are evaluated
+ *  at the same position.  (So perlin inside a map() is not the same as
+ *  perlin outside of it, but the same perlin in two maps over the same
+ *  input is.)  Seen this way, the tree is really a DAG, and a backend
+ *  only needs to evaluate every value number once per sample.
+ *
+ *  Scripts called with the @-operator are not analysed, their nodes
+ *  do not get a value number. */
+class subexpressions
+{
+public:
+    /** Number all nodes in a script.
+     * @param n  The script; it must not be modified while this object
+     *           is in use */
+    explicit subexpressions(const node& n);
+
+    /** Get the value number of a node.
+     * @return The value number, or 0 if n is not part of the script */
+    size_t id(const node& n) const;
+
+    /** Get the number of times the value of a node occurs in the
+     *  script. */
+    size_t count(const node& n) const;
+
+    /** The total number of functions in the script, not counting
+     *  constants and entry points. */
+    size_t functions() const { return functions_; }
+
+    /** The number of functions that were deduplicated, because the same
+     *  value is already computed elsewhere in the script. */
+    size_t duplicates() const { return duplicates_; }
+
+private:
+    size_t number(const node& n, size_t scope);
+    size_t intern(const std::vector<uint64_t>& key);
+
+private:
+    std::map<std::vector<uint64_t>, size_t> table_;
+    std::unordered_map<const node*, size_t> ids_;
+    std::vector<size_t> counts_;
+    size_t functions_;
+    size_t duplicates_;
+};
+
 } // namespace noise
 } // namespace hexa
@@ -0,0 +1,900 @@
+//---------------------------------------------------------------------------
+// hexanoise/bounds.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "bounds.hpp"
+
+#define GLM_FORCE_RADIANS
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <glm/gtx/rotate_vector.hpp>
+#include "generator_context.hpp"
+#include "node.hpp"
+#include "octaves.hpp"
+#include "primitives.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+namespace
+{
+
+const double pi = 3.14159265358979323846;
+const double inf = std::numeric_limits<double>::infinity();
+const interval everything{-inf, inf};
+
+// The ranges of the noise functions.  For lattice noise, the result at a
+// position is a weighted sum over the nearby lattice points, where every
+// term depends on the gradient picked at that point.  Picking the
+// gradient that maximizes every term separately gives an upper bound
+// that holds for any permutation table and seed.  These are the maxima
+// of that sum over all positions, rounded up.  (The unit tests sample
+// the functions densely for several seeds; the largest values found are
+// 1% (simplex) to 20% (perlin) below these.)
+const interval perlin_range{-1.23, 1.23};
+const interval perlin3_range{-1.27, 1.27};
+const interval simplex_range{-1.01, 1.01};
+const interval simplex3_range{-1.01, 1.01};
+const interval opensimplex_range{-0.88, 0.88};
+const interval opensimplex3_range{-1.01, 1.01};
+
+// The distances to the closest and second closest feature points.  The
+// closest one is at most the diagonal of a cell away.  The second one is
+// no further than the point in the neighbouring cell on the near side.
+const double worley_f0 = std::sqrt(2.0);
+const double worley_f1 = std::sqrt(1.5 * 1.5 + 1.0);
+const double worley3_f0 = std::sqrt(3.0);
+const double worley3_f1 = std::sqrt(1.5 * 1.5 + 2.0);
+
+struct box
+{
+    interval x, y, z;
+};
+
+// Whether a condition can be true, false, or both.
+struct truth
+{
+    bool can_be_true;
+    bool can_be_false;
+};
+
+interval point(double v)
+{
+    return interval{v, v};
+}
+
+// NaN ends mean the operation was undefined somewhere in the range.
+interval checked(double a, double b)
+{
+    if (std::isnan(a) || std::isnan(b))
+        return everything;
+
+    return interval{std::min(a, b), std::max(a, b)};
+}
+
+interval hull(const interval& a, const interval& b)
+{
+    return interval{std::min(a.lo, b.lo), std::max(a.hi, b.hi)};
+}
+
+interval hull(const interval& a, double v)
+{
+    return hull(a, point(v));
+}
+
+bool is_point(const interval& a)
+{
+    return a.lo == a.hi;
+}
+
+// The samples are finite, so 0 * inf counts as 0 here.
+double times(double a, double b)
+{
+    return (a == 0.0 || b == 0.0) ? 0.0 : a * b;
+}
+
+interval operator+(const interval& a, const interval& b)
+{
+    return checked(a.lo + b.lo, a.hi + b.hi);
+}
+
+interval operator-(const interval& a, const interval& b)
+{
+    return checked(a.lo - b.hi, a.hi - b.lo);
+}
+
+interval operator-(const interval& a)
+{
+    return interval{-a.hi, -a.lo};
+}
+
+interval operator*(const interval& a, const interval& b)
+{
+    double p[]
+        = {times(a.lo, b.lo), times(a.lo, b.hi), times(a.hi, b.lo),
+           times(a.hi, b.hi)};
+
+    return checked(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+}
+
+interval operator/(const interval& a, const interval& b)
+{
+    if (b.contains(0.0))
+        return everything;
+
+    double p[] = {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi};
+    for (double v : p) {
+        if (std::isnan(v))
+            return everything;
+    }
+    return interval{*std::min_element(p, p + 4), *std::max_element(p, p + 4)};
+}
+
+interval abs(const interval& a)
+{
+    if (a.lo >= 0.0)
+        return a;
+    if (a.hi <= 0.0)
+        return -a;
+
+    return interval{0.0, std::max(-a.lo, a.hi)};
+}
+
+interval sqr(const interval& a)
+{
+    auto m = abs(a);
+    return interval{m.lo * m.lo, m.hi * m.hi};
+}
+
+interval sqrt(const interval& a)
+{
+    if (a.lo < 0.0)
+        return everything;
+
+    return interval{std::sqrt(a.lo), std::sqrt(a.hi)};
+}
+
+interval min(const interval& a, const interval& b)
+{
+    return interval{std::min(a.lo, b.lo), std::min(a.hi, b.hi)};
+}
+
+interval max(const interval& a, const interval& b)
+{
+    return interval{std::max(a.lo, b.lo), std::max(a.hi, b.hi)};
+}
+
+// Both ranges hold the result; if rounding made them miss each other,
+// the first one is kept.
+interval intersect(const interval& a, const interval& b)
+{
+    interval r{std::max(a.lo, b.lo), std::min(a.hi, b.hi)};
+    return r.lo <= r.hi ? r : a;
+}
+
+// Does the range include x + k * period, for some integer k?
+bool hits(const interval& a, double x, double period)
+{
+    return std::ceil((a.lo - x) / period) * period + x <= a.hi;
+}
+
+// The range of f(v * pi), for a function with period 2 that has a
+// maximum of 1 at peak, and a minimum of -1 at peak + 1.
+template <typename F>
+interval wave(const interval& a, double peak, F f)
+{
+    if (!(a.hi - a.lo < 2.0))
+        return interval{-1.0, 1.0};
+
+    auto r = checked(f(a.lo * pi), f(a.hi * pi));
+    if (hits(a, peak, 2.0))
+        r.hi = 1.0;
+    if (hits(a, peak + 1.0, 2.0))
+        r.lo = -1.0;
+
+    return r;
+}
+
+interval sin_pi(const interval& a)
+{
+    return wave(a, 0.5, [](double v) { return std::sin(v); });
+}
+
+interval cos_pi(const interval& a)
+{
+    return wave(a, 0.0, [](double v) { return std::cos(v); });
+}
+
+interval tan_pi(const interval& a)
+{
+    if (!(a.hi - a.lo < 1.0) || hits(a, 0.5, 1.0))
+        return everything;
+
+    return checked(std::tan(a.lo * pi), std::tan(a.hi * pi));
+}
+
+interval pow(const interval& a, const interval& b)
+{
+    if (a.lo >= 0.0) {
+        // For a positive base, pow(x, y) = exp(y * log(x)), and y * log(x)
+        // takes its extremes in the corners.
+        return checked(
+            std::min(std::min(std::pow(a.lo, b.lo), std::pow(a.lo, b.hi)),
+                     std::min(std::pow(a.hi, b.lo), std::pow(a.hi, b.hi))),
+            std::max(std::max(std::pow(a.lo, b.lo), std::pow(a.lo, b.hi)),
+                     std::max(std::pow(a.hi, b.lo), std::pow(a.hi, b.hi))));
+    }
+
+    // A negative base is only defined for whole exponents.
+    if (!is_point(b) || b.lo != std::floor(b.lo) || !std::isfinite(b.lo))
+        return everything;
+
+    // x^n is monotonic for positive and for negative x.
+    auto r = checked(std::pow(a.lo, b.lo), std::pow(a.hi, b.lo));
+    if (a.contains(0.0)) {
+        if (b.lo < 0.0)
+            return everything;
+
+        r = hull(r, std::pow(0.0, b.lo));
+    }
+    return r;
+}
+
+// Tells if fract(v) < 0.5 everywhere in the range (1), nowhere (0), or
+// if it cannot tell (-1).
+int lower_half(const interval& a)
+{
+    if (!a.is_finite())
+        return -1;
+
+    double l = std::floor(a.lo * 2.0);
+    if (l != std::floor(a.hi * 2.0))
+        return -1;
+
+    return std::fmod(l, 2.0) == 0.0 ? 1 : 0;
+}
+
+// Corners of the range where atan2 is continuous.
+interval angle(const interval& x, const interval& y)
+{
+    if (x.lo < 0.0 && y.contains(0.0))
+        return interval{-1.0, 1.0};
+    if (x.contains(0.0) && y.contains(0.0))
+        return interval{-1.0, 1.0};
+
+    double a[] = {std::atan2(y.lo, x.lo), std::atan2(y.lo, x.hi),
+                  std::atan2(y.hi, x.lo), std::atan2(y.hi, x.hi)};
+
+    return checked(*std::min_element(a, a + 4) / pi,
+                   *std::max_element(a, a + 4) / pi);
+}
+
+double cubic(double v0, double v1, double v2, double v3, double a)
+{
+    const double x = v3 - v2 - v0 + v1;
+    return ((x * a + (v0 - v1 - x)) * a + (v2 - v0)) * a + v1;
+}
+
+// The range of a cubic segment for a in [a0, a1] is found at the ends,
+// and where the derivative is zero.
+interval cubic_range(double v0, double v1, double v2, double v3, double a0,
+                     double a1)
+{
+    auto r = checked(cubic(v0, v1, v2, v3, a0), cubic(v0, v1, v2, v3, a1));
+
+    const double x = v3 - v2 - v0 + v1;
+    const double qa = 3.0 * x, qb = 2.0 * (v0 - v1 - x), qc = v2 - v0;
+
+    double roots[2];
+    int count = 0;
+    if (qa == 0.0) {
+        if (qb != 0.0)
+            roots[count++] = -qc / qb;
+    } else {
+        double d = qb * qb - 4.0 * qa * qc;
+        if (d >= 0.0) {
+            d = std::sqrt(d);
+            roots[count++] = (-qb - d) / (2.0 * qa);
+            roots[count++] = (-qb + d) / (2.0 * qa);
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        if (roots[i] > a0 && roots[i] < a1)
+            r = hull(r, cubic(v0, v1, v2, v3, roots[i]));
+    }
+    return r;
+}
+
+interval curve_linear_range(const interval& a,
+                            const std::vector<node::control_point>& c)
+{
+    auto r = checked(curve_linear(a.lo, c), curve_linear(a.hi, c));
+    for (auto& p : c) {
+        if (p.in > a.lo && p.in < a.hi)
+            r = hull(r, p.out);
+    }
+    return r;
+}
+
+// Follows the segments of curve_spline() in primitives.cpp.
+interval curve_spline_range(const interval& a,
+                            const std::vector<node::control_point>& c)
+{
+    auto r = checked(curve_spline(a.lo, c), curve_spline(a.hi, c));
+
+    const int lim = c.size() - 1;
+    for (int i = 1; i <= lim; ++i) {
+        const double in0 = c[i - 1].in, in1 = c[i].in;
+        if (!(in0 < in1) || a.hi < in0 || a.lo >= in1)
+            continue;
+
+        const double a0 = (std::max(a.lo, in0) - in0) / (in1 - in0);
+        const double a1 = (std::min(a.hi, in1) - in0) / (in1 - in0);
+
+        r = hull(r, cubic_range(c[std::max(i - 2, 0)].out, c[i - 1].out,
+                                c[i].out, c[std::min(i + 1, lim)].out, a0,
+                                a1));
+    }
+    return r;
+}
+
+class evaluator
+{
+public:
+    evaluator(const generator_context& ctx)
+        : ctx_(ctx)
+    {
+    }
+
+    interval eval_v(const node& n, const box& fr) const;
+    box eval_xy(const node& n, const box& fr) const;
+    box eval_xyz(const node& n, const box& fr) const;
+    truth eval_bool(const node& n, const box& fr) const;
+
+private:
+    box input_vec3(const node& n, int i, const box& fr) const;
+    interval call_lambda(const node& func, const node& in,
+                         const box& fr) const;
+    interval fractal(const node& n, box inner) const;
+    box rotate3(const node& n, const box& fr) const;
+
+private:
+    const generator_context& ctx_;
+};
+
+interval evaluator::eval_v(const node& n, const box& fr) const
+{
+    if (n.type == node::const_var)
+        return point(n.aux_var);
+
+    auto& in = n.input[0];
+
+    switch (n.type) {
+    case node::angle: {
+        auto p = eval_xy(in, fr);
+        return angle(p.x, p.y);
+    }
+
+    case node::chebyshev: {
+        auto p = eval_xy(in, fr);
+        return max(abs(p.x), abs(p.y));
+    }
+
+    case node::chebyshev3: {
+        auto p = eval_xyz(in, fr);
+        return max(max(abs(p.x), abs(p.y)), abs(p.z));
+    }
+
+    case node::checkerboard: {
+        auto p = eval_xy(in, fr);
+        int x = lower_half(p.x), y = lower_half(p.y);
+        if (x < 0 || y < 0)
+            return interval{-1.0, 1.0};
+
+        return point(x ^ y ? 1 : -1);
+    }
+
+    case node::checkerboard3: {
+        auto p = eval_xyz(in, fr);
+        int x = lower_half(p.x), y = lower_half(p.y), z = lower_half(p.z);
+        if (x < 0 || y < 0 || z < 0)
+            return interval{-1.0, 1.0};
+
+        return point(x ^ y ^ z ? 1 : -1);
+    }
+
+    case node::distance: {
+        auto p = eval_xy(in, fr);
+        return sqrt(sqr(p.x) + sqr(p.y));
+    }
+
+    case node::distance3: {
+        auto p = eval_xyz(in, fr);
+        return sqrt(sqr(p.x) + sqr(p.y) + sqr(p.z));
+    }
+
+    case node::perlin:
+        return perlin_range;
+
+    case node::perlin3:
+        return perlin3_range;
+
+    case node::simplex:
+        return simplex_range;
+
+    case node::simplex3:
+        return simplex3_range;
+
+    case node::opensimplex:
+        return opensimplex_range;
+
+    case node::opensimplex3:
+        return opensimplex3_range;
+
+    case node::worley: {
+        box inner{{0.0, worley_f0}, {0.0, worley_f1}, point(0.0)};
+        return eval_v(n.input[1], inner);
+    }
+
+    case node::worley3: {
+        box inner{{0.0, worley3_f0}, {0.0, worley3_f1}, point(0.0)};
+        return eval_v(n.input[1], inner);
+    }
+
+    case node::voronoi: {
+        // The closest feature point lies in one of the neighbouring
+        // cells, at most a cell diagonal away.
+        auto p = eval_xy(in, fr);
+        auto near = [](const interval& a) {
+            return interval{
+                std::max(std::floor(a.lo) - 1.0, a.lo - worley_f0),
+                std::min(std::floor(a.hi) + 2.0, a.hi + worley_f0)};
+        };
+        box inner{near(p.x), near(p.y), point(0.0)};
+        return eval_v(n.input[1], inner);
+    }
+
+    case node::external_:
+        return call_lambda(ctx_.get_script(n.aux_string), in, fr);
+
+    case node::lambda_:
+        return call_lambda(n.input[1], in, fr);
+
+    case node::manhattan: {
+        auto p = eval_xy(in, fr);
+        return abs(p.x) + abs(p.y);
+    }
+
+    case node::manhattan3: {
+        auto p = eval_xyz(in, fr);
+        return abs(p.x) + abs(p.y) + abs(p.z);
+    }
+
+    case node::x:
+        return eval_xy(in, fr).x;
+
+    case node::y:
+        return eval_xy(in, fr).y;
+
+    case node::z:
+        return eval_xyz(in, fr).z;
+
+    case node::fractal: {
+        auto p = eval_xy(in, fr);
+        return fractal(n, box{p.x, p.y, point(0.0)});
+    }
+
+    case node::fractal3:
+        return fractal(n, eval_xyz(in, fr));
+
+    case node::abs:
+        return abs(eval_v(in, fr));
+
+    case node::add:
+        return eval_v(in, fr) + eval_v(n.input[1], fr);
+
+    case node::blend: {
+        auto l = (eval_v(in, fr) + point(1.0)) * point(0.5);
+        auto a = eval_v(n.input[1], fr);
+        auto b = eval_v(n.input[2], fr);
+        auto r = a + l * (b - a);
+
+        // Inside [0, 1], this is a weighted average of a and b.
+        if (l.lo >= 0.0 && l.hi <= 1.0)
+            r = intersect(r, hull(a, b));
+
+        return r;
+    }
+
+    case node::cos:
+        return cos_pi(eval_v(in, fr));
+
+    case node::div:
+        return eval_v(in, fr) / eval_v(n.input[1], fr);
+
+    case node::max:
+        return max(eval_v(in, fr), eval_v(n.input[1], fr));
+
+    case node::min:
+        return min(eval_v(in, fr), eval_v(n.input[1], fr));
+
+    case node::mul:
+        return eval_v(in, fr) * eval_v(n.input[1], fr);
+
+    case node::neg:
+        return -eval_v(in, fr);
+
+    case node::pow:
+        return pow(eval_v(in, fr), eval_v(n.input[1], fr));
+
+    case node::round: {
+        auto v = eval_v(in, fr);
+        return interval{std::round(v.lo), std::round(v.hi)};
+    }
+
+    case node::saw: {
+        auto v = eval_v(in, fr);
+        if (!v.is_finite() || std::floor(v.lo) != std::floor(v.hi))
+            return interval{0.0, 1.0};
+
+        return interval{v.lo - std::floor(v.lo), v.hi - std::floor(v.lo)};
+    }
+
+    case node::sin:
+        return sin_pi(eval_v(in, fr));
+
+    case node::sqrt:
+        return sqrt(eval_v(in, fr));
+
+    case node::sub:
+        return eval_v(in, fr) - eval_v(n.input[1], fr);
+
+    case node::tan:
+        return tan_pi(eval_v(in, fr));
+
+    case node::then_else: {
+        auto c = eval_bool(in, fr);
+        if (!c.can_be_false)
+            return eval_v(n.input[1], fr);
+        if (!c.can_be_true)
+            return eval_v(n.input[2], fr);
+
+        return hull(eval_v(n.input[1], fr), eval_v(n.input[2], fr));
+    }
+
+    case node::curve_linear:
+        return curve_linear_range(eval_v(in, fr), n.curve);
+
+    case node::curve_spline:
+        return curve_spline_range(eval_v(in, fr), n.curve);
+
+    case node::png_lookup:
+        return interval{-1.0, 1.0};
+
+    default:
+        throw std::runtime_error("type mismatch");
+    }
+}
+
+box evaluator::eval_xy(const node& n, const box& fr) const
+{
+    switch (n.type) {
+    case node::entry_point:
+        return box{fr.x, fr.y, point(0.0)};
+
+    case node::rotate: {
+        auto p = eval_xy(n.input[0], fr);
+        auto t = eval_v(n.input[1], fr);
+        auto ct = cos_pi(t), st = sin_pi(t);
+        box r{p.x * ct - p.y * st, p.x * st + p.y * ct, point(0.0)};
+
+        // A rotation does not change the distance to the origin.
+        auto d = sqrt(sqr(p.x) + sqr(p.y));
+        r.x = intersect(r.x, interval{-d.hi, d.hi});
+        r.y = intersect(r.y, interval{-d.hi, d.hi});
+        return r;
+    }
+
+    case node::scale: {
+        auto p = eval_xy(n.input[0], fr);
+        auto s = eval_v(n.input[1], fr);
+        return box{p.x / s, p.y / s, point(0.0)};
+    }
+
+    case node::shift: {
+        auto p = eval_xy(n.input[0], fr);
+        auto sx = eval_v(n.input[1], fr);
+        auto sy = eval_v(n.input[2], fr);
+        return box{p.x + sx, p.y + sy, point(0.0)};
+    }
+
+    case node::map: {
+        auto p = eval_xy(n.input[0], fr);
+        box inner{p.x, p.y, point(0.0)};
+        return box{eval_v(n.input[1], inner), eval_v(n.input[2], inner),
+                   point(0.0)};
+    }
+
+    case node::turbulence: {
+        auto p = eval_xy(n.input[0], fr);
+        box inner{p.x, p.y, point(0.0)};
+        return box{fr.x + eval_v(n.input[1], inner),
+                   fr.y + eval_v(n.input[2], inner), point(0.0)};
+    }
+
+    case node::swap: {
+        auto p = eval_xy(n.input[0], fr);
+        return box{p.y, p.x, point(0.0)};
+    }
+
+    case node::xy: {
+        auto p = eval_xyz(n.input[0], fr);
+        return box{p.x, p.y, point(0.0)};
+    }
+
+    default:
+        throw std::runtime_error("type mismatch");
+    }
+}
+
+box evaluator::eval_xyz(const node& n, const box& fr) const
+{
+    switch (n.type) {
+    case node::entry_point:
+        return fr;
+
+    case node::xplane: {
+        auto p = eval_xy(n.input[0], fr);
+        return box{eval_v(n.input[1], fr), p.y, p.x};
+    }
+
+    case node::yplane: {
+        auto p = eval_xy(n.input[0], fr);
+        return box{p.x, eval_v(n.input[1], fr), p.y};
+    }
+
+    case node::zplane: {
+        auto p = eval_xy(n.input[0], fr);
+        return box{p.x, p.y, eval_v(n.input[1], fr)};
+    }
+
+    case node::rotate3:
+        return rotate3(n, fr);
+
+    case node::scale3: {
+        auto p = eval_xyz(n.input[0], fr);
+        auto s = eval_v(n.input[1], fr);
+        return box{p.x / s, p.y / s, p.z / s};
+    }
+
+    case node::shift3: {
+        auto p = eval_xyz(n.input[0], fr);
+        auto q = input_vec3(n, 1, fr);
+        return box{p.x + q.x, p.y + q.y, p.z + q.z};
+    }
+
+    case node::map3:
+        return input_vec3(n, 1, eval_xyz(n.input[0], fr));
+
+    case node::turbulence3: {
+        auto q = input_vec3(n, 1, eval_xyz(n.input[0], fr));
+        return box{fr.x + q.x, fr.y + q.y, fr.z + q.z};
+    }
+
+    default:
+        throw std::runtime_error("type mismatch");
+    }
+}
+
+truth evaluator::eval_bool(const node& n, const box& fr) const
+{
+    switch (n.type) {
+    case node::const_bool:
+        return truth{n.aux_bool, !n.aux_bool};
+
+    case node::is_equal: {
+        auto a = eval_v(n.input[0], fr);
+        auto b = eval_v(n.input[1], fr);
+        return truth{a.lo <= b.hi && b.lo <= a.hi,
+                     !(is_point(a) && is_point(b) && a.lo == b.lo)};
+    }
+
+    case node::is_greaterthan: {
+        auto a = eval_v(n.input[0], fr);
+        auto b = eval_v(n.input[1], fr);
+        return truth{a.hi > b.lo, a.lo <= b.hi};
+    }
+
+    case node::is_gte: {
+        auto a = eval_v(n.input[0], fr);
+        auto b = eval_v(n.input[1], fr);
+        return truth{a.hi >= b.lo, a.lo < b.hi};
+    }
+
+    case node::is_lessthan: {
+        auto a = eval_v(n.input[0], fr);
+        auto b = eval_v(n.input[1], fr);
+        return truth{a.lo < b.hi, a.hi >= b.lo};
+    }
+
+    case node::is_lte: {
+        auto a = eval_v(n.input[0], fr);
+        auto b = eval_v(n.input[1], fr);
+        return truth{a.lo <= b.hi, a.hi > b.lo};
+    }
+
+    case node::bnot: {
+        auto a = eval_bool(n.input[0], fr);
+        return truth{a.can_be_false, a.can_be_true};
+    }
+
+    case node::band: {
+        auto a = eval_bool(n.input[0], fr);
+        auto b = eval_bool(n.input[1], fr);
+        return truth{a.can_be_true && b.can_be_true,
+                     a.can_be_false || b.can_be_false};
+    }
+
+    case node::bor: {
+        auto a = eval_bool(n.input[0], fr);
+        auto b = eval_bool(n.input[1], fr);
+        return truth{a.can_be_true || b.can_be_true,
+                     a.can_be_false && b.can_be_false};
+    }
+
+    case node::bxor: {
+        auto a = eval_bool(n.input[0], fr);
+        auto b = eval_bool(n.input[1], fr);
+        return truth{(a.can_be_true && b.can_be_false)
+                         || (a.can_be_false && b.can_be_true),
+                     (a.can_be_true && b.can_be_true)
+                         || (a.can_be_false && b.can_be_false)};
+    }
+
+    case node::is_in_circle: {
+        auto p = eval_xy(n.input[0], fr);
+        auto d = sqrt(sqr(p.x) + sqr(p.y));
+        auto r = eval_v(n.input[1], fr);
+        return truth{d.lo <= r.hi, d.hi > r.lo};
+    }
+
+    case node::is_in_rectangle: {
+        auto p = eval_xy(n.input[0], fr);
+        auto x0 = eval_v(n.input[1], fr);
+        auto y0 = eval_v(n.input[2], fr);
+        auto x1 = eval_v(n.input[3], fr);
+        auto y1 = eval_v(n.input[4], fr);
+
+        return truth{p.x.hi >= x0.lo && p.y.hi >= y0.lo && p.x.lo <= x1.hi
+                         && p.y.lo <= y1.hi,
+                     p.x.lo < x0.hi || p.y.lo < y0.hi || p.x.hi > x1.lo
+                         || p.y.hi > y1.lo};
+    }
+
+    default:
+        throw std::runtime_error("type mismatch");
+    }
+}
+
+box evaluator::input_vec3(const node& n, int i, const box& fr) const
+{
+    return box{eval_v(n.input[i], fr), eval_v(n.input[i + 1], fr),
+               eval_v(n.input[i + 2], fr)};
+}
+
+interval evaluator::call_lambda(const node& func, const node& in,
+                                const box& fr) const
+{
+    auto type = func.input_type();
+    box inner;
+
+    if (type == var_t::xyz)
+        inner = eval_xyz(in, fr);
+    else if (type == var_t::xy)
+        inner = eval_xy(in, fr);
+    else
+        throw std::runtime_error("lambda must take a coordinate type");
+
+    return eval_v(func, inner);
+}
+
+// Follows the loop in generator_slowinterpreter.  The result is a
+// weighted average of the octaves.
+interval evaluator::fractal(const node& n, box inner) const
+{
+    auto& f = n.input[1];
+    auto octaves = eval_v(n.input[2], inner);
+    auto lacunarity = eval_v(n.input[3], inner);
+    auto persistence = eval_v(n.input[4], inner);
+
+    if (!is_point(octaves) || !is_point(lacunarity)
+        || !is_point(persistence) || !octaves.is_finite()) {
+        // With positive weights, every octave falls inside the range of
+        // f over all positions.
+        if (octaves.lo < 1.0 || persistence.lo < 0.0)
+            return everything;
+
+        box all{everything, everything, everything};
+        if (n.type == node::fractal)
+            all.z = point(0.0);
+
+        return eval_v(f, all);
+    }
+
+    int count = static_cast<int>(std::max(
+        std::min(octaves.lo, double(INTERPRETER_OCTAVES_LIMIT)), -1.0));
+    if (count < 1)
+        return everything;
+
+    auto l = lacunarity;
+    interval result = point(0.0);
+    double div = 0.0, mul = 1.0;
+    for (int i = 0; i < count; ++i) {
+        result = result + eval_v(f, inner) * point(mul);
+        div += mul;
+        mul *= persistence.lo;
+        inner.x = inner.x * l + point(12345.0);
+        inner.y = inner.y * l;
+        inner.z = inner.z * l;
+    }
+    return result / point(div);
+}
+
+box evaluator::rotate3(const node& n, const box& fr) const
+{
+    auto p = eval_xyz(n.input[0], fr);
+    auto ax = eval_v(n.input[1], fr);
+    auto ay = eval_v(n.input[2], fr);
+    auto az = eval_v(n.input[3], fr);
+    auto angle = eval_v(n.input[4], fr);
+
+    // A rotation does not change the distance to the origin.
+    auto d = sqrt(sqr(p.x) + sqr(p.y) + sqr(p.z));
+    interval sphere{-d.hi, d.hi};
+    box r{sphere, sphere, sphere};
+
+    if (!is_point(ax) || !is_point(ay) || !is_point(az) || !is_point(angle))
+        return r;
+
+    // With a fixed axis and angle, it is a linear map.
+    glm::dvec3 axis{ax.lo, ay.lo, az.lo};
+    double t = angle.lo * pi;
+    auto cx = glm::rotate(glm::dvec3{1, 0, 0}, t, axis);
+    auto cy = glm::rotate(glm::dvec3{0, 1, 0}, t, axis);
+    auto cz = glm::rotate(glm::dvec3{0, 0, 1}, t, axis);
+
+    auto row = [&](int i) {
+        return p.x * point(cx[i]) + p.y * point(cy[i]) + p.z * point(cz[i]);
+    };
+    r.x = intersect(r.x, row(0));
+    r.y = intersect(r.y, row(1));
+    r.z = intersect(r.z, row(2));
+    return r;
+}
+
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+
+interval bounds(const node& n, const generator_context& ctx,
+                const glm::dvec3& lo, const glm::dvec3& hi)
+{
+    box b{checked(lo.x, hi.x), checked(lo.y, hi.y), checked(lo.z, hi.z)};
+    return evaluator(ctx).eval_v(n, b);
+}
+
+interval bounds(const node& n, const generator_context& ctx,
+                const glm::dvec2& lo, const glm::dvec2& hi)
+{
+    return bounds(n, ctx, glm::dvec3{lo, 0.0}, glm::dvec3{hi, 0.0});
+}
+
+} // namespace noise
+} // namespace hexa
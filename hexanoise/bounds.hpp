@@ -0,0 +1,73 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/bounds.hpp
+/// \brief  Find the range of a script's results over a box
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <cmath>
+#include <glm/glm.hpp>
+
+namespace hexa
+{
+namespace noise
+{
+
+class node;
+class generator_context;
+
+/** A closed range of numbers.  Either end can be infinite. */
+struct interval
+{
+    double lo;
+    double hi;
+
+    /** Returns true if v lies in the range. */
+    bool contains(double v) const { return lo <= v && v <= hi; }
+
+    /** Returns true if both ends are finite. */
+    bool is_finite() const { return std::isfinite(lo) && std::isfinite(hi); }
+};
+
+/** Find a conservative range of the results of a script over an
+ *  axis-aligned box.  Every value the script produces for a position in
+ *  the box lies inside the returned interval, so a chunk can be skipped
+ *  (or filled with a constant) before any sample is taken.
+ *
+ *  This is plain interval arithmetic: every function gets the ranges of
+ *  its inputs, and returns a range that covers all results for any
+ *  combination of inputs from these ranges.  The result is not tight.
+ *  Correlation between inputs is lost (x - x over [0,1] gives [-1,1]),
+ *  and the noise functions always return their full range.  The ranges
+ *  of the noise functions are the worst case over every possible choice
+ *  of gradients, so they hold for any seed:
+ *   - perlin: [-1.23, 1.23], perlin3: [-1.27, 1.27]
+ *   - simplex, simplex3, opensimplex3: [-1.01, 1.01]
+ *   - opensimplex: [-0.88, 0.88]
+ *
+ *  If the script can produce NaN (sqrt(-1), 0/0, the power of a negative
+ *  number, and so on), or if the range is unbounded (division by a range
+ *  that includes zero), the result is [-inf, inf].  The bounds are
+ *  computed with ordinary floating point math, so a result can lie
+ *  outside of them by a rounding error.
+ * @param n    The script
+ * @param ctx  Used to look up the scripts called with the @-operator
+ * @param lo   The lower corner of the box
+ * @param hi   The upper corner of the box
+ * @return The range of the results */
+interval bounds(const node& n, const generator_context& ctx,
+                const glm::dvec3& lo, const glm::dvec3& hi);
+
+/** Find a conservative range of the results of a script over an
+ *  axis-aligned rectangle.  (The z coordinate is 0.)
+ * @param n    The script
+ * @param ctx  Used to look up the scripts called with the @-operator
+ * @param lo   The top-left corner of the rectangle
+ * @param hi   The bottom-right corner of the rectangle
+ * @return The range of the results */
+interval bounds(const node& n, const generator_context& ctx,
+                const glm::dvec2& lo, const glm::dvec2& hi);
+
+} // namespace noise
+} // namespace hexa
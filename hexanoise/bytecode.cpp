@@ -0,0 +1,663 @@
+//---------------------------------------------------------------------------
+// hexanoise/bytecode.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "bytecode.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include "analysis.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+namespace
+{
+
+// Scripts that call each other through the @-operator get inlined; this
+// puts a limit on how deep that can go.
+const int max_call_depth = 32;
+
+// Branches that weigh less than this (see weight() in analysis.hpp) are
+// cheaper to run for the whole batch than to pack the samples for.  So
+// anything with a noise function in it gets its own op_branch.
+const size_t min_branch_weight = 5;
+
+// A value that was stored in one or more registers.
+struct value
+{
+    uint16_t reg;
+    int width;
+    // False for the entry point and constants, these cannot be released.
+    bool owned;
+};
+
+class compiler
+{
+public:
+    compiler(bytecode& out, const generator_context& ctx, const node& n)
+        : out_(out)
+        , ctx_(ctx)
+        , shared_(n)
+        , depth_(0)
+        , nesting_(0)
+    {
+    }
+
+    // Reserve w consecutive registers.
+    uint16_t alloc(int w)
+    {
+        size_t i = 0;
+        for (;;) {
+            int j = 0;
+            while (j < w && i + j < used_.size() && !used_[i + j])
+                ++j;
+
+            if (j == w || i + j == used_.size())
+                break;
+
+            i += j + 1;
+        }
+        if (i + w > used_.size())
+            used_.resize(i + w, false);
+
+        if (used_.size() > std::numeric_limits<uint16_t>::max())
+            throw std::runtime_error("script needs too many registers");
+
+        for (int j = 0; j < w; ++j)
+            used_[i + j] = true;
+
+        return static_cast<uint16_t>(i);
+    }
+
+    void release(const value& v)
+    {
+        if (!v.owned)
+            return;
+
+        for (int j = 0; j < v.width; ++j)
+            used_[v.reg + j] = false;
+    }
+
+    value constant(double v)
+    {
+        uint64_t key;
+        std::memcpy(&key, &v, sizeof(key));
+
+        auto found = constants_.find(key);
+        if (found != constants_.end())
+            return {found->second, 1, false};
+
+        // Constants are only written once, before the program runs, so
+        // they need a register that no temporary has ever used.
+        used_.push_back(true);
+        if (used_.size() > std::numeric_limits<uint16_t>::max())
+            throw std::runtime_error("script needs too many registers");
+
+        auto reg = static_cast<uint16_t>(used_.size() - 1);
+        constants_[key] = reg;
+        out_.constants.emplace_back(reg, v);
+        return {reg, 1, false};
+    }
+
+    size_t emit(bytecode::opcode op, uint16_t dst, uint16_t a = 0,
+                uint16_t b = 0, uint16_t c = 0, uint16_t d = 0,
+                uint16_t e = 0, uint32_t aux = 0)
+    {
+        out_.code.push_back({op, dst, a, b, c, d, e, aux});
+        return out_.code.size() - 1;
+    }
+
+    size_t here() const { return out_.code.size(); }
+
+    void patch(size_t instr) { out_.code[instr].aux = here(); }
+
+    // Compile all inputs of n, and apply an instruction to them.
+    value simple(bytecode::opcode op, int width, const node& n, uint16_t p)
+    {
+        uint16_t in[5] = {0, 0, 0, 0, 0};
+        std::vector<value> tmp;
+        for (size_t i = 0; i < n.input.size() && i < 5; ++i) {
+            tmp.emplace_back(compile(n.input[i], p));
+            in[i] = tmp.back().reg;
+        }
+        for (auto& v : tmp)
+            release(v);
+
+        auto dst = alloc(width);
+        emit(op, dst, in[0], in[1], in[2], in[3], in[4]);
+        return {dst, width, true};
+    }
+
+    // A gradient noise function.  If it has a permutation table of its
+    // own, the seed is not needed.
+    value noise(bytecode::opcode op, bytecode::opcode op_table,
+                const node& n, uint16_t p)
+    {
+        auto table = seed_table(n, ctx_);
+        if (table == nullptr)
+            return simple(op, 1, n, p);
+
+        auto in = compile(n.input[0], p);
+        release(in);
+        auto dst = alloc(1);
+        out_.permutations.push_back(table);
+        emit(op_table, dst, in.reg, 0, 0, 0, 0,
+             out_.permutations.size() - 1);
+        return {dst, 1, true};
+    }
+
+    // Pick a single component out of a coordinate.
+    value component(const node& n, int i, uint16_t p)
+    {
+        auto v = compile(n.input[0], p);
+        release(v);
+        auto dst = alloc(1);
+        emit(bytecode::op_mov, dst, v.reg + i);
+        return {dst, 1, true};
+    }
+
+    // Set up a new entry point for the children of a node.
+    value scope(const node& n, uint16_t p, bool is_3d)
+    {
+        auto v = compile(n, p);
+        if (is_3d) {
+            if (v.width != 3)
+                throw std::runtime_error("type mismatch");
+
+            return v;
+        }
+        release(v);
+        auto q = alloc(3);
+        emit(bytecode::op_xy0, q, v.reg);
+        return {q, 3, true};
+    }
+
+    value call_lambda(const node& func, const node& in, uint16_t p)
+    {
+        auto type = func.input_type();
+        if (type != var_t::xy && type != var_t::xyz)
+            throw std::runtime_error("lambda must take a coordinate type");
+
+        auto q = scope(in, p, type == var_t::xyz);
+        auto result = compile(func, q.reg);
+        release(q);
+        return result;
+    }
+
+    value fractal(const node& n, uint16_t p, bool is_3d)
+    {
+        // The coordinates are modified in every octave, so the fractal
+        // always gets its own copy.
+        auto in = compile(n.input[0], p);
+        release(in);
+        value pf{alloc(3), 3, true};
+        emit(is_3d ? bytecode::op_mov3 : bytecode::op_xy0, pf.reg, in.reg);
+
+        auto octaves = compile(n.input[2], pf.reg);
+        auto lacunarity = compile(n.input[3], pf.reg);
+        auto persistence = compile(n.input[4], pf.reg);
+
+        release(octaves);
+        value state{alloc(5), 5, true};
+        emit(bytecode::op_fractal_init, state.reg, octaves.reg);
+
+        auto loop = here();
+        auto done = emit(bytecode::op_fractal_loop, 0, state.reg);
+        begin_region();
+        auto v = compile(n.input[1], pf.reg);
+        emit(bytecode::op_fractal_step, state.reg, v.reg, pf.reg,
+             lacunarity.reg, persistence.reg);
+        release(v);
+        end_region();
+        emit(bytecode::op_jump, 0, 0, 0, 0, 0, 0, loop);
+        patch(done);
+
+        release(lacunarity);
+        release(persistence);
+        release(pf);
+        release(state);
+
+        auto dst = alloc(1);
+        emit(bytecode::op_fractal_end, dst, state.reg);
+        return {dst, 1, true};
+    }
+
+    // Values that occur more than once in the script are kept in their
+    // registers, and are only computed the first time they are needed.
+    value compile(const node& n, uint16_t p)
+    {
+        auto id = shared_.id(n);
+        if (id == 0 || shared_.count(n) < 2)
+            return lower(n, p);
+
+        auto found = cache_.find(id);
+        if (found != cache_.end()) {
+            used_from_branch(id, found->second);
+            return {found->second.reg, found->second.width, false};
+        }
+
+        auto result = lower(n, p);
+        if (!result.owned)
+            return result;
+
+        cache_[id] = result;
+        cached_.push_back(id);
+        return {result.reg, result.width, false};
+    }
+
+    // Code that does not always run (a branch, or the body of a loop)
+    // gets a region of its own.  The values that were cached inside the
+    // region are forgotten at the end, their registers are released,
+    // except for 'keep', which is handed over to the caller.
+    void begin_region() { regions_.push_back(cached_.size()); }
+
+    void end_region(value& keep)
+    {
+        while (cached_.size() > regions_.back()) {
+            auto found = cache_.find(cached_.back());
+            if (!keep.owned && found->second.reg == keep.reg)
+                keep.owned = true;
+            else
+                release(found->second);
+
+            cache_.erase(found);
+            cached_.pop_back();
+        }
+        regions_.pop_back();
+    }
+
+    void end_region()
+    {
+        value none{0, 0, true};
+        end_region(none);
+    }
+
+    // A cached value that was computed before an out-of-line branch
+    // started is one of the inputs of that branch.
+    void used_from_branch(size_t id, const value& v)
+    {
+        if (open_.empty())
+            return;
+
+        size_t pos = std::find(cached_.begin(), cached_.end(), id)
+                     - cached_.begin();
+        for (auto& b : open_) {
+            if (pos < b.start) {
+                for (int j = 0; j < v.width; ++j)
+                    b.inputs.insert(v.reg + j);
+            }
+        }
+    }
+
+    // Compile one side of a then_else, for the samples where cond equals
+    // 'when'.  Cheap branches are skipped if no sample in the batch needs
+    // them; expensive ones are compiled out of line, for op_branch.
+    value branch(const node& n, uint16_t p, const value& cond, bool when)
+    {
+        typedef bytecode b;
+
+        if (weight(n) < min_branch_weight) {
+            auto skip = emit(when ? b::op_jump_if_none : b::op_jump_if_all,
+                             0, cond.reg);
+            begin_region();
+            auto v = compile(n, p);
+            end_region(v);
+            patch(skip);
+            return v;
+        }
+
+        auto skip = emit(b::op_jump, 0);
+        size_t index = out_.branches.size();
+        out_.branches.push_back({static_cast<uint32_t>(here()), when, {}});
+        open_.push_back({cached_.size(), {p, uint16_t(p + 1),
+                                          uint16_t(p + 2)}});
+        nesting_ = std::max(nesting_, open_.size());
+
+        begin_region();
+        auto v = compile(n, p);
+        end_region(v);
+        emit(b::op_return, 0, v.reg);
+        patch(skip);
+
+        auto& inputs = open_.back().inputs;
+        out_.branches[index].inputs.assign(inputs.begin(), inputs.end());
+        open_.pop_back();
+
+        release(v);
+        auto dst = alloc(1);
+        emit(b::op_branch, dst, cond.reg, 0, 0, 0, 0, index);
+        return {dst, 1, true};
+    }
+
+    value lower(const node& n, uint16_t p)
+    {
+        typedef bytecode b;
+
+        switch (n.type) {
+        case node::entry_point:
+            if (n.return_type != var_t::xy && n.return_type != var_t::xyz
+                && n.return_type != var_t::external)
+                throw std::runtime_error("type mismatch");
+
+            return {p, 3, false};
+
+        case node::const_var:
+            return constant(n.aux_var);
+
+        case node::const_bool:
+            return constant(n.aux_bool ? 1.0 : 0.0);
+
+        case node::const_str:
+            throw std::runtime_error("string encountered");
+
+        case node::rotate:
+            return simple(b::op_rotate, 2, n, p);
+        case node::scale:
+            return simple(b::op_scale, 2, n, p);
+        case node::shift:
+            return simple(b::op_shift, 2, n, p);
+        case node::swap:
+            return simple(b::op_swap, 2, n, p);
+
+        case node::map: {
+            auto q = scope(n.input[0], p, false);
+            auto x = compile(n.input[1], q.reg);
+            auto y = compile(n.input[2], q.reg);
+            release(q);
+            release(x);
+            release(y);
+            auto dst = alloc(2);
+            emit(b::op_pack2, dst, x.reg, y.reg);
+            return {dst, 2, true};
+        }
+
+        case node::turbulence: {
+            auto q = scope(n.input[0], p, false);
+            auto x = compile(n.input[1], q.reg);
+            auto y = compile(n.input[2], q.reg);
+            release(q);
+            release(x);
+            release(y);
+            auto dst = alloc(2);
+            emit(b::op_turbulence, dst, p, x.reg, y.reg);
+            return {dst, 2, true};
+        }
+
+        case node::angle:
+            return simple(b::op_angle, 1, n, p);
+        case node::chebyshev:
+            return simple(b::op_chebyshev, 1, n, p);
+        case node::checkerboard:
+            return simple(b::op_checkerboard, 1, n, p);
+        case node::distance:
+            return simple(b::op_distance, 1, n, p);
+        case node::manhattan:
+            return simple(b::op_manhattan, 1, n, p);
+        case node::perlin:
+            return noise(b::op_perlin, b::op_perlin_table, n, p);
+        case node::simplex:
+            return noise(b::op_simplex, b::op_simplex_table, n, p);
+        case node::opensimplex:
+            return noise(b::op_opensimplex, b::op_opensimplex_table, n, p);
+
+        case node::worley:
+        case node::worley3:
+        case node::voronoi: {
+            auto in = compile(n.input[0], p);
+            auto seed = compile(n.input[2], p);
+            release(in);
+            release(seed);
+            value q{alloc(3), 3, true};
+            emit(n.type == node::worley
+                     ? b::op_worley
+                     : n.type == node::worley3 ? b::op_worley3 : b::op_voronoi,
+                 q.reg, in.reg, seed.reg);
+            auto result = compile(n.input[1], q.reg);
+            release(q);
+            return result;
+        }
+
+        case node::png_lookup: {
+            auto in = compile(n.input[0], p);
+            release(in);
+            auto dst = alloc(1);
+            out_.images.push_back(&ctx_.get_image(n.input[1].aux_string));
+            emit(b::op_png_lookup, dst, in.reg, 0, 0, 0, 0,
+                 out_.images.size() - 1);
+            return {dst, 1, true};
+        }
+
+        case node::external_: {
+            if (++depth_ > max_call_depth)
+                throw std::runtime_error("@" + n.aux_string
+                                         + ": scripts nested too deep");
+
+            auto result
+                = call_lambda(ctx_.get_script(n.aux_string), n.input[0], p);
+            --depth_;
+            return result;
+        }
+
+        case node::lambda_:
+            return call_lambda(n.input[1], n.input[0], p);
+
+        case node::x:
+            return component(n, 0, p);
+        case node::y:
+            return component(n, 1, p);
+        case node::z:
+            return component(n, 2, p);
+
+        case node::fractal:
+            return fractal(n, p, false);
+        case node::fractal3:
+            return fractal(n, p, true);
+
+        case node::abs:
+            return simple(b::op_abs, 1, n, p);
+        case node::add:
+            return simple(b::op_add, 1, n, p);
+        case node::blend:
+            return simple(b::op_blend, 1, n, p);
+        case node::cos:
+            return simple(b::op_cos, 1, n, p);
+        case node::div:
+            return simple(b::op_div, 1, n, p);
+        case node::max:
+            return simple(b::op_max, 1, n, p);
+        case node::min:
+            return simple(b::op_min, 1, n, p);
+        case node::mul:
+            return simple(b::op_mul, 1, n, p);
+        case node::neg:
+            return simple(b::op_neg, 1, n, p);
+        case node::pow:
+            return simple(b::op_pow, 1, n, p);
+        case node::round:
+            return simple(b::op_round, 1, n, p);
+        case node::saw:
+            return simple(b::op_saw, 1, n, p);
+        case node::sin:
+            return simple(b::op_sin, 1, n, p);
+        case node::sqrt:
+            return simple(b::op_sqrt, 1, n, p);
+        case node::sub:
+            return simple(b::op_sub, 1, n, p);
+        case node::tan:
+            return simple(b::op_tan, 1, n, p);
+
+        case node::curve_linear:
+        case node::curve_spline: {
+            auto in = compile(n.input[0], p);
+            release(in);
+            auto dst = alloc(1);
+            out_.curves.push_back(n.curve);
+            emit(n.type == node::curve_linear ? b::op_curve_linear
+                                              : b::op_curve_spline,
+                 dst, in.reg, 0, 0, 0, 0, out_.curves.size() - 1);
+            return {dst, 1, true};
+        }
+
+        case node::band:
+            return simple(b::op_band, 1, n, p);
+        case node::bnot:
+            return simple(b::op_bnot, 1, n, p);
+        case node::bor:
+            return simple(b::op_bor, 1, n, p);
+        case node::bxor:
+            return simple(b::op_bxor, 1, n, p);
+
+        case node::is_equal:
+            return simple(b::op_is_equal, 1, n, p);
+        case node::is_greaterthan:
+            return simple(b::op_is_greaterthan, 1, n, p);
+        case node::is_gte:
+            return simple(b::op_is_gte, 1, n, p);
+        case node::is_lessthan:
+            return simple(b::op_is_lessthan, 1, n, p);
+        case node::is_lte:
+            return simple(b::op_is_lte, 1, n, p);
+        case node::is_in_rectangle:
+            return simple(b::op_is_in_rectangle, 1, n, p);
+        case node::is_in_circle:
+            return simple(b::op_is_in_circle, 1, n, p);
+
+        case node::then_else: {
+            // Both branches only run if the samples in a batch disagree,
+            // the results are then combined with op_select.
+            auto cond = compile(n.input[0], p);
+            auto a = branch(n.input[1], p, cond, true);
+            auto c = branch(n.input[2], p, cond, false);
+
+            release(cond);
+            release(a);
+            release(c);
+            auto dst = alloc(1);
+            emit(b::op_select, dst, cond.reg, a.reg, c.reg);
+            return {dst, 1, true};
+        }
+
+        case node::rotate3:
+            return simple(b::op_rotate3, 3, n, p);
+        case node::scale3:
+            return simple(b::op_scale3, 3, n, p);
+        case node::shift3:
+            return simple(b::op_shift3, 3, n, p);
+
+        case node::map3: {
+            auto q = scope(n.input[0], p, true);
+            auto x = compile(n.input[1], q.reg);
+            auto y = compile(n.input[2], q.reg);
+            auto z = compile(n.input[3], q.reg);
+            release(q);
+            release(x);
+            release(y);
+            release(z);
+            auto dst = alloc(3);
+            emit(b::op_pack3, dst, x.reg, y.reg, z.reg);
+            return {dst, 3, true};
+        }
+
+        case node::turbulence3: {
+            auto q = scope(n.input[0], p, true);
+            auto x = compile(n.input[1], q.reg);
+            auto y = compile(n.input[2], q.reg);
+            auto z = compile(n.input[3], q.reg);
+            release(q);
+            release(x);
+            release(y);
+            release(z);
+            auto dst = alloc(3);
+            emit(b::op_turbulence3, dst, p, x.reg, y.reg, z.reg);
+            return {dst, 3, true};
+        }
+
+        case node::xplane:
+            return simple(b::op_xplane, 3, n, p);
+        case node::yplane:
+            return simple(b::op_yplane, 3, n, p);
+        case node::zplane:
+            return simple(b::op_zplane, 3, n, p);
+
+        case node::xy: {
+            auto in = compile(n.input[0], p);
+            release(in);
+            auto dst = alloc(2);
+            emit(b::op_mov2, dst, in.reg);
+            return {dst, 2, true};
+        }
+
+        case node::chebyshev3:
+            return simple(b::op_chebyshev3, 1, n, p);
+        case node::checkerboard3:
+            return simple(b::op_checkerboard3, 1, n, p);
+        case node::distance3:
+            return simple(b::op_distance3, 1, n, p);
+        case node::manhattan3:
+            return simple(b::op_manhattan3, 1, n, p);
+        case node::perlin3:
+            return noise(b::op_perlin3, b::op_perlin3_table, n, p);
+        case node::simplex3:
+            return noise(b::op_simplex3, b::op_simplex3_table, n, p);
+        case node::opensimplex3:
+            return noise(b::op_opensimplex3, b::op_opensimplex3_table, n, p);
+
+        default:
+            throw std::runtime_error("type mismatch");
+        }
+    }
+
+    size_t registers() const { return used_.size(); }
+
+    size_t nesting() const { return nesting_; }
+
+private:
+    bytecode& out_;
+    const generator_context& ctx_;
+    std::vector<bool> used_;
+    std::map<uint64_t, uint16_t> constants_;
+    subexpressions shared_;
+    std::map<size_t, value> cache_;
+    std::vector<size_t> cached_;
+    std::vector<size_t> regions_;
+    int depth_;
+
+    // The out-of-line branches that are being compiled, and the position
+    // in cached_ where each of them started.
+    struct open_branch
+    {
+        size_t start;
+        std::set<uint16_t> inputs;
+    };
+    std::vector<open_branch> open_;
+    size_t nesting_;
+};
+
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+
+bytecode::bytecode(const node& n, const generator_context& ctx)
+{
+    if (n.return_type != var_t::var)
+        throw std::runtime_error("type mismatch");
+
+    compiler c{*this, ctx, n};
+    entry = c.alloc(3);
+    auto result = c.compile(n, entry);
+    c.emit(op_return, 0, result.reg);
+    registers = c.registers();
+    nesting = c.nesting();
+}
+
+} // namespace noise
+} // namespace hexa
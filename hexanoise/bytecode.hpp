@@ -0,0 +1,229 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/bytecode.hpp
+/// \brief  Lowers a compiled HNDL script to a flat instruction stream
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "generator_context.hpp"
+#include "node.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+/** A compiled HNDL script, lowered to a flat, register-based instruction
+ *  stream.
+ *  Every intermediate value is assigned a numbered register.  Scalars and
+ *  booleans take up one register, coordinates take up two (xy) or three
+ *  (xyz) consecutive registers.  Constants get a register of their own
+ *  that is filled in once, before the program runs.
+ *
+ *  Instead of saving and restoring the current coordinate, functions such
+ *  as map and fractal simply pass a different block of registers to their
+ *  children as the entry point.
+ *
+ *  The expensive branches of a then_else are compiled out of line, and
+ *  run by op_branch.  If the samples in a batch disagree on the
+ *  condition, the samples that take the branch are packed together in
+ *  another set of registers first, so the branch only does the work
+ *  for those samples. */
+class bytecode
+{
+public:
+    /** The instruction set.
+     *  Unless noted otherwise, 'dst' is the output register and 'a' to 'e'
+     *  are the input registers, in the same order as the node inputs.
+     *  Instructions are applied to a batch of samples at once, so jumps
+     *  are only taken if all samples in the batch agree. */
+    typedef enum {
+        /** Stop, the result is in a */
+        op_return,
+        /** Continue at aux */
+        op_jump,
+        /** Continue at aux if a is false for every sample */
+        op_jump_if_none,
+        /** Continue at aux if a is true for every sample */
+        op_jump_if_all,
+        /** dst = a ? b : c */
+        op_select,
+        /** Run branches[aux] for the samples where a matches its 'when',
+         *  and store the results in dst.  The other samples in dst are
+         *  left undefined. */
+        op_branch,
+
+        op_mov,
+        op_mov2,
+        op_mov3,
+        /** dst = (a.x, a.y, 0) */
+        op_xy0,
+        /** dst = (a, b) */
+        op_pack2,
+        /** dst = (a, b, c) */
+        op_pack3,
+
+        op_rotate,
+        op_scale,
+        op_shift,
+        op_swap,
+        /** dst = a + (b, c) */
+        op_turbulence,
+
+        op_angle,
+        op_chebyshev,
+        op_checkerboard,
+        op_distance,
+        op_manhattan,
+        op_perlin,
+        op_simplex,
+        op_opensimplex,
+        /** perlin without a seed, aux is an index in permutations */
+        op_perlin_table,
+        /** simplex without a seed, aux is an index in permutations */
+        op_simplex_table,
+        /** opensimplex without a seed, aux is an index in permutations */
+        op_opensimplex_table,
+        /** dst = (f0, f1, 0) */
+        op_worley,
+        /** dst = (x, y, 0) */
+        op_voronoi,
+        /** aux is an index in images */
+        op_png_lookup,
+
+        op_abs,
+        op_add,
+        op_blend,
+        op_cos,
+        /** aux is an index in curves */
+        op_curve_linear,
+        /** aux is an index in curves */
+        op_curve_spline,
+        op_div,
+        op_max,
+        op_min,
+        op_mul,
+        op_neg,
+        op_pow,
+        op_round,
+        op_saw,
+        op_sin,
+        op_sqrt,
+        op_sub,
+        op_tan,
+
+        op_band,
+        op_bnot,
+        op_bor,
+        op_bxor,
+
+        op_is_equal,
+        op_is_greaterthan,
+        op_is_gte,
+        op_is_lessthan,
+        op_is_lte,
+        op_is_in_rectangle,
+        op_is_in_circle,
+
+        op_rotate3,
+        op_scale3,
+        op_shift3,
+        /** dst = a + (b, c, d) */
+        op_turbulence3,
+        op_xplane,
+        op_yplane,
+        op_zplane,
+
+        op_chebyshev3,
+        op_checkerboard3,
+        op_distance3,
+        op_manhattan3,
+        op_perlin3,
+        op_simplex3,
+        op_opensimplex3,
+        /** perlin3 without a seed, aux is an index in permutations */
+        op_perlin3_table,
+        /** simplex3 without a seed, aux is an index in permutations */
+        op_simplex3_table,
+        /** opensimplex3 without a seed, aux is an index in permutations */
+        op_opensimplex3_table,
+        /** dst = (f0, f1, 0) */
+        op_worley3,
+
+        /** Set up the fractal state in dst (5 registers: sum, divider,
+         *  multiplier, octave, and the octave count from a) */
+        op_fractal_init,
+        /** Continue at aux if all octaves in state a are done, for every
+         *  sample */
+        op_fractal_loop,
+        /** Add octave value a to state dst, and move the coordinates in b
+         *  to the next octave, using lacunarity c and persistence d.
+         *  Samples that are done already are left alone. */
+        op_fractal_step,
+        /** dst = the result of fractal state a */
+        op_fractal_end
+
+    } opcode;
+
+    /** A single instruction. */
+    struct instruction
+    {
+        opcode op;
+        uint16_t dst;
+        uint16_t a, b, c, d, e;
+        /** Jump target, or an index in 'curves', 'images', 'branches'
+         *  or 'permutations'. */
+        uint32_t aux;
+    };
+
+    /** A branch of a then_else that is compiled out of line. */
+    struct branch
+    {
+        /** The first instruction; the branch ends with op_return. */
+        uint32_t start;
+        /** The branch is taken by the samples where the condition has
+         *  this value. */
+        bool when;
+        /** The registers the branch reads, but does not write.  Only these
+         *  need to be copied when the samples are packed together. */
+        std::vector<uint16_t> inputs;
+    };
+
+public:
+    /** Lower a compiled script.
+     * @param n    The script
+     * @param ctx  Used to look up external scripts and images
+     * @throw std::runtime_error if the script cannot be lowered */
+    bytecode(const node& n, const generator_context& ctx);
+
+public:
+    /** The instruction stream, execution starts at the first
+     *  instruction. */
+    std::vector<instruction> code;
+    /** The constant registers and their values. */
+    std::vector<std::pair<uint16_t, double>> constants;
+    /** Adjustment curves used by the curve_* instructions. */
+    std::vector<std::vector<node::control_point>> curves;
+    /** Images used by the png_lookup instruction. */
+    std::vector<const generator_context::image*> images;
+    /** Branches used by the op_branch instruction. */
+    std::vector<branch> branches;
+    /** Permutation tables used by the noise instructions, if seed tables
+     *  are enabled. */
+    std::vector<const generator_context::permutation*> permutations;
+    /** The first of the three registers that hold the input coordinates. */
+    uint16_t entry;
+    /** The total number of registers used by the program. */
+    size_t registers;
+    /** How deep op_branch instructions are nested.  Every level needs a
+     *  set of registers of its own to pack the samples into. */
+    size_t nesting;
+};
+
+} // namespace noise
+} // namespace hexa
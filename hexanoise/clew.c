@@ -81,6 +81,8 @@ PFNCLRETAINPROGRAM                  __clewRetainProgram                 = NULL;
 PFNCLRELEASEPROGRAM                 __clewReleaseProgram                = NULL;
 PFNCLBUILDPROGRAM                   __clewBuildProgram                  = NULL;
 PFNCLUNLOADCOMPILER                 __clewUnloadCompiler                = NULL;
+PFNCLCOMPILEPROGRAM                 __clewCompileProgram                = NULL;
+PFNCLLINKPROGRAM                    __clewLinkProgram                   = NULL;
 PFNCLGETPROGRAMINFO                 __clewGetProgramInfo                = NULL;
 PFNCLGETPROGRAMBUILDINFO            __clewGetProgramBuildInfo           = NULL;
 PFNCLCREATEKERNEL                   __clewCreateKernel                  = NULL;
@@ -240,6 +242,10 @@ int clewInit(const char* path)
     CLEW_CHECK_FUNCTION(__clewEnqueueBarrier                = (PFNCLENQUEUEBARRIER              )CLCC_DYNLIB_IMPORT(module, "clEnqueueBarrier"));
     CLEW_CHECK_FUNCTION(__clewGetExtensionFunctionAddress   = (PFNCLGETEXTENSIONFUNCTIONADDRESS )CLCC_DYNLIB_IMPORT(module, "clGetExtensionFunctionAddress"));
 
+    //  Optional entry-points (OpenCL 1.2)
+    __clewCompileProgram = (PFNCLCOMPILEPROGRAM)CLCC_DYNLIB_IMPORT(module, "clCompileProgram");
+    __clewLinkProgram    = (PFNCLLINKPROGRAM   )CLCC_DYNLIB_IMPORT(module, "clLinkProgram");
+
     return CLEW_SUCCESS;
 }
 
@@ -266,9 +272,9 @@ const char* clewErrorString(cl_int error)
 
         , ""    //  -13
         , ""    //  -14
-        , ""    //  -15
-        , ""    //  -16
-        , ""    //  -17
+        , "CL_COMPILE_PROGRAM_FAILURE"                  //  -15
+        , "CL_LINKER_NOT_AVAILABLE"                     //  -16
+        , "CL_LINK_PROGRAM_FAILURE"                     //  -17
         , ""    //  -18
         , ""    //  -19
 
@@ -375,6 +375,9 @@ typedef struct _cl_image_format {
 #define CL_IMAGE_FORMAT_NOT_SUPPORTED               -10
 #define CL_BUILD_PROGRAM_FAILURE                    -11
 #define CL_MAP_FAILURE                              -12
+#define CL_COMPILE_PROGRAM_FAILURE                  -15
+#define CL_LINKER_NOT_AVAILABLE                     -16
+#define CL_LINK_PROGRAM_FAILURE                     -17
 
 #define CL_INVALID_VALUE                            -30
 #define CL_INVALID_DEVICE_TYPE                      -31
@@ -483,6 +486,8 @@ typedef struct _cl_image_format {
 #define CL_DEVICE_VERSION                           0x102F
 #define CL_DEVICE_EXTENSIONS                        0x1030
 #define CL_DEVICE_PLATFORM                          0x1031
+#define CL_DEVICE_HOST_UNIFIED_MEMORY               0x1035
+#define CL_DEVICE_LINKER_AVAILABLE                  0x103E
 
 // cl_device_fp_config - bitfield
 #define CL_FP_DENORM                                (1 << 0)
@@ -875,6 +880,29 @@ PFNCLBUILDPROGRAM)(cl_program           /* program */,
 typedef CL_API_ENTRY cl_int (CL_API_CALL *
 PFNCLUNLOADCOMPILER)(void) CL_API_SUFFIX__VERSION_1_0;
 
+// OpenCL 1.2; these are null if the library does not have them.
+typedef CL_API_ENTRY cl_int (CL_API_CALL *
+PFNCLCOMPILEPROGRAM)(cl_program           /* program */,
+                 cl_uint              /* num_devices */,
+                 const cl_device_id * /* device_list */,
+                 const char *         /* options */,
+                 cl_uint              /* num_input_headers */,
+                 const cl_program *   /* input_headers */,
+                 const char **        /* header_include_names */,
+                 void (*pfn_notify)(cl_program /* program */, void * /* user_data */),
+                 void *               /* user_data */);
+
+typedef CL_API_ENTRY cl_program (CL_API_CALL *
+PFNCLLINKPROGRAM)(cl_context           /* context */,
+                 cl_uint              /* num_devices */,
+                 const cl_device_id * /* device_list */,
+                 const char *         /* options */,
+                 cl_uint              /* num_input_programs */,
+                 const cl_program *   /* input_programs */,
+                 void (*pfn_notify)(cl_program /* program */, void * /* user_data */),
+                 void *               /* user_data */,
+                 cl_int *             /* errcode_ret */);
+
 typedef CL_API_ENTRY cl_int (CL_API_CALL *
 PFNCLGETPROGRAMINFO)(cl_program         /* program */,
                  cl_program_info    /* param_name */,
@@ -1195,6 +1223,8 @@ CLEW_FUN_EXPORT     PFNCLRETAINPROGRAM                  __clewRetainProgram
 CLEW_FUN_EXPORT     PFNCLRELEASEPROGRAM                 __clewReleaseProgram                ;
 CLEW_FUN_EXPORT     PFNCLBUILDPROGRAM                   __clewBuildProgram                  ;
 CLEW_FUN_EXPORT     PFNCLUNLOADCOMPILER                 __clewUnloadCompiler                ;
+CLEW_FUN_EXPORT     PFNCLCOMPILEPROGRAM                 __clewCompileProgram                ;
+CLEW_FUN_EXPORT     PFNCLLINKPROGRAM                    __clewLinkProgram                   ;
 CLEW_FUN_EXPORT     PFNCLGETPROGRAMINFO                 __clewGetProgramInfo                ;
 CLEW_FUN_EXPORT     PFNCLGETPROGRAMBUILDINFO            __clewGetProgramBuildInfo           ;
 CLEW_FUN_EXPORT     PFNCLCREATEKERNEL                   __clewCreateKernel                  ;
@@ -1263,6 +1293,8 @@ CLEW_FUN_EXPORT     PFNCLGETEXTENSIONFUNCTIONADDRESS    __clewGetExtensionFuncti
 #define	clReleaseProgram                CLEW_GET_FUN(__clewReleaseProgram                )
 #define	clBuildProgram                  CLEW_GET_FUN(__clewBuildProgram                  )
 #define	clUnloadCompiler                CLEW_GET_FUN(__clewUnloadCompiler                )
+#define	clCompileProgram                CLEW_GET_FUN(__clewCompileProgram                )
+#define	clLinkProgram                   CLEW_GET_FUN(__clewLinkProgram                   )
 #define	clGetProgramInfo                CLEW_GET_FUN(__clewGetProgramInfo                )
 #define	clGetProgramBuildInfo           CLEW_GET_FUN(__clewGetProgramBuildInfo           )
 #define	clCreateKernel                  CLEW_GET_FUN(__clewCreateKernel                  )
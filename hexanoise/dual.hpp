@@ -0,0 +1,187 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/dual.hpp
+/// \brief  Dual numbers, for evaluating scripts together with their gradient
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+
+namespace hexa
+{
+namespace noise
+{
+
+/** A number, together with its derivatives along the x, y, and z axis of
+ *  the sample position.  Every operation on dual numbers applies the
+ *  chain rule, so a script that is evaluated with these instead of
+ *  doubles gives its gradient in the same pass (forward mode automatic
+ *  differentiation).  The value is always computed exactly like the
+ *  plain double version would, so it matches the result of run().
+ *
+ *  Functions that are not differentiable everywhere (abs, min, round,
+ *  and so on) use the derivative of the piece that the value lies on. */
+struct dual
+{
+    dual()
+        : v(0.0)
+        , d(0.0)
+    {
+    }
+
+    /** A constant; all derivatives are zero. */
+    dual(double value)
+        : v(value)
+        , d(0.0)
+    {
+    }
+
+    dual(double value, const glm::dvec3& derivatives)
+        : v(value)
+        , d(derivatives)
+    {
+    }
+
+    dual& operator+=(const dual& a)
+    {
+        v += a.v;
+        d += a.d;
+        return *this;
+    }
+
+    dual& operator*=(const dual& a)
+    {
+        d = d * a.v + a.d * v;
+        v *= a.v;
+        return *this;
+    }
+
+    /** The value */
+    double v;
+    /** The derivatives along x, y, and z */
+    glm::dvec3 d;
+};
+
+/** A 2-D position, made of dual numbers. */
+struct dual2
+{
+    dual x, y;
+
+    glm::dvec2 value() const { return glm::dvec2{x.v, y.v}; }
+};
+
+/** A 3-D position, made of dual numbers. */
+struct dual3
+{
+    dual x, y, z;
+
+    glm::dvec3 value() const { return glm::dvec3{x.v, y.v, z.v}; }
+};
+
+inline dual operator+(const dual& a, const dual& b)
+{
+    return dual{a.v + b.v, a.d + b.d};
+}
+
+inline dual operator-(const dual& a, const dual& b)
+{
+    return dual{a.v - b.v, a.d - b.d};
+}
+
+inline dual operator-(const dual& a)
+{
+    return dual{-a.v, -a.d};
+}
+
+inline dual operator*(const dual& a, const dual& b)
+{
+    return dual{a.v * b.v, a.d * b.v + b.d * a.v};
+}
+
+inline dual operator/(const dual& a, const dual& b)
+{
+    return dual{a.v / b.v, (a.d * b.v - b.d * a.v) / (b.v * b.v)};
+}
+
+/** Apply a function to a dual number, given the value of the function and
+ *  its slope at a.v. */
+inline dual chain(double value, double slope, const dual& a)
+{
+    return dual{value, a.d * slope};
+}
+
+/** Apply a function of a 2-D position, given the value of the function
+ *  and its gradient at p.value(). */
+inline dual chain(double value, const glm::dvec2& gradient, const dual2& p)
+{
+    return dual{value, p.x.d * gradient.x + p.y.d * gradient.y};
+}
+
+/** Apply a function of a 3-D position, given the value of the function
+ *  and its gradient at p.value(). */
+inline dual chain(double value, const glm::dvec3& gradient, const dual3& p)
+{
+    return dual{value, p.x.d * gradient.x + p.y.d * gradient.y
+                           + p.z.d * gradient.z};
+}
+
+inline dual abs(const dual& a)
+{
+    return a.v < 0.0 ? -a : a;
+}
+
+inline dual min(const dual& a, const dual& b)
+{
+    return b.v < a.v ? b : a;
+}
+
+inline dual max(const dual& a, const dual& b)
+{
+    return a.v < b.v ? b : a;
+}
+
+inline dual sqrt(const dual& a)
+{
+    double r = std::sqrt(a.v);
+    return chain(r, 0.5 / r, a);
+}
+
+inline dual sin(const dual& a)
+{
+    return chain(std::sin(a.v), std::cos(a.v), a);
+}
+
+inline dual cos(const dual& a)
+{
+    return chain(std::cos(a.v), -std::sin(a.v), a);
+}
+
+inline dual tan(const dual& a)
+{
+    double c = std::cos(a.v);
+    return chain(std::tan(a.v), 1.0 / (c * c), a);
+}
+
+// The second term is left out if the exponent is constant, so a negative
+// base with an integer exponent does not give NaN.
+inline dual pow(const dual& a, const dual& b)
+{
+    double r = std::pow(a.v, b.v);
+    glm::dvec3 d{a.d * (b.v * std::pow(a.v, b.v - 1.0))};
+    if (b.d.x != 0.0 || b.d.y != 0.0 || b.d.z != 0.0)
+        d += b.d * (r * std::log(a.v));
+
+    return dual{r, d};
+}
+
+inline dual atan2(const dual& y, const dual& x)
+{
+    double r2 = x.v * x.v + y.v * y.v;
+    return dual{std::atan2(y.v, x.v), (y.d * x.v - x.d * y.v) / r2};
+}
+
+} // namespace noise
+} // namespace hexa
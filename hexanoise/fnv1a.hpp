@@ -0,0 +1,72 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/fnv1a.hpp
+/// \brief  64- and 128-bit FNV-1a hashes
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace hexa
+{
+namespace noise
+{
+
+/** A 128-bit hash. */
+struct digest128
+{
+    uint64_t hi;
+    uint64_t lo;
+};
+
+/** The 64-bit FNV-1a hash of a block of memory.  Unlike std::hash, it
+ *  gives the same result across compilers and library versions, so it
+ *  can end up in file names and files.
+ * @param data  The bytes to hash
+ * @param size  The number of bytes
+ * @param hash  The hash of the bytes that came before, to hash data
+ *              that comes in several parts
+ * @return The hash */
+inline uint64_t fnv1a(const void* data, size_t size,
+                      uint64_t hash = 14695981039346656037ull)
+{
+    auto c = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= c[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t fnv1a(const std::string& str,
+                      uint64_t hash = 14695981039346656037ull)
+{
+    return fnv1a(str.data(), str.size(), hash);
+}
+
+/** The 128-bit FNV-1a hash of a string.  This one is wide enough to
+ *  identify something on its own, without ever running into a
+ *  collision in practice. */
+inline digest128 fnv1a_128(const std::string& str)
+{
+    // The prime is 2^88 + 0x13b, so the multiplication comes down to a
+    // shift, and a product with a small number that carries into the
+    // high half.
+    uint64_t hi = 0x6c62272e07bb0142ull, lo = 0x62b821756295c58dull;
+    for (unsigned char c : str) {
+        lo ^= c;
+        uint64_t a = (lo & 0xffffffffull) * 0x13b;
+        uint64_t b = (lo >> 32) * 0x13b;
+        uint64_t carry
+            = (b >> 32) + (((a >> 32) + (b & 0xffffffffull)) >> 32);
+        hi = hi * 0x13b + (lo << 24) + carry;
+        lo = a + (b << 32);
+    }
+    return digest128{hi, lo};
+}
+
+} // namespace noise
+} // namespace hexa
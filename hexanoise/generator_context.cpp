@@ -6,11 +6,14 @@
 
 #include "generator_context.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 #include <cstdio>
+#include <random>
 #include <boost/property_tree/ptree.hpp>
 
 #include "ast.hpp"
+#include "optimize.hpp"
 #include "parser.hpp"
 #include "tokens.hpp"
 
@@ -142,14 +145,33 @@ static global_variables_null global_null;
 
 generator_context::generator_context()
     : variables_(global_null)
+    , image_generation_(0)
+    , seed_tables_(false)
 {
 }
 
 generator_context::generator_context(const global_variables_i& v)
     : variables_(v)
+    , image_generation_(0)
+    , seed_tables_(false)
 {
 }
 
+// A Fisher-Yates shuffle.  The output of std::mt19937 is fully specified
+// by the standard, but the distributions are not, so the modulo is done
+// here instead.
+generator_context::permutation::permutation(uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    for (int i = 0; i < 256; ++i)
+        p[i] = i;
+
+    for (int i = 255; i > 0; --i)
+        std::swap(p[i], p[rng() % (i + 1)]);
+
+    std::copy(p, p + 256, p + 256);
+}
+
 const node& generator_context::set_script(const std::string& name,
                                    const std::string& script)
 {
@@ -167,9 +189,12 @@ const node& generator_context::set_script(const std::string& name,
     yy_delete_buffer(state, scanner);
     yylex_destroy(scanner);
 
-    auto result = scripts_.emplace(std::make_pair(name, node(func, *this)));
+    node compiled(func, *this);
     delete func;
-    
+    fold_constants(compiled, *this);
+
+    auto result = scripts_.emplace(std::make_pair(name, std::move(compiled)));
+
     return result.first->second;
 }
 
@@ -195,13 +220,19 @@ bool generator_context::exists_global(const std::string& name) const
 
 void generator_context::set_image(const std::string& name, image&& data)
 {
-    images_[name] = std::move(data);
+    auto& img = images_[name];
+    if (!img.buffer.empty())
+        ++image_generation_;
+
+    img = std::move(data);
+    if (tiles_)
+        tiles_->clear();
 }
 
 void generator_context::load_png_image(const std::string& name,
                                        const std::string& png_file)
 {
-    images_[name] = png_load(png_file);
+    set_image(name, png_load(png_file));
 }
 
 const generator_context::image&
@@ -214,5 +245,41 @@ generator_context::get_image(const std::string& name) const
     return found->second;
 }
 
+const generator_context::permutation&
+generator_context::get_permutation(uint32_t seed) const
+{
+    std::lock_guard<std::mutex> lock(permutations_mutex_);
+    auto& found = permutations_[seed];
+    if (!found)
+        found.reset(new permutation(seed));
+
+    return *found;
+}
+
+void generator_context::set_threads(unsigned int count)
+{
+    if (count == 1)
+        workers_.reset();
+    else
+        workers_.reset(new thread_pool(count));
+}
+
+void generator_context::set_tile_cache(size_t budget)
+{
+    if (budget == 0)
+        tiles_.reset();
+    else
+        tiles_.reset(new tile_cache(budget));
+}
+
+void generator_context::set_tile_store(const std::string& file,
+                                       size_t budget)
+{
+    // The old store has to let go of the file first.
+    store_.reset();
+    if (!file.empty())
+        store_.reset(new tile_store(file, budget));
+}
+
 } // namespace noise
 } // namespace hexa
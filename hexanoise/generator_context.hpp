@@ -7,12 +7,17 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "global_variables_i.hpp"
 #include "node.hpp"
+#include "thread_pool.hpp"
+#include "tile_cache.hpp"
+#include "tile_store.hpp"
 
 namespace hexa
 {
@@ -61,6 +66,19 @@ public:
         }
     };
 
+    /** A shuffled permutation of 0..255, used by the gradient noise
+     *  functions to pick a gradient for every lattice point.  The table
+     *  is stored twice in a row, so two lookups can be added without
+     *  wrapping around. */
+    struct permutation
+    {
+        /** Shuffle the table with a random generator, seeded with
+         *  \a seed.  The result is the same on every platform. */
+        explicit permutation(uint32_t seed);
+
+        int p[512];
+    };
+
 public:
     /** Create a context without global variables. */
     generator_context();
@@ -82,7 +100,11 @@ public:
     /** Check if a global variable exists. */
     bool exists_global(const std::string& name) const;
 
-    /** Register image data. */
+    /** Register image data.  This empties the tile cache, because the
+     *  results of scripts that use the image may change.  Replacing an
+     *  image also stops generators that were made before from using the
+     *  tile cache and store, since their tiles are filed under the old
+     *  image; make new generators to cache results again. */
     void set_image(const std::string& name, image&& data);
 
     /** Load an image from a greyscale PNG file. */
@@ -91,6 +113,88 @@ public:
     /** Get an image by name. */
     const image& get_image(const std::string& name) const;
 
+    /** The number of times an image was replaced.  Generators use this
+     *  to find out if the tiles they would cache are still valid. */
+    unsigned int image_generation() const { return image_generation_; }
+
+    /** Set the number of threads the CPU generators use for a single
+     *  run() call.  The output range is split into chunks that are
+     *  evaluated in parallel; the results are the same as with a single
+     *  thread.  Do not call this while a generator is running.
+     * @param count  The number of threads, including the calling thread.
+     *               The default is 1; 0 means one for every hardware
+     *               thread. */
+    void set_threads(unsigned int count);
+
+    /** Get the worker threads.
+     * @return The thread pool, or null if generators should run on the
+     *         calling thread only */
+    thread_pool* workers() const { return workers_.get(); }
+
+    /** Choose how the gradient noise functions (perlin, simplex, and
+     *  opensimplex, in 2-D and 3-D) use their seed.  By default, the
+     *  seed is added to the lattice coordinates, which shifts the noise
+     *  over a fixed permutation table.  With seed tables enabled, every
+     *  seed that is a constant in the script gets a permutation table of
+     *  its own, so the results for different seeds are not correlated,
+     *  and the lookups don't need any extra math.  Seeds that are not
+     *  constant still use the default method.  The cell noise functions
+     *  don't use a permutation table, and are not affected.
+     *
+     *  This changes the results, so it should be chosen once, before
+     *  any generators are created. */
+    void set_seed_tables(bool enable) { seed_tables_ = enable; }
+
+    /** Returns true if seed tables are enabled. */
+    bool seed_tables() const { return seed_tables_; }
+
+    /** Get the permutation table for a seed.  It is built the first time
+     *  it is asked for, and kept until the context is destroyed.  This
+     *  function can be called from several threads at once. */
+    const permutation& get_permutation(uint32_t seed) const;
+
+    /** Keep the results of recent runs in memory, so the same tile
+     *  does not have to be generated twice.  The cache is shared by all
+     *  generators made from this context, after this call.  A tile is
+     *  identified by:
+     *   - the compiled script, including the scripts it calls with the
+     *     @-operator, and the global variables (these are constants in
+     *     the compiled script, except for the global seed, which is
+     *     added separately);
+     *   - the type of the generator, since the OpenCL generator does not
+     *     give exactly the same results as the CPU generators;
+     *   - the corner, step, and count of the run;
+     *   - the output type, and the scale, offset, and clamp range for
+     *     run_quantized().
+     *  The script goes into the key as a 128-bit hash, so the keys stay
+     *  small for large scripts, and the generator type by its
+     *  tile_tag().  Runs over a list of points are not cached.
+     *
+     *  Do not call this while a generator is running.
+     * @param budget  The most memory the cache may use, in bytes; 0
+     *                turns the cache off */
+    void set_tile_cache(size_t budget);
+
+    /** Get the tile cache.
+     * @return The cache, or null if it is turned off */
+    tile_cache* tiles() const { return tiles_.get(); }
+
+    /** Keep the results of runs in a file, so they survive a restart.
+     *  Tiles are identified the same way as in the tile cache, and the
+     *  tile cache (if there is one) is checked first.  Tiles that are
+     *  read from the store are also put in the tile cache.
+     *
+     *  Do not call this while a generator is running.
+     * @param file    The file name; an empty name closes the store
+     * @param budget  The largest size the file may grow to, in bytes
+     * @throw std::runtime_error if the file could not be opened (see
+     *                           tile_store) */
+    void set_tile_store(const std::string& file, size_t budget);
+
+    /** Get the tile store.
+     * @return The store, or null if there is none */
+    tile_store* store() const { return store_.get(); }
+
 private:
     void init();
 
@@ -98,6 +202,14 @@ private:
     const global_variables_i& variables_;
     std::unordered_map<std::string, node> scripts_;
     std::unordered_map<std::string, image> images_;
+    unsigned int image_generation_;
+    std::unique_ptr<thread_pool> workers_;
+    std::unique_ptr<tile_cache> tiles_;
+    std::unique_ptr<tile_store> store_;
+    bool seed_tables_;
+    mutable std::mutex permutations_mutex_;
+    mutable std::unordered_map<uint32_t, std::unique_ptr<permutation>>
+        permutations_;
 };
 
 } // namespace noise
@@ -0,0 +1,193 @@
+//---------------------------------------------------------------------------
+// hexanoise/generator_hybrid.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "generator_hybrid.hpp"
+
+#include <stdexcept>
+
+namespace hexa
+{
+namespace noise
+{
+
+generator_hybrid::generator_hybrid(const generator_context& context,
+                                   const node& n,
+                                   std::unique_ptr<generator_i> fallback,
+                                   factory make)
+    : generator_i(context, n)
+    , fallback_(std::move(fallback))
+    , state_(building)
+{
+    if (!fallback_)
+        throw std::runtime_error("generator_hybrid needs a fallback");
+
+    thread_ = std::thread([this, make] {
+        std::unique_ptr<generator_i> result;
+        std::string error;
+        try {
+            result = make();
+            if (!result)
+                error = "the factory did not make a generator";
+        } catch (std::exception& e) {
+            error = e.what();
+        } catch (...) {
+            error = "unknown error";
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        built_ = std::move(result);
+        error_ = error;
+        state_ = built_ ? built : broken;
+        done_.notify_all();
+    });
+}
+
+generator_hybrid::~generator_hybrid()
+{
+    // An OpenCL build cannot be cancelled.
+    thread_.join();
+}
+
+void generator_hybrid::wait() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return state_ != building; });
+}
+
+std::string generator_hybrid::error() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+const generator_i& generator_hybrid::current() const
+{
+    return state_ == built ? *built_ : *fallback_;
+}
+
+void generator_hybrid::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, double* output,
+                                size_t row_pitch) const
+{
+    current().run(corner, step, count, output, extent(count, row_pitch),
+                  row_pitch);
+}
+
+void generator_hybrid::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, const quantizer& q,
+                                void* output, size_t row_pitch) const
+{
+    current().run_quantized(corner, step, count, q, output,
+                            extent(count, row_pitch), row_pitch);
+}
+
+void generator_hybrid::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, float* output,
+                                size_t row_pitch) const
+{
+    current().run_float(corner, step, count, output,
+                        extent(count, row_pitch), row_pitch);
+}
+
+void generator_hybrid::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, double* output,
+                                size_t row_pitch, size_t slice_pitch) const
+{
+    current().run(corner, step, count, output,
+                  extent(count, row_pitch, slice_pitch), row_pitch,
+                  slice_pitch);
+}
+
+void generator_hybrid::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, const quantizer& q,
+                                void* output, size_t row_pitch,
+                                size_t slice_pitch) const
+{
+    current().run_quantized(corner, step, count, q, output,
+                            extent(count, row_pitch, slice_pitch), row_pitch,
+                            slice_pitch);
+}
+
+void generator_hybrid::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, float* output,
+                                size_t row_pitch, size_t slice_pitch) const
+{
+    current().run_float(corner, step, count, output,
+                        extent(count, row_pitch, slice_pitch), row_pitch,
+                        slice_pitch);
+}
+
+void generator_hybrid::generate(const glm::dvec2* points, size_t n,
+                                double* output) const
+{
+    current().run(points, n, output);
+}
+
+void generator_hybrid::generate(const glm::dvec3* points, size_t n,
+                                double* output) const
+{
+    current().run(points, n, output);
+}
+
+void generator_hybrid::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, glm::dvec3* output,
+                                size_t row_pitch) const
+{
+    current().run_with_gradient(corner, step, count, output,
+                                extent(count, row_pitch), row_pitch);
+}
+
+void generator_hybrid::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, glm::dvec4* output,
+                                size_t row_pitch, size_t slice_pitch) const
+{
+    current().run_with_gradient(corner, step, count, output,
+                                extent(count, row_pitch, slice_pitch),
+                                row_pitch, slice_pitch);
+}
+
+std::future<std::vector<double>>
+generator_hybrid::generate_async(const glm::dvec2& corner,
+                                 const glm::dvec2& step,
+                                 const glm::ivec2& count) const
+{
+    return current().run_async(corner, step, count);
+}
+
+std::future<std::vector<double>>
+generator_hybrid::generate_async(const glm::dvec3& corner,
+                                 const glm::dvec3& step,
+                                 const glm::ivec3& count) const
+{
+    return current().run_async(corner, step, count);
+}
+
+std::future<std::vector<float>>
+generator_hybrid::generate_float_async(const glm::dvec2& corner,
+                                       const glm::dvec2& step,
+                                       const glm::ivec2& count) const
+{
+    return current().run_float_async(corner, step, count);
+}
+
+std::future<std::vector<float>>
+generator_hybrid::generate_float_async(const glm::dvec3& corner,
+                                       const glm::dvec3& step,
+                                       const glm::ivec3& count) const
+{
+    return current().run_float_async(corner, step, count);
+}
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,147 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/generator_hybrid.hpp
+/// \brief  Uses a CPU generator while a faster one is being built
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <glm/glm.hpp>
+
+#include "generator_i.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+/** Builds a generator that takes a while to set up (generator_opencl,
+ *  generator_native) on a background thread.  Until it is ready, the
+ *  runs are passed on to a generator that is available right away, such
+ *  as generator_vm.  Once the build is done, all later runs use the new
+ *  generator; runs that are still going finish with the old one.
+ *
+ *  If the build fails, the fallback is used for good, and error() tells
+ *  why.  For generator_opencl, this includes the build log.
+ *
+ *  The factory runs on another thread, and reads from the context, so
+ *  the context must not be changed until ready() returns true. */
+class generator_hybrid : public generator_i
+{
+public:
+    /** Builds the fast generator. */
+    typedef std::function<std::unique_ptr<generator_i>()> factory;
+
+public:
+    /** Set up a generator, and start the build.
+     * @param context   Shared data
+     * @param n         The compiled noise script to execute
+     * @param fallback  Runs the script until the build is done
+     * @param make      Builds the generator that takes over */
+    generator_hybrid(const generator_context& context, const node& n,
+                     std::unique_ptr<generator_i> fallback, factory make);
+
+    /** Waits for the build to finish. */
+    ~generator_hybrid();
+
+    generator_hybrid(const generator_hybrid&) = delete;
+    generator_hybrid& operator=(const generator_hybrid&) = delete;
+
+    /** Returns true if the build is done, successful or not. */
+    bool ready() const { return state_ != building; }
+
+    /** Returns true if the build failed. */
+    bool failed() const { return state_ == broken; }
+
+    /** Block until the build is done. */
+    void wait() const;
+
+    /** Why the build failed, or an empty string. */
+    std::string error() const;
+
+protected:
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, double* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, const quantizer& q, void* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, float* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, double* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, const quantizer& q, void* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, float* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec2* points, size_t n,
+                  double* output) const override;
+
+    void generate(const glm::dvec3* points, size_t n,
+                  double* output) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, glm::dvec3* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, glm::dvec4* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
+
+    std::future<std::vector<double>>
+    generate_async(const glm::dvec2& corner, const glm::dvec2& step,
+                   const glm::ivec2& count) const override;
+
+    std::future<std::vector<double>>
+    generate_async(const glm::dvec3& corner, const glm::dvec3& step,
+                   const glm::ivec3& count) const override;
+
+    std::future<std::vector<float>>
+    generate_float_async(const glm::dvec2& corner, const glm::dvec2& step,
+                         const glm::ivec2& count) const override;
+
+    std::future<std::vector<float>>
+    generate_float_async(const glm::dvec3& corner, const glm::dvec3& step,
+                         const glm::ivec3& count) const override;
+
+    /** The two generators use the cache themselves.  Their results are
+     *  not always the same, so they must not share tiles. */
+    bool use_tile_cache() const override { return false; }
+
+private:
+    enum state_t { building, built, broken };
+
+    /** The generator that runs are passed on to. */
+    const generator_i& current() const;
+
+private:
+    std::unique_ptr<generator_i> fallback_;
+    /** Only set by the build thread, before state_ changes. */
+    std::unique_ptr<generator_i> built_;
+    std::atomic<int> state_;
+    std::string error_;
+
+    mutable std::mutex mutex_;
+    mutable std::condition_variable done_;
+    std::thread thread_;
+};
+
+} // namespace noise
+} // namespace hexa
@@ -6,10 +6,22 @@
 //---------------------------------------------------------------------------
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <future>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <typeinfo>
 #include <vector>
 #include <glm/glm.hpp>
+#include "analysis.hpp"
+#include "bounds.hpp"
+#include "fnv1a.hpp"
 #include "generator_context.hpp"
+#include "quantize.hpp"
 
 namespace hexa
 {
@@ -17,12 +29,40 @@ namespace noise
 {
 
 /** Base class for noise generators.
- *  The actual implementations run the HNDL script. */
+ *  The actual implementations run the HNDL script.  The run functions are
+ *  const, and can be called from several threads at the same time on a
+ *  single instance.
+ *
+ *  Every run function comes in two flavors: one that returns a new
+ *  buffer, and one that writes to memory owned by the caller.  The latter
+ *  takes the distance between rows (and slices, in 3-D) in elements, so
+ *  the results can go straight into a part of a larger array.  Derived
+ *  classes only implement the second flavor, in generate(). */
 class generator_i
 {
 public:
     generator_i(const generator_context& c)
         : cntx_(c)
+        , cacheable_(false)
+        , script_digest_{0, 0}
+        , image_generation_(0)
+    {
+    }
+
+    /** Set up a generator that can also find the bounds of its results,
+     *  and use the tile cache and tile store of the context, if it has
+     *  them.
+     * @param c      Shared data
+     * @param n      The script; a copy is kept for bounds()
+     * @param cache  False to leave the tile cache and store alone, for
+     *               runs that are not worth keeping */
+    generator_i(const generator_context& c, const node& n, bool cache = true)
+        : cntx_(c)
+        , script_(std::make_shared<node>(n))
+        , cacheable_(cache && (c.tiles() || c.store()))
+        , script_digest_(cacheable_ ? fnv1a_128(fingerprint(n, c))
+                                    : digest128{0, 0})
+        , image_generation_(c.image_generation())
     {
     }
 
@@ -34,9 +74,11 @@ public:
      * @param count     The number of samples to take in the x and y direction
      * @return A buffer with size (count.x * count.y) holding the results
      */
-    virtual std::vector<double> run(const glm::dvec2& corner,
-                                    const glm::dvec2& step,
-                                    const glm::ivec2& count) = 0;
+    std::vector<double> run(const glm::dvec2& corner, const glm::dvec2& step,
+                            const glm::ivec2& count) const
+    {
+        return make<double>(corner, step, count);
+    }
 
     /** Run the script for a given range, output in signed 16-bit precision.
      * @param corner    The top-left corner of the range
@@ -44,9 +86,12 @@ public:
      * @param count     The number of samples to take in the x and y direction
      * @return A buffer with size (count.x * count.y) holding the results
      */
-    virtual std::vector<int16_t> run_int16(const glm::dvec2& corner,
-                                           const glm::dvec2& step,
-                                           const glm::ivec2& count) = 0;
+    std::vector<int16_t> run_int16(const glm::dvec2& corner,
+                                   const glm::dvec2& step,
+                                   const glm::ivec2& count) const
+    {
+        return make<int16_t>(corner, step, count, quantized::int16);
+    }
 
     /** Run the script for a given range, output in double precision.
      * @param corner    The corner of the range
@@ -56,9 +101,11 @@ public:
      * @return A buffer with size (count.x * count.y * count.z) holding the
      * results
      */
-    virtual std::vector<double> run(const glm::dvec3& corner,
-                                    const glm::dvec3& step,
-                                    const glm::ivec3& count) = 0;
+    std::vector<double> run(const glm::dvec3& corner, const glm::dvec3& step,
+                            const glm::ivec3& count) const
+    {
+        return make<double>(corner, step, count);
+    }
 
     /** Run the script for a given range, output in signed 16-bit precision.
      * @param corner    The corner of the range
@@ -68,12 +115,726 @@ public:
      * @return A buffer with size (count.x * count.y * count.z) holding the
      * results
      */
-    virtual std::vector<int16_t> run_int16(const glm::dvec3& corner,
-                                           const glm::dvec3& step,
-                                           const glm::ivec3& count) = 0;
+    std::vector<int16_t> run_int16(const glm::dvec3& corner,
+                                   const glm::dvec3& step,
+                                   const glm::ivec3& count) const
+    {
+        return make<int16_t>(corner, step, count, quantized::int16);
+    }
+
+    /** Run the script for a given range, output in single precision.
+     *  The default implementation computes the results in double precision
+     *  and rounds them, so the error is at most half a unit in the last
+     *  place of a float (a relative error of 6e-8).  generator_opencl
+     *  does the whole computation in single precision, which is less
+     *  accurate; see there.
+     * @param corner    The top-left corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x and y direction
+     * @return A buffer with size (count.x * count.y) holding the results
+     */
+    std::vector<float> run_float(const glm::dvec2& corner,
+                                 const glm::dvec2& step,
+                                 const glm::ivec2& count) const
+    {
+        return make<float>(corner, step, count);
+    }
+
+    /** Run the script for a given range, output in single precision.
+     * @param corner    The corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x, y, and z
+     * direction
+     * @return A buffer with size (count.x * count.y * count.z) holding the
+     * results
+     */
+    std::vector<float> run_float(const glm::dvec3& corner,
+                                 const glm::dvec3& step,
+                                 const glm::ivec3& count) const
+    {
+        return make<float>(corner, step, count);
+    }
+
+    /** Start a run, and return before it is done.  Several runs can be
+     *  in flight at once, so the next chunk is generated while the
+     *  results of the last one are being used.  Errors are thrown by
+     *  get().  The generator must outlive the future.
+     *
+     *  The CPU generators start a task on a thread of its own; its run
+     *  still uses the thread pool of the context.  On a machine with a
+     *  single hardware thread, the run is done by get() instead, because
+     *  a thread only adds overhead there.  generator_opencl
+     *  queues the kernel and the transfer of the results right away, and
+     *  get() waits for them.
+     * @param corner    The top-left corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x and y direction
+     * @return The results of run() */
+    std::future<std::vector<double>> run_async(const glm::dvec2& corner,
+                                               const glm::dvec2& step,
+                                               const glm::ivec2& count) const
+    {
+        return generate_async(corner, step, count);
+    }
+
+    std::future<std::vector<double>> run_async(const glm::dvec3& corner,
+                                               const glm::dvec3& step,
+                                               const glm::ivec3& count) const
+    {
+        return generate_async(corner, step, count);
+    }
+
+    /** Like run_async(), in single precision. */
+    std::future<std::vector<float>>
+    run_float_async(const glm::dvec2& corner, const glm::dvec2& step,
+                    const glm::ivec2& count) const
+    {
+        return generate_float_async(corner, step, count);
+    }
+
+    std::future<std::vector<float>>
+    run_float_async(const glm::dvec3& corner, const glm::dvec3& step,
+                    const glm::ivec3& count) const
+    {
+        return generate_float_async(corner, step, count);
+    }
+
+    /** Run the script for a given range, and write the results to a
+     *  buffer owned by the caller.  Sample (x, y) ends up in
+     *  output[x + y * row_pitch]; the elements between the rows are not
+     *  touched.
+     * @param corner    The top-left corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x and y direction
+     * @param output    The buffer that receives the results
+     * @param size      The number of elements in the buffer
+     * @param row_pitch The distance between the start of two rows, in
+     *                  elements
+     * @throw std::runtime_error if the rows overlap, or if the buffer is
+     *                           too small */
+    void run(const glm::dvec2& corner, const glm::dvec2& step,
+             const glm::ivec2& count, double* output, size_t size,
+             size_t row_pitch) const
+    {
+        if (check(count, size, row_pitch))
+            generate_cached(corner, step, count, output, row_pitch);
+    }
+
+    /** Like run(), with output in signed 16-bit precision. */
+    void run_int16(const glm::dvec2& corner, const glm::dvec2& step,
+                   const glm::ivec2& count, int16_t* output, size_t size,
+                   size_t row_pitch) const
+    {
+        run_quantized(corner, step, count, quantized::int16, output, size,
+                      row_pitch);
+    }
+
+    /** Like run(), with output in single precision. */
+    void run_float(const glm::dvec2& corner, const glm::dvec2& step,
+                   const glm::ivec2& count, float* output, size_t size,
+                   size_t row_pitch) const
+    {
+        if (check(count, size, row_pitch))
+            generate_cached(corner, step, count, output, row_pitch);
+    }
+
+    /** Run the script for a given range, and write the results to a
+     *  buffer owned by the caller.  Sample (x, y, z) ends up in
+     *  output[x + y * row_pitch + z * slice_pitch].
+     * @param corner    The corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x, y, and z
+     *                  direction
+     * @param output    The buffer that receives the results
+     * @param size      The number of elements in the buffer
+     * @param row_pitch The distance between the start of two rows, in
+     *                  elements
+     * @param slice_pitch  The distance between the start of two slices,
+     *                     in elements
+     * @throw std::runtime_error if the rows or slices overlap, or if the
+     *                           buffer is too small */
+    void run(const glm::dvec3& corner, const glm::dvec3& step,
+             const glm::ivec3& count, double* output, size_t size,
+             size_t row_pitch, size_t slice_pitch) const
+    {
+        if (check(count, size, row_pitch, slice_pitch))
+            generate_cached(corner, step, count, output, row_pitch,
+                            slice_pitch);
+    }
+
+    /** Like run(), with output in signed 16-bit precision. */
+    void run_int16(const glm::dvec3& corner, const glm::dvec3& step,
+                   const glm::ivec3& count, int16_t* output, size_t size,
+                   size_t row_pitch, size_t slice_pitch) const
+    {
+        run_quantized(corner, step, count, quantized::int16, output, size,
+                      row_pitch, slice_pitch);
+    }
+
+    /** Like run(), with output in single precision. */
+    void run_float(const glm::dvec3& corner, const glm::dvec3& step,
+                   const glm::ivec3& count, float* output, size_t size,
+                   size_t row_pitch, size_t slice_pitch) const
+    {
+        if (check(count, size, row_pitch, slice_pitch))
+            generate_cached(corner, step, count, output, row_pitch,
+                            slice_pitch);
+    }
+
+    /** Run the script for a given range, and store the results in one of
+     *  the compact formats.  Scaling, clamping and rounding are done in
+     *  the inner loop (or in the OpenCL kernel), so no results in double
+     *  precision are kept around.
+     * @param corner    The top-left corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x and y direction
+     * @param q         The format, and how to scale and clamp the results
+     * @param output    The buffer that receives the results, its elements
+     *                  are of type q.format
+     * @param size      The number of elements in the buffer
+     * @param row_pitch The distance between the start of two rows, in
+     *                  elements
+     * @throw std::runtime_error if the rows overlap, or if the buffer is
+     *                           too small */
+    void run_quantized(const glm::dvec2& corner, const glm::dvec2& step,
+                       const glm::ivec2& count, const quantizer& q,
+                       void* output, size_t size, size_t row_pitch) const
+    {
+        if (check(count, size, row_pitch))
+            generate_cached(corner, step, count, q, output, row_pitch);
+    }
+
+    /** Like run_quantized(), in 3-D.
+     * @param slice_pitch  The distance between the start of two slices,
+     *                     in elements */
+    void run_quantized(const glm::dvec3& corner, const glm::dvec3& step,
+                       const glm::ivec3& count, const quantizer& q,
+                       void* output, size_t size, size_t row_pitch,
+                       size_t slice_pitch) const
+    {
+        if (check(count, size, row_pitch, slice_pitch))
+            generate_cached(corner, step, count, q, output, row_pitch,
+                            slice_pitch);
+    }
+
+    /** Run the script at a list of arbitrary positions.  This is a lot
+     *  faster than asking for a 1x1 grid at every position.
+     * @param points    The positions
+     * @param n         The number of positions
+     * @param output    Receives the n results, in the same order */
+    void run(const glm::dvec2* points, size_t n, double* output) const
+    {
+        if (n > 0)
+            generate(points, n, output);
+    }
+
+    /** Run the script at a list of arbitrary positions in 3-D.
+     * @param points    The positions
+     * @param n         The number of positions
+     * @param output    Receives the n results, in the same order */
+    void run(const glm::dvec3* points, size_t n, double* output) const
+    {
+        if (n > 0)
+            generate(points, n, output);
+    }
+
+    /** Run the script for a given range, and find the gradient of the
+     *  results as well.  The derivatives are computed analytically, in
+     *  the same pass as the value (see dual.hpp), so they are exact up
+     *  to rounding, and a lot cheaper than finite differences.  Where the
+     *  script is not differentiable (the edges of abs, round, then_else,
+     *  and so on), the derivative of one of the sides is used.
+     *
+     *  generator_slowinterpreter and generator_opencl compute the
+     *  gradient themselves.  The other generators hand the run over to
+     *  a generator_slowinterpreter, so this is as slow as the
+     *  interpreter there, but the results are the same.  Generators
+     *  that were made without a script throw a std::runtime_error.
+     * @param corner    The top-left corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x and y direction
+     * @return A buffer with size (count.x * count.y), every element holds
+     *         the result, and its derivatives along x and y */
+    std::vector<glm::dvec3> run_with_gradient(const glm::dvec2& corner,
+                                              const glm::dvec2& step,
+                                              const glm::ivec2& count) const
+    {
+        return make<glm::dvec3>(corner, step, count);
+    }
+
+    /** Run the script for a given range in 3-D, and find the gradient of
+     *  the results as well.
+     * @param corner    The corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x, y, and z
+     *                  direction
+     * @return A buffer with size (count.x * count.y * count.z), every
+     *         element holds the result, and its derivatives along x, y,
+     *         and z */
+    std::vector<glm::dvec4> run_with_gradient(const glm::dvec3& corner,
+                                              const glm::dvec3& step,
+                                              const glm::ivec3& count) const
+    {
+        return make<glm::dvec4>(corner, step, count);
+    }
+
+    /** Like run_with_gradient(), with the results written to a buffer
+     *  owned by the caller.  See run() for the layout. */
+    void run_with_gradient(const glm::dvec2& corner, const glm::dvec2& step,
+                           const glm::ivec2& count, glm::dvec3* output,
+                           size_t size, size_t row_pitch) const
+    {
+        if (check(count, size, row_pitch))
+            generate_cached(corner, step, count, output, row_pitch);
+    }
+
+    /** Like run_with_gradient(), with the results written to a buffer
+     *  owned by the caller.  See run() for the layout. */
+    void run_with_gradient(const glm::dvec3& corner, const glm::dvec3& step,
+                           const glm::ivec3& count, glm::dvec4* output,
+                           size_t size, size_t row_pitch,
+                           size_t slice_pitch) const
+    {
+        if (check(count, size, row_pitch, slice_pitch))
+            generate_cached(corner, step, count, output, row_pitch,
+                            slice_pitch);
+    }
+
+    /** Find a range that holds all the results of run() for a block,
+     *  without running the script.  See bounds() in bounds.hpp for how
+     *  conservative this is.  If the block ends up entirely above or
+     *  below a threshold, it does not need to be generated at all.
+     * @param corner    The top-left corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x and y direction
+     * @return The range of the results, or [-inf, inf] if the generator
+     *         was set up without a script */
+    interval bounds(const glm::dvec2& corner, const glm::dvec2& step,
+                    const glm::ivec2& count) const
+    {
+        return bounds(glm::dvec3{corner, 0.0}, glm::dvec3{step, 0.0},
+                      glm::ivec3{count, 1});
+    }
+
+    /** Find a range that holds all the results of run() for a 3-D block.
+     * @param corner    The corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x, y, and z
+     *                  direction
+     * @return The range of the results, or [-inf, inf] if the generator
+     *         was set up without a script */
+    interval bounds(const glm::dvec3& corner, const glm::dvec3& step,
+                    const glm::ivec3& count) const
+    {
+        const double inf = std::numeric_limits<double>::infinity();
+        if (script_ == nullptr)
+            return interval{-inf, inf};
+
+        glm::dvec3 last{std::max(count.x - 1, 0), std::max(count.y - 1, 0),
+                        std::max(count.z - 1, 0)};
+        return noise::bounds(*script_, cntx_, corner, corner + last * step);
+    }
+
+    /** Check if every sample of a block would be stored as the same
+     *  value by run_quantized().  If so, the block is filled with that
+     *  value without running the script.  Most chunks that are entirely
+     *  empty or entirely solid can be culled this way.
+     * @param corner    The top-left corner of the range
+     * @param step      The step size between samples
+     * @param count     The number of samples to take in the x and y direction
+     * @param q         The format, and how to scale and clamp the results
+     * @param output    The buffer that receives the results
+     * @param size      The number of elements in the buffer
+     * @param row_pitch The distance between the start of two rows, in
+     *                  elements
+     * @return True if the block was filled, false if the output was not
+     *         touched and run_quantized() is still needed
+     * @throw std::runtime_error if the rows overlap, or if the buffer is
+     *                           too small */
+    bool fill_uniform(const glm::dvec2& corner, const glm::dvec2& step,
+                      const glm::ivec2& count, const quantizer& q,
+                      void* output, size_t size, size_t row_pitch) const
+    {
+        if (!check(count, size, row_pitch))
+            return true;
+
+        return fill_uniform(bounds(corner, step, count), glm::ivec3{count, 1},
+                            q, output, row_pitch, 0);
+    }
+
+    /** Like fill_uniform(), in 3-D.
+     * @param slice_pitch  The distance between the start of two slices,
+     *                     in elements */
+    bool fill_uniform(const glm::dvec3& corner, const glm::dvec3& step,
+                      const glm::ivec3& count, const quantizer& q,
+                      void* output, size_t size, size_t row_pitch,
+                      size_t slice_pitch) const
+    {
+        if (!check(count, size, row_pitch, slice_pitch))
+            return true;
+
+        return fill_uniform(bounds(corner, step, count), count, q, output,
+                            row_pitch, slice_pitch);
+    }
+
+protected:
+    /** Write the results to output.  The arguments have been checked
+     *  already, and count is not empty. */
+    virtual void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                          const glm::ivec2& count, double* output,
+                          size_t row_pitch) const = 0;
+
+    virtual void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                          const glm::ivec2& count, const quantizer& q,
+                          void* output, size_t row_pitch) const = 0;
+
+    virtual void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                          const glm::ivec3& count, double* output,
+                          size_t row_pitch, size_t slice_pitch) const = 0;
+
+    virtual void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                          const glm::ivec3& count, const quantizer& q,
+                          void* output, size_t row_pitch,
+                          size_t slice_pitch) const = 0;
+
+    virtual void generate(const glm::dvec2* points, size_t n,
+                          double* output) const = 0;
+
+    virtual void generate(const glm::dvec3* points, size_t n,
+                          double* output) const = 0;
+
+    /** The default computes the results in double precision, and rounds
+     *  them. */
+    virtual void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                          const glm::ivec2& count, float* output,
+                          size_t row_pitch) const
+    {
+        auto result = run(corner, step, count);
+        for (int y = 0; y < count.y; ++y)
+            std::copy_n(result.begin() + y * count.x, count.x,
+                        output + y * row_pitch);
+    }
+
+    virtual void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                          const glm::ivec3& count, float* output,
+                          size_t row_pitch, size_t slice_pitch) const
+    {
+        auto result = run(corner, step, count);
+        for (int z = 0; z < count.z; ++z) {
+            for (int y = 0; y < count.y; ++y) {
+                std::copy_n(result.begin() + (z * count.y + y) * count.x,
+                            count.x,
+                            output + y * row_pitch + z * slice_pitch);
+            }
+        }
+    }
+
+    /** Write the results and their gradients to output.  The default
+     *  runs the script in a generator_slowinterpreter, which is why it
+     *  is defined in generator_slowinterpreter.cpp. */
+    virtual void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                          const glm::ivec2& count, glm::dvec3* output,
+                          size_t row_pitch) const;
+
+    virtual void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                          const glm::ivec3& count, glm::dvec4* output,
+                          size_t row_pitch, size_t slice_pitch) const;
+
+    /** The launch policy of the default generate_async().  With a
+     *  single hardware thread, nothing can overlap with the task, so it
+     *  is deferred until get() instead of paying for a thread. */
+    static std::launch async_policy()
+    {
+        return std::thread::hardware_concurrency() > 1
+                   ? std::launch::async
+                   : std::launch::deferred;
+    }
+
+    /** Start a run on another thread.  Generators that can queue the
+     *  work without a thread, or that pass it on, override these. */
+    virtual std::future<std::vector<double>>
+    generate_async(const glm::dvec2& corner, const glm::dvec2& step,
+                   const glm::ivec2& count) const
+    {
+        return std::async(async_policy(),
+                          [=] { return run(corner, step, count); });
+    }
+
+    virtual std::future<std::vector<double>>
+    generate_async(const glm::dvec3& corner, const glm::dvec3& step,
+                   const glm::ivec3& count) const
+    {
+        return std::async(async_policy(),
+                          [=] { return run(corner, step, count); });
+    }
+
+    virtual std::future<std::vector<float>>
+    generate_float_async(const glm::dvec2& corner, const glm::dvec2& step,
+                         const glm::ivec2& count) const
+    {
+        return std::async(async_policy(),
+                          [=] { return run_float(corner, step, count); });
+    }
+
+    virtual std::future<std::vector<float>>
+    generate_float_async(const glm::dvec3& corner, const glm::dvec3& step,
+                         const glm::ivec3& count) const
+    {
+        return std::async(async_policy(),
+                          [=] { return run_float(corner, step, count); });
+    }
+
+    /** A name for the type of generator, that is the same in every
+     *  build of the library.  Tiles in the tile cache and store are only
+     *  shared by generators with the same name.  The default is the
+     *  name of the C++ type, which depends on the compiler; derived
+     *  classes should override it if their tiles are kept in a store. */
+    virtual const char* tile_tag() const { return typeid(*this).name(); }
+
+    /** Returns false if the results should not go through the tile
+     *  cache of the context, for example because the generator only
+     *  passes the work on to other generators. */
+    virtual bool use_tile_cache() const { return true; }
+
+    /** Returns true if runs go through the tile cache or the tile store
+     *  of the context. */
+    bool caching() const
+    {
+        return (cntx_.tiles() != nullptr || cntx_.store() != nullptr)
+               && cacheable_ && use_tile_cache()
+               && image_generation_ == cntx_.image_generation();
+    }
+
+    /** The number of elements of an output buffer that a run writes to,
+     *  for generators that pass a run on to another generator. */
+    static size_t extent(const glm::ivec2& count, size_t row_pitch)
+    {
+        return (count.y - 1) * row_pitch + count.x;
+    }
+
+    static size_t extent(const glm::ivec3& count, size_t row_pitch,
+                         size_t slice_pitch)
+    {
+        return (count.z - 1) * slice_pitch
+               + extent(glm::ivec2{count.x, count.y}, row_pitch);
+    }
+
+private:
+    // Look the tile up in the tile cache of the context, and then in the
+    // tile store.  If it is not there, gen() writes it to the output, and
+    // a copy is stored in both.
+    template <typename Generate>
+    void cached(char sample, const quantizer* q,
+                const glm::dvec3& corner, const glm::dvec3& step,
+                const glm::ivec3& count, int dims, size_t sample_size,
+                void* output, size_t row_pitch, size_t slice_pitch,
+                Generate gen) const
+    {
+        if (!caching()) {
+            gen();
+            return;
+        }
+
+        auto tiles = cntx_.tiles();
+        auto store = cntx_.store();
+
+        // The script is only included as a digest, so the keys stay short
+        // no matter how large the script is.
+        std::string key;
+        auto put = [&](const void* p, size_t n) {
+            key.append(static_cast<const char*>(p), n);
+        };
+        put(&script_digest_.hi, sizeof(uint64_t));
+        put(&script_digest_.lo, sizeof(uint64_t));
+        key += tile_tag();
+        key.push_back('\0');
+        key.push_back(sample);
+        if (q != nullptr) {
+            put(&q->format, sizeof(q->format));
+            put(&q->scale, sizeof(double));
+            put(&q->offset, sizeof(double));
+            put(&q->low, sizeof(double));
+            put(&q->high, sizeof(double));
+        }
+        for (int i = 0; i < 3; ++i) {
+            put(&corner[i], sizeof(double));
+            put(&step[i], sizeof(double));
+            put(&count[i], sizeof(int));
+        }
+        put(&dims, sizeof(dims));
+
+        if (tiles != nullptr && tiles->find(key, count, sample_size, output,
+                                            row_pitch, slice_pitch)) {
+            return;
+        }
+
+        size_t bytes = size_t(count.x) * count.y * count.z * sample_size;
+        if (store != nullptr) {
+            auto found = store->find(key);
+            if (found && found.size() == bytes) {
+                unpack_tile(count, sample_size, found.data(), output,
+                            row_pitch, slice_pitch);
+                if (tiles != nullptr)
+                    tiles->insert(key, count, sample_size, output, row_pitch,
+                                  slice_pitch);
+                return;
+            }
+        }
+
+        gen();
+        if (tiles != nullptr)
+            tiles->insert(key, count, sample_size, output, row_pitch,
+                          slice_pitch);
+
+        if (store != nullptr) {
+            std::vector<uint8_t> packed(bytes);
+            pack_tile(count, sample_size, output, row_pitch, slice_pitch,
+                      packed.data());
+            store->insert(key, packed.data(), bytes);
+        }
+    }
+
+    // Names for the types of samples in the keys of tiles.
+    static char sample_tag(const double*) { return 'd'; }
+    static char sample_tag(const float*) { return 'f'; }
+    static char sample_tag(const glm::dvec3*) { return '3'; }
+    static char sample_tag(const glm::dvec4*) { return '4'; }
+
+    template <typename T>
+    void generate_cached(const glm::dvec2& corner, const glm::dvec2& step,
+                         const glm::ivec2& count, T* output,
+                         size_t row_pitch) const
+    {
+        cached(sample_tag(output), nullptr, glm::dvec3{corner, 0.0},
+               glm::dvec3{step, 0.0}, glm::ivec3{count, 1}, 2, sizeof(T),
+               output, row_pitch, 0,
+               [&] { generate(corner, step, count, output, row_pitch); });
+    }
+
+    template <typename T>
+    void generate_cached(const glm::dvec3& corner, const glm::dvec3& step,
+                         const glm::ivec3& count, T* output, size_t row_pitch,
+                         size_t slice_pitch) const
+    {
+        cached(sample_tag(output), nullptr, corner, step, count, 3,
+               sizeof(T), output, row_pitch, slice_pitch, [&] {
+            generate(corner, step, count, output, row_pitch, slice_pitch);
+        });
+    }
+
+    void generate_cached(const glm::dvec2& corner, const glm::dvec2& step,
+                         const glm::ivec2& count, const quantizer& q,
+                         void* output, size_t row_pitch) const
+    {
+        cached('q', &q, glm::dvec3{corner, 0.0},
+               glm::dvec3{step, 0.0}, glm::ivec3{count, 1}, 2,
+               sample_size(q.format), output, row_pitch, 0,
+               [&] { generate(corner, step, count, q, output, row_pitch); });
+    }
+
+    void generate_cached(const glm::dvec3& corner, const glm::dvec3& step,
+                         const glm::ivec3& count, const quantizer& q,
+                         void* output, size_t row_pitch,
+                         size_t slice_pitch) const
+    {
+        cached('q', &q, corner, step, count, 3,
+               sample_size(q.format), output, row_pitch, slice_pitch, [&] {
+            generate(corner, step, count, q, output, row_pitch, slice_pitch);
+        });
+    }
+
+    // Quantizes the results if a format is given.
+    template <typename T, typename... Format>
+    std::vector<T> make(const glm::dvec2& corner, const glm::dvec2& step,
+                        const glm::ivec2& count, Format... q) const
+    {
+        std::vector<T> result;
+        if (count.x > 0 && count.y > 0) {
+            result.resize(size_t(count.x) * count.y);
+            generate_cached(corner, step, count, quantizer(q)...,
+                            result.data(), count.x);
+        }
+        return result;
+    }
+
+    template <typename T, typename... Format>
+    std::vector<T> make(const glm::dvec3& corner, const glm::dvec3& step,
+                        const glm::ivec3& count, Format... q) const
+    {
+        std::vector<T> result;
+        if (count.x > 0 && count.y > 0 && count.z > 0) {
+            result.resize(size_t(count.x) * count.y * count.z);
+            generate_cached(corner, step, count, quantizer(q)...,
+                            result.data(), count.x,
+                            size_t(count.x) * count.y);
+        }
+        return result;
+    }
+
+    // Rounding and clamping are monotonic, so if both ends of the range
+    // are stored as the same bits, so is everything in between.
+    bool fill_uniform(const interval& range, const glm::ivec3& count,
+                      const quantizer& q, void* output, size_t row_pitch,
+                      size_t slice_pitch) const
+    {
+        uint16_t lo = 0, hi = 0;
+        q.store(&lo, 0, range.lo);
+        q.store(&hi, 0, range.hi);
+        if (lo != hi)
+            return false;
+
+        for (int z = 0; z < count.z; ++z) {
+            for (int y = 0; y < count.y; ++y) {
+                size_t row = y * row_pitch + z * slice_pitch;
+                for (int x = 0; x < count.x; ++x)
+                    q.store(output, row + x, range.lo);
+            }
+        }
+        return true;
+    }
+
+    // Returns false if there is nothing to do.
+    static bool check(const glm::ivec2& count, size_t size, size_t row_pitch)
+    {
+        if (count.x <= 0 || count.y <= 0)
+            return false;
+        if (row_pitch < size_t(count.x))
+            throw std::runtime_error("row pitch is smaller than a row");
+        if (size < (count.y - 1) * row_pitch + count.x)
+            throw std::runtime_error("output buffer is too small");
+
+        return true;
+    }
+
+    static bool check(const glm::ivec3& count, size_t size, size_t row_pitch,
+                      size_t slice_pitch)
+    {
+        if (count.z <= 0 || !check(glm::ivec2{count}, size, row_pitch))
+            return false;
+
+        size_t slice = (count.y - 1) * row_pitch + count.x;
+        if (count.z > 1 && slice_pitch < slice)
+            throw std::runtime_error("slice pitch is smaller than a slice");
+        if (size < (count.z - 1) * slice_pitch + slice)
+            throw std::runtime_error("output buffer is too small");
+
+        return true;
+    }
 
 protected:
     const generator_context& cntx_;
+
+private:
+    std::shared_ptr<const node> script_;
+    /** False if the context had no tile cache or store when the
+     *  generator was made, or if it was told not to use them. */
+    bool cacheable_;
+    /** Identifies the script in the tile cache and store: the 128-bit
+     *  hash of its fingerprint(). */
+    digest128 script_digest_;
+    /** The image generation of the context when the digest was made;
+     *  see generator_context::set_image(). */
+    unsigned int image_generation_;
 };
 }
 } // namespace hexa::noise
@@ -0,0 +1,215 @@
+//---------------------------------------------------------------------------
+// hexanoise/generator_lod.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "generator_lod.hpp"
+
+#include <cmath>
+#include "optimize.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+namespace
+{
+
+// The number of generators that are kept around.  A terrain engine only
+// uses a few step sizes, so this is only reached if the step size
+// changes continuously.
+const size_t cache_size = 64;
+
+glm::dvec3 spacing(const glm::dvec3& step, const glm::ivec3& count)
+{
+    return glm::dvec3{count.x > 1 ? std::abs(step.x) : 0.0,
+                      count.y > 1 ? std::abs(step.y) : 0.0,
+                      count.z > 1 ? std::abs(step.z) : 0.0};
+}
+
+glm::dvec3 spacing(const glm::dvec2& step, const glm::ivec2& count)
+{
+    return spacing(glm::dvec3{step, 0.0}, glm::ivec3{count, 1});
+}
+
+// Rounding to an integer adds an error of up to half a unit anyway.
+// Half precision floats have a relative error, so nothing can be left
+// out for them.
+double tolerance(const quantizer& q)
+{
+    if (q.format == quantized::half)
+        return 0.0;
+
+    return 0.5 / std::abs(q.scale);
+}
+
+// A generator, and the rewritten script it runs.
+struct rewritten
+{
+    explicit rewritten(const node& n)
+        : script(n)
+    {
+    }
+
+    node script;
+    std::unique_ptr<generator_i> gen;
+};
+
+} // anonymous namespace
+
+generator_lod::generator_lod(const generator_context& context, const node& n,
+                             factory make, bool fade)
+    : generator_i(context, n)
+    , original_(n)
+    , make_(std::move(make))
+    , fade_(fade)
+{
+}
+
+std::vector<double> generator_lod::limits(const glm::dvec3& spacing,
+                                          double tolerance) const
+{
+    return octave_limits(original_, cntx_, spacing, tolerance, fade_);
+}
+
+std::shared_ptr<const generator_i>
+generator_lod::get(const glm::dvec3& spacing, double tolerance) const
+{
+    auto key = limits(spacing, tolerance);
+
+    std::shared_future<std::shared_ptr<const generator_i>> pending;
+    std::promise<std::shared_ptr<const generator_i>> promise;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = cache_.find(key);
+        if (found != cache_.end()) {
+            pending = found->second.gen;
+        } else {
+            // Runs that are still going hold on to their own copy.
+            if (cache_.size() >= cache_size)
+                cache_.clear();
+
+            cache_[key] = entry{promise.get_future().share(), &promise};
+        }
+    }
+    if (pending.valid())
+        return pending.get();
+
+    // Building an OpenCL or native generator can take a while, so it is
+    // done without holding the lock.
+    try {
+        auto built = std::make_shared<rewritten>(original_);
+        limit_octaves(built->script, cntx_, key);
+        built->gen = make_(built->script);
+
+        // The generator keeps the script alive.
+        std::shared_ptr<const generator_i> result{built, built->gen.get()};
+        promise.set_value(result);
+        return result;
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+
+        // The cache may have been cleared in the meantime, and another
+        // run may be building the same generator again.
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = cache_.find(key);
+        if (found != cache_.end() && found->second.builder == &promise)
+            cache_.erase(found);
+
+        throw;
+    }
+}
+
+void generator_lod::generate(const glm::dvec2& corner, const glm::dvec2& step,
+                             const glm::ivec2& count, double* output,
+                             size_t row_pitch) const
+{
+    get(spacing(step, count), 0.0)
+        ->run(corner, step, count, output, extent(count, row_pitch),
+              row_pitch);
+}
+
+void generator_lod::generate(const glm::dvec2& corner, const glm::dvec2& step,
+                             const glm::ivec2& count, const quantizer& q,
+                             void* output, size_t row_pitch) const
+{
+    get(spacing(step, count), tolerance(q))
+        ->run_quantized(corner, step, count, q, output,
+                        extent(count, row_pitch), row_pitch);
+}
+
+void generator_lod::generate(const glm::dvec2& corner, const glm::dvec2& step,
+                             const glm::ivec2& count, float* output,
+                             size_t row_pitch) const
+{
+    get(spacing(step, count), 0.0)
+        ->run_float(corner, step, count, output, extent(count, row_pitch),
+                    row_pitch);
+}
+
+void generator_lod::generate(const glm::dvec3& corner, const glm::dvec3& step,
+                             const glm::ivec3& count, double* output,
+                             size_t row_pitch, size_t slice_pitch) const
+{
+    get(spacing(step, count), 0.0)
+        ->run(corner, step, count, output,
+              extent(count, row_pitch, slice_pitch), row_pitch, slice_pitch);
+}
+
+void generator_lod::generate(const glm::dvec3& corner, const glm::dvec3& step,
+                             const glm::ivec3& count, const quantizer& q,
+                             void* output, size_t row_pitch,
+                             size_t slice_pitch) const
+{
+    get(spacing(step, count), tolerance(q))
+        ->run_quantized(corner, step, count, q, output,
+                        extent(count, row_pitch, slice_pitch), row_pitch,
+                        slice_pitch);
+}
+
+void generator_lod::generate(const glm::dvec3& corner, const glm::dvec3& step,
+                             const glm::ivec3& count, float* output,
+                             size_t row_pitch, size_t slice_pitch) const
+{
+    get(spacing(step, count), 0.0)
+        ->run_float(corner, step, count, output,
+                    extent(count, row_pitch, slice_pitch), row_pitch,
+                    slice_pitch);
+}
+
+// There is no step size, so nothing can be left out.
+void generator_lod::generate(const glm::dvec2* points, size_t n,
+                             double* output) const
+{
+    get(glm::dvec3{0.0}, 0.0)->run(points, n, output);
+}
+
+void generator_lod::generate(const glm::dvec3* points, size_t n,
+                             double* output) const
+{
+    get(glm::dvec3{0.0}, 0.0)->run(points, n, output);
+}
+
+void generator_lod::generate(const glm::dvec2& corner, const glm::dvec2& step,
+                             const glm::ivec2& count, glm::dvec3* output,
+                             size_t row_pitch) const
+{
+    get(spacing(step, count), 0.0)
+        ->run_with_gradient(corner, step, count, output,
+                            extent(count, row_pitch), row_pitch);
+}
+
+void generator_lod::generate(const glm::dvec3& corner, const glm::dvec3& step,
+                             const glm::ivec3& count, glm::dvec4* output,
+                             size_t row_pitch, size_t slice_pitch) const
+{
+    get(spacing(step, count), 0.0)
+        ->run_with_gradient(corner, step, count, output,
+                            extent(count, row_pitch, slice_pitch), row_pitch,
+                            slice_pitch);
+}
+
+} // namespace noise
+} // namespace hexa
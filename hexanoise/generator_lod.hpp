@@ -0,0 +1,138 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/generator_lod.hpp
+/// \brief  Drops fractal octaves that cannot be seen at the sample spacing
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "generator_i.hpp"
+#include "node.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+/** Runs a script with fewer octaves in fractal() and fractal3() when
+ *  they cannot make a difference.  For every run, octave_limits() (see
+ *  optimize.hpp) decides what to keep, based on the step size and the
+ *  output format:
+ *   - octaves that are smaller than the distance between the samples
+ *     would only add aliasing, so they are dropped (or faded out);
+ *   - run_quantized() and run_int16() also drop the octaves that can
+ *     change the result by less than half a unit of the format.
+ *
+ *  The script is rewritten with limit_octaves(), and run by another
+ *  generator, made by a factory function.  These generators are cached
+ *  per set of limits, so a terrain engine that uses a handful of levels
+ *  of detail only builds a handful of them.  run() with a list of
+ *  points always runs the whole script.
+ *
+ *  The results are not the same as those of the original script, but
+ *  the difference is either below the output precision, or it is
+ *  detail that could not be represented at this spacing anyway. */
+class generator_lod : public generator_i
+{
+public:
+    /** Makes a generator that runs a rewritten script.  The script is
+     *  kept alive for as long as the generator, so the generator may
+     *  hold on to a reference to it. */
+    typedef std::function<std::unique_ptr<generator_i>(const node&)>
+        factory;
+
+public:
+    /** Set up a generator
+     * @param context  Shared data
+     * @param n        The compiled noise script to execute
+     * @param make     Makes the generator that runs a rewritten script,
+     *                 for example a generator_vm
+     * @param fade     Fade octaves out as the step size grows, instead
+     *                 of dropping them at once */
+    generator_lod(const generator_context& context, const node& n,
+                  factory make, bool fade = true);
+
+    /** Get the number of octaves every fractal would get in a run.
+     *  See octave_limits() for the meaning of the numbers.
+     * @param spacing    The step size, or 0 for the directions in which
+     *                   only one sample is taken
+     * @param tolerance  The error that is allowed in the results */
+    std::vector<double> limits(const glm::dvec3& spacing,
+                               double tolerance) const;
+
+protected:
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, double* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, const quantizer& q, void* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, float* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, double* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, const quantizer& q, void* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, float* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec2* points, size_t n,
+                  double* output) const override;
+
+    void generate(const glm::dvec3* points, size_t n,
+                  double* output) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, glm::dvec3* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, glm::dvec4* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
+
+    /** The generators for the rewritten scripts use the cache. */
+    bool use_tile_cache() const override { return false; }
+
+private:
+    /** Get the generator for a run, and build it if needed.  Runs that
+     *  need a generator that is being built wait for it; other runs go
+     *  on. */
+    std::shared_ptr<const generator_i> get(const glm::dvec3& spacing,
+                                           double tolerance) const;
+
+    /** A generator that is built, or still being built. */
+    struct entry
+    {
+        std::shared_future<std::shared_ptr<const generator_i>> gen;
+        /** Tells which call to get() builds it */
+        const void* builder;
+    };
+
+private:
+    node original_;
+    factory make_;
+    bool fade_;
+
+    mutable std::mutex mutex_;
+    mutable std::map<std::vector<double>, entry> cache_;
+};
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,988 @@
+//---------------------------------------------------------------------------
+// hexanoise/generator_native.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "generator_native.hpp"
+
+#define GLM_FORCE_RADIANS
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <locale>
+#include <sstream>
+#include <stdexcept>
+#include <glm/gtx/rotate_vector.hpp>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "fnv1a.hpp"
+#include "native_prelude.hpp"
+#include "node.hpp"
+#include "primitives.hpp"
+
+#ifndef NATIVE_OCTAVES_LIMIT
+#define NATIVE_OCTAVES_LIMIT 16
+#endif
+
+namespace hexa
+{
+namespace noise
+{
+
+namespace
+{
+
+// Must have the same layout as native_api in native_prelude.hpp.
+struct native_api
+{
+    double (*perlin)(double, double, uint32_t);
+    double (*perlin3)(double, double, double, uint32_t);
+    double (*simplex)(double, double, uint32_t);
+    double (*simplex3)(double, double, double, uint32_t);
+    double (*opensimplex)(double, double, uint32_t);
+    double (*opensimplex3)(double, double, double, uint32_t);
+    void (*worley)(double, double, uint32_t, void*, double*);
+    void (*worley3)(double, double, double, uint32_t, void*, double*);
+    void (*voronoi)(double, double, uint32_t, void*, double*);
+    void (*rotate3)(double, double, double, double, double, double, double,
+                    double*);
+    double (*curve_linear)(double, const void*);
+    double (*curve_spline)(double, const void*);
+    double (*png)(double, double, const void*);
+    double (*perlin_table)(double, double, const void*);
+    double (*perlin3_table)(double, double, double, const void*);
+    double (*simplex_table)(double, double, const void*);
+    double (*simplex3_table)(double, double, double, const void*);
+    double (*opensimplex_table)(double, double, const void*);
+    double (*opensimplex3_table)(double, double, double, const void*);
+    void* (*new_cells)();
+    void (*delete_cells)(void*);
+};
+
+double api_perlin(double x, double y, uint32_t seed)
+{
+    return p_perlin(glm::dvec2{x, y}, seed);
+}
+
+double api_perlin3(double x, double y, double z, uint32_t seed)
+{
+    return p_perlin3(glm::dvec3{x, y, z}, seed);
+}
+
+double api_simplex(double x, double y, uint32_t seed)
+{
+    return p_simplex(glm::dvec2{x, y}, seed);
+}
+
+double api_simplex3(double x, double y, double z, uint32_t seed)
+{
+    return p_simplex3(glm::dvec3{x, y, z}, seed);
+}
+
+double api_opensimplex(double x, double y, uint32_t seed)
+{
+    return p_opensimplex(glm::dvec2{x, y}, seed);
+}
+
+double api_opensimplex3(double x, double y, double z, uint32_t seed)
+{
+    return p_opensimplex3(glm::dvec3{x, y, z}, seed);
+}
+
+void api_worley(double x, double y, uint32_t seed, void* cells, double* out)
+{
+    auto r = p_worley(glm::dvec2{x, y}, seed,
+                      *static_cast<cell_cache*>(cells));
+    out[0] = r.x;
+    out[1] = r.y;
+}
+
+void api_worley3(double x, double y, double z, uint32_t seed, void* cells,
+                 double* out)
+{
+    auto r = p_worley3(glm::dvec3{x, y, z}, seed,
+                       *static_cast<cell_cache*>(cells));
+    out[0] = r.x;
+    out[1] = r.y;
+}
+
+void api_voronoi(double x, double y, uint32_t seed, void* cells,
+                 double* out)
+{
+    auto r = p_voronoi(glm::dvec2{x, y}, seed,
+                       *static_cast<cell_cache*>(cells));
+    out[0] = r.x;
+    out[1] = r.y;
+    out[2] = r.z;
+}
+
+void api_rotate3(double x, double y, double z, double ax, double ay,
+                 double az, double angle, double* out)
+{
+    auto r = glm::rotate(glm::dvec3{x, y, z}, angle, glm::dvec3{ax, ay, az});
+    out[0] = r.x;
+    out[1] = r.y;
+    out[2] = r.z;
+}
+
+typedef std::vector<node::control_point> curve_t;
+
+double api_curve_linear(double x, const void* curve)
+{
+    return curve_linear(x, *static_cast<const curve_t*>(curve));
+}
+
+double api_curve_spline(double x, const void* curve)
+{
+    return curve_spline(x, *static_cast<const curve_t*>(curve));
+}
+
+double api_png(double x, double y, const void* img)
+{
+    return png(glm::dvec2{x, y},
+               *static_cast<const generator_context::image*>(img));
+}
+
+typedef generator_context::permutation perm_t;
+
+double api_perlin_table(double x, double y, const void* perm)
+{
+    return p_perlin(glm::dvec2{x, y}, *static_cast<const perm_t*>(perm));
+}
+
+double api_perlin3_table(double x, double y, double z, const void* perm)
+{
+    return p_perlin3(glm::dvec3{x, y, z}, *static_cast<const perm_t*>(perm));
+}
+
+double api_simplex_table(double x, double y, const void* perm)
+{
+    return p_simplex(glm::dvec2{x, y}, *static_cast<const perm_t*>(perm));
+}
+
+double api_simplex3_table(double x, double y, double z, const void* perm)
+{
+    return p_simplex3(glm::dvec3{x, y, z},
+                      *static_cast<const perm_t*>(perm));
+}
+
+double api_opensimplex_table(double x, double y, const void* perm)
+{
+    return p_opensimplex(glm::dvec2{x, y},
+                         *static_cast<const perm_t*>(perm));
+}
+
+double api_opensimplex3_table(double x, double y, double z,
+                              const void* perm)
+{
+    return p_opensimplex3(glm::dvec3{x, y, z},
+                          *static_cast<const perm_t*>(perm));
+}
+
+void* api_new_cells()
+{
+    return new cell_cache;
+}
+
+void api_delete_cells(void* cells)
+{
+    delete static_cast<cell_cache*>(cells);
+}
+
+const native_api api = {
+    api_perlin,           api_perlin3,           api_simplex,
+    api_simplex3,         api_opensimplex,       api_opensimplex3,
+    api_worley,           api_worley3,           api_voronoi,
+    api_rotate3,          api_curve_linear,      api_curve_spline,
+    api_png,              api_perlin_table,      api_perlin3_table,
+    api_simplex_table,    api_simplex3_table,    api_opensimplex_table,
+    api_opensimplex3_table,
+    api_new_cells,        api_delete_cells};
+
+const char* compiler_flags
+    = "-std=c++11 -O3 -march=native -ffp-contract=off -fPIC -shared";
+
+// A double constant that the C++ compiler reads back as the exact same
+// value.
+std::string literal(double v)
+{
+    if (std::isnan(v))
+        return "NAN";
+    if (std::isinf(v))
+        return v > 0 ? "HUGE_VAL" : "(-HUGE_VAL)";
+
+    std::ostringstream str;
+    str.imbue(std::locale::classic());
+    str << std::setprecision(17) << v;
+    auto result = str.str();
+    if (result.find_first_of(".e") == std::string::npos)
+        result += ".0";
+
+    return "(" + result + ")";
+}
+
+std::string read_file(const std::string& name)
+{
+    std::ifstream file(name);
+    std::stringstream str;
+    str << file.rdbuf();
+    return str.str();
+}
+
+#ifndef _WIN32
+void make_directories(const std::string& path)
+{
+    for (size_t i = 1; i <= path.size(); ++i) {
+        if (i < path.size() && path[i] != '/')
+            continue;
+
+        auto dir = path.substr(0, i);
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+            throw std::runtime_error("cannot create directory " + dir);
+    }
+}
+#endif
+
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+
+generator_native::generator_native(const generator_context& context,
+                                   const node& n,
+                                   const std::string& cache_dir)
+    : generator_i(context, n)
+    , shared_(n)
+    , seed_(static_cast<uint32_t>(
+          boost::get<double>(context.get_global("seed"))))
+    , count_(1)
+    , handle_(nullptr)
+    , run2_(nullptr)
+    , run3_(nullptr)
+    , points_(nullptr)
+{
+#ifdef _WIN32
+    throw std::runtime_error("generator_native requires dlopen()");
+#else
+    // The position is always kept as a 3-D vector, just like in the
+    // interpreter, so every script gets a 2-D and a 3-D entry point.
+    begin_frame();
+    std::string body{co_v(n)};
+    std::string locals{end_frame()};
+
+    main_ = native_prelude;
+    main_ += "namespace {\n\n";
+    for (auto& f : functions_) {
+        main_ += f;
+        main_ += "\n";
+    }
+    main_ += "} // anonymous namespace\n\n";
+
+    main_ += R"xxxxx(
+extern "C" const size_t hexanoise_api_size = sizeof(native_api);
+
+extern "C" void hexanoise_run2(
+    const native_api* api, const void* const* data, uint32_t seed,
+    const double* corner, const double* step, const int* count,
+    size_t begin, size_t end, double* out)
+{
+    const cells c{api};
+    const env e{api, data, seed, c.ptr};
+    for (size_t i = begin; i < end; ++i) {
+        const v3 p{corner[0] + int(i % count[0]) * step[0],
+                   corner[1] + int(i / count[0]) * step[1], 0.0};
+)xxxxx";
+    main_ += locals;
+    main_ += "        out[i - begin] = ";
+    main_ += body;
+    main_ += R"xxxxx(;
+    }
+}
+
+extern "C" void hexanoise_run3(
+    const native_api* api, const void* const* data, uint32_t seed,
+    const double* corner, const double* step, const int* count,
+    size_t begin, size_t end, double* out)
+{
+    const cells c{api};
+    const env e{api, data, seed, c.ptr};
+    for (size_t i = begin; i < end; ++i) {
+        const v3 p{corner[0] + int(i % count[0]) * step[0],
+                   corner[1] + int((i / count[0]) % count[1]) * step[1],
+                   corner[2] + int(i / (count[0] * count[1])) * step[2]};
+)xxxxx";
+    main_ += locals;
+    main_ += "        out[i - begin] = ";
+    main_ += body;
+    main_ += R"xxxxx(;
+    }
+}
+
+extern "C" void hexanoise_points(
+    const native_api* api, const void* const* data, uint32_t seed,
+    const double* points, size_t dims, size_t begin, size_t end,
+    double* out)
+{
+    const cells c{api};
+    const env e{api, data, seed, c.ptr};
+    for (size_t i = begin; i < end; ++i) {
+        const double* q = points + i * dims;
+        const v3 p{q[0], q[1], dims == 3 ? q[2] : 0.0};
+)xxxxx";
+    main_ += locals;
+    main_ += "        out[i] = ";
+    main_ += body;
+    main_ += ";\n    }\n}\n";
+
+    build(cache_dir.empty() ? default_cache_dir() : cache_dir);
+#endif
+}
+
+generator_native::~generator_native()
+{
+#ifndef _WIN32
+    if (handle_)
+        dlclose(handle_);
+#endif
+}
+
+std::string generator_native::default_cache_dir()
+{
+    if (const char* dir = std::getenv("HEXANOISE_CACHE_DIR"))
+        return dir;
+
+    if (const char* dir = std::getenv("XDG_CACHE_HOME"))
+        return std::string(dir) + "/hexanoise";
+
+    if (const char* dir = std::getenv("HOME"))
+        return std::string(dir) + "/.cache/hexanoise";
+
+    return "/tmp/hexanoise";
+}
+
+void generator_native::build(const std::string& cache_dir)
+{
+#ifndef _WIN32
+    std::string compiler{"c++"};
+    if (const char* env = std::getenv("HEXANOISE_CXX"))
+        compiler = env;
+
+    // -march=native makes the library specific to this machine, so the
+    // host name is part of the hash as well.
+    char host[256] = {0};
+    gethostname(host, sizeof(host) - 1);
+
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0')
+         << fnv1a(main_ + compiler + compiler_flags + host);
+
+    make_directories(cache_dir);
+    auto base = cache_dir + "/" + name.str();
+    library_ = base + ".so";
+
+    if (access(library_.c_str(), R_OK) != 0) {
+        // Other threads or processes might be building the same script;
+        // every build uses its own temporary files, and the finished
+        // library is moved into place in one step.
+        static std::atomic<unsigned int> builds{0};
+        auto tmp = base + "-" + std::to_string(getpid()) + "-"
+                   + std::to_string(builds++);
+        {
+            std::ofstream src(tmp + ".cpp");
+            src << main_;
+            if (!src)
+                throw std::runtime_error("cannot write " + tmp + ".cpp");
+        }
+
+        auto cmd = compiler + " " + compiler_flags + " -o '" + tmp
+                   + ".so' '" + tmp + ".cpp' > '" + tmp + ".log' 2>&1";
+        int status = std::system(cmd.c_str());
+        auto log = read_file(tmp + ".log");
+        std::remove((tmp + ".log").c_str());
+
+        if (status != 0) {
+            std::remove((tmp + ".cpp").c_str());
+            std::remove((tmp + ".so").c_str());
+            throw std::runtime_error("cannot compile HNDL script with "
+                                     + compiler + ":\n" + log);
+        }
+        std::rename((tmp + ".cpp").c_str(), (base + ".cpp").c_str());
+        if (std::rename((tmp + ".so").c_str(), library_.c_str()) != 0) {
+            std::remove((tmp + ".so").c_str());
+            throw std::runtime_error("cannot write " + library_);
+        }
+    }
+
+    handle_ = dlopen(library_.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle_ == nullptr)
+        throw std::runtime_error(std::string("cannot load ") + library_
+                                 + ": " + dlerror());
+
+    auto size = static_cast<const size_t*>(
+        dlsym(handle_, "hexanoise_api_size"));
+    run2_ = reinterpret_cast<entry_t>(dlsym(handle_, "hexanoise_run2"));
+    run3_ = reinterpret_cast<entry_t>(dlsym(handle_, "hexanoise_run3"));
+    points_ = reinterpret_cast<points_t>(dlsym(handle_, "hexanoise_points"));
+    if (size == nullptr || *size != sizeof(native_api) || run2_ == nullptr
+        || run3_ == nullptr || points_ == nullptr) {
+        throw std::runtime_error(library_ + " is not a compiled HNDL script");
+    }
+#endif
+}
+
+template <typename Write>
+void generator_native::exec(entry_t entry, const double* corner,
+                            const double* step, const int* count,
+                            size_t rows, double* direct, size_t row_pitch,
+                            size_t slice_pitch, Write write) const
+{
+    // The entry points always write doubles.  If the output holds
+    // doubles, they write straight into it.  Otherwise every row goes
+    // through a temporary buffer.
+    size_t width = count[0];
+    auto chunk = [&](size_t begin, size_t end) {
+        std::vector<double> tmp(width);
+        for (size_t r = begin; r < end; ++r) {
+            size_t row = (r % count[1]) * row_pitch
+                         + (r / count[1]) * slice_pitch;
+            double* buf = direct ? direct + row : tmp.data();
+            entry(&api, data_.data(), seed_, corner, step, count, r * width,
+                  (r + 1) * width, buf);
+
+            if (!direct) {
+                for (size_t x = 0; x < width; ++x)
+                    write(row + x, buf[x]);
+            }
+        }
+    };
+
+    auto pool = cntx_.workers();
+    if (pool == nullptr || rows < 2)
+        chunk(0, rows);
+    else
+        pool->parallel_for(rows, pool->grain(rows * width, width) / width,
+                           chunk);
+}
+
+void generator_native::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, double* output,
+                                size_t row_pitch) const
+{
+    double c[] = {corner.x, corner.y}, s[] = {step.x, step.y};
+    int n[] = {count.x, count.y};
+    exec(run2_, c, s, n, count.y, output, row_pitch, 0,
+         [](size_t, double) {});
+}
+
+void generator_native::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, const quantizer& q,
+                                void* output, size_t row_pitch) const
+{
+    double c[] = {corner.x, corner.y}, s[] = {step.x, step.y};
+    int n[] = {count.x, count.y};
+    exec(run2_, c, s, n, count.y, nullptr, row_pitch, 0,
+         [&](size_t i, double v) { q.store(output, i, v); });
+}
+
+void generator_native::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, float* output,
+                                size_t row_pitch) const
+{
+    double c[] = {corner.x, corner.y}, s[] = {step.x, step.y};
+    int n[] = {count.x, count.y};
+    exec(run2_, c, s, n, count.y, nullptr, row_pitch, 0,
+         [=](size_t i, double v) { output[i] = static_cast<float>(v); });
+}
+
+void generator_native::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, double* output,
+                                size_t row_pitch, size_t slice_pitch) const
+{
+    double c[] = {corner.x, corner.y, corner.z};
+    double s[] = {step.x, step.y, step.z};
+    int n[] = {count.x, count.y, count.z};
+    exec(run3_, c, s, n, count.y * count.z, output, row_pitch, slice_pitch,
+         [](size_t, double) {});
+}
+
+void generator_native::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, const quantizer& q,
+                                void* output, size_t row_pitch,
+                                size_t slice_pitch) const
+{
+    double c[] = {corner.x, corner.y, corner.z};
+    double s[] = {step.x, step.y, step.z};
+    int n[] = {count.x, count.y, count.z};
+    exec(run3_, c, s, n, count.y * count.z, nullptr, row_pitch, slice_pitch,
+         [&](size_t i, double v) { q.store(output, i, v); });
+}
+
+void generator_native::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, float* output,
+                                size_t row_pitch, size_t slice_pitch) const
+{
+    double c[] = {corner.x, corner.y, corner.z};
+    double s[] = {step.x, step.y, step.z};
+    int n[] = {count.x, count.y, count.z};
+    exec(run3_, c, s, n, count.y * count.z, nullptr, row_pitch, slice_pitch,
+         [=](size_t i, double v) { output[i] = static_cast<float>(v); });
+}
+
+void generator_native::gather(const double* points, size_t dims, size_t n,
+                              double* output) const
+{
+    auto chunk = [&](size_t begin, size_t end) {
+        points_(&api, data_.data(), seed_, points, dims, begin, end, output);
+    };
+
+    auto pool = cntx_.workers();
+    if (pool == nullptr || n <= 64)
+        chunk(0, n);
+    else
+        pool->parallel_for(n, pool->grain(n, 64), chunk);
+}
+
+void generator_native::generate(const glm::dvec2* points, size_t n,
+                                double* output) const
+{
+    gather(&points[0].x, 2, n, output);
+}
+
+void generator_native::generate(const glm::dvec3* points, size_t n,
+                                double* output) const
+{
+    gather(&points[0].x, 3, n, output);
+}
+
+//---------------------------------------------------------------------------
+
+std::string generator_native::data(const void* p)
+{
+    data_.push_back(p);
+    return "e.data[" + std::to_string(data_.size() - 1) + "]";
+}
+
+std::string generator_native::co_noise(const node& n, const std::string& func,
+                                       const std::string& p)
+{
+    if (auto table = seed_table(n, cntx_))
+        return func + "_table(e, " + p + ", " + data(table) + ")";
+
+    return func + "(e, " + p + ", " + co_v(n.input[1]) + ")";
+}
+
+std::string generator_native::co_lambda(const node& func, const node& in)
+{
+    std::string arg;
+    auto type = func.input_type();
+    if (type == var_t::xyz)
+        arg = co_xyz(in);
+    else if (type == var_t::xy)
+        arg = "to3(" + co_xy(in) + ")";
+    else
+        throw std::runtime_error("lambda must take a coordinate type");
+
+    std::string func_name{"ip_lambda" + std::to_string(count_++)};
+    begin_frame();
+    std::string body{co_v(func)};
+    functions_.emplace_back("double " + func_name + " (const env& e, v3 p) {"
+                            + end_frame() + " return " + body + "; }\n");
+
+    return func_name + "(e, " + arg + ")";
+}
+
+void generator_native::begin_frame()
+{
+    frames_.emplace_back();
+}
+
+std::string generator_native::end_frame()
+{
+    std::string result{frames_.back().locals};
+    frames_.pop_back();
+    return result;
+}
+
+// A value that occurs more than once is wrapped in a lambda that only
+// computes it the first time it is called.  This way the code does not
+// need to be reordered, and a value that is only needed in one branch
+// of a then_else is not computed if that branch isn't taken.
+std::string generator_native::co_shared(const node& n, const char* type,
+                                        lower_t lower)
+{
+    if (n.is_const || n.type == node::entry_point || shared_.count(n) < 2)
+        return (this->*lower)(n);
+
+    auto id = std::to_string(shared_.id(n));
+    auto name = "s" + id + "()";
+    if (frames_.back().shared.count(shared_.id(n)))
+        return name;
+
+    std::string code{(this->*lower)(n)};
+    frames_.back().shared.insert(shared_.id(n));
+    frames_.back().locals
+        += std::string("\n        ") + type + " v" + id + "; bool h" + id
+           + " = false;\n        auto s" + id + " = [&]() -> " + type
+           + " {\n            if (!h" + id + ") { h" + id + " = true; v" + id
+           + " = " + code + "; }\n            return v" + id
+           + ";\n        };\n";
+
+    return name;
+}
+
+std::string generator_native::co_v(const node& n)
+{
+    return co_shared(n, "double", &generator_native::lower_v);
+}
+
+std::string generator_native::co_xy(const node& n)
+{
+    return co_shared(n, "v2", &generator_native::lower_xy);
+}
+
+std::string generator_native::co_xyz(const node& n)
+{
+    return co_shared(n, "v3", &generator_native::lower_xyz);
+}
+
+std::string generator_native::co_bool(const node& n)
+{
+    return co_shared(n, "bool", &generator_native::lower_bool);
+}
+
+std::string generator_native::lower_v(const node& n)
+{
+    if (n.type == node::const_var)
+        return literal(n.aux_var);
+
+    auto& in = n.input[0];
+
+    switch (n.type) {
+    case node::angle:
+        return "p_angle(" + co_xy(in) + ")";
+    case node::chebyshev:
+        return "p_chebyshev(" + co_xy(in) + ")";
+    case node::chebyshev3:
+        return "p_chebyshev3(" + co_xyz(in) + ")";
+    case node::checkerboard:
+        return "p_checkerboard(" + co_xy(in) + ")";
+    case node::checkerboard3:
+        return "p_checkerboard3(" + co_xyz(in) + ")";
+    case node::distance:
+        return "p_distance(" + co_xy(in) + ")";
+    case node::distance3:
+        return "p_distance3(" + co_xyz(in) + ")";
+    case node::manhattan:
+        return "p_manhattan(" + co_xy(in) + ")";
+    case node::manhattan3:
+        return "p_manhattan3(" + co_xyz(in) + ")";
+
+    case node::perlin:
+        return co_noise(n, "p_perlin", co_xy(in));
+    case node::perlin3:
+        return co_noise(n, "p_perlin3", co_xyz(in));
+    case node::simplex:
+        return co_noise(n, "p_simplex", co_xy(in));
+    case node::simplex3:
+        return co_noise(n, "p_simplex3", co_xyz(in));
+    case node::opensimplex:
+        return co_noise(n, "p_opensimplex", co_xy(in));
+    case node::opensimplex3:
+        return co_noise(n, "p_opensimplex3", co_xyz(in));
+
+    case node::worley:
+    case node::worley3:
+    case node::voronoi: {
+        std::string func_name{"ip_cell" + std::to_string(count_++)};
+        begin_frame();
+        std::string body{co_v(n.input[1])};
+        functions_.emplace_back("double " + func_name
+                                + " (const env& e, v3 p) {" + end_frame()
+                                + " return " + body + "; }\n");
+
+        std::string cell;
+        if (n.type == node::worley)
+            cell = "p_worley(e, " + co_xy(in);
+        else if (n.type == node::worley3)
+            cell = "p_worley3(e, " + co_xyz(in);
+        else
+            cell = "p_voronoi(e, " + co_xy(in);
+
+        return func_name + "(e, " + cell + ", " + co_v(n.input[2]) + "))";
+    }
+
+    case node::external_:
+        return co_lambda(cntx_.get_script(n.aux_string), in);
+
+    case node::lambda_:
+        return co_lambda(n.input[1], in);
+
+    case node::x:
+        return co_xy(in) + ".x";
+    case node::y:
+        return co_xy(in) + ".y";
+    case node::z:
+        return co_xyz(in) + ".z";
+
+    case node::fractal:
+    case node::fractal3: {
+        std::string func_name{"ip_fractal" + std::to_string(count_++)};
+
+        // The position changes in every octave, so the octaves get a
+        // frame of their own.
+        begin_frame();
+        std::string octaves{co_v(n.input[2])};
+        std::string lac{co_v(n.input[3])};
+        std::string per{co_v(n.input[4])};
+        begin_frame();
+        std::string octave{co_v(n.input[1])};
+        std::string octave_locals{end_frame()};
+        std::string locals{end_frame()};
+
+        std::stringstream func_body;
+        func_body
+            << "double " << func_name << " (const env& e, v3 p) {" << locals
+            << "\n"
+            << "    int octaves = " << octaves << ";\n"
+            << "    octaves = std::min(octaves, " << NATIVE_OCTAVES_LIMIT
+            << ");\n"
+            << "    double lac = " << lac << ";\n"
+            << "    double per = " << per << ";\n"
+            << "    double div = 0.0, mul = 1.0, result = 0.0;\n"
+            << "    for (int i = 0; i < octaves; ++i) {" << octave_locals
+            << "\n"
+            << "        result += (" << octave << ") * mul;\n"
+            << "        div += mul;\n"
+            << "        mul *= per;\n"
+            << "        p.x *= lac; p.y *= lac; p.z *= lac;\n"
+            << "        p.x += 12345;\n"
+            << "    }\n"
+            << "    return result / div;\n"
+            << "}\n";
+
+        functions_.emplace_back(func_body.str());
+
+        if (n.type == node::fractal)
+            return func_name + "(e, to3(" + co_xy(in) + "))";
+
+        return func_name + "(e, " + co_xyz(in) + ")";
+    }
+
+    case node::abs:
+        return "std::abs(" + co_v(in) + ")";
+    case node::add:
+        return "(" + co_v(in) + " + " + co_v(n.input[1]) + ")";
+    case node::sub:
+        return "(" + co_v(in) + " - " + co_v(n.input[1]) + ")";
+    case node::mul:
+        return "(" + co_v(in) + " * " + co_v(n.input[1]) + ")";
+    case node::div:
+        return "(" + co_v(in) + " / " + co_v(n.input[1]) + ")";
+    case node::blend:
+        return "p_blend(" + co_v(in) + ", " + co_v(n.input[1]) + ", "
+               + co_v(n.input[2]) + ")";
+    case node::cos:
+        return "std::cos(" + co_v(in) + " * pi)";
+    case node::sin:
+        return "std::sin(" + co_v(in) + " * pi)";
+    case node::tan:
+        return "std::tan(" + co_v(in) + " * pi)";
+    case node::max:
+        return "std::max(" + co_v(in) + ", " + co_v(n.input[1]) + ")";
+    case node::min:
+        return "std::min(" + co_v(in) + ", " + co_v(n.input[1]) + ")";
+    case node::neg:
+        return "(-" + co_v(in) + ")";
+    case node::pow:
+        return "std::pow(" + co_v(in) + ", " + co_v(n.input[1]) + ")";
+    case node::round:
+        return "std::round(" + co_v(in) + ")";
+    case node::saw:
+        return "p_saw(" + co_v(in) + ")";
+    case node::sqrt:
+        return "std::sqrt(" + co_v(in) + ")";
+
+    case node::then_else:
+        return "(" + co_bool(in) + " ? " + co_v(n.input[1]) + " : "
+               + co_v(n.input[2]) + ")";
+
+    case node::curve_linear:
+        return "e.api->curve_linear(" + co_v(in) + ", " + data(&n.curve)
+               + ")";
+    case node::curve_spline:
+        return "e.api->curve_spline(" + co_v(in) + ", " + data(&n.curve)
+               + ")";
+
+    case node::png_lookup:
+        return "p_png(e, " + co_xy(in) + ", "
+               + data(&cntx_.get_image(n.input[1].aux_string)) + ")";
+
+    default:
+        throw std::runtime_error("type mismatch");
+    }
+}
+
+std::string generator_native::lower_xy(const node& n)
+{
+    switch (n.type) {
+    case node::entry_point:
+        return "to2(p)";
+
+    case node::rotate:
+        return "p_rotate(" + co_xy(n.input[0]) + ", " + co_v(n.input[1])
+               + ")";
+    case node::scale:
+        return "p_scale(" + co_xy(n.input[0]) + ", " + co_v(n.input[1])
+               + ")";
+    case node::shift:
+        return "p_shift(" + co_xy(n.input[0]) + ", " + co_v(n.input[1])
+               + ", " + co_v(n.input[2]) + ")";
+    case node::swap:
+        return "p_swap(" + co_xy(n.input[0]) + ")";
+    case node::xy:
+        return "to2(" + co_xyz(n.input[0]) + ")";
+
+    case node::map: {
+        std::string func_name{"ip_map" + std::to_string(count_++)};
+        begin_frame();
+        std::string x{co_v(n.input[1])}, y{co_v(n.input[2])};
+        functions_.emplace_back("v2 " + func_name + " (const env& e, v3 p) {"
+                                + end_frame() + " return v2{" + x + ", " + y
+                                + "}; }\n");
+
+        return func_name + "(e, to3(" + co_xy(n.input[0]) + "))";
+    }
+
+    // Turbulence displaces the current position, not its input.
+    case node::turbulence: {
+        std::string func_name{"ip_turb" + std::to_string(count_++)};
+        begin_frame();
+        std::string x{co_v(n.input[1])}, y{co_v(n.input[2])};
+        functions_.emplace_back(
+            "v2 " + func_name + " (const env& e, v3 outer, v3 p) {"
+            + end_frame() + " return v2{outer.x + " + x + ", outer.y + " + y
+            + "}; }\n");
+
+        return func_name + "(e, p, to3(" + co_xy(n.input[0]) + "))";
+    }
+
+    default:
+        throw std::runtime_error("type mismatch");
+    }
+}
+
+std::string generator_native::lower_xyz(const node& n)
+{
+    switch (n.type) {
+    case node::entry_point:
+        return "p";
+
+    case node::xplane:
+        return "p_xplane(" + co_xy(n.input[0]) + ", " + co_v(n.input[1])
+               + ")";
+    case node::yplane:
+        return "p_yplane(" + co_xy(n.input[0]) + ", " + co_v(n.input[1])
+               + ")";
+    case node::zplane:
+        return "p_zplane(" + co_xy(n.input[0]) + ", " + co_v(n.input[1])
+               + ")";
+
+    case node::rotate3:
+        return "p_rotate3(e, " + co_xyz(n.input[0]) + ", " + co_v(n.input[1])
+               + ", " + co_v(n.input[2]) + ", " + co_v(n.input[3]) + ", "
+               + co_v(n.input[4]) + ")";
+    case node::scale3:
+        return "p_scale3(" + co_xyz(n.input[0]) + ", " + co_v(n.input[1])
+               + ")";
+    case node::shift3:
+        return "p_shift3(" + co_xyz(n.input[0]) + ", " + co_v(n.input[1])
+               + ", " + co_v(n.input[2]) + ", " + co_v(n.input[3]) + ")";
+
+    case node::map3: {
+        std::string func_name{"ip_map3_" + std::to_string(count_++)};
+        begin_frame();
+        std::string x{co_v(n.input[1])}, y{co_v(n.input[2])},
+            z{co_v(n.input[3])};
+        functions_.emplace_back("v3 " + func_name + " (const env& e, v3 p) {"
+                                + end_frame() + " return v3{" + x + ", " + y
+                                + ", " + z + "}; }\n");
+
+        return func_name + "(e, " + co_xyz(n.input[0]) + ")";
+    }
+
+    case node::turbulence3: {
+        std::string func_name{"ip_turb3_" + std::to_string(count_++)};
+        begin_frame();
+        std::string x{co_v(n.input[1])}, y{co_v(n.input[2])},
+            z{co_v(n.input[3])};
+        functions_.emplace_back(
+            "v3 " + func_name + " (const env& e, v3 outer, v3 p) {"
+            + end_frame() + " return v3{outer.x + " + x + ", outer.y + " + y
+            + ", outer.z + " + z + "}; }\n");
+
+        return func_name + "(e, p, " + co_xyz(n.input[0]) + ")";
+    }
+
+    default:
+        throw std::runtime_error("type mismatch");
+    }
+}
+
+std::string generator_native::lower_bool(const node& n)
+{
+    switch (n.type) {
+    case node::const_bool:
+        return n.aux_bool ? "true" : "false";
+
+    case node::is_equal:
+        return "(" + co_v(n.input[0]) + " == " + co_v(n.input[1]) + ")";
+    case node::is_greaterthan:
+        return "(" + co_v(n.input[0]) + " > " + co_v(n.input[1]) + ")";
+    case node::is_gte:
+        return "(" + co_v(n.input[0]) + " >= " + co_v(n.input[1]) + ")";
+    case node::is_lessthan:
+        return "(" + co_v(n.input[0]) + " < " + co_v(n.input[1]) + ")";
+    case node::is_lte:
+        return "(" + co_v(n.input[0]) + " <= " + co_v(n.input[1]) + ")";
+
+    case node::bnot:
+        return "(!" + co_bool(n.input[0]) + ")";
+    case node::band:
+        return "(" + co_bool(n.input[0]) + " && " + co_bool(n.input[1]) + ")";
+    case node::bor:
+        return "(" + co_bool(n.input[0]) + " || " + co_bool(n.input[1]) + ")";
+    case node::bxor:
+        return "(" + co_bool(n.input[0]) + " != " + co_bool(n.input[1]) + ")";
+
+    case node::is_in_circle:
+        return "p_is_in_circle(" + co_xy(n.input[0]) + ", "
+               + co_v(n.input[1]) + ")";
+    case node::is_in_rectangle:
+        return "p_is_in_rectangle(" + co_xy(n.input[0]) + ", "
+               + co_v(n.input[1]) + ", " + co_v(n.input[2]) + ", "
+               + co_v(n.input[3]) + ", " + co_v(n.input[4]) + ")";
+
+    default:
+        throw std::runtime_error("type mismatch");
+    }
+}
+
+} // namespace noise
+} // namespace hexa
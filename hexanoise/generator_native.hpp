@@ -0,0 +1,163 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/generator_native.hpp
+/// \brief  Compiles a HNDL script to native code with the system compiler
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "analysis.hpp"
+#include "generator_i.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+class node;
+
+/** Runs noise scripts as native code.
+ *  The script is translated to C++, which is built into a shared library
+ *  by the C++ compiler installed on the system, and then loaded with
+ *  dlopen().  This takes a while the first time, so the libraries are
+ *  kept in a cache directory, where they are found by a hash of their
+ *  source code.
+ *
+ *  The compiler is "c++", unless the environment variable HEXANOISE_CXX
+ *  says otherwise.  The code is built with -O3 -march=native, but
+ *  without any fast-math options, so the results match those of
+ *  generator_slowinterpreter.
+ *
+ *  Only available on POSIX systems. */
+class generator_native : public generator_i
+{
+public:
+    /** Compile a script, or load it from the cache.
+     * @param context    Shared data
+     * @param n          The compiled noise script
+     * @param cache_dir  Where to keep the shared libraries; if this is
+     *                   empty, default_cache_dir() is used
+     * @throw std::runtime_error if the script could not be built */
+    generator_native(const generator_context& context, const node& n,
+                     const std::string& cache_dir = std::string());
+
+    ~generator_native();
+
+    generator_native(const generator_native&) = delete;
+    generator_native& operator=(const generator_native&) = delete;
+
+    /** Returns the generated C++ source code. */
+    std::string cpp_sourcecode() const { return main_; }
+
+    /** Returns the file name of the shared library. */
+    std::string library_path() const { return library_; }
+
+    /** The cache directory that is used if none is given: the value of
+     *  HEXANOISE_CACHE_DIR, or else $XDG_CACHE_HOME/hexanoise, or else
+     *  ~/.cache/hexanoise. */
+    static std::string default_cache_dir();
+
+protected:
+    const char* tile_tag() const override { return "native"; }
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, double* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, const quantizer& q, void* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, float* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, double* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, const quantizer& q, void* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, float* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec2* points, size_t n,
+                  double* output) const override;
+
+    void generate(const glm::dvec3* points, size_t n,
+                  double* output) const override;
+
+private:
+    typedef void (*entry_t)(const void*, const void* const*, uint32_t,
+                            const double*, const double*, const int*, size_t,
+                            size_t, double*);
+
+    typedef void (*points_t)(const void*, const void* const*, uint32_t,
+                             const double*, size_t, size_t, size_t,
+                             double*);
+
+    template <typename Write>
+    void exec(entry_t entry, const double* corner, const double* step,
+              const int* count, size_t rows, double* direct,
+              size_t row_pitch, size_t slice_pitch, Write write) const;
+
+    void gather(const double* points, size_t dims, size_t n,
+                double* output) const;
+
+    void build(const std::string& cache_dir);
+
+    typedef std::string (generator_native::*lower_t)(const node&);
+
+    std::string co_v(const node& n);
+    std::string co_xy(const node& n);
+    std::string co_xyz(const node& n);
+    std::string co_bool(const node& n);
+    std::string co_shared(const node& n, const char* type, lower_t lower);
+    std::string co_noise(const node& n, const std::string& func,
+                         const std::string& p);
+    std::string co_lambda(const node& func, const node& in);
+    std::string data(const void* p);
+
+    std::string lower_v(const node& n);
+    std::string lower_xy(const node& n);
+    std::string lower_xyz(const node& n);
+    std::string lower_bool(const node& n);
+
+    void begin_frame();
+    std::string end_frame();
+
+private:
+    /** The shared subexpressions that were declared in the generated
+     *  function that is being written. */
+    struct frame
+    {
+        std::set<size_t> shared;
+        std::string locals;
+    };
+
+    subexpressions shared_;
+    std::vector<frame> frames_;
+    uint32_t seed_;
+    size_t count_;
+    std::string main_;
+    std::list<std::string> functions_;
+    std::vector<const void*> data_;
+    std::string library_;
+
+    void* handle_;
+    entry_t run2_;
+    entry_t run3_;
+    points_t points_;
+};
+
+} // namespace noise
+} // namespace hexa
@@ -6,10 +6,26 @@
 
 #include "generator_opencl.hpp"
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iterator>
 #include <cmath>
 #include <fstream>
+#include <iomanip>
+#include <locale>
+#include <map>
 #include <stdexcept>
+#include <tuple>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "analysis.hpp"
+#include "fnv1a.hpp"
+#include "generator_native.hpp"
 #include "node.hpp"
 #include "opencl_prelude.hpp"
 
@@ -22,58 +38,263 @@ namespace hexa
 namespace noise
 {
 
+namespace
+{
+
+// The number of programs that are shared between generators.
+const size_t program_cache_size = 64;
+
+typedef std::map<std::tuple<cl_context, cl_device_id, std::string>,
+                 cl::Program> program_map;
+
+std::mutex programs_mutex;
+
+// The programs that were built in this process, by context, device, and
+// build options plus source code.  The map is never destroyed: clew
+// unloads the OpenCL library at exit, possibly before the destructors of
+// static objects are run.
+program_map& programs()
+{
+    static auto result = new program_map;
+    return *result;
+}
+
+// The compiled noise functions, by context, device, and build options.
+// An empty program means they could not be compiled.
+program_map& libraries()
+{
+    static auto result = new program_map;
+    return *result;
+}
+
+// Everything but the noise functions.  Every part of the code that is
+// compiled on its own starts with this.
+const std::string prelude_header{std::string(opencl_prelude_types)
+                                 + opencl_prelude_declarations
+                                 + opencl_prelude_helpers};
+
+// Only the math options can be given to the linker.
+const char* link_flags = "-cl-unsafe-math-optimizations "
+                         "-cl-fast-relaxed-math";
+
+bool can_link(const cl::Device& device)
+{
+    if (clCompileProgram == nullptr || clLinkProgram == nullptr)
+        return false;
+
+    int major = 0, minor = 0;
+    auto version = device.getInfo<CL_DEVICE_VERSION>();
+    if (std::sscanf(version.c_str(), "OpenCL %d.%d", &major, &minor) != 2
+        || major * 10 + minor < 12) {
+        return false;
+    }
+    cl_bool linker = CL_FALSE;
+    return clGetDeviceInfo(device(), CL_DEVICE_LINKER_AVAILABLE,
+                           sizeof(linker), &linker, nullptr) == CL_SUCCESS
+           && linker == CL_TRUE;
+}
+
+// CPU devices, and GPUs that are built into the CPU, can use host memory
+// as a buffer without copying it.
+bool shares_memory(const cl::Device& device)
+{
+    if (device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU)
+        return true;
+
+    cl_bool unified = CL_FALSE;
+    return clGetDeviceInfo(device(), CL_DEVICE_HOST_UNIFIED_MEMORY,
+                           sizeof(unified), &unified, nullptr) == CL_SUCCESS
+           && unified == CL_TRUE;
+}
+
+// Buffers in the pool are rounded up to a power of two, so runs of about
+// the same size can share them.
+size_t buffer_size(size_t bytes)
+{
+    size_t size = 1 << 16;
+    while (size < bytes)
+        size *= 2;
+
+    return size;
+}
+
+const size_t pool_limit = 8;
+
+// Compile source code, without linking it.
+cl::Program compile(const cl::Context& context, const cl::Device& device,
+                    const std::string& source, const std::string& flags)
+{
+    cl::Program::Sources sources{1, {source.c_str(), source.size()}};
+    cl::Program program{context, sources};
+    cl_device_id id = device();
+    if (clCompileProgram(program(), 1, &id, flags.c_str(), 0, nullptr,
+                         nullptr, nullptr, nullptr) != CL_SUCCESS) {
+        return cl::Program();
+    }
+    return program;
+}
+
+cl::Program load_binary(const cl::Context& context,
+                        const std::vector<cl::Device>& devices,
+                        const std::string& flags, const std::string& file)
+{
+    std::ifstream in(file, std::ios::binary);
+    std::string binary{std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>()};
+    if (binary.empty())
+        return cl::Program();
+
+    try {
+        cl::Program::Binaries binaries{1, {binary.data(), binary.size()}};
+        cl::Program program{context, devices, binaries};
+        program.build(devices, flags.c_str());
+        return program;
+    } catch (cl::Error&) {
+        // Damaged, or made by another version of the driver.
+        return cl::Program();
+    }
+}
+
+void save_binary(const cl::Program& program, const std::string& dir,
+                 const std::string& file)
+{
+    size_t size = 0;
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size),
+                         &size, nullptr) != CL_SUCCESS
+        || size == 0) {
+        return;
+    }
+    std::vector<unsigned char> binary(size);
+    auto data = binary.data();
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(data), &data,
+                         nullptr) != CL_SUCCESS) {
+        return;
+    }
+
+#ifndef _WIN32
+    for (size_t i = 1; i <= dir.size(); ++i) {
+        if (i == dir.size() || dir[i] == '/')
+            mkdir(dir.substr(0, i).c_str(), 0755);
+    }
+    auto tmp = file + "-" + std::to_string(getpid());
+#else
+    auto tmp = file + "-tmp";
+#endif
+    // A half-written binary is never seen under the final name.
+    static std::atomic<unsigned int> writes{0};
+    tmp += "-" + std::to_string(writes++);
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(binary.data()), size);
+        if (!out) {
+            out.close();
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmp.c_str(), file.c_str()) != 0)
+        std::remove(tmp.c_str());
+}
+
+} // anonymous namespace
+
 generator_opencl::generator_opencl(const generator_context& ctx,
                                    cl::Context& opencl_context,
-                                   cl::Device& opencl_device, const node& n)
-    : generator_i{ctx}
+                                   cl::Device& opencl_device, const node& n,
+                                   const std::string& cache_dir)
+    : generator_i{ctx, n}
     , count_{1}
-    , main_{opencl_prelude}
+    , link_{can_link(opencl_device)}
+    , linked_{false}
+    , unified_{shares_memory(opencl_device)}
+    , cache_dir_{cache_dir.empty() ? generator_native::default_cache_dir()
+                                   : cache_dir}
     , context_{opencl_context}
     , device_{opencl_device}
     , queue_{opencl_context, opencl_device}
+    , next_queue_{0}
 {
+    for (int i = 0; i < 2; ++i)
+        async_queues_.emplace_back(opencl_context, opencl_device);
+
+    if (n.input_type() == var_t::xy)
+        scope_ = "real2";
+    else if (n.input_type() == var_t::xyz)
+        scope_ = "real3";
+
     std::string body{co(n)};
+    main_ += definitions();
 
-    main_ += "\n";
-    for (auto& p : functions_) {
-        main_ += p;
-        main_ += "\n\n";
-    }
-    
     auto func_type = n.input_type();
         
-    bool make_2d = func_type == var_t::xy || func_type == var_t::none;
-    bool make_3d = func_type == var_t::xyz || func_type == var_t::none;
+    make_2d_ = func_type == var_t::xy || func_type == var_t::none;
+    make_3d_ = func_type == var_t::xyz || func_type == var_t::none;
     
-    if (make_3d) {
+    if (make_3d_) {
         main_ += R"xxxxx(
 
         __kernel void noisemain3(
-            __global double* output, const double startx,
-            const double starty, const double startz,
-            const double stepx, const double stepy, const double stepz)
+            __global real* output, const real startx,
+            const real starty, const real startz,
+            const real stepx, const real stepy, const real stepz)
         {
             int3 coord = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
             int  sizex = get_global_size(0);
             int  sizey = get_global_size(1);
-            double3 p = mad((double3)(stepx, stepy, stepz),
-                (double3)(coord.x, coord.y, coord.z),
-                (double3)(startx, starty, startz));
+            real3 p = mad((real3)(stepx, stepy, stepz),
+                (real3)(coord.x, coord.y, coord.z),
+                (real3)(startx, starty, startz));
             output[coord.z * sizex * sizey + coord.y * sizex + coord.x] =
         )xxxxx";
     
         main_ += body;
         main_ += ";\n}\n";
+
+        main_ += R"xxxxx(
+
+        __kernel void noisemain3_q(
+            __global uchar* output, const real startx,
+            const real starty, const real startz,
+            const real stepx, const real stepy, const real stepz,
+            const int format, const real scale, const real offset,
+            const real lo, const real hi)
+        {
+            int3 coord = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
+            int  sizex = get_global_size(0);
+            int  sizey = get_global_size(1);
+            real3 p = mad((real3)(stepx, stepy, stepz),
+                (real3)(coord.x, coord.y, coord.z),
+                (real3)(startx, starty, startz));
+            p_store_quantized(output,
+                coord.z * sizex * sizey + coord.y * sizex + coord.x,
+                format, scale, offset, lo, hi,
+        )xxxxx";
+
+        main_ += body;
+        main_ += ");\n}\n";
+
+        main_ += R"xxxxx(
+
+        __kernel void noisepoints3(
+            __global real* output, __global const real* points)
+        {
+            int i = get_global_id(0);
+            real3 p = vload3(i, points);
+            output[i] =
+        )xxxxx";
+
+        main_ += body;
+        main_ += ";\n}\n";
     }
-    if (make_2d) {
+    if (make_2d_) {
         main_ += R"xxxxx(
 
         __kernel void noisemain(
-            __global double* output, const double2 start, const double2 step)
+            __global real* output, const real2 start, const real2 step)
         {
             int2 coord = (int2)(get_global_id(0), get_global_id(1));
             int sizex = get_global_size(0);
-            double2 p = mad(step, (double2)(coord.x, coord.y), start);
+            real2 p = mad(step, (real2)(coord.x, coord.y), start);
             output[coord.y * sizex + coord.x] =
         )xxxxx";
 
@@ -82,150 +303,933 @@ generator_opencl::generator_opencl(const generator_context& ctx,
 
         main_ += R"xxxxx(
 
-        __kernel void noisemain_int16(
-            __global int16* output, const double2 start, const double2 step)
+        __kernel void noisemain_q(
+            __global uchar* output, const real2 start, const real2 step,
+            const int format, const real scale, const real offset,
+            const real lo, const real hi)
         {
             int2 coord = (int2)(get_global_id(0), get_global_id(1));
             int sizex = get_global_size(0);
-            double2 p = mad(step, (double2)(coord.x, coord.y), start);
-            output[coord.y * sizex + coord.x] = (int16)round(
+            real2 p = mad(step, (real2)(coord.x, coord.y), start);
+            p_store_quantized(output, coord.y * sizex + coord.x,
+                format, scale, offset, lo, hi,
         )xxxxx";
 
         main_ += body;
         main_ += ");\n}\n";
+
+        main_ += R"xxxxx(
+
+        __kernel void noisepoints(
+            __global real* output, __global const real* points)
+        {
+            int i = get_global_id(0);
+            real2 p = vload2(i, points);
+            output[i] =
+        )xxxxx";
+
+        main_ += body;
+        main_ += ";\n}\n";
+    }
+
+    // The gradient kernels get their own program, so scripts with
+    // functions that cd() doesn't support can still be used with run().
+    try {
+        std::string grad_body{cd(n)};
+        gradient_ = definitions();
+        for (auto& p : dual_functions_) {
+            gradient_ += p;
+            gradient_ += "\n\n";
+        }
+        if (make_3d_) {
+            gradient_ += R"xxxxx(
+
+        __kernel void noisemain3_grad(
+            __global real* output, const real startx,
+            const real starty, const real startz,
+            const real stepx, const real stepy, const real stepz)
+        {
+            int3 coord = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
+            int  sizex = get_global_size(0);
+            int  sizey = get_global_size(1);
+            real3 p = mad((real3)(stepx, stepy, stepz),
+                (real3)(coord.x, coord.y, coord.z),
+                (real3)(startx, starty, startz));
+            dual3 dp = d3_at(p);
+            vstore4(
+        )xxxxx";
+
+            gradient_ += grad_body;
+            gradient_ += ", coord.z * sizex * sizey + coord.y * sizex + coord.x,"
+                         " output);\n}\n";
+        }
+        if (make_2d_) {
+            gradient_ += R"xxxxx(
+
+        __kernel void noisemain_grad(
+            __global real* output, const real2 start, const real2 step)
+        {
+            int2 coord = (int2)(get_global_id(0), get_global_id(1));
+            int sizex = get_global_size(0);
+            real2 p = mad(step, (real2)(coord.x, coord.y), start);
+            dual2 dp = d2_at(p);
+            dual r =
+        )xxxxx";
+
+            gradient_ += grad_body;
+            gradient_ += ";\n    vstore3(r.xyz, coord.y * sizex + coord.x,"
+                         " output);\n}\n";
+        }
+    } catch (std::exception&) {
+        gradient_.clear();
+    }
+
+    auto extensions = device_.getInfo<CL_DEVICE_EXTENSIONS>();
+    fp64_ = extensions.find("cl_khr_fp64") != std::string::npos
+            || extensions.find("cl_amd_fp64") != std::string::npos;
+
+    if (!fp64_) {
+        build_fp32();
+        return;
+    }
+
+    program_ = build(main_, "");
+    make_kernels(program_, kernels_);
+}
+
+std::string generator_opencl::definitions() const
+{
+    std::string result{"\n"};
+    for (size_t i = 0; i < permutations_.size(); ++i) {
+        result += "__constant int perm" + std::to_string(i) + "[512] = {";
+        for (int j = 0; j < 512; ++j) {
+            result += std::to_string(permutations_[i]->p[j]);
+            result += j % 32 == 31 ? ",\n" : ",";
+        }
+        result += "};\n\n";
+    }
+    for (auto& p : functions_) {
+        result += p;
+        result += "\n\n";
+    }
+    return result;
+}
+
+cl::Program generator_opencl::build(const std::string& source,
+                                    const std::string& options) const
+{
+    auto flags = "-cl-strict-aliasing -cl-mad-enable "
+                 "-cl-unsafe-math-optimizations -cl-fast-relaxed-math "
+                 + options;
+
+    auto key = std::make_tuple(context_(), device_(), flags + '\n' + source);
+    {
+        std::lock_guard<std::mutex> lock(programs_mutex);
+        auto found = programs().find(key);
+        if (found != programs().end())
+            return found->second;
     }
 
     std::vector<cl::Device> device_vec;
-    device_vec.emplace_back(opencl_device);
+    device_vec.emplace_back(device_);
+
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0')
+         << fnv1a(std::get<2>(key) + prelude_header + opencl_prelude_noise
+                  + device_.getInfo<CL_DEVICE_NAME>()
+                  + device_.getInfo<CL_DEVICE_VENDOR>()
+                  + device_.getInfo<CL_DEVICE_VERSION>()
+                  + device_.getInfo<CL_DRIVER_VERSION>());
+    auto file = cache_dir_ + "/" + name.str() + ".clbin";
+
+    auto program = load_binary(context_, device_vec, flags, file);
+    if (!program()) {
+        program = link(source, flags);
+        if (program()) {
+            linked_ = true;
+        } else {
+            auto full = prelude_header + opencl_prelude_noise + source;
+            cl::Program::Sources sources{1, {full.c_str(), full.size()}};
+            program = cl::Program{context_, sources};
+            try {
+                program.build(device_vec, flags.c_str());
+            } catch (cl::Error& e) {
+                throw std::runtime_error(
+                    "cannot build OpenCL program (" + std::string(e.what())
+                    + ", code " + std::to_string(e.err()) + "):\n"
+                    + program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device_));
+            }
+        }
+        save_binary(program, cache_dir_, file);
+    }
+
+    // Clearing the map does not release the programs that generators
+    // are still using.  Another thread may have built the same program in
+    // the meantime; then that one is shared.
+    std::lock_guard<std::mutex> lock(programs_mutex);
+    if (programs().size() >= program_cache_size)
+        programs().clear();
+
+    return programs().emplace(key, program).first->second;
+}
+
+// If the script itself does not compile, an empty program is returned as
+// well; build() then builds it as a whole, and shows the errors.
+cl::Program generator_opencl::link(const std::string& source,
+                                   const std::string& flags) const
+{
+    if (!link_)
+        return cl::Program();
+
+    auto key = std::make_tuple(context_(), device_(), flags);
+    cl::Program library;
+    bool found;
+    {
+        std::lock_guard<std::mutex> lock(programs_mutex);
+        auto i = libraries().find(key);
+        found = i != libraries().end();
+        if (found)
+            library = i->second;
+    }
+    if (!found) {
+        library = compile(context_, device_,
+                          prelude_header + opencl_prelude_noise, flags);
+
+        std::lock_guard<std::mutex> lock(programs_mutex);
+        if (libraries().size() >= program_cache_size)
+            libraries().clear();
+
+        library = libraries().emplace(key, library).first->second;
+    }
+    if (!library())
+        return cl::Program();
+
+    auto object = compile(context_, device_, prelude_header + source, flags);
+    if (!object())
+        return cl::Program();
+
+    cl_program inputs[] = {library(), object()};
+    cl_device_id id = device_();
+    cl_int error = CL_SUCCESS;
+    cl::Program result;
+    result() = clLinkProgram(context_(), 1, &id, link_flags, 2, inputs,
+                             nullptr, nullptr, &error);
+    if (error != CL_SUCCESS)
+        return cl::Program();
+
+    return result;
+}
+
+std::string generator_opencl::opencl_sourcecode() const
+{
+    return prelude_header + opencl_prelude_noise + main_;
+}
+
+std::string generator_opencl::opencl_gradient_sourcecode() const
+{
+    if (gradient_.empty())
+        return gradient_;
+
+    return prelude_header + opencl_prelude_noise + gradient_;
+}
+
+void generator_opencl::make_kernels(const cl::Program& program,
+                                    kernel_set& k) const
+{
+    if (make_3d_) {
+        k.grid3 = cl::Kernel(program, "noisemain3");
+        k.quantized3 = cl::Kernel(program, "noisemain3_q");
+        k.points3 = cl::Kernel(program, "noisepoints3");
+    }
+    if (make_2d_) {
+        k.grid = cl::Kernel(program, "noisemain");
+        k.quantized = cl::Kernel(program, "noisemain_q");
+        k.points = cl::Kernel(program, "noisepoints");
+    }
+}
+
+// Must be called with mutex_ locked, or from the constructor.
+void generator_opencl::build_fp32() const
+{
+    if (program32_())
+        return;
+
+    program32_ = build(main_,
+                       "-DHEXANOISE_FP32 -cl-single-precision-constant");
+    make_kernels(program32_, kernels32_);
+}
 
-    cl::Program::Sources sources{1, {main_.c_str(), main_.size()}};
-    program_ = cl::Program(opencl_context, sources);
+// Must be called with mutex_ locked.
+void generator_opencl::build_gradient() const
+{
+    if (program_grad_())
+        return;
+
+    program_grad_ = build(gradient_, fp64_ ? "" : "-DHEXANOISE_FP32 "
+                                                  "-cl-single-precision-constant");
+    if (make_3d_)
+        grad3_ = cl::Kernel(program_grad_, "noisemain3_grad");
+    if (make_2d_)
+        grad_ = cl::Kernel(program_grad_, "noisemain_grad");
+}
+
+cl::Buffer generator_opencl::acquire(size_t bytes, size_t& capacity) const
+{
+    capacity = buffer_size(bytes);
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        auto found = pool_.find(capacity);
+        if (found != pool_.end()) {
+            cl::Buffer result{found->second};
+            pool_.erase(found);
+            return result;
+        }
+    }
+    // Memory that the driver allocates itself can be mapped without a
+    // copy on CPU devices, and is pinned for fast transfers on GPUs.
+    return cl::Buffer(context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      capacity);
+}
+
+void generator_opencl::release(cl::Buffer buffer, size_t capacity) const
+{
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if (pool_.size() < pool_limit)
+        pool_.emplace(capacity, std::move(buffer));
+}
+
+void generator_opencl::unmap(cl::Buffer& buffer, void* data,
+                             size_t capacity) const
+{
     try {
-        program_.build(device_vec,
-                       "-cl-strict-aliasing -cl-mad-enable "
-                       "-cl-unsafe-math-optimizations -cl-fast-relaxed-math");
+        queue_.enqueueUnmapMemObject(buffer, data);
+        release(buffer, capacity);
     } catch (cl::Error&) {
-        std::cerr << program_.getBuildInfo<CL_PROGRAM_BUILD_LOG>(opencl_device)
-                  << std::endl;
-        throw;
+        // The buffer is freed instead of going back to the pool.
     }
+    buffer = cl::Buffer();
+}
 
-    if (make_3d) {
-        kernel3_ = cl::Kernel(program_, "noisemain3");
+namespace
+{
+
+// The kernel arguments of type real are either floats or doubles.
+template <typename Real>
+cl::Kernel& set_args(cl::Kernel& k, const glm::dvec2& corner,
+                     const glm::dvec2& step)
+{
+    Real c[] = {Real(corner.x), Real(corner.y)};
+    Real s[] = {Real(step.x), Real(step.y)};
+    k.setArg(1, sizeof(c), c);
+    k.setArg(2, sizeof(s), s);
+    return k;
+}
+
+template <typename Real>
+cl::Kernel& set_args(cl::Kernel& k, const glm::dvec3& corner,
+                     const glm::dvec3& step)
+{
+    for (int i = 0; i < 3; ++i) {
+        k.setArg(1 + i, Real(corner[i]));
+        k.setArg(4 + i, Real(step[i]));
     }
-    if (make_2d) {
-        kernel_ = cl::Kernel(program_, "noisemain");
-        kernel_int16_ = cl::Kernel(program_, "noisemain_int16");
+    return k;
+}
+
+template <typename Real>
+cl::Kernel& set_args(cl::Kernel& k, int first, const quantizer& q)
+{
+    double lo, hi;
+    q.bounds(lo, hi);
+    k.setArg(first, static_cast<int>(q.format));
+    k.setArg(first + 1, Real(q.scale));
+    k.setArg(first + 2, Real(q.offset));
+    k.setArg(first + 3, Real(lo));
+    k.setArg(first + 4, Real(hi));
+    return k;
+}
+
+// Used on devices without double precision support.
+template <typename T, typename Convert>
+void copy_rows(const std::vector<float>& src, const glm::ivec3& count,
+               T* output, size_t row_pitch, size_t slice_pitch,
+               Convert convert)
+{
+    auto i = src.begin();
+    for (int z = 0; z < count.z; ++z) {
+        for (int y = 0; y < count.y; ++y) {
+            T* row = output + y * row_pitch + z * slice_pitch;
+            for (int x = 0; x < count.x; ++x)
+                row[x] = convert(*i++);
+        }
     }
 }
 
-std::vector<double> generator_opencl::run(const glm::dvec2& corner,
-                                          const glm::dvec2& step,
-                                          const glm::ivec2& count)
+// A run that was started by run_async().  The transfer writes to
+// 'result', so if the future is dropped before get(), the transfer still
+// has to finish before the memory is freed.
+template <typename T>
+struct pending_run
 {
-    unsigned int width = count.x;
-    unsigned int height = count.y;
-    unsigned int elements = width * height;
+    ~pending_run()
+    {
+        try {
+            if (done())
+                done.wait();
+        } catch (cl::Error&) {
+        }
+    }
 
-    std::vector<double> result(elements);
-    cl::Buffer output(context_, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
-                      elements * sizeof(double), &result[0]);
+    std::vector<T> result;
+    cl::Buffer buffer;
+    size_t capacity;
+    cl::Event done;
+};
 
-    kernel_.setArg(0, output);
-    kernel_.setArg(1, sizeof(corner), (void*)&corner);
-    kernel_.setArg(2, sizeof(step), (void*)&step);
+std::runtime_error opencl_error(const cl::Error& err)
+{
+    return std::runtime_error(std::string("OpenCL error: ") + err.what()
+                              + " (" + std::to_string(err.err()) + ")");
+}
 
-    queue_.enqueueNDRangeKernel(kernel_, cl::NullRange, {width, height},
-                                cl::NullRange);
+} // anonymous namespace
+
+template <typename SetArgs>
+void generator_opencl::enqueue(SetArgs set_args, const glm::ivec3& count,
+                               const cl::Buffer& buffer,
+                               cl::CommandQueue& queue) const
+{
+    cl::NDRange range{size_t(count.x), size_t(count.y), size_t(count.z)};
+    if (count.z == 1)
+        range = cl::NDRange{size_t(count.x), size_t(count.y)};
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    cl::Kernel& kernel = set_args();
+    kernel.setArg(0, buffer);
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, range, cl::NullRange);
+}
 
-    auto memobj = queue_.enqueueMapBuffer(output, true, CL_MAP_WRITE, 0,
-                                          elements * sizeof(double));
+template <typename T, typename SetArgs>
+void generator_opencl::execute(SetArgs set_args, const glm::ivec3& count,
+                               T* output, size_t row_pitch,
+                               size_t slice_pitch) const
+{
+    size_t bytes = size_t(count.x) * count.y * count.z * sizeof(T);
+    bool dense = row_pitch == size_t(count.x)
+                 && (count.z == 1 || slice_pitch == row_pitch * count.y);
+
+    // If the device shares memory with the host, the kernel can write to
+    // a contiguous output directly.  Mapping it makes sure the results
+    // are there.
+    if (dense && unified_) {
+        cl::Buffer buffer(context_, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
+                          bytes, output);
+        enqueue(set_args, count, buffer, queue_);
+        auto memobj = queue_.enqueueMapBuffer(buffer, true, CL_MAP_READ, 0,
+                                              bytes);
+        queue_.enqueueUnmapMemObject(buffer, memobj);
+        return;
+    }
 
-    queue_.enqueueUnmapMemObject(output, memobj);
+    size_t capacity;
+    cl::Buffer buffer{acquire(bytes, capacity)};
+    enqueue(set_args, count, buffer, queue_);
+    if (dense) {
+        queue_.enqueueReadBuffer(buffer, true, 0, bytes, output);
+        release(buffer, capacity);
+        return;
+    }
 
+    // The queue is in order, so once the last row has been read, all of
+    // them have.  (clEnqueueReadBufferRect would do this in one go, but
+    // needs OpenCL 1.1.)
+    size_t row_bytes = count.x * sizeof(T), rows = count.y * count.z;
+    for (size_t r = 0; r < rows; ++r) {
+        T* dest = output + (r % count.y) * row_pitch
+                  + (r / count.y) * slice_pitch;
+        queue_.enqueueReadBuffer(buffer, r + 1 == rows, r * row_bytes,
+                                 row_bytes, dest);
+    }
+    release(buffer, capacity);
+}
+
+template <typename T, typename SetArgs>
+generator_opencl::mapped_result<T>
+generator_opencl::execute_mapped(SetArgs set_args,
+                                 const glm::ivec3& count) const
+{
+    mapped_result<T> result;
+    if (count.x <= 0 || count.y <= 0 || count.z <= 0)
+        return result;
+
+    size_t size = size_t(count.x) * count.y * count.z;
+    cl::Buffer buffer{acquire(size * sizeof(T), result.capacity_)};
+    enqueue(set_args, count, buffer, queue_);
+    auto memobj = queue_.enqueueMapBuffer(buffer, true, CL_MAP_READ, 0,
+                                          size * sizeof(T));
+    result.owner_ = this;
+    result.buffer_ = buffer;
+    result.data_ = static_cast<const T*>(memobj);
+    result.size_ = size;
     return result;
 }
 
-std::vector<int16_t> generator_opencl::run_int16(const glm::dvec2& corner,
-                                                 const glm::dvec2& step,
-                                                 const glm::ivec2& count)
+template <typename T, typename SetArgs>
+std::future<std::vector<T>>
+generator_opencl::execute_async(SetArgs set_args,
+                                const glm::ivec3& count) const
 {
-    unsigned int width = count.x;
-    unsigned int height = count.y;
-    unsigned int elements = width * height;
+    if (count.x <= 0 || count.y <= 0 || count.z <= 0)
+        return std::async(std::launch::deferred,
+                          [] { return std::vector<T>(); });
+
+    auto job = std::make_shared<pending_run<T>>();
+    size_t bytes = size_t(count.x) * count.y * count.z * sizeof(T);
+    job->result.resize(bytes / sizeof(T));
+    job->buffer = acquire(bytes, job->capacity);
+
+    // Both queues are in order, so the kernel is done before the read.
+    auto& queue = async_queues_[next_queue_++ % async_queues_.size()];
+    enqueue(set_args, count, job->buffer, queue);
+    queue.enqueueReadBuffer(job->buffer, false, 0, bytes, job->result.data(),
+                            nullptr, &job->done);
+    queue.flush();
+
+    return std::async(std::launch::deferred, [this, job] {
+        try {
+            job->done.wait();
+        } catch (cl::Error& err) {
+            throw opencl_error(err);
+        }
+        release(job->buffer, job->capacity);
+        job->buffer = cl::Buffer();
+        return std::move(job->result);
+    });
+}
 
-    std::vector<int16_t> result(elements);
-    cl::Buffer output(context_, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
-                      elements * sizeof(int16_t), &result[0]);
+template <typename SetArgs>
+void generator_opencl::execute(SetArgs set_args, const glm::ivec3& count,
+                               quantized format, void* output,
+                               size_t row_pitch, size_t slice_pitch) const
+{
+    if (sample_size(format) == 1) {
+        execute(set_args, count, static_cast<uint8_t*>(output), row_pitch,
+                slice_pitch);
+    } else {
+        execute(set_args, count, static_cast<uint16_t*>(output), row_pitch,
+                slice_pitch);
+    }
+}
 
-    kernel_int16_.setArg(0, output);
-    kernel_int16_.setArg(1, sizeof(corner), (void*)&corner);
-    kernel_int16_.setArg(2, sizeof(step), (void*)&step);
+void generator_opencl::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, double* output,
+                                size_t row_pitch) const
+{
+    if (!fp64_) {
+        copy_rows(run_float(corner, step, count), glm::ivec3{count, 1},
+                  output, row_pitch, 0, [](float v) { return double(v); });
+        return;
+    }
 
-    queue_.enqueueNDRangeKernel(kernel_int16_, cl::NullRange, {width, height},
-                                cl::NullRange);
+    execute([&]() -> cl::Kernel& {
+        return set_args<double>(kernels_.grid, corner, step);
+    }, glm::ivec3{count, 1}, output, row_pitch, 0);
+}
+
+void generator_opencl::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, const quantizer& q,
+                                void* output, size_t row_pitch) const
+{
+    execute([&]() -> cl::Kernel& {
+        if (!fp64_) {
+            build_fp32();
+            set_args<float>(kernels32_.quantized, 3, q);
+            return set_args<float>(kernels32_.quantized, corner, step);
+        }
+        set_args<double>(kernels_.quantized, 3, q);
+        return set_args<double>(kernels_.quantized, corner, step);
+    }, glm::ivec3{count, 1}, q.format, output, row_pitch, 0);
+}
 
-    auto memobj = queue_.enqueueMapBuffer(output, true, CL_MAP_WRITE, 0,
-                                          elements * sizeof(int16_t));
+void generator_opencl::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, float* output,
+                                size_t row_pitch) const
+{
+    execute([&]() -> cl::Kernel& {
+        build_fp32();
+        return set_args<float>(kernels32_.grid, corner, step);
+    }, glm::ivec3{count, 1}, output, row_pitch, 0);
+}
 
-    queue_.enqueueUnmapMemObject(output, memobj);
+void generator_opencl::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, double* output,
+                                size_t row_pitch, size_t slice_pitch) const
+{
+    if (!fp64_) {
+        copy_rows(run_float(corner, step, count), count, output, row_pitch,
+                  slice_pitch, [](float v) { return double(v); });
+        return;
+    }
 
-    return result;
+    try {
+        execute([&]() -> cl::Kernel& {
+            return set_args<double>(kernels_.grid3, corner, step);
+        }, count, output, row_pitch, slice_pitch);
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
 }
 
-std::vector<double> generator_opencl::run(const glm::dvec3& corner,
-                                          const glm::dvec3& step,
-                                          const glm::ivec3& count)
+void generator_opencl::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, const quantizer& q,
+                                void* output, size_t row_pitch,
+                                size_t slice_pitch) const
 {
-    unsigned int width = count.x;
-    unsigned int height = count.y;
-    unsigned int depth = count.z;
-    unsigned int elements = width * height * depth;
+    try {
+        execute([&]() -> cl::Kernel& {
+            if (!fp64_) {
+                build_fp32();
+                set_args<float>(kernels32_.quantized3, 7, q);
+                return set_args<float>(kernels32_.quantized3, corner, step);
+            }
+            set_args<double>(kernels_.quantized3, 7, q);
+            return set_args<double>(kernels_.quantized3, corner, step);
+        }, count, q.format, output, row_pitch, slice_pitch);
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
 
-    std::vector<double> result(elements);
-    cl::Buffer output(context_, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
-                      elements * sizeof(double), &result[0]);
+void generator_opencl::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, float* output,
+                                size_t row_pitch, size_t slice_pitch) const
+{
+    try {
+        execute([&]() -> cl::Kernel& {
+            build_fp32();
+            return set_args<float>(kernels32_.grid3, corner, step);
+        }, count, output, row_pitch, slice_pitch);
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
+
+generator_opencl::mapped_result<double>
+generator_opencl::run_mapped(const glm::dvec2& corner, const glm::dvec2& step,
+                             const glm::ivec2& count) const
+{
+    if (!fp64_)
+        throw std::runtime_error("OpenCL device has no double precision");
 
     try {
-        kernel3_.setArg(0, output);
-        kernel3_.setArg(1, corner.x);
-        kernel3_.setArg(2, corner.y);
-        kernel3_.setArg(3, corner.z);
-        kernel3_.setArg(4, step.x);
-        kernel3_.setArg(5, step.y);
-        kernel3_.setArg(6, step.z);
+        return execute_mapped<double>([&]() -> cl::Kernel& {
+            return set_args<double>(kernels_.grid, corner, step);
+        }, glm::ivec3{count, 1});
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
 
-        queue_.enqueueNDRangeKernel(kernel3_, cl::NullRange,
-                                    {width, height, depth}, cl::NullRange);
+generator_opencl::mapped_result<double>
+generator_opencl::run_mapped(const glm::dvec3& corner, const glm::dvec3& step,
+                             const glm::ivec3& count) const
+{
+    if (!fp64_)
+        throw std::runtime_error("OpenCL device has no double precision");
 
-        auto memobj= queue_.enqueueMapBuffer(output, true, CL_MAP_WRITE, 0,
-                                             elements * sizeof(double));
+    try {
+        return execute_mapped<double>([&]() -> cl::Kernel& {
+            return set_args<double>(kernels_.grid3, corner, step);
+        }, count);
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
 
-        queue_.enqueueUnmapMemObject(output, memobj);
+generator_opencl::mapped_result<float>
+generator_opencl::run_float_mapped(const glm::dvec2& corner,
+                                   const glm::dvec2& step,
+                                   const glm::ivec2& count) const
+{
+    try {
+        return execute_mapped<float>([&]() -> cl::Kernel& {
+            build_fp32();
+            return set_args<float>(kernels32_.grid, corner, step);
+        }, glm::ivec3{count, 1});
     } catch (cl::Error& err) {
-        throw std::runtime_error(std::string("OpenCL error: ") + err.what()
-                                 + " (" + std::to_string(err.err()) + ")");
+        throw opencl_error(err);
     }
+}
 
-    return result;
+generator_opencl::mapped_result<float>
+generator_opencl::run_float_mapped(const glm::dvec3& corner,
+                                   const glm::dvec3& step,
+                                   const glm::ivec3& count) const
+{
+    try {
+        return execute_mapped<float>([&]() -> cl::Kernel& {
+            build_fp32();
+            return set_args<float>(kernels32_.grid3, corner, step);
+        }, count);
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
+
+std::future<std::vector<double>>
+generator_opencl::generate_async(const glm::dvec2& corner,
+                                 const glm::dvec2& step,
+                                 const glm::ivec2& count) const
+{
+    if (!fp64_ || caching())
+        return generator_i::generate_async(corner, step, count);
+
+    try {
+        return execute_async<double>([&]() -> cl::Kernel& {
+            return set_args<double>(kernels_.grid, corner, step);
+        }, glm::ivec3{count, 1});
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
+
+std::future<std::vector<double>>
+generator_opencl::generate_async(const glm::dvec3& corner,
+                                 const glm::dvec3& step,
+                                 const glm::ivec3& count) const
+{
+    if (!fp64_ || caching())
+        return generator_i::generate_async(corner, step, count);
+
+    try {
+        return execute_async<double>([&]() -> cl::Kernel& {
+            return set_args<double>(kernels_.grid3, corner, step);
+        }, count);
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
 }
 
-std::vector<int16_t> generator_opencl::run_int16(const glm::dvec3& corner,
-                                                 const glm::dvec3& step,
-                                                 const glm::ivec3& count)
+std::future<std::vector<float>>
+generator_opencl::generate_float_async(const glm::dvec2& corner,
+                                       const glm::dvec2& step,
+                                       const glm::ivec2& count) const
 {
-    throw std::runtime_error("opencl::run_int16 3-D not implemented yet");
+    if (caching())
+        return generator_i::generate_float_async(corner, step, count);
+
+    try {
+        return execute_async<float>([&]() -> cl::Kernel& {
+            build_fp32();
+            return set_args<float>(kernels32_.grid, corner, step);
+        }, glm::ivec3{count, 1});
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
+
+std::future<std::vector<float>>
+generator_opencl::generate_float_async(const glm::dvec3& corner,
+                                       const glm::dvec3& step,
+                                       const glm::ivec3& count) const
+{
+    if (caching())
+        return generator_i::generate_float_async(corner, step, count);
+
+    try {
+        return execute_async<float>([&]() -> cl::Kernel& {
+            build_fp32();
+            return set_args<float>(kernels32_.grid3, corner, step);
+        }, count);
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
+
+template <typename Real, typename Pick>
+void generator_opencl::gather(Pick pick, const Real* points, size_t dims,
+                              size_t n, Real* output) const
+{
+    size_t in_bytes = n * dims * sizeof(Real), out_bytes = n * sizeof(Real);
+    size_t in_capacity = 0, out_capacity = 0;
+    cl::Buffer input, buffer;
+    if (unified_) {
+        input = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                           in_bytes, const_cast<Real*>(points));
+        buffer = cl::Buffer(context_, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR,
+                            out_bytes, output);
+    } else {
+        input = acquire(in_bytes, in_capacity);
+        buffer = acquire(out_bytes, out_capacity);
+        queue_.enqueueWriteBuffer(input, true, 0, in_bytes, points);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cl::Kernel& kernel = pick();
+        kernel.setArg(0, buffer);
+        kernel.setArg(1, input);
+        queue_.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange{n},
+                                    cl::NullRange);
+    }
+
+    if (unified_) {
+        auto memobj = queue_.enqueueMapBuffer(buffer, true, CL_MAP_READ, 0,
+                                              out_bytes);
+        queue_.enqueueUnmapMemObject(buffer, memobj);
+        return;
+    }
+
+    queue_.enqueueReadBuffer(buffer, true, 0, out_bytes, output);
+    release(input, in_capacity);
+    release(buffer, out_capacity);
+}
+
+void generator_opencl::generate(const glm::dvec2* points, size_t n,
+                                double* output) const
+{
+    if (fp64_) {
+        gather([&]() -> cl::Kernel& { return kernels_.points; },
+               &points[0].x, 2, n, output);
+        return;
+    }
+
+    std::vector<float> coords(&points[0].x, &points[0].x + 2 * n);
+    std::vector<float> result(n);
+    gather([&]() -> cl::Kernel& {
+        build_fp32();
+        return kernels32_.points;
+    }, coords.data(), 2, n, result.data());
+    std::copy(result.begin(), result.end(), output);
+}
+
+void generator_opencl::generate(const glm::dvec3* points, size_t n,
+                                double* output) const
+{
+    if (fp64_) {
+        gather([&]() -> cl::Kernel& { return kernels_.points3; },
+               &points[0].x, 3, n, output);
+        return;
+    }
+
+    std::vector<float> coords(&points[0].x, &points[0].x + 3 * n);
+    std::vector<float> result(n);
+    gather([&]() -> cl::Kernel& {
+        build_fp32();
+        return kernels32_.points3;
+    }, coords.data(), 3, n, result.data());
+    std::copy(result.begin(), result.end(), output);
+}
+
+void generator_opencl::generate(const glm::dvec2& corner,
+                                const glm::dvec2& step,
+                                const glm::ivec2& count, glm::dvec3* output,
+                                size_t row_pitch) const
+{
+    // Scripts that the gradient kernels cannot handle are run on the CPU.
+    if (gradient_.empty()) {
+        generator_i::generate(corner, step, count, output, row_pitch);
+        return;
+    }
+
+    try {
+        if (fp64_) {
+            execute([&]() -> cl::Kernel& {
+                build_gradient();
+                return set_args<double>(grad_, corner, step);
+            }, glm::ivec3{count, 1}, output, row_pitch, 0);
+            return;
+        }
+
+        std::vector<glm::vec3> result(size_t(count.x) * count.y);
+        execute([&]() -> cl::Kernel& {
+            build_gradient();
+            return set_args<float>(grad_, corner, step);
+        }, glm::ivec3{count, 1}, result.data(), count.x, 0);
+
+        auto i = result.begin();
+        for (int y = 0; y < count.y; ++y) {
+            for (int x = 0; x < count.x; ++x, ++i)
+                output[y * row_pitch + x] = glm::dvec3{i->x, i->y, i->z};
+        }
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
+
+void generator_opencl::generate(const glm::dvec3& corner,
+                                const glm::dvec3& step,
+                                const glm::ivec3& count, glm::dvec4* output,
+                                size_t row_pitch, size_t slice_pitch) const
+{
+    if (gradient_.empty()) {
+        generator_i::generate(corner, step, count, output, row_pitch,
+                              slice_pitch);
+        return;
+    }
+
+    try {
+        if (fp64_) {
+            execute([&]() -> cl::Kernel& {
+                build_gradient();
+                return set_args<double>(grad3_, corner, step);
+            }, count, output, row_pitch, slice_pitch);
+            return;
+        }
+
+        std::vector<glm::vec4> result(size_t(count.x) * count.y * count.z);
+        execute([&]() -> cl::Kernel& {
+            build_gradient();
+            return set_args<float>(grad3_, corner, step);
+        }, count, result.data(), count.x, size_t(count.x) * count.y);
+
+        auto i = result.begin();
+        for (int z = 0; z < count.z; ++z) {
+            for (int y = 0; y < count.y; ++y) {
+                glm::dvec4* row = output + y * row_pitch + z * slice_pitch;
+                for (int x = 0; x < count.x; ++x, ++i)
+                    row[x] = glm::dvec4{i->x, i->y, i->z, i->w};
+            }
+        }
+    } catch (cl::Error& err) {
+        throw opencl_error(err);
+    }
+}
+
+// std::to_string only prints six decimals, which is not enough for the
+// constants that come out of fold_constants().
+std::string literal(double v)
+{
+    if (std::isnan(v))
+        return "NAN";
+    if (std::isinf(v))
+        return v > 0 ? "INFINITY" : "(-INFINITY)";
+
+    std::ostringstream str;
+    str.imbue(std::locale::classic());
+    str << std::setprecision(17) << v;
+    auto result = str.str();
+    if (result.find_first_of(".e") == std::string::npos)
+        result += ".0";
+
+    return "(" + result + ")";
 }
 
 std::string type_string(const node& n)
 {
     switch (n.return_type) {
     case var_t::var:
-        return "double";
+        return "real";
     case var_t::xy:
-        return "double2";
+        return "real2";
     case var_t::xyz:
-        return "double3";
+        return "real3";
     default:
         ;
     }
@@ -245,13 +1249,43 @@ std::string generator_opencl::pl(const node& n)
     return result;
 }
 
+// The permutation tables are constants in the program, rather than a
+// __constant buffer argument, so the functions generated for map,
+// fractal, and so on can use them as well; an argument would have to be
+// passed down through every one of them.  Both end up in constant
+// memory.  The seed is a literal in the source anyway, so the tables do
+// not keep programs from being shared between generators either.
+std::string generator_opencl::co_noise(const node& n, const std::string& func)
+{
+    auto table = seed_table(n, cntx_);
+    if (table == nullptr)
+        return func + pl(n);
+
+    auto found = std::find(permutations_.begin(), permutations_.end(), table);
+    auto index = found - permutations_.begin();
+    if (found == permutations_.end())
+        permutations_.push_back(table);
+
+    return func + "_table(" + co(n.input[0]) + ", perm"
+           + std::to_string(index) + ")";
+}
+
+std::string generator_opencl::co(const node& n, const std::string& scope)
+{
+    std::string outer{scope};
+    std::swap(scope_, outer);
+    std::string result{co(n)};
+    std::swap(scope_, outer);
+    return result;
+}
+
 std::string generator_opencl::co(const node& n)
 {
     switch (n.type) {
     case node::entry_point:
         return "p";
     case node::const_var:
-        return std::to_string(n.aux_var);
+        return literal(n.aux_var);
     case node::const_bool:
         return std::to_string(n.aux_bool);
     case node::const_str:
@@ -260,15 +1294,15 @@ std::string generator_opencl::co(const node& n)
     case node::rotate:
         return "p_rotate" + pl(n);
     case node::rotate3:
-        return "p_rotate3(" + co(n.input[0]) + ", (double3)(" + co(n.input[1]) + "," + co(n.input[2]) + "," + co(n.input[3]) + "), " + co(n.input[4]) + ")";
+        return "p_rotate3(" + co(n.input[0]) + ", (real3)(" + co(n.input[1]) + "," + co(n.input[2]) + "," + co(n.input[3]) + "), " + co(n.input[4]) + ")";
     case node::scale:
     case node::scale3:
         return "(" + co(n.input[0]) + "/" + co(n.input[1]) + ")";
     case node::shift:
-        return "(" + co(n.input[0]) + "+(double2)(" + co(n.input[1]) + ","
+        return "(" + co(n.input[0]) + "+(real2)(" + co(n.input[1]) + ","
                + co(n.input[2]) + "))";
     case node::shift3:
-        return "(" + co(n.input[0]) + "+(double3)(" + co(n.input[1]) + ","
+        return "(" + co(n.input[0]) + "+(real3)(" + co(n.input[1]) + ","
                + co(n.input[2]) + "," + co(n.input[3]) + "))";
     case node::swap:
         return "p_swap" + pl(n);
@@ -277,9 +1311,10 @@ std::string generator_opencl::co(const node& n)
         std::string func_name{std::string("ip_map") + std::to_string(count_++)};
 
         std::stringstream func_body;
-        func_body << "inline double2 " << func_name
-                  << " (const double2 p) { return (double2)(" << co(n.input[1])
-                  << ", " << co(n.input[2]) << "); }" << std::endl;
+        func_body << "inline real2 " << func_name
+                  << " (const real2 p) { return (real2)("
+                  << co(n.input[1], "real2") << ", "
+                  << co(n.input[2], "real2") << "); }" << std::endl;
 
         functions_.emplace_back(func_body.str());
 
@@ -289,10 +1324,11 @@ std::string generator_opencl::co(const node& n)
         std::string func_name{"ip_map3" + std::to_string(count_++)};
 
         std::stringstream func_body;
-        func_body << "inline double3 " << func_name
-                  << " (const double3 p) { return (double3)(" << co(n.input[1])
-                  << ", " << co(n.input[2]) << ", " << co(n.input[3]) << "); }"
-                  << std::endl;
+        func_body << "inline real3 " << func_name
+                  << " (const real3 p) { return (real3)("
+                  << co(n.input[1], "real3") << ", "
+                  << co(n.input[2], "real3") << ", "
+                  << co(n.input[3], "real3") << "); }" << std::endl;
 
         functions_.emplace_back(func_body.str());
 
@@ -303,10 +1339,11 @@ std::string generator_opencl::co(const node& n)
         std::string func_name("ip_turb" + std::to_string(count_++));
 
         std::stringstream func_body;
-        func_body << "inline double2 " << func_name
-                  << " (const double2 p) { return (double2)("
-                  << "p.x+(" << co(n.input[1]) << "), "
-                  << "p.y+(" << co(n.input[2]) << ")); }" << std::endl;
+        func_body << "inline real2 " << func_name
+                  << " (const real2 p) { return (real2)("
+                  << "p.x+(" << co(n.input[1], "real2") << "), "
+                  << "p.y+(" << co(n.input[2], "real2") << ")); }"
+                  << std::endl;
 
         functions_.emplace_back(func_body.str());
 
@@ -317,11 +1354,12 @@ std::string generator_opencl::co(const node& n)
         std::string func_name("ip_turb3" + std::to_string(count_++));
 
         std::stringstream func_body;
-        func_body << "inline double3 " << func_name
-                  << " (const double3 p) { return (double3)("
-                  << "p.x+(" << co(n.input[1]) << "), "
-                  << "p.y+(" << co(n.input[2]) << "), "
-                  << "p.z+(" << co(n.input[3]) << ")); }" << std::endl;
+        func_body << "inline real3 " << func_name
+                  << " (const real3 p) { return (real3)("
+                  << "p.x+(" << co(n.input[1], "real3") << "), "
+                  << "p.y+(" << co(n.input[2], "real3") << "), "
+                  << "p.z+(" << co(n.input[3], "real3") << ")); }"
+                  << std::endl;
 
         functions_.emplace_back(func_body.str());
 
@@ -332,10 +1370,11 @@ std::string generator_opencl::co(const node& n)
         std::string func_name("ip_worley" + std::to_string(count_++));
 
         std::stringstream func_body;
-        func_body << "inline double " << func_name
-                  << " (const double2 q, uint seed) { "
-                  << "  double2 p = p_worley(q, seed);"
-                  << "  return " << co(n.input[1]) << "; }" << std::endl;
+        func_body << "inline real " << func_name
+                  << " (const real2 q, uint seed) { "
+                  << "  real2 p = p_worley(q, seed);"
+                  << "  return " << co(n.input[1], "real2") << "; }"
+                  << std::endl;
 
         functions_.emplace_back(func_body.str());
         return func_name + "(" + co(n.input[0]) + "," + co(n.input[2]) + ")";
@@ -345,10 +1384,11 @@ std::string generator_opencl::co(const node& n)
         std::string func_name("ip_worley3" + std::to_string(count_++));
 
         std::stringstream func_body;
-        func_body << "inline double " << func_name
-                  << " (const double3 q, uint seed) { "
-                  << "  double3 p = p_worley3(q, seed);"
-                  << "  return " << co(n.input[1]) << "; }" << std::endl;
+        func_body << "inline real " << func_name
+                  << " (const real3 q, uint seed) { "
+                  << "  real3 p = p_worley3(q, seed);"
+                  << "  return " << co(n.input[1], "real3") << "; }"
+                  << std::endl;
 
         functions_.emplace_back(func_body.str());
         return func_name + "(" + co(n.input[0]) + "," + co(n.input[2]) + ")";
@@ -358,10 +1398,11 @@ std::string generator_opencl::co(const node& n)
         std::string func_name("ip_voronoi" + std::to_string(count_++));
 
         std::stringstream func_body;
-        func_body << "inline double " << func_name
-                  << " (const double2 q, uint seed) { "
-                  << "  double2 p = p_voronoi(q, seed);"
-                  << "  return " << co(n.input[1]) << "; }" << std::endl;
+        func_body << "inline real " << func_name
+                  << " (const real2 q, uint seed) { "
+                  << "  real2 p = p_voronoi(q, seed);"
+                  << "  return " << co(n.input[1], "real2") << "; }"
+                  << std::endl;
 
         functions_.emplace_back(func_body.str());
         return func_name + "(" + co(n.input[0]) + "," + co(n.input[2]) + ")";
@@ -385,17 +1426,17 @@ std::string generator_opencl::co(const node& n)
     case node::manhattan3:
         return "p_manhattan3" + pl(n);
     case node::perlin:
-        return "p_perlin" + pl(n);
+        return co_noise(n, "p_perlin");
     case node::perlin3:
-        return "p_perlin3" + pl(n);
+        return co_noise(n, "p_perlin3");
     case node::simplex:
-        return "p_simplex" + pl(n);
+        return co_noise(n, "p_simplex");
     case node::simplex3:
-        return "p_simplex3" + pl(n);
+        return co_noise(n, "p_simplex3");
     case node::opensimplex:
-        return "p_opensimplex" + pl(n);
+        return co_noise(n, "p_opensimplex");
     case node::opensimplex3:
-        return "p_opensimplex3" + pl(n);
+        return co_noise(n, "p_opensimplex3");
     case node::x:
         return co(n.input[0]) + ".x";
     case node::y:
@@ -405,7 +1446,7 @@ std::string generator_opencl::co(const node& n)
     case node::xy:
         return co(n.input[0]) + ".xy";
     case node::zplane:
-        return "(double3)(" + co(n.input[0]) + "," + co(n.input[1]) + ")";
+        return "(real3)(" + co(n.input[0]) + "," + co(n.input[1]) + ")";
 
     case node::add:
         return "(" + co(n.input[0]) + "+" + co(n.input[1]) + ")";
@@ -475,9 +1516,27 @@ std::string generator_opencl::co(const node& n)
     case node::is_in_rectangle:
         return "p_is_in_rectangle" + pl(n);
 
-    case node::then_else:
-        return "(" + co(n.input[0]) + ")?(" + co(n.input[1]) + "):("
-               + co(n.input[2]) + ")";
+    case node::then_else: {
+        if (n.input[1].input.empty() && n.input[2].input.empty())
+            return "(" + co(n.input[0]) + ")?(" + co(n.input[1]) + "):("
+                   + co(n.input[2]) + ")";
+
+        // The ternary operator is usually compiled to a select, which
+        // evaluates both sides.  Moving them into a function with an if
+        // statement lets the work-items skip the side they don't need.
+        std::string func_name("ip_then_else_" + std::to_string(count_++));
+        std::string args{scope_.empty() ? "" : ", const " + scope_ + " p"};
+
+        std::stringstream func_body;
+        func_body << type_string(n) << " " << func_name << " (const int c"
+                  << args << ") { if (c) return " << co(n.input[1])
+                  << "; return " << co(n.input[2]) << "; }" << std::endl;
+
+        functions_.emplace_back(func_body.str());
+
+        return func_name + "(" + co(n.input[0])
+               + (scope_.empty() ? "" : ", p") + ")";
+    }
 
     case node::fractal: {
         assert(n.input.size() == 5);
@@ -491,12 +1550,12 @@ std::string generator_opencl::co(const node& n)
 
         std::stringstream func_body;
         func_body
-            << "double " << func_name
-            << " (double2 p, const double lac, const double per) {"
-            << "double result = 0.0; double div = 0.0; double step = 1.0;"
+            << "real " << func_name
+            << " (real2 p, const real lac, const real per) {"
+            << "real result = 0.0; real div = 0.0; real step = 1.0;"
             << "for(int i = 0; i < " << octaves << "; ++i)"
             << "{"
-            << "  result += " << co(n.input[1]) << " * step;"
+            << "  result += " << co(n.input[1], "real2") << " * step;"
             << "  div += step;"
             << "  step *= per;"
             << "  p *= lac;"
@@ -523,12 +1582,12 @@ std::string generator_opencl::co(const node& n)
 
         std::stringstream func_body;
         func_body
-            << "double " << func_name
-            << " (double3 p, const double lac, const double per) {"
-            << "double result = 0.0; double div = 0.0; double step = 1.0;"
+            << "real " << func_name
+            << " (real3 p, const real lac, const real per) {"
+            << "real result = 0.0; real div = 0.0; real step = 1.0;"
             << "for(int i = 0; i < " << octaves << "; ++i)"
             << "{"
-            << "  result += " << co(n.input[1]) << " * step;"
+            << "  result += " << co(n.input[1], "real3") << " * step;"
             << "  div += step;"
             << "  step *= per;"
             << "  p *= lac;"
@@ -549,8 +1608,8 @@ std::string generator_opencl::co(const node& n)
         std::string type{type_string(n.input[0])};
 
         std::stringstream func_body;
-        func_body << "double " << func_name << " (" << type << " p) {"
-                  << "return " << co(n.input[1]) << ";}" << std::endl;
+        func_body << "real " << func_name << " (" << type << " p) {"
+                  << "return " << co(n.input[1], type) << ";}" << std::endl;
 
         functions_.emplace_back(func_body.str());
 
@@ -576,5 +1635,313 @@ std::string generator_opencl::co(const node& n)
     return std::string();
 }
 
+// The dual number type that goes with a node's return type.
+std::string dual_type(const node& n)
+{
+    switch (n.return_type) {
+    case var_t::var:
+        return "dual";
+    case var_t::xy:
+        return "dual2";
+    case var_t::xyz:
+        return "dual3";
+    default:
+        ;
+    }
+    return "$type error$";
+}
+
+std::string generator_opencl::cd(const node& n, const std::string& scope)
+{
+    std::string outer{scope};
+    std::swap(scope_, outer);
+    std::string result{cd(n)};
+    std::swap(scope_, outer);
+    return result;
+}
+
+std::string generator_opencl::cd_noise(const node& n, const std::string& func)
+{
+    auto table = seed_table(n, cntx_);
+    if (table == nullptr)
+        return func + "(" + cd(n.input[0]) + "," + co(n.input[1]) + ")";
+
+    auto found = std::find(permutations_.begin(), permutations_.end(), table);
+    auto index = found - permutations_.begin();
+    if (found == permutations_.end())
+        permutations_.push_back(table);
+
+    return func + "_table(" + cd(n.input[0]) + ", perm"
+           + std::to_string(index) + ")";
+}
+
+// Adds a function that takes the position as dp.  If scope is not empty,
+// the body can use p as well, just like the functions generated by co().
+std::string generator_opencl::cd_function(const std::string& type,
+                                          const std::string& name,
+                                          const std::string& args,
+                                          const std::string& scope,
+                                          const std::string& body)
+{
+    std::string func_name{name + std::to_string(count_++)};
+    std::string value{scope == "real2" ? "d2_value" : "d3_value"};
+
+    std::stringstream func_body;
+    func_body << type << " " << func_name << " (" << args << ") { ";
+    if (!scope.empty())
+        func_body << "const " << scope << " p = " << value << "(dp); ";
+    func_body << body << " }" << std::endl;
+
+    dual_functions_.emplace_back(func_body.str());
+    return func_name;
+}
+
+std::string generator_opencl::cd(const node& n)
+{
+    switch (n.type) {
+    case node::entry_point:
+        return "dp";
+    case node::const_var:
+        return "d_const(" + literal(n.aux_var) + ")";
+
+    case node::rotate:
+        return "d_rotate(" + cd(n.input[0]) + "," + cd(n.input[1]) + ")";
+    case node::rotate3:
+        if (!n.input[1].is_const || !n.input[2].is_const
+            || !n.input[3].is_const) {
+            throw std::runtime_error(
+                "rotate3: the gradient needs a constant axis");
+        }
+        return "d_rotate3(" + cd(n.input[0]) + ", (real3)(" + co(n.input[1])
+               + "," + co(n.input[2]) + "," + co(n.input[3]) + "), "
+               + cd(n.input[4]) + ")";
+    case node::scale:
+        return "d_scale(" + cd(n.input[0]) + "," + cd(n.input[1]) + ")";
+    case node::scale3:
+        return "d_scale3(" + cd(n.input[0]) + "," + cd(n.input[1]) + ")";
+    case node::shift:
+        return "d_shift(" + cd(n.input[0]) + "," + cd(n.input[1]) + ","
+               + cd(n.input[2]) + ")";
+    case node::shift3:
+        return "d_shift3(" + cd(n.input[0]) + "," + cd(n.input[1]) + ","
+               + cd(n.input[2]) + "," + cd(n.input[3]) + ")";
+    case node::swap:
+        return "d_swap(" + cd(n.input[0]) + ")";
+
+    case node::map: {
+        auto name = cd_function(
+            "dual2", "id_map", "const dual2 dp", "real2",
+            "return d2(" + cd(n.input[1], "real2") + ", "
+            + cd(n.input[2], "real2") + ");");
+        return name + "(" + cd(n.input[0]) + ")";
+    }
+    case node::map3: {
+        auto name = cd_function(
+            "dual3", "id_map3", "const dual3 dp", "real3",
+            "return d3(" + cd(n.input[1], "real3") + ", "
+            + cd(n.input[2], "real3") + ", " + cd(n.input[3], "real3")
+            + ");");
+        return name + "(" + cd(n.input[0]) + ")";
+    }
+
+    case node::turbulence: {
+        auto name = cd_function(
+            "dual2", "id_turb", "const dual2 dp", "real2",
+            "return d2(dp.x+(" + cd(n.input[1], "real2") + "), dp.y+("
+            + cd(n.input[2], "real2") + "));");
+        return name + "(" + cd(n.input[0]) + ")";
+    }
+    case node::turbulence3: {
+        auto name = cd_function(
+            "dual3", "id_turb3", "const dual3 dp", "real3",
+            "return d3(dp.x+(" + cd(n.input[1], "real3") + "), dp.y+("
+            + cd(n.input[2], "real3") + "), dp.z+(" + cd(n.input[3], "real3")
+            + "));");
+        return name + "(" + cd(n.input[0]) + ")";
+    }
+
+    case node::worley:
+    case node::worley3:
+        throw std::runtime_error("OpenCL worley gradient not implemented yet");
+
+    case node::voronoi: {
+        auto name = cd_function(
+            "dual", "id_voronoi", "const dual2 q, uint seed", "",
+            "const dual2 dp = d_voronoi(q, seed);"
+            " const real2 p = d2_value(dp); return "
+            + cd(n.input[1], "real2") + ";");
+        return name + "(" + cd(n.input[0]) + "," + co(n.input[2]) + ")";
+    }
+
+    case node::angle:
+        return "d_angle(" + cd(n.input[0]) + ")";
+    case node::chebyshev:
+        return "d_chebyshev(" + cd(n.input[0]) + ")";
+    case node::chebyshev3:
+        return "d_chebyshev3(" + cd(n.input[0]) + ")";
+    case node::checkerboard:
+    case node::checkerboard3:
+        return "d_const(" + co(n) + ")";
+    case node::distance:
+        return "d_length2(" + cd(n.input[0]) + ")";
+    case node::distance3:
+        return "d_length3(" + cd(n.input[0]) + ")";
+    case node::manhattan:
+        return "d_manhattan(" + cd(n.input[0]) + ")";
+    case node::manhattan3:
+        return "d_manhattan3(" + cd(n.input[0]) + ")";
+    case node::perlin:
+        return cd_noise(n, "p_perlin_d");
+    case node::perlin3:
+        return cd_noise(n, "p_perlin3_d");
+    case node::simplex:
+        return cd_noise(n, "p_simplex_d");
+    case node::simplex3:
+        return cd_noise(n, "p_simplex3_d");
+    case node::opensimplex:
+        return cd_noise(n, "p_opensimplex_d");
+    case node::opensimplex3:
+        return cd_noise(n, "p_opensimplex3_d");
+    case node::x:
+        return cd(n.input[0]) + ".x";
+    case node::y:
+        return cd(n.input[0]) + ".y";
+    case node::z:
+        return cd(n.input[0]) + ".z";
+    case node::xy:
+        return "d3_xy(" + cd(n.input[0]) + ")";
+    case node::zplane:
+        return "d_zplane(" + cd(n.input[0]) + "," + cd(n.input[1]) + ")";
+
+    case node::add:
+        return "(" + cd(n.input[0]) + "+" + cd(n.input[1]) + ")";
+    case node::sub:
+        return "(" + cd(n.input[0]) + "-" + cd(n.input[1]) + ")";
+    case node::mul:
+        return "d_mul(" + cd(n.input[0]) + "," + cd(n.input[1]) + ")";
+    case node::div:
+        return "d_div(" + cd(n.input[0]) + "," + cd(n.input[1]) + ")";
+
+    case node::abs:
+        return "d_abs(" + cd(n.input[0]) + ")";
+    case node::blend:
+        return "d_blend(" + cd(n.input[0]) + "," + cd(n.input[1]) + ","
+               + cd(n.input[2]) + ")";
+    case node::cos:
+        return "d_cospi(" + cd(n.input[0]) + ")";
+    case node::min:
+        return "d_min(" + cd(n.input[0]) + "," + cd(n.input[1]) + ")";
+    case node::max:
+        return "d_max(" + cd(n.input[0]) + "," + cd(n.input[1]) + ")";
+    case node::neg:
+        return "-" + cd(n.input[0]);
+
+    case node::pow: {
+        if (n.input[1].is_const) {
+            double exp(std::floor(n.input[1].aux_var));
+            if (std::abs(exp - n.input[1].aux_var) < 1e-9)
+                return "d_pown(" + cd(n.input[0]) + ","
+                       + std::to_string((int)exp) + ")";
+        }
+        return "d_pow(" + cd(n.input[0]) + "," + cd(n.input[1]) + ")";
+    }
+
+    case node::round:
+        return "d_round(" + cd(n.input[0]) + ")";
+    case node::saw:
+        return "d_saw(" + cd(n.input[0]) + ")";
+    case node::sin:
+        return "d_sinpi(" + cd(n.input[0]) + ")";
+    case node::sqrt:
+        return "d_sqrt(" + cd(n.input[0]) + ")";
+    case node::tan:
+        return "d_tanpi(" + cd(n.input[0]) + ")";
+
+    case node::then_else: {
+        if (n.input[1].input.empty() && n.input[2].input.empty())
+            return "(" + co(n.input[0]) + ")?(" + cd(n.input[1]) + "):("
+                   + cd(n.input[2]) + ")";
+
+        std::string args{"const int c"};
+        if (!scope_.empty())
+            args += ", const dual" + scope_.substr(4) + " dp";
+
+        auto name = cd_function(dual_type(n), "id_then_else_", args, scope_,
+                                "if (c) return " + cd(n.input[1])
+                                + "; return " + cd(n.input[2]) + ";");
+
+        return name + "(" + co(n.input[0])
+               + (scope_.empty() ? "" : ", dp") + ")";
+    }
+
+    // The octaves are moved apart by adding a constant, so only the value
+    // of dp.x changes there.
+    case node::fractal:
+    case node::fractal3: {
+        assert(n.input.size() == 5);
+        if (!n.input[2].is_const)
+            throw std::runtime_error(
+                "fractal octave count must be a constexpr");
+
+        int octaves(std::min<int>(n.input[2].aux_var, OPENCL_OCTAVES_LIMIT));
+        bool is3d{n.type == node::fractal3};
+        std::string scope{is3d ? "real3" : "real2"};
+
+        std::stringstream body;
+        body << "dual result = d_const(0.0); dual div = d_const(0.0);"
+             << "dual step = d_const(1.0);"
+             << "for(int i = 0; i < " << octaves << "; ++i)"
+             << "{"
+             << "  const " << scope << " p = " << (is3d ? "d3" : "d2")
+             << "_value(dp);"
+             << "  result += d_mul(" << cd(n.input[1], scope) << ", step);"
+             << "  div += step;"
+             << "  step = d_mul(step, per);"
+             << "  dp.x = d_mul(dp.x, lac);"
+             << "  dp.y = d_mul(dp.y, lac);"
+             << (is3d ? "  dp.z = d_mul(dp.z, lac);" : "")
+             << "  dp.x.x += 12345.0;"
+             << "}"
+             << "return d_div(result, div);";
+
+        auto name = cd_function(
+            "dual", is3d ? "id_fractal3_" : "id_fractal_",
+            std::string(is3d ? "dual3" : "dual2")
+            + " dp, const dual lac, const dual per", "", body.str());
+
+        return name + "(" + cd(n.input[0]) + "," + cd(n.input[3]) + ","
+               + cd(n.input[4]) + ")";
+    }
+
+    case node::lambda_: {
+        assert(n.input.size() == 2);
+        std::string type{type_string(n.input[0])};
+
+        auto name = cd_function("dual", "id_lambda_",
+                                dual_type(n.input[0]) + " dp", type,
+                                "return " + cd(n.input[1], type) + ";");
+
+        return name + "(" + cd(n.input[0]) + ")";
+    }
+
+    case node::external_:
+        throw std::runtime_error("OpenCL @external not implemented yet");
+
+    case node::curve_linear:
+        throw std::runtime_error("OpenCL curve_linear not implemented yet");
+
+    case node::curve_spline:
+        throw std::runtime_error("OpenCL curve_spline not implemented yet");
+
+    case node::png_lookup:
+        throw std::runtime_error("OpenCL png_lookup not implemented yet");
+
+    default:
+        throw std::runtime_error("function not implemented in OpenCL yet");
+    }
+
+    return std::string();
+}
+
 } // namespace noise
 } // namespace hexa
@@ -6,9 +6,14 @@
 //---------------------------------------------------------------------------
 #pragma once
 
+#include <atomic>
+#include <future>
 #include <string>
 #include <sstream>
 #include <list>
+#include <map>
+#include <mutex>
+#include <vector>
 
 #define __CL_ENABLE_EXCEPTIONS
 #include "cl.hpp"
@@ -22,53 +27,389 @@ namespace noise
 
 class node;
 
-/** Use OpenCL to execute a HNDL script. */
+/** Use OpenCL to execute a HNDL script.
+ *  The script is built in double precision, if the device supports it.
+ *  It is built again in single precision when run_float() is used for
+ *  the first time.  On devices without double precision support, only
+ *  the single precision version is built, and run() and run_int16()
+ *  widen its results.
+ *
+ *  Single precision results differ from those in double precision by
+ *  more than just rounding, because the coordinates are stored in floats
+ *  as well.  Perlin noise, computed on the CPU with every intermediate
+ *  position rounded to a float, has these absolute errors:
+ *   - coordinates around 2.5: 5e-7
+ *   - coordinates around 250: 5e-5
+ *   - every octave of fractal() adds up to 1e-3, because the position
+ *     is moved by 12345 in every octave, where a float only has a
+ *     resolution of about 1/1000.
+ *  The built-in functions are also compiled with -cl-fast-relaxed-math,
+ *  which allows for a few ulp of error in sin, cos, pow and so on.
+ *
+ *  run_with_gradient() uses a third program, built the first time it is
+ *  needed, that evaluates the script with dual numbers.  Everything but
+ *  worley and worley3 is supported; rotate3 needs a constant axis.
+ *  Scripts that use anything else are handed to the dual numbers of
+ *  generator_slowinterpreter on the CPU instead.
+ *
+ *  Building a program takes a while, so the results are cached twice.
+ *  Generators with the same source code, build options, and device share
+ *  the program they were built from, for as long as the process runs.
+ *  The program binaries are also kept in a cache directory, where they
+ *  are found by a hash of the source code, the build options, and the
+ *  name and driver version of the device.  A binary that the driver
+ *  rejects is simply built again.  Nothing but speed depends on the
+ *  cache directory; if it cannot be written to, it is not used.
+ *
+ *  Most of the code is the noise functions of the prelude, which are the
+ *  same for every script.  If the device has an OpenCL 1.2 linker, they
+ *  are compiled only once per device and build options, and every
+ *  script is compiled on its own and linked against them.  Otherwise,
+ *  or if that fails, the whole program is built from source.
+ *
+ *  The results are written to buffers that are kept in a pool, and used
+ *  again by later runs of about the same size.  On devices that share
+ *  their memory with the host, a contiguous output array is handed to
+ *  the kernel directly instead.  run_mapped() returns a view of a
+ *  pooled buffer itself, which saves copying the results at all.
+ *
+ *  run_async() queues the kernel and the transfer of its results on one
+ *  of two extra command queues, taking turns, so the transfer of one
+ *  chunk overlaps with the kernel of the next.  The future it returns is
+ *  deferred: get() waits for the transfer on the calling thread. */
 class generator_opencl : public generator_i
 {
+public:
+    /** The results of run_mapped(), read straight from an OpenCL buffer
+     *  that is mapped into host memory.  The buffer goes back to the pool
+     *  of the generator when the view is released or destroyed, so the
+     *  view must not outlive the generator. */
+    template <typename T>
+    class mapped_result
+    {
+    public:
+        mapped_result()
+            : owner_(nullptr)
+            , data_(nullptr)
+            , size_(0)
+            , capacity_(0)
+        {
+        }
+
+        mapped_result(mapped_result&& move)
+            : owner_(move.owner_)
+            , buffer_(std::move(move.buffer_))
+            , data_(move.data_)
+            , size_(move.size_)
+            , capacity_(move.capacity_)
+        {
+            move.owner_ = nullptr;
+            move.data_ = nullptr;
+            move.size_ = 0;
+        }
+
+        mapped_result& operator=(mapped_result&& move)
+        {
+            if (this != &move) {
+                release();
+                owner_ = move.owner_;
+                buffer_ = std::move(move.buffer_);
+                data_ = move.data_;
+                size_ = move.size_;
+                capacity_ = move.capacity_;
+                move.owner_ = nullptr;
+                move.data_ = nullptr;
+                move.size_ = 0;
+            }
+            return *this;
+        }
+
+        mapped_result(const mapped_result&) = delete;
+        mapped_result& operator=(const mapped_result&) = delete;
+
+        ~mapped_result() { release(); }
+
+        /** The samples, in the same order as the results of run(). */
+        const T* data() const { return data_; }
+        const T* begin() const { return data_; }
+        const T* end() const { return data_ + size_; }
+
+        /** The number of samples. */
+        size_t size() const { return size_; }
+
+        const T& operator[](size_t i) const { return data_[i]; }
+
+        /** Unmap the buffer and give it back to the generator.  The view
+         *  is empty afterwards. */
+        void release()
+        {
+            if (owner_)
+                owner_->unmap(buffer_, const_cast<T*>(data_), capacity_);
+
+            owner_ = nullptr;
+            data_ = nullptr;
+            size_ = 0;
+        }
+
+    private:
+        friend class generator_opencl;
+
+        const generator_opencl* owner_;
+        cl::Buffer buffer_;
+        const T* data_;
+        size_t size_;
+        size_t capacity_;
+    };
+
 public:
     /** Set up a new generator
      * @param context  Shared data
      * @param opencl_context  The OpenCL context
      * @param opencl_device   The script will be executed on this device
      * @param n               The compiled script
+     * @param cache_dir       Where to keep the program binaries; if this
+     *                        is empty, the default cache directory of
+     *                        generator_native is used
+     * @throw std::runtime_error with the build log, if the program could
+     *                           not be built
      */
     generator_opencl(const generator_context& context,
                      cl::Context& opencl_context, cl::Device& opencl_device,
-                     const node& n);
+                     const node& n,
+                     const std::string& cache_dir = std::string());
+
+    /** Returns the generated OpenCL source code, including the
+     *  prelude. */
+    std::string opencl_sourcecode() const;
+
+    /** Returns true if the device supports double precision. */
+    bool has_fp64() const { return fp64_; }
+
+    /** Returns true if one of the programs of this generator was made by
+     *  linking the script against the precompiled noise functions.
+     *  Programs that were found in the cache in memory or on disk do not
+     *  count. */
+    bool linked() const { return linked_; }
+
+    /** Returns the generated OpenCL source code of the gradient kernels,
+     *  or an empty string if the script uses a function that has no
+     *  gradient in OpenCL. */
+    std::string opencl_gradient_sourcecode() const;
+
+    /** Run the script on a grid, and map the results into host memory,
+     *  instead of copying them to an array.  On CPU devices, the view
+     *  points to the memory the kernel wrote to.  The tile cache is not
+     *  used.
+     * @throw std::runtime_error if the device has no double precision;
+     *                           use run_float_mapped() instead */
+    mapped_result<double> run_mapped(const glm::dvec2& corner,
+                                     const glm::dvec2& step,
+                                     const glm::ivec2& count) const;
+
+    mapped_result<double> run_mapped(const glm::dvec3& corner,
+                                     const glm::dvec3& step,
+                                     const glm::ivec3& count) const;
+
+    /** Like run_mapped(), in single precision. */
+    mapped_result<float> run_float_mapped(const glm::dvec2& corner,
+                                          const glm::dvec2& step,
+                                          const glm::ivec2& count) const;
+
+    mapped_result<float> run_float_mapped(const glm::dvec3& corner,
+                                          const glm::dvec3& step,
+                                          const glm::ivec3& count) const;
+
+protected:
+    const char* tile_tag() const override { return "opencl"; }
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, double* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, const quantizer& q, void* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, float* output,
+                  size_t row_pitch) const override;
 
-    /** Returns the generated OpenCL source code. */
-    std::string opencl_sourcecode() const { return main_; }
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, double* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
 
-    std::vector<double> run(const glm::dvec2& corner, const glm::dvec2& step,
-                            const glm::ivec2& count) override;
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, const quantizer& q, void* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
 
-    std::vector<int16_t> run_int16(const glm::dvec2& corner,
-                                   const glm::dvec2& step,
-                                   const glm::ivec2& count) override;
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, float* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
 
-    std::vector<double> run(const glm::dvec3& corner, const glm::dvec3& step,
-                            const glm::ivec3& count) override;
+    void generate(const glm::dvec2* points, size_t n,
+                  double* output) const override;
 
-    std::vector<int16_t> run_int16(const glm::dvec3& corner,
-                                   const glm::dvec3& step,
-                                   const glm::ivec3& count) override;
+    void generate(const glm::dvec3* points, size_t n,
+                  double* output) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, glm::dvec3* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, glm::dvec4* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
+
+    std::future<std::vector<double>>
+    generate_async(const glm::dvec2& corner, const glm::dvec2& step,
+                   const glm::ivec2& count) const override;
+
+    std::future<std::vector<double>>
+    generate_async(const glm::dvec3& corner, const glm::dvec3& step,
+                   const glm::ivec3& count) const override;
+
+    std::future<std::vector<float>>
+    generate_float_async(const glm::dvec2& corner, const glm::dvec2& step,
+                         const glm::ivec2& count) const override;
+
+    std::future<std::vector<float>>
+    generate_float_async(const glm::dvec3& corner, const glm::dvec3& step,
+                         const glm::ivec3& count) const override;
 
 private:
+    /** The kernels of one build of the program. */
+    struct kernel_set
+    {
+        cl::Kernel grid;
+        cl::Kernel grid3;
+        cl::Kernel quantized;
+        cl::Kernel quantized3;
+        cl::Kernel points;
+        cl::Kernel points3;
+    };
+
+    void make_kernels(const cl::Program& program, kernel_set& k) const;
+
+    /** Run a kernel on a grid, with its results in the given buffer. */
+    template <typename SetArgs>
+    void enqueue(SetArgs set_args, const glm::ivec3& count,
+                 const cl::Buffer& buffer, cl::CommandQueue& queue) const;
+
+    template <typename T, typename SetArgs>
+    void execute(SetArgs set_args, const glm::ivec3& count, T* output,
+                 size_t row_pitch, size_t slice_pitch) const;
+
+    template <typename SetArgs>
+    void execute(SetArgs set_args, const glm::ivec3& count, quantized format,
+                 void* output, size_t row_pitch, size_t slice_pitch) const;
+
+    template <typename T, typename SetArgs>
+    mapped_result<T> execute_mapped(SetArgs set_args,
+                                    const glm::ivec3& count) const;
+
+    template <typename T, typename SetArgs>
+    std::future<std::vector<T>> execute_async(SetArgs set_args,
+                                              const glm::ivec3& count) const;
+
+    template <typename Real, typename Pick>
+    void gather(Pick pick, const Real* points, size_t dims, size_t n,
+                Real* output) const;
+
     std::string pl(const node& n);
     std::string co(const node& n);
 
+    /** Generate code for a function body, where p has another type.
+     * @param n      The node
+     * @param scope  The OpenCL type of p in the function */
+    std::string co(const node& n, const std::string& scope);
+    std::string co_noise(const node& n, const std::string& func);
+
+    /** Generate code that computes a node as a dual number, that is,
+     *  together with its derivatives.  The position is called dp, and
+     *  p holds its value, so co() can be used for the parts that don't
+     *  need derivatives (seeds, conditions, and so on). */
+    std::string cd(const node& n);
+    std::string cd(const node& n, const std::string& scope);
+    std::string cd_noise(const node& n, const std::string& func);
+    std::string cd_function(const std::string& type, const std::string& name,
+                            const std::string& args, const std::string& scope,
+                            const std::string& body);
+
+    /** The permutation tables and helper functions, in OpenCL code. */
+    std::string definitions() const;
+
+    /** Build a program from the prelude and a part of the generated
+     *  code, or get it from the cache. */
+    cl::Program build(const std::string& source,
+                      const std::string& options) const;
+
+    /** Compile the generated code, and link it against the noise
+     *  functions.
+     * @return The program, or an empty one if this is not possible */
+    cl::Program link(const std::string& source,
+                     const std::string& flags) const;
+    void build_fp32() const;
+    void build_gradient() const;
+
+    /** Take a buffer of at least 'bytes' from the pool, or make one.
+     * @param bytes     The size that is needed
+     * @param capacity  Set to the real size of the buffer */
+    cl::Buffer acquire(size_t bytes, size_t& capacity) const;
+
+    /** Put a buffer back in the pool. */
+    void release(cl::Buffer buffer, size_t capacity) const;
+
+    /** Unmap a buffer of a mapped_result, and put it back. */
+    void unmap(cl::Buffer& buffer, void* data, size_t capacity) const;
+
 private:
     size_t count_;
+    /** The generated code, without the prelude */
     std::string main_;
     std::list<std::string> functions_;
+    /** The functions generated by cd(). */
+    std::list<std::string> dual_functions_;
+    /** The generated code of the gradient kernels, without the prelude.
+     *  Empty if the script has to fall back to the interpreter. */
+    std::string gradient_;
+    /** The OpenCL type of p at the current point in the code generation,
+     *  or empty if the script doesn't have an input. */
+    std::string scope_;
+    /** The permutation tables used by the script, if seed tables are
+     *  enabled.  Table i is called perm<i> in the OpenCL code. */
+    std::vector<const generator_context::permutation*> permutations_;
+    bool make_2d_;
+    bool make_3d_;
+    bool fp64_;
+    /** True if the device can link programs */
+    bool link_;
+    /** True if link() made one of the programs */
+    mutable std::atomic<bool> linked_;
+    /** True if the device shares its memory with the host */
+    bool unified_;
+    std::string cache_dir_;
 
     cl::Context context_;
     cl::Device device_;
-    cl::CommandQueue queue_;
+    mutable cl::CommandQueue queue_;
+    /** The queues for run_async() */
+    mutable std::vector<cl::CommandQueue> async_queues_;
+    mutable std::atomic<unsigned int> next_queue_;
     cl::Program program_;
-    cl::Kernel kernel_;
-    cl::Kernel kernel_int16_;
-    cl::Kernel kernel3_;
+    mutable cl::Program program32_;
+    mutable cl::Program program_grad_;
+
+    // OpenCL copies the kernel arguments when the kernel is enqueued, so
+    // the lock is only needed between setArg() and enqueueNDRangeKernel().
+    mutable std::mutex mutex_;
+    mutable kernel_set kernels_;
+    mutable kernel_set kernels32_;
+    mutable cl::Kernel grad_;
+    mutable cl::Kernel grad3_;
+
+    /** Buffers that are not in use, by size. */
+    mutable std::multimap<size_t, cl::Buffer> pool_;
+    mutable std::mutex pool_mutex_;
 };
 
 }
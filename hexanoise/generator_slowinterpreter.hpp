@@ -11,6 +11,7 @@
 #include <unordered_map>
 #include <glm/glm.hpp>
 
+#include "dual.hpp"
 #include "generator_i.hpp"
 
 namespace hexa
@@ -20,46 +21,137 @@ namespace noise
 
 class node;
 
-/** A rather slow interpreter for noise scripts. */
+/** A rather slow interpreter for noise scripts.
+ *  All state that changes during an evaluation is kept in a frame on
+ *  the stack, so one instance can be used by several threads at once. */
 class generator_slowinterpreter : public generator_i
 {
 public:
     /** Set up an interpreter
      * @param context  Shared data
      * @param n        The compiled noise script to execute
+     * @param cache    False to leave the tile cache and store of the
+     *                 context alone
      */
-    generator_slowinterpreter(const generator_context& context, const node& n);
+    generator_slowinterpreter(const generator_context& context, const node& n,
+                              bool cache = true);
 
-    std::vector<double> run(const glm::dvec2& corner, const glm::dvec2& step,
-                            const glm::ivec2& count) override;
+    /** Evaluate a value at the origin, without going through run().
+     *  This is meant for the parts of a script that do not depend on the
+     *  position, such as functions of constants.
+     * @param n  The node to evaluate; it does not have to be part of the
+     *           script the interpreter was set up with, as long as it
+     *           does not use noise functions
+     * @return The result */
+    double value(const node& n) const;
 
-    std::vector<int16_t> run_int16(const glm::dvec2& corner,
-                                   const glm::dvec2& step,
-                                   const glm::ivec2& count) override;
+    /** Evaluate a condition at the origin, like value(). */
+    bool condition(const node& n) const;
 
-    std::vector<double> run(const glm::dvec3& corner, const glm::dvec3& step,
-                            const glm::ivec3& count) override;
+protected:
+    const char* tile_tag() const override { return "interpreter"; }
 
-    std::vector<int16_t> run_int16(const glm::dvec3& corner,
-                                   const glm::dvec3& step,
-                                   const glm::ivec3& count) override;
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, double* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, const quantizer& q, void* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, float* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, double* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, const quantizer& q, void* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, float* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec2* points, size_t n,
+                  double* output) const override;
+
+    void generate(const glm::dvec3* points, size_t n,
+                  double* output) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, glm::dvec3* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, glm::dvec4* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
 
 private:
-    double eval(const glm::dvec2& p, const node& n);
-    double eval(const glm::dvec3& p, const node& n);
+    /** The evaluation state.  Functions such as map and fractal evaluate
+     *  their inputs at a different position; they do so in a new frame. */
+    struct frame
+    {
+        /** The current position */
+        glm::dvec3 p;
+    };
+
+    /** Like frame, but the position also carries its derivatives along
+     *  the axes of the sample position. */
+    struct dual_frame
+    {
+        dual3 p;
+
+        /** The frame of a sample position. */
+        static dual_frame at(const glm::dvec3& p);
+
+        /** The same frame, without the derivatives. */
+        frame values() const { return frame{p.value()}; }
+    };
+
+    template <typename Rows>
+    void for_rows(size_t rows, size_t row_length, Rows f) const;
+
+    template <typename Write>
+    void fill(const glm::dvec2& corner, const glm::dvec2& step,
+              const glm::ivec2& count, size_t row_pitch, Write write) const;
+
+    template <typename Write>
+    void fill(const glm::dvec3& corner, const glm::dvec3& step,
+              const glm::ivec3& count, size_t row_pitch, size_t slice_pitch,
+              Write write) const;
+
+    double eval(const glm::dvec2& p, const node& n) const;
+    double eval(const glm::dvec3& p, const node& n) const;
+
+    double eval_v(const node& n, const frame& fr) const;
+    glm::dvec2 eval_xy(const node& n, const frame& fr) const;
+    glm::dvec3 eval_xyz(const node& n, const frame& fr) const;
+    bool eval_bool(const node& n, const frame& fr) const;
+    double call_lambda(const node& func, const node& in,
+                       const frame& fr) const;
+
+    glm::dvec3 input_vec3(const node& n, int i, const frame& fr) const;
 
-    double eval_v(const node& n);
-    glm::dvec2 eval_xy(const node& n);
-    glm::dvec3 eval_xyz(const node& n);
-    bool eval_bool(const node& n);
-    double call_lambda(const node& func, const node& in);
+    dual grad_v(const node& n, const dual_frame& fr) const;
+    dual2 grad_xy(const node& n, const dual_frame& fr) const;
+    dual3 grad_xyz(const node& n, const dual_frame& fr) const;
+    dual grad_lambda(const node& func, const node& in,
+                     const dual_frame& fr) const;
+    dual3 grad_vec3(const node& n, int i, const dual_frame& fr) const;
 
-    glm::dvec3 input_vec3(const node& n, int i);
+    void find_tables(const node& n);
+    const generator_context::permutation* table(const node& n) const;
 
 private:
     const node& n_;
-    glm::dvec3 p_;
     uint32_t seed_;
+    /** The permutation tables of the noise functions, if seed tables are
+     *  enabled.  Scripts called with the @-operator are included. */
+    std::unordered_map<const node*, const generator_context::permutation*>
+        tables_;
 };
 
 } // namespace noise
@@ -0,0 +1,786 @@
+//---------------------------------------------------------------------------
+// hexanoise/generator_vm.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "generator_vm.hpp"
+
+#define GLM_FORCE_RADIANS
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <glm/gtx/rotate_vector.hpp>
+#include "node.hpp"
+#include "octaves.hpp"
+#include "primitives.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+namespace
+{
+
+const double pi = 3.14159265358979323846;
+
+// Every register holds one value for each sample in the batch, so the
+// components of a coordinate are batch_size doubles apart.
+const size_t batch_size = generator_vm::batch_size;
+
+inline glm::dvec2 load2(const double* r, size_t j)
+{
+    return glm::dvec2{r[j], r[j + batch_size]};
+}
+
+inline glm::dvec3 load3(const double* r, size_t j)
+{
+    return glm::dvec3{r[j], r[j + batch_size], r[j + 2 * batch_size]};
+}
+
+inline void store(double* r, size_t j, const glm::dvec2& v)
+{
+    r[j] = v.x;
+    r[j + batch_size] = v.y;
+}
+
+inline void store(double* r, size_t j, const glm::dvec3& v)
+{
+    r[j] = v.x;
+    r[j + batch_size] = v.y;
+    r[j + 2 * batch_size] = v.z;
+}
+
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+
+generator_vm::generator_vm(const generator_context& context, const node& n)
+    : generator_i(context, n)
+    , code_(n, context)
+    , seed_(static_cast<uint32_t>(
+          boost::get<double>(context.get_global("seed"))))
+{
+}
+
+void generator_vm::generate(const glm::dvec2& corner, const glm::dvec2& step,
+                            const glm::ivec2& count, double* output,
+                            size_t row_pitch) const
+{
+    fill(corner, step, count, row_pitch,
+         [=](size_t i, double v) { output[i] = v; });
+}
+
+void generator_vm::generate(const glm::dvec2& corner, const glm::dvec2& step,
+                            const glm::ivec2& count, const quantizer& q,
+                            void* output, size_t row_pitch) const
+{
+    fill(corner, step, count, row_pitch,
+         [&](size_t i, double v) { q.store(output, i, v); });
+}
+
+void generator_vm::generate(const glm::dvec2& corner, const glm::dvec2& step,
+                            const glm::ivec2& count, float* output,
+                            size_t row_pitch) const
+{
+    fill(corner, step, count, row_pitch, [=](size_t i, double v) {
+        output[i] = static_cast<float>(v);
+    });
+}
+
+void generator_vm::generate(const glm::dvec3& corner, const glm::dvec3& step,
+                            const glm::ivec3& count, double* output,
+                            size_t row_pitch, size_t slice_pitch) const
+{
+    fill(corner, step, count, row_pitch, slice_pitch,
+         [=](size_t i, double v) { output[i] = v; });
+}
+
+void generator_vm::generate(const glm::dvec3& corner, const glm::dvec3& step,
+                            const glm::ivec3& count, const quantizer& q,
+                            void* output, size_t row_pitch,
+                            size_t slice_pitch) const
+{
+    fill(corner, step, count, row_pitch, slice_pitch,
+         [&](size_t i, double v) { q.store(output, i, v); });
+}
+
+void generator_vm::generate(const glm::dvec3& corner, const glm::dvec3& step,
+                            const glm::ivec3& count, float* output,
+                            size_t row_pitch, size_t slice_pitch) const
+{
+    fill(corner, step, count, row_pitch, slice_pitch,
+         [=](size_t i, double v) { output[i] = static_cast<float>(v); });
+}
+
+void generator_vm::generate(const glm::dvec2* points, size_t n,
+                            double* output) const
+{
+    batches(n, [&](size_t i) { return points[i]; },
+            [&](size_t i, double v) { output[i] = v; });
+}
+
+void generator_vm::generate(const glm::dvec3* points, size_t n,
+                            double* output) const
+{
+    batches(n, [&](size_t i) { return points[i]; },
+            [&](size_t i, double v) { output[i] = v; });
+}
+
+template <typename Write>
+void generator_vm::fill(const glm::dvec2& corner, const glm::dvec2& step,
+                        const glm::ivec2& count, size_t row_pitch,
+                        Write write) const
+{
+    batches(
+        count.x * count.y,
+        [&](size_t i) {
+            return corner + glm::dvec2{i % count.x, i / count.x} * step;
+        },
+        [&](size_t i, double v) {
+            write(i % count.x + i / count.x * row_pitch, v);
+        });
+}
+
+template <typename Write>
+void generator_vm::fill(const glm::dvec3& corner, const glm::dvec3& step,
+                        const glm::ivec3& count, size_t row_pitch,
+                        size_t slice_pitch, Write write) const
+{
+    batches(
+        count.x * count.y * count.z,
+        [&](size_t i) {
+            return corner
+                   + glm::dvec3{i % count.x, (i / count.x) % count.y,
+                                i / (count.x * count.y)} * step;
+        },
+        [&](size_t i, double v) {
+            size_t row = i / count.x;
+            write(i % count.x + (row % count.y) * row_pitch
+                  + (row / count.y) * slice_pitch, v);
+        });
+}
+
+template <typename Position, typename Write>
+void generator_vm::batches(size_t total, Position position, Write write) const
+{
+    // Every chunk has its own registers and cell cache, so chunks can run
+    // on different threads.
+    auto chunk = [&](size_t begin, size_t end) {
+        auto regs = registers();
+        cell_cache cells;
+        double* p = &regs[code_.entry * batch_size];
+
+        for (size_t i = begin; i < end; i += batch_size) {
+            size_t n = std::min(batch_size, end - i);
+            for (size_t j = 0; j < n; ++j)
+                store(p, j, position(i + j));
+
+            const double* v = exec(&regs[0], n, cells);
+            for (size_t j = 0; j < n; ++j)
+                write(i + j, v[j]);
+        }
+    };
+
+    auto pool = cntx_.workers();
+    if (pool == nullptr || total <= batch_size)
+        chunk(0, total);
+    else
+        pool->parallel_for(total, pool->grain(total, batch_size), chunk);
+}
+
+// Every level of op_branch gets a set of registers of its own, right
+// after the previous one.  All of them hold the constants.
+std::vector<double> generator_vm::registers() const
+{
+    size_t file = code_.registers * batch_size;
+    std::vector<double> result(file * (code_.nesting + 1), 0.0);
+    for (size_t level = 0; level <= code_.nesting; ++level) {
+        for (auto& c : code_.constants) {
+            std::fill_n(result.begin() + level * file + c.first * batch_size,
+                        batch_size, c.second);
+        }
+    }
+    return result;
+}
+
+const double* generator_vm::exec(double* r, size_t n, cell_cache& cells,
+                                 size_t pc) const
+{
+    typedef bytecode b;
+    const b::instruction* code = &code_.code[0];
+
+    // Scratch space for the batched noise functions, these need a
+    // separate output array and integer seeds.
+    uint32_t seeds[batch_size];
+    double tmp[batch_size];
+
+    for (;;) {
+        const b::instruction& i = code[pc++];
+        double* dst = r + i.dst * batch_size;
+        const double* a = r + i.a * batch_size;
+        const double* ib = r + i.b * batch_size;
+        const double* ic = r + i.c * batch_size;
+        const double* id = r + i.d * batch_size;
+        const double* ie = r + i.e * batch_size;
+
+        // Registers can be reused as soon as they have been read, so dst
+        // may be the same as one of the inputs.  This is why all inputs
+        // for a sample are read before any output is written.
+        switch (i.op) {
+        case b::op_return:
+            return a;
+
+        case b::op_jump:
+            pc = i.aux;
+            break;
+
+        case b::op_jump_if_none:
+            if (std::none_of(a, a + n, [](double v) { return v != 0.0; }))
+                pc = i.aux;
+            break;
+
+        case b::op_jump_if_all:
+            if (std::all_of(a, a + n, [](double v) { return v != 0.0; }))
+                pc = i.aux;
+            break;
+
+        case b::op_select:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] != 0.0 ? ib[j] : ic[j];
+            break;
+
+        case b::op_branch:
+            branch(code_.branches[i.aux], r, n, cells, a, dst);
+            break;
+
+        case b::op_mov:
+            std::copy(a, a + n, dst);
+            break;
+
+        case b::op_mov2:
+            for (size_t j = 0; j < n; ++j)
+                store(dst, j, load2(a, j));
+            break;
+
+        case b::op_mov3:
+            for (size_t j = 0; j < n; ++j)
+                store(dst, j, load3(a, j));
+            break;
+
+        case b::op_xy0:
+            for (size_t j = 0; j < n; ++j)
+                store(dst, j, glm::dvec3{load2(a, j), 0.0});
+            break;
+
+        case b::op_pack2:
+            for (size_t j = 0; j < n; ++j)
+                store(dst, j, glm::dvec2{a[j], ib[j]});
+            break;
+
+        case b::op_pack3:
+            for (size_t j = 0; j < n; ++j)
+                store(dst, j, glm::dvec3{a[j], ib[j], ic[j]});
+            break;
+
+        case b::op_rotate:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                auto t = ib[j] * pi;
+                auto ct = std::cos(t);
+                auto st = std::sin(t);
+                store(dst, j,
+                      glm::dvec2{p.x * ct - p.y * st, p.x * st + p.y * ct});
+            }
+            break;
+
+        case b::op_scale:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                auto s = ib[j];
+                store(dst, j, glm::dvec2{p.x / s, p.y / s});
+            }
+            break;
+
+        case b::op_shift:
+        case b::op_turbulence:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                store(dst, j, glm::dvec2{p.x + ib[j], p.y + ic[j]});
+            }
+            break;
+
+        case b::op_swap:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                store(dst, j, glm::dvec2{p.y, p.x});
+            }
+            break;
+
+        case b::op_angle:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                dst[j] = std::atan2(p.y, p.x) / pi;
+            }
+            break;
+
+        case b::op_chebyshev:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                dst[j] = std::max(std::abs(p.x), std::abs(p.y));
+            }
+            break;
+
+        case b::op_checkerboard:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                auto fl = glm::floor(p);
+                auto fr = p - fl;
+                dst[j] = (fr.x < 0.5) ^ (fr.y < 0.5) ? 1 : -1;
+            }
+            break;
+
+        case b::op_distance:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = glm::length(load2(a, j));
+            break;
+
+        case b::op_manhattan:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                dst[j] = std::abs(p.x) + std::abs(p.y);
+            }
+            break;
+
+        case b::op_perlin:
+            for (size_t j = 0; j < n; ++j)
+                seeds[j] = ib[j];
+            p_perlin(n, a, a + batch_size, seeds, tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_simplex:
+            for (size_t j = 0; j < n; ++j)
+                seeds[j] = seed_ + ib[j];
+            p_simplex(n, a, a + batch_size, seeds, tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_opensimplex:
+            for (size_t j = 0; j < n; ++j)
+                seeds[j] = seed_ + ib[j];
+            p_opensimplex(n, a, a + batch_size, seeds, tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_perlin_table:
+            p_perlin(n, a, a + batch_size, *code_.permutations[i.aux], tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_simplex_table:
+            p_simplex(n, a, a + batch_size, *code_.permutations[i.aux], tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_opensimplex_table:
+            p_opensimplex(n, a, a + batch_size, *code_.permutations[i.aux],
+                          tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_worley:
+            for (size_t j = 0; j < n; ++j) {
+                auto d = p_worley(load2(a, j), seed_ + ib[j], cells);
+                store(dst, j, glm::dvec3(d, 0.0));
+            }
+            break;
+
+        case b::op_voronoi:
+            for (size_t j = 0; j < n; ++j)
+                store(dst, j, p_voronoi(load2(a, j), seed_ + ib[j], cells));
+            break;
+
+        case b::op_png_lookup: {
+            auto& img = *code_.images[i.aux];
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = png(load2(a, j), img);
+            break;
+        }
+
+        case b::op_abs:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = std::abs(a[j]);
+            break;
+
+        case b::op_add:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] + ib[j];
+            break;
+
+        case b::op_blend:
+            for (size_t j = 0; j < n; ++j) {
+                double l = (a[j] + 1.0) / 2.0;
+                double from = ib[j];
+                double to = ic[j];
+                dst[j] = from + l * (to - from);
+            }
+            break;
+
+        case b::op_cos:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = std::cos(a[j] * pi);
+            break;
+
+        case b::op_curve_linear: {
+            auto& curve = code_.curves[i.aux];
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = curve_linear(a[j], curve);
+            break;
+        }
+
+        case b::op_curve_spline: {
+            auto& curve = code_.curves[i.aux];
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = curve_spline(a[j], curve);
+            break;
+        }
+
+        case b::op_div:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] / ib[j];
+            break;
+
+        case b::op_max:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = std::max(a[j], ib[j]);
+            break;
+
+        case b::op_min:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = std::min(a[j], ib[j]);
+            break;
+
+        case b::op_mul:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] * ib[j];
+            break;
+
+        case b::op_neg:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = -a[j];
+            break;
+
+        case b::op_pow:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = std::pow(a[j], ib[j]);
+            break;
+
+        case b::op_round:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = std::round(a[j]);
+            break;
+
+        case b::op_saw:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] - std::floor(a[j]);
+            break;
+
+        case b::op_sin:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = std::sin(a[j] * pi);
+            break;
+
+        case b::op_sqrt:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = std::sqrt(a[j]);
+            break;
+
+        case b::op_sub:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] - ib[j];
+            break;
+
+        case b::op_tan:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = std::tan(a[j] * pi);
+            break;
+
+        case b::op_band:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] != 0.0 && ib[j] != 0.0;
+            break;
+
+        case b::op_bnot:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] == 0.0;
+            break;
+
+        case b::op_bor:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] != 0.0 || ib[j] != 0.0;
+            break;
+
+        case b::op_bxor:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = (a[j] != 0.0) ^ (ib[j] != 0.0);
+            break;
+
+        case b::op_is_equal:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] == ib[j];
+            break;
+
+        case b::op_is_greaterthan:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] > ib[j];
+            break;
+
+        case b::op_is_gte:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] >= ib[j];
+            break;
+
+        case b::op_is_lessthan:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] < ib[j];
+            break;
+
+        case b::op_is_lte:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] <= ib[j];
+            break;
+
+        case b::op_is_in_rectangle:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                dst[j] = p.x >= ib[j] && p.y >= ic[j] && p.x <= id[j]
+                         && p.y <= ie[j];
+            }
+            break;
+
+        case b::op_is_in_circle:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                dst[j] = std::sqrt(p.x * p.x + p.y * p.y) <= ib[j];
+            }
+            break;
+
+        case b::op_rotate3:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load3(a, j);
+                auto axis = glm::dvec3(ib[j], ic[j], id[j]);
+                auto angle = ie[j] * pi;
+                store(dst, j, glm::rotate(p, angle, axis));
+            }
+            break;
+
+        case b::op_scale3:
+            for (size_t j = 0; j < n; ++j)
+                store(dst, j, load3(a, j) / ib[j]);
+            break;
+
+        case b::op_shift3:
+        case b::op_turbulence3:
+            for (size_t j = 0; j < n; ++j) {
+                store(dst, j,
+                      load3(a, j) + glm::dvec3{ib[j], ic[j], id[j]});
+            }
+            break;
+
+        case b::op_xplane:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                store(dst, j, glm::dvec3{ib[j], p.y, p.x});
+            }
+            break;
+
+        case b::op_yplane:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                store(dst, j, glm::dvec3{p.x, ib[j], p.y});
+            }
+            break;
+
+        case b::op_zplane:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load2(a, j);
+                store(dst, j, glm::dvec3{p.x, p.y, ib[j]});
+            }
+            break;
+
+        case b::op_chebyshev3:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load3(a, j);
+                dst[j] = std::max(std::max(std::abs(p.x), std::abs(p.y)),
+                                  std::abs(p.z));
+            }
+            break;
+
+        case b::op_checkerboard3:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load3(a, j);
+                auto fl = glm::floor(p);
+                auto fr = p - fl;
+                dst[j] = (fr.x < 0.5) ^ (fr.y < 0.5) ^ (fr.z < 0.5) ? 1 : -1;
+            }
+            break;
+
+        case b::op_distance3:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = glm::length(load3(a, j));
+            break;
+
+        case b::op_manhattan3:
+            for (size_t j = 0; j < n; ++j) {
+                auto p = load3(a, j);
+                dst[j] = std::abs(p.x) + std::abs(p.y) + std::abs(p.z);
+            }
+            break;
+
+        case b::op_perlin3:
+            for (size_t j = 0; j < n; ++j)
+                seeds[j] = ib[j];
+            p_perlin3(n, a, a + batch_size, a + 2 * batch_size, seeds, tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_simplex3:
+            for (size_t j = 0; j < n; ++j)
+                seeds[j] = seed_ + ib[j];
+            p_simplex3(n, a, a + batch_size, a + 2 * batch_size, seeds, tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_opensimplex3:
+            for (size_t j = 0; j < n; ++j)
+                seeds[j] = seed_ + ib[j];
+            p_opensimplex3(n, a, a + batch_size, a + 2 * batch_size, seeds,
+                           tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_perlin3_table:
+            p_perlin3(n, a, a + batch_size, a + 2 * batch_size,
+                      *code_.permutations[i.aux], tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_simplex3_table:
+            p_simplex3(n, a, a + batch_size, a + 2 * batch_size,
+                       *code_.permutations[i.aux], tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_opensimplex3_table:
+            p_opensimplex3(n, a, a + batch_size, a + 2 * batch_size,
+                           *code_.permutations[i.aux], tmp);
+            std::copy(tmp, tmp + n, dst);
+            break;
+
+        case b::op_worley3:
+            for (size_t j = 0; j < n; ++j) {
+                auto d = p_worley3(load3(a, j), seed_ + ib[j], cells);
+                store(dst, j, glm::dvec3(d, 0.0));
+            }
+            break;
+
+        // The fractal state is five registers: sum, divider, multiplier,
+        // current octave, and the number of octaves.  Every sample can
+        // have a different number of octaves, so the loop continues
+        // until the last sample in the batch is done.
+        case b::op_fractal_init:
+            for (size_t j = 0; j < n; ++j) {
+                int octaves = a[j];
+                octaves = std::min(octaves, INTERPRETER_OCTAVES_LIMIT);
+                dst[j] = 0.0;
+                dst[j + batch_size] = 0.0;
+                dst[j + 2 * batch_size] = 1.0;
+                dst[j + 3 * batch_size] = 0.0;
+                dst[j + 4 * batch_size] = octaves;
+            }
+            break;
+
+        case b::op_fractal_loop: {
+            const double* octave = a + 3 * batch_size;
+            const double* octaves = a + 4 * batch_size;
+            bool done = true;
+            for (size_t j = 0; j < n; ++j)
+                done &= !(octave[j] < octaves[j]);
+
+            if (done)
+                pc = i.aux;
+            break;
+        }
+
+        case b::op_fractal_step: {
+            double* sum = dst;
+            double* div = dst + batch_size;
+            double* mul = dst + 2 * batch_size;
+            double* octave = dst + 3 * batch_size;
+            const double* octaves = dst + 4 * batch_size;
+            double* p = r + i.b * batch_size;
+            for (size_t j = 0; j < n; ++j) {
+                if (!(octave[j] < octaves[j]))
+                    continue;
+
+                sum[j] += a[j] * mul[j];
+                div[j] += mul[j];
+                mul[j] *= id[j];
+                auto q = load3(p, j) * ic[j];
+                q.x += 12345;
+                store(p, j, q);
+                octave[j] += 1.0;
+            }
+            break;
+        }
+
+        case b::op_fractal_end:
+            for (size_t j = 0; j < n; ++j)
+                dst[j] = a[j] / a[j + batch_size];
+            break;
+
+        default:
+            throw std::runtime_error("invalid instruction");
+        }
+    }
+}
+
+// If only some of the samples take the branch, they are packed together
+// in the next set of registers, and the branch runs for just those.
+void generator_vm::branch(const bytecode::branch& br, double* r, size_t n,
+                          cell_cache& cells, const double* cond,
+                          double* dst) const
+{
+    size_t lanes[batch_size];
+    size_t k = 0;
+    for (size_t j = 0; j < n; ++j) {
+        if ((cond[j] != 0.0) == br.when)
+            lanes[k++] = j;
+    }
+    if (k == 0)
+        return;
+
+    if (k == n) {
+        const double* v = exec(r, n, cells, br.start);
+        std::copy(v, v + n, dst);
+        return;
+    }
+
+    double* packed = r + code_.registers * batch_size;
+    for (auto reg : br.inputs) {
+        const double* from = r + reg * batch_size;
+        double* to = packed + reg * batch_size;
+        for (size_t j = 0; j < k; ++j)
+            to[j] = from[lanes[j]];
+    }
+
+    const double* v = exec(packed, k, cells, br.start);
+    for (size_t j = 0; j < k; ++j)
+        dst[lanes[j]] = v[j];
+}
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,113 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/generator_vm.hpp
+/// \brief  Executes a compiled HNDL script as register-based bytecode
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "bytecode.hpp"
+#include "generator_i.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+class node;
+class cell_cache;
+
+/** Runs noise scripts on the CPU.
+ *  The script is lowered to bytecode once, in the constructor.  This
+ *  avoids the recursion and pointer chasing of generator_slowinterpreter,
+ *  but produces the exact same results.
+ *
+ *  Samples are evaluated in batches: every instruction is applied to
+ *  batch_size samples at once, with a separate array for every register
+ *  (so x, y and z each get their own array).  The cost of decoding an
+ *  instruction is only paid once per batch, and the inner loops are
+ *  simple enough for the compiler to vectorize.  Every call to run()
+ *  uses its own registers, so it can be called from several threads at
+ *  once.
+ *
+ *  A then_else only runs a branch if some sample in the batch takes it.
+ *  If the samples disagree, an expensive branch runs on just the samples
+ *  that take it, so its cost follows the fraction of samples that need
+ *  it, rather than the fraction of batches. */
+class generator_vm : public generator_i
+{
+public:
+    /** The number of samples that are evaluated together. */
+    static const size_t batch_size = 64;
+
+public:
+    /** Set up a virtual machine
+     * @param context  Shared data
+     * @param n        The compiled noise script to execute
+     */
+    generator_vm(const generator_context& context, const node& n);
+
+    /** Returns the lowered script. */
+    const bytecode& program() const { return code_; }
+
+protected:
+    const char* tile_tag() const override { return "vm"; }
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, double* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, const quantizer& q, void* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec2& corner, const glm::dvec2& step,
+                  const glm::ivec2& count, float* output,
+                  size_t row_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, double* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, const quantizer& q, void* output,
+                  size_t row_pitch, size_t slice_pitch) const override;
+
+    void generate(const glm::dvec3& corner, const glm::dvec3& step,
+                  const glm::ivec3& count, float* output, size_t row_pitch,
+                  size_t slice_pitch) const override;
+
+    void generate(const glm::dvec2* points, size_t n,
+                  double* output) const override;
+
+    void generate(const glm::dvec3* points, size_t n,
+                  double* output) const override;
+
+private:
+    template <typename Write>
+    void fill(const glm::dvec2& corner, const glm::dvec2& step,
+              const glm::ivec2& count, size_t row_pitch, Write write) const;
+
+    template <typename Write>
+    void fill(const glm::dvec3& corner, const glm::dvec3& step,
+              const glm::ivec3& count, size_t row_pitch, size_t slice_pitch,
+              Write write) const;
+
+    template <typename Position, typename Write>
+    void batches(size_t total, Position position, Write write) const;
+
+    std::vector<double> registers() const;
+    const double* exec(double* r, size_t n, cell_cache& cells,
+                       size_t pc = 0) const;
+    void branch(const bytecode::branch& br, double* r, size_t n,
+                cell_cache& cells, const double* cond, double* dst) const;
+
+private:
+    bytecode code_;
+    uint32_t seed_;
+};
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,260 @@
+//---------------------------------------------------------------------------
+// hexanoise/native_prelude.hpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+namespace hexa {
+namespace noise {
+
+// The start of every source file generated by generator_native.  The
+// noise functions themselves are not compiled into the generated code;
+// they are called through native_api, which must have the same layout
+// as the struct of the same name in generator_native.cpp.
+const char* native_prelude = R"xxxxx(
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace {
+
+struct native_api
+{
+    double (*perlin)(double, double, uint32_t);
+    double (*perlin3)(double, double, double, uint32_t);
+    double (*simplex)(double, double, uint32_t);
+    double (*simplex3)(double, double, double, uint32_t);
+    double (*opensimplex)(double, double, uint32_t);
+    double (*opensimplex3)(double, double, double, uint32_t);
+    void (*worley)(double, double, uint32_t, void*, double*);
+    void (*worley3)(double, double, double, uint32_t, void*, double*);
+    void (*voronoi)(double, double, uint32_t, void*, double*);
+    void (*rotate3)(double, double, double, double, double, double, double,
+                    double*);
+    double (*curve_linear)(double, const void*);
+    double (*curve_spline)(double, const void*);
+    double (*png)(double, double, const void*);
+    double (*perlin_table)(double, double, const void*);
+    double (*perlin3_table)(double, double, double, const void*);
+    double (*simplex_table)(double, double, const void*);
+    double (*simplex3_table)(double, double, double, const void*);
+    double (*opensimplex_table)(double, double, const void*);
+    double (*opensimplex3_table)(double, double, double, const void*);
+    void* (*new_cells)();
+    void (*delete_cells)(void*);
+};
+
+struct env
+{
+    const native_api* api;
+    const void* const* data;
+    uint32_t seed;
+    void* cells;
+};
+
+// The cell cache used by one call of an entry point.
+struct cells
+{
+    explicit cells (const native_api* a) : api(a), ptr(a->new_cells()) { }
+    ~cells () { api->delete_cells(ptr); }
+    cells (const cells&) = delete;
+    cells& operator= (const cells&) = delete;
+
+    const native_api* api;
+    void* ptr;
+};
+
+struct v2 { double x, y; };
+struct v3 { double x, y, z; };
+
+const double pi = 3.14159265358979323846;
+
+inline v2 to2 (v3 p) { return v2{p.x, p.y}; }
+inline v3 to3 (v2 p) { return v3{p.x, p.y, 0.0}; }
+
+inline v2 p_rotate (v2 p, double t)
+{
+    t *= pi;
+    double ct = std::cos(t), st = std::sin(t);
+    return v2{p.x * ct - p.y * st, p.x * st + p.y * ct};
+}
+
+inline v3 p_rotate3 (const env& e, v3 p, double ax, double ay, double az,
+                     double t)
+{
+    double r[3];
+    e.api->rotate3(p.x, p.y, p.z, ax, ay, az, t * pi, r);
+    return v3{r[0], r[1], r[2]};
+}
+
+inline v2 p_scale (v2 p, double s) { return v2{p.x / s, p.y / s}; }
+inline v3 p_scale3 (v3 p, double s) { return v3{p.x / s, p.y / s, p.z / s}; }
+
+inline v2 p_shift (v2 p, double x, double y) { return v2{p.x + x, p.y + y}; }
+
+inline v3 p_shift3 (v3 p, double x, double y, double z)
+{
+    return v3{p.x + x, p.y + y, p.z + z};
+}
+
+inline v2 p_swap (v2 p) { return v2{p.y, p.x}; }
+
+inline v3 p_xplane (v2 p, double x) { return v3{x, p.y, p.x}; }
+inline v3 p_yplane (v2 p, double y) { return v3{p.x, y, p.y}; }
+inline v3 p_zplane (v2 p, double z) { return v3{p.x, p.y, z}; }
+
+inline double p_angle (v2 p) { return std::atan2(p.y, p.x) / pi; }
+
+inline double p_chebyshev (v2 p)
+{
+    return std::max(std::abs(p.x), std::abs(p.y));
+}
+
+inline double p_chebyshev3 (v3 p)
+{
+    return std::max(std::max(std::abs(p.x), std::abs(p.y)), std::abs(p.z));
+}
+
+inline double p_checkerboard (v2 p)
+{
+    double fx = p.x - std::floor(p.x), fy = p.y - std::floor(p.y);
+    return (fx < 0.5) ^ (fy < 0.5) ? 1 : -1;
+}
+
+inline double p_checkerboard3 (v3 p)
+{
+    double fx = p.x - std::floor(p.x), fy = p.y - std::floor(p.y),
+           fz = p.z - std::floor(p.z);
+    return (fx < 0.5) ^ (fy < 0.5) ^ (fz < 0.5) ? 1 : -1;
+}
+
+inline double p_distance (v2 p) { return std::sqrt(p.x * p.x + p.y * p.y); }
+
+inline double p_distance3 (v3 p)
+{
+    return std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+}
+
+inline double p_manhattan (v2 p) { return std::abs(p.x) + std::abs(p.y); }
+
+inline double p_manhattan3 (v3 p)
+{
+    return std::abs(p.x) + std::abs(p.y) + std::abs(p.z);
+}
+
+inline double p_blend (double x, double a, double b)
+{
+    double l = (x + 1.0) / 2.0;
+    return a + l * (b - a);
+}
+
+inline double p_saw (double x) { return x - std::floor(x); }
+
+inline bool p_is_in_circle (v2 p, double r)
+{
+    return std::sqrt(p.x * p.x + p.y * p.y) <= r;
+}
+
+inline bool p_is_in_rectangle (v2 p, double x1, double y1, double x2,
+                               double y2)
+{
+    return p.x >= x1 && p.y >= y1 && p.x <= x2 && p.y <= y2;
+}
+
+// Perlin noise uses the seed as is, all other functions add the global
+// seed to it.  (Same as generator_slowinterpreter.)
+inline double p_perlin (const env& e, v2 p, double seed)
+{
+    return e.api->perlin(p.x, p.y, seed);
+}
+
+inline double p_perlin3 (const env& e, v3 p, double seed)
+{
+    return e.api->perlin3(p.x, p.y, p.z, seed);
+}
+
+inline double p_simplex (const env& e, v2 p, double seed)
+{
+    return e.api->simplex(p.x, p.y, e.seed + seed);
+}
+
+inline double p_simplex3 (const env& e, v3 p, double seed)
+{
+    return e.api->simplex3(p.x, p.y, p.z, e.seed + seed);
+}
+
+inline double p_opensimplex (const env& e, v2 p, double seed)
+{
+    return e.api->opensimplex(p.x, p.y, e.seed + seed);
+}
+
+inline double p_opensimplex3 (const env& e, v3 p, double seed)
+{
+    return e.api->opensimplex3(p.x, p.y, p.z, e.seed + seed);
+}
+
+// The same functions with a permutation table instead of a seed.
+inline double p_perlin_table (const env& e, v2 p, const void* perm)
+{
+    return e.api->perlin_table(p.x, p.y, perm);
+}
+
+inline double p_perlin3_table (const env& e, v3 p, const void* perm)
+{
+    return e.api->perlin3_table(p.x, p.y, p.z, perm);
+}
+
+inline double p_simplex_table (const env& e, v2 p, const void* perm)
+{
+    return e.api->simplex_table(p.x, p.y, perm);
+}
+
+inline double p_simplex3_table (const env& e, v3 p, const void* perm)
+{
+    return e.api->simplex3_table(p.x, p.y, p.z, perm);
+}
+
+inline double p_opensimplex_table (const env& e, v2 p, const void* perm)
+{
+    return e.api->opensimplex_table(p.x, p.y, perm);
+}
+
+inline double p_opensimplex3_table (const env& e, v3 p, const void* perm)
+{
+    return e.api->opensimplex3_table(p.x, p.y, p.z, perm);
+}
+
+inline v3 p_worley (const env& e, v2 p, double seed)
+{
+    double r[2];
+    e.api->worley(p.x, p.y, e.seed + seed, e.cells, r);
+    return v3{r[0], r[1], 0.0};
+}
+
+inline v3 p_worley3 (const env& e, v3 p, double seed)
+{
+    double r[2];
+    e.api->worley3(p.x, p.y, p.z, e.seed + seed, e.cells, r);
+    return v3{r[0], r[1], 0.0};
+}
+
+inline v3 p_voronoi (const env& e, v2 p, double seed)
+{
+    double r[3];
+    e.api->voronoi(p.x, p.y, e.seed + seed, e.cells, r);
+    return v3{r[0], r[1], r[2]};
+}
+
+inline double p_png (const env& e, v2 p, const void* img)
+{
+    return e.api->png(p.x, p.y, img);
+}
+
+} // anonymous namespace
+
+)xxxxx";
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,15 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/octaves.hpp
+/// \brief  The most octaves the CPU generators run in a fractal
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+/** fractal() and fractal3() never run more octaves than this in the CPU
+ *  generators.  The analysis of scripts (bounds, octave limits, weights)
+ *  assumes the same limit, so it has to be set for the whole library at
+ *  once. */
+#ifndef INTERPRETER_OCTAVES_LIMIT
+#define INTERPRETER_OCTAVES_LIMIT 16
+#endif
@@ -6,21 +6,455 @@
 
 namespace hexa {
 namespace noise {
-
-const char* opencl_prelude = R"xxxxx(
-
-
-#ifdef cl_khr_fp64
-    #pragma OPENCL EXTENSION cl_khr_fp64 : enable
-#elif defined(cl_amd_fp64)
-    #pragma OPENCL EXTENSION cl_amd_fp64 : enable
+/** Macros and types that every part of the OpenCL code uses. */
+const char* opencl_prelude_types = R"xxxxx(
+
+
+// Scripts are built twice: in double precision, and with HEXANOISE_FP32
+// defined, in single precision.  Everything uses the 'real' types.
+#ifdef HEXANOISE_FP32
+    #define real float
+    #define real2 float2
+    #define real3 float3
+    #define real4 float4
+    #define real16 float16
 #else
-    #error "Double precision floating point not supported by OpenCL implementation."
+    #ifdef cl_khr_fp64
+        #pragma OPENCL EXTENSION cl_khr_fp64 : enable
+    #elif defined(cl_amd_fp64)
+        #pragma OPENCL EXTENSION cl_amd_fp64 : enable
+    #else
+        #error "Double precision floating point not supported by OpenCL implementation."
+    #endif
+
+    #define real double
+    #define real2 double2
+    #define real3 double3
+    #define real4 double4
+    #define real16 double16
 #endif
 
 #define ONE_F1                 (1.0f)
 #define ZERO_F1                (0.0f)
 
+//////////////////////////////////////////////////////////////////////////
+
+// Dual numbers, for run_with_gradient().  The first component is the value,
+// the other three are its derivatives along x, y, and z.  Addition,
+// subtraction, negation, and multiplication by a constant are the plain
+// vector operations.
+typedef real4 dual;
+typedef struct { dual x, y; } dual2;
+typedef struct { dual x, y, z; } dual3;
+
+)xxxxx";
+
+/** Declarations of the functions in opencl_prelude_noise. */
+const char* opencl_prelude_declarations = R"xxxxx(
+
+real perlin (real2 xy, __constant int* perm, uint seed, real2* gradient);
+real perlin3 (real3 xyz, __constant int* perm, uint seed, real3* gradient);
+real simplex (real2 xy, __constant int* perm, uint seed, real2* gradient);
+real simplex3 (real3 p, __constant int* perm, uint seed, real3* gradient);
+real opensimplex (real2 p, __constant int* perm, uint seed, real2* gradient);
+real opensimplex3 (real3 p, __constant int* perm, uint seed, real3* gradient);
+
+real p_perlin (real2 xy, uint seed);
+real p_perlin_table (real2 xy, __constant int* perm);
+real p_perlin3 (real3 xyz, uint seed);
+real p_perlin3_table (real3 xyz, __constant int* perm);
+real p_simplex (real2 xy, uint seed);
+real p_simplex_table (real2 xy, __constant int* perm);
+real p_simplex3 (real3 p, uint seed);
+real p_simplex3_table (real3 p, __constant int* perm);
+real p_opensimplex (real2 p, uint seed);
+real p_opensimplex_table (real2 p, __constant int* perm);
+real p_opensimplex3 (real3 p, uint seed);
+real p_opensimplex3_table (real3 p, __constant int* perm);
+real2 p_worley (const real2 p, uint seed);
+real2 p_worley3 (const real3 p, uint seed);
+real2 p_voronoi (const real2 p, uint seed);
+
+dual p_perlin_d (dual2 p, uint seed);
+dual p_perlin_d_table (dual2 p, __constant int* perm);
+dual p_perlin3_d (dual3 p, uint seed);
+dual p_perlin3_d_table (dual3 p, __constant int* perm);
+dual p_simplex_d (dual2 p, uint seed);
+dual p_simplex_d_table (dual2 p, __constant int* perm);
+dual p_simplex3_d (dual3 p, uint seed);
+dual p_simplex3_d_table (dual3 p, __constant int* perm);
+dual p_opensimplex_d (dual2 p, uint seed);
+dual p_opensimplex_d_table (dual2 p, __constant int* perm);
+dual p_opensimplex3_d (dual3 p, uint seed);
+dual p_opensimplex3_d_table (dual3 p, __constant int* perm);
+
+)xxxxx";
+
+/** Small functions that the generated code calls directly.  They are
+ *  inlined, so they are compiled along with every script. */
+const char* opencl_prelude_helpers = R"xxxxx(
+
+inline real lerp (real x, real a, real b)
+{
+    return mad(x, b - a, a);
+}
+
+inline real2 lerp2d (const real x, const real2 a, const real2 b)
+{
+    return mad(x, b - a, a);
+}
+
+inline real4 lerp4d (const real x, const real4 a, const real4 b)
+{
+    return mad(x, b - a, a);
+}
+
+
+inline real2 p_rotate (real2 p, real a)
+{
+    real t = a * M_PI;
+    return (real2)(p.x * cos(t) - p.y * sin(t), p.x * sin(t) + p.y * cos(t));
+}
+
+inline real16 rotMatrix(real3 a, real angle)
+{
+    const real u2 = a.x * a.x;
+    const real v2 = a.y * a.y;
+    const real w2 = a.z * a.z;
+    const real l = u2 + v2 + w2;
+    const real sl = sqrt(l);
+    const real sa = sin(angle);
+    const real ca = cos(angle);
+
+    return (real16)(
+
+    (u2 + (v2 + w2) * ca) / l,
+    (a.x * a.y * (1.0 - ca) - a.z * sl * sa) / l,
+    (a.x * a.z * (1.0 - ca) + a.y * sl * sa) / l,
+    0.0,
+
+    (a.x * a.y * (1.0 - ca) + a.z * sl * sa) / l,
+    (v2 + (u2 + w2) * ca) / l,
+    (a.y * a.z * (1.0 - ca) - a.x * sl * sa) / l,
+    0.0,
+
+    (a.x * a.z * (1.0 - ca) - a.y * sl * sa) / l,
+    (a.y * a.z * (1.0 - ca) + a.x * sl * sa) / l,
+    (w2 + (u2 + v2) * ca) / l,
+    0.0,
+
+    0.0, 0.0, 0.0, 1.0
+    );
+}
+
+inline real3 p_rotate3 (real3 p, real3 axis, real a)
+{
+    real4 h = (real4)(p, 1);
+    real16 m = rotMatrix(axis, a * M_PI);
+    return (real3)(
+                dot(m.s048C, h),
+                dot(m.s159D, h),
+                dot(m.s26AE, h)
+                );
+}
+
+inline real2 p_swap (real2 p)
+{
+    return (real2)(p.y, p.x);
+}
+
+inline real p_angle (real2 p)
+{
+    return atan2pi(p.y, p.x);
+}
+
+inline real p_chebyshev (real2 p)
+{
+    return fmax(fabs(p.x), fabs(p.y));
+}
+
+inline real p_chebyshev3 (real3 p)
+{
+    return fmax(fmax(fabs(p.x), fabs(p.y)), fabs(p.z));
+}
+
+inline real p_saw (real n)
+{
+    return n - floor(n);
+}
+
+inline real p_checkerboard (real2 p)
+{
+    real2 sp = p - floor(p);
+    return (sp.x < 0.5) ^ (sp.y < 0.5) ? 1.0 : -1.0;
+}
+
+inline real p_checkerboard3 (real3 p)
+{
+    real3 sp = p - floor(p);
+    return (sp.x < 0.5) ^ (sp.y < 0.5) ^ (sp.z < 0.5) ? 1.0 : -1.0;
+}
+
+inline real p_manhattan (real2 p)
+{
+    return fabs(p.x) + fabs(p.y);
+}
+
+inline real p_manhattan3 (real3 p)
+{
+    return fabs(p.x) + fabs(p.y) + fabs(p.z);
+}
+
+inline real p_blend (real x, real a, real b)
+{
+    x = (clamp(x, -1.0, 1.0) + 1.0) / 2.0;
+    return lerp(x, a, b);
+}
+
+inline real p_range (real x, real a, real b)
+{
+    return clamp((a * 0.5 + x + 1.0) * ((b - a) * 0.5), a, b);
+}
+
+inline bool p_is_in_circle (real2 p, real r)
+{
+    return length(p) <= r;
+}
+
+inline bool p_is_in_rectangle (real2 p, real x1, real y1, real x2, real y2)
+{
+    return p.x >= x1 && p.y >= y1 && p.x <= x2 && p.y <= y2;
+}
+
+// Scale, clamp and store a result in a compact format, just like
+// quantizer::store() does.  The formats are: 0 = short, 1 = ushort,
+// 2 = uchar, 3 = half.  Every work item takes the same branch.
+inline void p_store_quantized (__global uchar* out, int i, int format,
+                               real scale, real offset, real lo, real hi,
+                               real v)
+{
+    v = v * scale + offset;
+    v = v >= lo ? (v > hi ? hi : v) : lo;
+    switch (format) {
+    case 0:
+        ((__global short*)out)[i] = (short)floor(v + 0.5);
+        break;
+    case 1:
+        ((__global ushort*)out)[i] = (ushort)floor(v + 0.5);
+        break;
+    case 2:
+        out[i] = (uchar)floor(v + 0.5);
+        break;
+    default:
+        vstore_half_rte(v, i, (__global half*)out);
+    }
+}
+
+
+inline dual d_const (real v)
+{
+    return (dual)(v, 0.0, 0.0, 0.0);
+}
+
+inline dual2 d2 (dual x, dual y)
+{
+    dual2 r; r.x = x; r.y = y;
+    return r;
+}
+
+inline dual3 d3 (dual x, dual y, dual z)
+{
+    dual3 r; r.x = x; r.y = y; r.z = z;
+    return r;
+}
+
+inline dual2 d2_at (real2 p)
+{
+    return d2((dual)(p.x, 1.0, 0.0, 0.0), (dual)(p.y, 0.0, 1.0, 0.0));
+}
+
+inline dual3 d3_at (real3 p)
+{
+    return d3((dual)(p.x, 1.0, 0.0, 0.0), (dual)(p.y, 0.0, 1.0, 0.0),
+              (dual)(p.z, 0.0, 0.0, 1.0));
+}
+
+inline real2 d2_value (dual2 p) { return (real2)(p.x.x, p.y.x); }
+inline real3 d3_value (dual3 p) { return (real3)(p.x.x, p.y.x, p.z.x); }
+inline dual2 d3_xy (dual3 p) { return d2(p.x, p.y); }
+inline dual3 d_zplane (dual2 p, dual z) { return d3(p.x, p.y, z); }
+
+// Apply a function, given its value and its slope at a.x.
+inline dual d_chain (real v, real slope, dual a)
+{
+    return (dual)(v, a.yzw * slope);
+}
+
+inline dual d_chain2 (real v, real2 g, dual2 p)
+{
+    return (dual)(v, p.x.yzw * g.x + p.y.yzw * g.y);
+}
+
+inline dual d_chain3 (real v, real3 g, dual3 p)
+{
+    return (dual)(v, p.x.yzw * g.x + p.y.yzw * g.y + p.z.yzw * g.z);
+}
+
+inline dual d_mul (dual a, dual b)
+{
+    return (dual)(a.x * b.x, a.yzw * b.x + b.yzw * a.x);
+}
+
+inline dual d_div (dual a, dual b)
+{
+    return (dual)(a.x / b.x, (a.yzw * b.x - b.yzw * a.x) / (b.x * b.x));
+}
+
+inline dual d_abs (dual a) { return a.x < 0.0 ? -a : a; }
+inline dual d_min (dual a, dual b) { return b.x < a.x ? b : a; }
+inline dual d_max (dual a, dual b) { return a.x < b.x ? b : a; }
+
+inline dual d_sqrt (dual a)
+{
+    real r = sqrt(a.x);
+    return d_chain(r, 0.5 / r, a);
+}
+
+inline dual d_sinpi (dual a)
+{
+    return d_chain(sinpi(a.x), M_PI * cospi(a.x), a);
+}
+
+inline dual d_cospi (dual a)
+{
+    return d_chain(cospi(a.x), -M_PI * sinpi(a.x), a);
+}
+
+inline dual d_tanpi (dual a)
+{
+    real c = cospi(a.x);
+    return d_chain(tanpi(a.x), M_PI / (c * c), a);
+}
+
+inline dual d_pown (dual a, int n)
+{
+    if (n == 0)
+        return d_const(1.0);
+    return d_chain(pown(a.x, n), n * pown(a.x, n - 1), a);
+}
+
+inline dual d_pow (dual a, dual b)
+{
+    real r = pow(a.x, b.x);
+    dual result = d_chain(r, b.x * pow(a.x, b.x - 1.0), a);
+    if (any(b.yzw != (real3)(0.0)))
+        result.yzw += b.yzw * (r * log(a.x));
+    return result;
+}
+
+inline dual d_round (dual a) { return d_const(round(a.x)); }
+inline dual d_saw (dual a) { return (dual)(p_saw(a.x), a.yzw); }
+
+inline dual d_blend (dual x, dual a, dual b)
+{
+    dual l = (x.x < -1.0 || x.x > 1.0) ? d_const(clamp(x.x, -1.0, 1.0)) : x;
+    l = (l + 1.0) / 2.0;
+    return a + d_mul(l, b - a);
+}
+
+inline dual d_angle (dual2 p)
+{
+    real r2 = p.x.x * p.x.x + p.y.x * p.y.x;
+    return (dual)(atan2pi(p.y.x, p.x.x),
+                  (p.y.yzw * p.x.x - p.x.yzw * p.y.x) / (r2 * M_PI));
+}
+
+// The derivative of a length is not defined at the origin; zero is as
+// good as any other.
+inline dual d_length2 (dual2 p)
+{
+    real r = length(d2_value(p));
+    if (r == 0.0)
+        return d_const(r);
+    return (dual)(r, (p.x.yzw * p.x.x + p.y.yzw * p.y.x) / r);
+}
+
+inline dual d_length3 (dual3 p)
+{
+    real r = length(d3_value(p));
+    if (r == 0.0)
+        return d_const(r);
+    return (dual)(r, (p.x.yzw * p.x.x + p.y.yzw * p.y.x
+                      + p.z.yzw * p.z.x) / r);
+}
+
+inline dual d_manhattan (dual2 p) { return d_abs(p.x) + d_abs(p.y); }
+
+inline dual d_manhattan3 (dual3 p)
+{
+    return d_abs(p.x) + d_abs(p.y) + d_abs(p.z);
+}
+
+inline dual d_chebyshev (dual2 p) { return d_max(d_abs(p.x), d_abs(p.y)); }
+
+inline dual d_chebyshev3 (dual3 p)
+{
+    return d_max(d_max(d_abs(p.x), d_abs(p.y)), d_abs(p.z));
+}
+
+inline dual2 d_scale (dual2 p, dual s) { return d2(d_div(p.x, s), d_div(p.y, s)); }
+
+inline dual3 d_scale3 (dual3 p, dual s)
+{
+    return d3(d_div(p.x, s), d_div(p.y, s), d_div(p.z, s));
+}
+
+inline dual2 d_shift (dual2 p, dual x, dual y) { return d2(p.x + x, p.y + y); }
+
+inline dual3 d_shift3 (dual3 p, dual x, dual y, dual z)
+{
+    return d3(p.x + x, p.y + y, p.z + z);
+}
+
+inline dual2 d_swap (dual2 p) { return d2(p.y, p.x); }
+
+inline dual2 d_rotate (dual2 p, dual a)
+{
+    real t = a.x * M_PI;
+    dual c = d_chain(cos(t), -M_PI * sin(t), a);
+    dual s = d_chain(sin(t), M_PI * cos(t), a);
+    return d2(d_mul(p.x, c) - d_mul(p.y, s), d_mul(p.x, s) + d_mul(p.y, c));
+}
+
+// The axis has to be constant.  The rotation is linear in p, so the
+// derivatives of p are rotated along; turning the angle moves the result
+// along axis x (R p).
+inline dual3 d_rotate3 (dual3 p, real3 axis, dual a)
+{
+    real3 r = p_rotate3(d3_value(p), axis, a.x);
+    real3 turn = cross(normalize(axis), r) * M_PI;
+    real3 dx = p_rotate3((real3)(p.x.y, p.y.y, p.z.y), axis, a.x) + turn * a.y;
+    real3 dy = p_rotate3((real3)(p.x.z, p.y.z, p.z.z), axis, a.x) + turn * a.z;
+    real3 dz = p_rotate3((real3)(p.x.w, p.y.w, p.z.w), axis, a.x) + turn * a.w;
+    return d3((dual)(r.x, dx.x, dy.x, dz.x), (dual)(r.y, dx.y, dy.y, dz.y),
+              (dual)(r.z, dx.z, dy.z, dz.z));
+}
+
+// The closest feature point does not move when the position changes
+// a little.
+inline dual2 d_voronoi (dual2 p, uint seed)
+{
+    real2 r = p_voronoi(d2_value(p), seed);
+    return d2(d_const(r.x), d_const(r.y));
+}
+
+)xxxxx";
+
+/** The noise functions.  This is the bulk of the prelude; on devices that
+ *  support OpenCL 1.2, it is compiled once, and linked with the scripts
+ *  (see generator_opencl). */
+const char* opencl_prelude_noise = R"xxxxx(
+
 __constant int P_MASK = 255;
 __constant int P_SIZE = 256;
 __constant int P[512] = {151,160,137,91,90,15,
@@ -78,29 +512,33 @@ __constant float G[16*4] = {
 __constant uint OFFSET_BASIS = 2166136261;
 __constant uint FNV_PRIME = 16777619;
 
-inline double lerp (double x, double a, double b)
+inline real blend3 (const real a)
 {
-    return mad(x, b - a, a);
+    return a * a * (3.0 - 2.0 * a);
 }
 
-inline double2 lerp2d (const double x, const double2 a, const double2 b)
+inline real blend5 (const real a)
 {
-    return mad(x, b - a, a);
+    return a * a * a * (a * (a * 6.0 - 15.0) + 10.0);
 }
 
-inline double4 lerp4d (const double x, const double4 a, const double4 b)
+inline real blend5_slope (const real a)
 {
-    return mad(x, b - a, a);
+    return 30.0 * a * a * (a - 1.0) * (a - 1.0);
 }
 
-inline double blend3 (const double a)
+// Add the derivative of t^4 * (g . d) to a gradient, where t = r - |d|^2.
+// This is the shape of every corner's share in (Open)Simplex noise.
+inline void add_slope2 (real2* gradient, real t, real2 g, real2 d)
 {
-    return a * a * (3.0 - 2.0 * a);
+    if (gradient)
+        *gradient += (g * t - d * (8.0 * dot(g, d))) * (t * t * t);
 }
 
-inline double blend5 (const double a)
+inline void add_slope3 (real3* gradient, real t, real3 g, real3 d)
 {
-    return a * a * a * (a * (a * 6.0 - 15.0) + 10.0);
+    if (gradient)
+        *gradient += (g * t - d * (8.0 * dot(g, d))) * (t * t * t);
 }
 
 
@@ -124,62 +562,88 @@ inline uint rng (uint last)
 
 //////////////////////////////////////////////////////////////////////////
 
-inline double gradient_noise2d (double2 xy, int2 ixy, uint seed)
+inline real2 gradient2d (int2 ixy, __constant int* perm, uint seed)
 {
     ixy.x += seed * 1013;
     ixy.y += seed * 1619;
     ixy &= P_MASK;
 
-    int index = (P[ixy.x+P[ixy.y]] & G_MASK) * G_VECSIZE;
-    double2 g = (double2)(G[index], G[index+1]);
+    int index = (perm[ixy.x+perm[ixy.y]] & G_MASK) * G_VECSIZE;
+    return (real2)(G[index], G[index+1]);
+}
 
-    return dot(xy, g);
+inline real gradient_noise2d (real2 xy, int2 ixy, __constant int* perm,
+                              uint seed)
+{
+    return dot(xy, gradient2d(ixy, perm, seed));
 }
 
-double p_perlin (double2 xy, uint seed)
+// If gradient is not null, it receives the derivatives of the noise along
+// x and y.  The same goes for the other noise functions below.
+real perlin (real2 xy, __constant int* perm, uint seed, real2* gradient)
 {
-    double2 t = floor(xy);
+    real2 t = floor(xy);
     int2 xy0 = (int2)((int)t.x, (int)t.y);
-    double2 xyf = xy - t;
+    real2 xyf = xy - t;
 
     const int2 I01 = (int2)(0, 1);
     const int2 I10 = (int2)(1, 0);
     const int2 I11 = (int2)(1, 1);
 
-    const double2 F01 = (double2)(0.0, 1.0);
-    const double2 F10 = (double2)(1.0, 0.0);
-    const double2 F11 = (double2)(1.0, 1.0);
-
-    const double n00 = gradient_noise2d(xyf      , xy0, seed);
-    const double n10 = gradient_noise2d(xyf - F10, xy0 + I10, seed);
-    const double n01 = gradient_noise2d(xyf - F01, xy0 + I01, seed);
-    const double n11 = gradient_noise2d(xyf - F11, xy0 + I11, seed);
-
-    const double2 n0001 = (double2)(n00, n01);
-    const double2 n1011 = (double2)(n10, n11);
-    const double2 n2 = lerp2d(blend5(xyf.x), n0001, n1011);
+    const real2 F01 = (real2)(0.0, 1.0);
+    const real2 F10 = (real2)(1.0, 0.0);
+    const real2 F11 = (real2)(1.0, 1.0);
+
+    const real n00 = gradient_noise2d(xyf      , xy0, perm, seed);
+    const real n10 = gradient_noise2d(xyf - F10, xy0 + I10, perm, seed);
+    const real n01 = gradient_noise2d(xyf - F01, xy0 + I01, perm, seed);
+    const real n11 = gradient_noise2d(xyf - F11, xy0 + I11, perm, seed);
+
+    const real2 n0001 = (real2)(n00, n01);
+    const real2 n1011 = (real2)(n10, n11);
+    const real2 n2 = lerp2d(blend5(xyf.x), n0001, n1011);
+
+    if (gradient) {
+        real2 w = (real2)(blend5(xyf.x), blend5(xyf.y));
+        real2 dw = (real2)(blend5_slope(xyf.x), blend5_slope(xyf.y));
+        real2 g = (real2)(0.0);
+        for (int i = 0; i < 2; ++i) {
+            for (int j = 0; j < 2; ++j) {
+                real2 cg = gradient2d(xy0 + (int2)(i, j), perm, seed);
+                real n = dot(xyf - (real2)(i, j), cg);
+                real wx = i ? w.x : 1.0 - w.x, dwx = i ? dw.x : -dw.x;
+                real wy = j ? w.y : 1.0 - w.y, dwy = j ? dw.y : -dw.y;
+                g += cg * (wx * wy) + (real2)(dwx * wy, wx * dwy) * n;
+            }
+        }
+        *gradient = g * 1.227;
+    }
 
     return lerp(blend5(xyf.y), n2.x, n2.y) * 1.227;
 }
 
-inline double gradient_noise3d (int3 ixyz, double3 xyz, uint seed)
+inline real3 gradient3d (int3 ixyz, __constant int* perm, uint seed)
 {
     ixyz.x += seed * 1013;
     ixyz.y += seed * 1619;
     ixyz.z += seed * 997;
     ixyz &= P_MASK;
 
-    int index = (P[ixyz.x+P[ixyz.y+P[ixyz.z]]] & G_MASK) * G_VECSIZE;
-    double3 g = (double3)(G[index], G[index+1], G[index+2]);
+    int index = (perm[ixyz.x+perm[ixyz.y+perm[ixyz.z]]] & G_MASK) * G_VECSIZE;
+    return (real3)(G[index], G[index+1], G[index+2]);
+}
 
-    return dot(xyz, g);
+inline real gradient_noise3d (int3 ixyz, real3 xyz, __constant int* perm,
+                              uint seed)
+{
+    return dot(xyz, gradient3d(ixyz, perm, seed));
 }
 
-double p_perlin3 (double3 xyz, uint seed)
+real perlin3 (real3 xyz, __constant int* perm, uint seed, real3* gradient)
 {
-    double3 t = floor(xyz);
+    real3 t = floor(xyz);
     int3 xyz0 = (int3)((int)t.x, (int)t.y, (int)t.z);
-    double3 xyzf = xyz - t;
+    real3 xyzf = xyz - t;
 
     const int3 I001 = (int3)(0, 0, 1);
     const int3 I010 = (int3)(0, 1, 0);
@@ -189,53 +653,78 @@ double p_perlin3 (double3 xyz, uint seed)
     const int3 I110 = (int3)(1, 1, 0);
     const int3 I111 = (int3)(1, 1, 1);
 
-    const double3 F001 = (double3)(0.0, 0.0, 1.0);
-    const double3 F010 = (double3)(0.0, 1.0, 0.0);
-    const double3 F011 = (double3)(0.0, 1.0, 1.0);
-    const double3 F100 = (double3)(1.0, 0.0, 0.0);
-    const double3 F101 = (double3)(1.0, 0.0, 1.0);
-    const double3 F110 = (double3)(1.0, 1.0, 0.0);
-    const double3 F111 = (double3)(1.0, 1.0, 1.0);
-
-    const double n000 = gradient_noise3d(xyz0       , xyzf       , seed);
-    const double n001 = gradient_noise3d(xyz0 + I001, xyzf - F001, seed);
-    const double n010 = gradient_noise3d(xyz0 + I010, xyzf - F010, seed);
-    const double n011 = gradient_noise3d(xyz0 + I011, xyzf - F011, seed);
-    const double n100 = gradient_noise3d(xyz0 + I100, xyzf - F100, seed);
-    const double n101 = gradient_noise3d(xyz0 + I101, xyzf - F101, seed);
-    const double n110 = gradient_noise3d(xyz0 + I110, xyzf - F110, seed);
-    const double n111 = gradient_noise3d(xyz0 + I111, xyzf - F111, seed);
-
-    double4 n40 = (double4)(n000, n001, n010, n011);
-    double4 n41 = (double4)(n100, n101, n110, n111);
-
-    double4 n4 = lerp4d(blend5(xyzf.x), n40, n41);
-    double2 n2 = lerp2d(blend5(xyzf.y), n4.xy, n4.zw);
-    double n = lerp(blend5(xyzf.z), n2.x, n2.y);
+    const real3 F001 = (real3)(0.0, 0.0, 1.0);
+    const real3 F010 = (real3)(0.0, 1.0, 0.0);
+    const real3 F011 = (real3)(0.0, 1.0, 1.0);
+    const real3 F100 = (real3)(1.0, 0.0, 0.0);
+    const real3 F101 = (real3)(1.0, 0.0, 1.0);
+    const real3 F110 = (real3)(1.0, 1.0, 0.0);
+    const real3 F111 = (real3)(1.0, 1.0, 1.0);
+
+    const real n000 = gradient_noise3d(xyz0       , xyzf       , perm, seed);
+    const real n001 = gradient_noise3d(xyz0 + I001, xyzf - F001, perm, seed);
+    const real n010 = gradient_noise3d(xyz0 + I010, xyzf - F010, perm, seed);
+    const real n011 = gradient_noise3d(xyz0 + I011, xyzf - F011, perm, seed);
+    const real n100 = gradient_noise3d(xyz0 + I100, xyzf - F100, perm, seed);
+    const real n101 = gradient_noise3d(xyz0 + I101, xyzf - F101, perm, seed);
+    const real n110 = gradient_noise3d(xyz0 + I110, xyzf - F110, perm, seed);
+    const real n111 = gradient_noise3d(xyz0 + I111, xyzf - F111, perm, seed);
+
+    real4 n40 = (real4)(n000, n001, n010, n011);
+    real4 n41 = (real4)(n100, n101, n110, n111);
+
+    real4 n4 = lerp4d(blend5(xyzf.x), n40, n41);
+    real2 n2 = lerp2d(blend5(xyzf.y), n4.xy, n4.zw);
+    real n = lerp(blend5(xyzf.z), n2.x, n2.y);
+
+    if (gradient) {
+        real3 w = (real3)(blend5(xyzf.x), blend5(xyzf.y), blend5(xyzf.z));
+        real3 dw = (real3)(blend5_slope(xyzf.x), blend5_slope(xyzf.y),
+                           blend5_slope(xyzf.z));
+        real3 g = (real3)(0.0);
+        for (int i = 0; i < 2; ++i) {
+            for (int j = 0; j < 2; ++j) {
+                for (int k = 0; k < 2; ++k) {
+                    int3 c = (int3)(i, j, k);
+                    real3 cg = gradient3d(xyz0 + c, perm, seed);
+                    real n = dot(xyzf - (real3)(i, j, k), cg);
+                    real wx = i ? w.x : 1.0 - w.x, dwx = i ? dw.x : -dw.x;
+                    real wy = j ? w.y : 1.0 - w.y, dwy = j ? dw.y : -dw.y;
+                    real wz = k ? w.z : 1.0 - w.z, dwz = k ? dw.z : -dw.z;
+                    g += cg * (wx * wy * wz)
+                         + (real3)(dwx * wy * wz, wx * dwy * wz,
+                                   wx * wy * dwz) * n;
+                }
+            }
+        }
+        *gradient = g * 1.216;
+    }
 
     return n * 1.216;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-__constant double F2 = 0.366025404; // 0.5 * (sqrt(3.0) - 1.0)
-__constant double G2 = 0.211324865; // (3.0 - sqrt(3.0)) / 6.0
+__constant real F2 = 0.366025404; // 0.5 * (sqrt(3.0) - 1.0)
+__constant real G2 = 0.211324865; // (3.0 - sqrt(3.0)) / 6.0
 
-double p_simplex (double2 xy, uint seed)
+real simplex (real2 xy, __constant int* perm, uint seed, real2* gradient)
 {
-    double n0, n1, n2;
+    real n0, n1, n2;
+    if (gradient)
+        *gradient = (real2)(0.0);
 
     // Skew the input space to determine which simplex cell we're in
-    double s = (xy.x + xy.y) * F2;
+    real s = (xy.x + xy.y) * F2;
     int i = floor(xy.x + s);
     int j = floor(xy.y + s);
 
     // Unskew the cell origin back to (x,y) space
-    double t = (i + j) * G2;
-    double2 o = (double2)(i - t, j - t);
+    real t = (i + j) * G2;
+    real2 o = (real2)(i - t, j - t);
 
     // The x,y distances from the cell origin
-    double2 d0 = xy - o;
+    real2 d0 = xy - o;
 
     // For the 2D case, the simplex shape is an equilateral triangle.
     // Determine which simplex we are in.
@@ -251,67 +740,73 @@ double p_simplex (double2 xy, uint seed)
         j1=1;
     }
 
-    double2 d1 = (double2)(d0.x - i1 + G2, d0.y - j1 + G2);
-    double2 d2 = (double2)(d0.x - 1.0 + 2.0 * G2, d0.y - 1.0 + 2.0 * G2);
+    real2 d1 = (real2)(d0.x - i1 + G2, d0.y - j1 + G2);
+    real2 d2 = (real2)(d0.x - 1.0 + 2.0 * G2, d0.y - 1.0 + 2.0 * G2);
 
     int ii = (i + seed * 1063) & 0xFF;
     int jj = j & 0xFF;
-    int gi0 = (P[ii+P[jj]] & G_MASK) * G_VECSIZE;
-    int gi1 = (P[ii+i1+P[jj+j1]] & G_MASK) * G_VECSIZE;
-    int gi2 = (P[ii+1+P[jj+1]] & G_MASK) * G_VECSIZE;
+    int gi0 = (perm[ii+perm[jj]] & G_MASK) * G_VECSIZE;
+    int gi1 = (perm[ii+i1+perm[jj+j1]] & G_MASK) * G_VECSIZE;
+    int gi2 = (perm[ii+1+perm[jj+1]] & G_MASK) * G_VECSIZE;
 
-    double t0 = 0.5 - dot(d0,d0);
+    real t0 = 0.5 - dot(d0,d0);
     if (t0 < 0)
     {
         n0 = 0.0;
     }
     else
     {
+        add_slope2(gradient, t0, (real2)(G[gi0],G[gi0+1]), d0);
         t0 *= t0;
-        n0 = t0 * t0 * dot((double2)(G[gi0],G[gi0+1]), d0);
+        n0 = t0 * t0 * dot((real2)(G[gi0],G[gi0+1]), d0);
     }
 
-    double t1 = 0.5 - dot(d1,d1);
+    real t1 = 0.5 - dot(d1,d1);
     if(t1 < 0)
     {
         n1 = 0.0;
     }
     else
     {
+        add_slope2(gradient, t1, (real2)(G[gi1],G[gi1+1]), d1);
         t1 *= t1;
-        n1 = t1 * t1 * dot((double2)(G[gi1],G[gi1+1]), d1);
+        n1 = t1 * t1 * dot((real2)(G[gi1],G[gi1+1]), d1);
     }
 
-    double t2 = 0.5 - dot(d2,d2);
+    real t2 = 0.5 - dot(d2,d2);
     if(t2 < 0)
     {
         n2 = 0.0;
     }
     else
     {
+        add_slope2(gradient, t2, (real2)(G[gi2],G[gi2+1]), d2);
         t2 *= t2;
-        n2 = t2 * t2 * dot((double2)(G[gi2],G[gi2+1]), d2);
+        n2 = t2 * t2 * dot((real2)(G[gi2],G[gi2+1]), d2);
     }
 
+    if (gradient)
+        *gradient *= 70.0;
+
     return 70.0 * (n0 + n1 + n2);
 }
 
-__constant double G3 = 0.16666666666666666; // 1.0 / 6.0
+__constant real G3 = 0.16666666666666666; // 1.0 / 6.0
 
-double p_simplex3 (double3 p, uint seed)
+real simplex3 (real3 p, __constant int* perm, uint seed, real3* gradient)
 {
     // Skew the input space to determine which simplex cell we're in
-    double s = (p.x + p.y + p.z) / 3.0;
+    real s = (p.x + p.y + p.z) / 3.0;
     int i = floor(p.x + s);
     int j = floor(p.y + s);
     int k = floor(p.z + s);
 
     // Unskew the cell origin back to (x,y,z) space
-    double t = (i + j + k) / 6.0;
-    double3 o = (double3)(i - t, j - t, k - t);
+    real t = (i + j + k) / 6.0;
+    real3 o = (real3)(i - t, j - t, k - t);
 
     // The x,y,z distances from the cell origin
-    double3 d0 = p - o;
+    real3 d0 = p - o;
 
     // For the 3D case, the simplex shape is an irregular tetrahedron.
     // Determine which simplex we are in.
@@ -336,47 +831,57 @@ double p_simplex3 (double3 p, uint seed)
         }
     }
 
-    double3 d1 = (double3)(d0.x - i1, d0.y - j1, d0.z - k1) + G3;
-    double3 d2 = (double3)(d0.x - i2, d0.y - j2, d0.z - k2) + 2.0 * G3;
-    double3 d3 = d0 - 1.0 + 3.0 * G3;
+    real3 d1 = (real3)(d0.x - i1, d0.y - j1, d0.z - k1) + G3;
+    real3 d2 = (real3)(d0.x - i2, d0.y - j2, d0.z - k2) + 2.0 * G3;
+    real3 d3 = d0 - 1.0 + 3.0 * G3;
 
     int ii = (i + seed * 1063) & 0xFF;
     int jj = j & 0xFF;
     int kk = k & 0xFF;
-    int gi0 = (P[ii+P[jj+P[kk]]] & G_MASK) * G_VECSIZE;
-    int gi1 = (P[ii+i1+P[jj+j1+P[kk+k1]]] & G_MASK) * G_VECSIZE;
-    int gi2 = (P[ii+i2+P[jj+j2+P[kk+k2]]] & G_MASK) * G_VECSIZE;
-    int gi3 = (P[ii+1+P[jj+1+P[kk+1]]] & G_MASK) * G_VECSIZE;
+    int gi0 = (perm[ii+perm[jj+perm[kk]]] & G_MASK) * G_VECSIZE;
+    int gi1 = (perm[ii+i1+perm[jj+j1+perm[kk+k1]]] & G_MASK) * G_VECSIZE;
+    int gi2 = (perm[ii+i2+perm[jj+j2+perm[kk+k2]]] & G_MASK) * G_VECSIZE;
+    int gi3 = (perm[ii+1+perm[jj+1+perm[kk+1]]] & G_MASK) * G_VECSIZE;
 
-    double n0, n1, n2, n3;
-    double t0 = 0.6 - dot(d0, d0);
+    real n0, n1, n2, n3;
+    if (gradient)
+        *gradient = (real3)(0.0);
+
+    real t0 = 0.6 - dot(d0, d0);
     if (t0 < 0) {
         n0 = 0.0;
     } else {
-        n0 = pow(t0, 4) * dot((double3)(G[gi0],G[gi0+1],G[gi0+2]), d0);
+        add_slope3(gradient, t0, (real3)(G[gi0],G[gi0+1],G[gi0+2]), d0);
+        n0 = pow(t0, 4) * dot((real3)(G[gi0],G[gi0+1],G[gi0+2]), d0);
     }
 
-    double t1 = 0.6 - dot(d1, d1);
+    real t1 = 0.6 - dot(d1, d1);
     if (t1 < 0) {
         n1 = 0.0;
     } else {
-        n1 = pow(t1, 4) * dot((double3)(G[gi1],G[gi1+1],G[gi1+2]), d1);
+        add_slope3(gradient, t1, (real3)(G[gi1],G[gi1+1],G[gi1+2]), d1);
+        n1 = pow(t1, 4) * dot((real3)(G[gi1],G[gi1+1],G[gi1+2]), d1);
     }
 
-    double t2 = 0.6 - dot(d2, d2);
+    real t2 = 0.6 - dot(d2, d2);
     if (t2 < 0) {
         n2 = 0.0;
     } else {
-        n2 = pow(t2, 4) * dot((double3)(G[gi2],G[gi2+1],G[gi2+2]), d2);
+        add_slope3(gradient, t2, (real3)(G[gi2],G[gi2+1],G[gi2+2]), d2);
+        n2 = pow(t2, 4) * dot((real3)(G[gi2],G[gi2+1],G[gi2+2]), d2);
     }
 
-    double t3 = 0.6 - dot(d3, d3);
+    real t3 = 0.6 - dot(d3, d3);
     if (t3 < 0) {
         n3 = 0.0;
     } else {
-        n3 = pow(t3, 4) * dot((double3)(G[gi3],G[gi3+1],G[gi3+2]), d3);
+        add_slope3(gradient, t3, (real3)(G[gi3],G[gi3+1],G[gi3+2]), d3);
+        n3 = pow(t3, 4) * dot((real3)(G[gi3],G[gi3+1],G[gi3+2]), d3);
     }
 
+    if (gradient)
+        *gradient *= 32.0;
+
     return 32.0 * (n0 + n1 + n2 + n3);
 }
 
@@ -409,86 +914,110 @@ __constant int gradients3D[] = {
      11, -4, -4,   4, -11, -4,   4, -4, -11
 };
 
-inline double extrapolate2(int x, int y, double2 d, uint seed)
+inline real extrapolate2(int x, int y, real2 d, __constant int* perm,
+                         uint seed)
 {
-    int index = P[(P[(x + seed) & 0xFF] + (y + seed * 23)) & 0xFF] & 0x0E;
+    int index = perm[(perm[(x + seed) & 0xFF] + (y + seed * 23)) & 0xFF] & 0x0E;
     return gradients2D[index] * d.x + gradients2D[index + 1] * d.y;
 }
 
-inline double extrapolate3(int x, int y, int z, double3 d, uint seed)
+inline real extrapolate3(int x, int y, int z, real3 d,
+                         __constant int* perm, uint seed)
 {
-    int index = (P[(P[(P[(x + seed) & 0xFF] + (y + seed * 23)) & 0xFF] + (z + seed * 27)) & 0xFF] % 24) * 3;
+    int index = (perm[(perm[(perm[(x + seed) & 0xFF] + (y + seed * 23)) & 0xFF] + (z + seed * 27)) & 0xFF] % 24) * 3;
     return gradients3D[index] * d.x + gradients3D[index + 1] * d.y + gradients3D[index + 2] * d.z;
 }
 
+// The gradients that extrapolate2() and extrapolate3() take the dot
+// product with.
+inline real2 gradient_os2(int x, int y, __constant int* perm, uint seed)
+{
+    int index = perm[(perm[(x + seed) & 0xFF] + (y + seed * 23)) & 0xFF] & 0x0E;
+    return (real2)(gradients2D[index], gradients2D[index + 1]);
+}
+
+inline real3 gradient_os3(int x, int y, int z, __constant int* perm,
+                          uint seed)
+{
+    int index = (perm[(perm[(perm[(x + seed) & 0xFF] + (y + seed * 23)) & 0xFF] + (z + seed * 27)) & 0xFF] % 24) * 3;
+    return (real3)(gradients3D[index], gradients3D[index + 1], gradients3D[index + 2]);
+}
+
 // Implementation of the OpenSimplex algorithm by Kurt Spencer.
 
-double p_opensimplex (double2 p, uint seed)
+real opensimplex (real2 p, __constant int* perm, uint seed,
+                  real2* gradient)
 {
-    const double STRETCH_CONSTANT_2D = -0.211324865405187; // (1 / sqrt(2 + 1) - 1 ) / 2;
-    const double SQUISH_CONSTANT_2D = 0.366025403784439; // (sqrt(2 + 1) -1) / 2;
-    const double NORM_CONSTANT_2D = 47.0;
+    const real STRETCH_CONSTANT_2D = -0.211324865405187; // (1 / sqrt(2 + 1) - 1 ) / 2;
+    const real SQUISH_CONSTANT_2D = 0.366025403784439; // (sqrt(2 + 1) -1) / 2;
+    const real NORM_CONSTANT_2D = 47.0;
 
     // Place input coordinates onto grid.
-    double stretchOffset = (p.x + p.y) * STRETCH_CONSTANT_2D;
-    double2 s = p + stretchOffset;
+    real stretchOffset = (p.x + p.y) * STRETCH_CONSTANT_2D;
+    real2 s = p + stretchOffset;
 
     // Floor to get grid coordinates of rhombus (stretched square) super-cell origin.
     int2 sb = (int2)(floor(s.x), floor(s.y));
 
     // Skew out to get actual coordinates of rhombus origin. We'll need these later.
-    double squishOffset = (sb.x + sb.y) * SQUISH_CONSTANT_2D;
-    double2 b = (double2)(sb.x, sb.y) + squishOffset;
+    real squishOffset = (sb.x + sb.y) * SQUISH_CONSTANT_2D;
+    real2 b = (real2)(sb.x, sb.y) + squishOffset;
 
     // Compute grid coordinates relative to rhombus origin.
-    double2 ins = s - (double2)(sb.x, sb.y);
+    real2 ins = s - (real2)(sb.x, sb.y);
 
     // Sum those together to get a value that determines which region we're in.
-    double inSum = ins.x + ins.y;
+    real inSum = ins.x + ins.y;
 
     // Positions relative to origin point.
-    double2 d0 = p - b;
+    real2 d0 = p - b;
 
     // We'll be defining these inside the next block and using them afterwards.
-    double2 d_ext;
+    real2 d_ext;
     int2 sv_ext;
-    double value = 0;
+    real value = 0;
+    if (gradient)
+        *gradient = (real2)(0.0);
 
     // Contribution (1,0)
-    double2 d1 = d0 + (double2)(-1,0) - SQUISH_CONSTANT_2D;
-    double attn1 = 2.0 - dot(d1, d1);
-    if (attn1 > 0)
-        value += pow(attn1, 4) * extrapolate2(sb.x + 1, sb.y + 0, d1, seed);
+    real2 d1 = d0 + (real2)(-1,0) - SQUISH_CONSTANT_2D;
+    real attn1 = 2.0 - dot(d1, d1);
+    if (attn1 > 0) {
+        add_slope2(gradient, attn1, gradient_os2(sb.x + 1, sb.y + 0, perm, seed), d1);
+        value += pow(attn1, 4) * extrapolate2(sb.x + 1, sb.y + 0, d1, perm, seed);
+    }
 
     // Contribution (0,1)
-    double2 d2 = d0 + (double2)(0,-1) - SQUISH_CONSTANT_2D;
-    double attn2 = 2.0 - dot(d2, d2);
-    if (attn2 > 0)
-        value += pow(attn2, 4) * extrapolate2(sb.x + 0, sb.y + 1, d2, seed);
+    real2 d2 = d0 + (real2)(0,-1) - SQUISH_CONSTANT_2D;
+    real attn2 = 2.0 - dot(d2, d2);
+    if (attn2 > 0) {
+        add_slope2(gradient, attn2, gradient_os2(sb.x + 0, sb.y + 1, perm, seed), d2);
+        value += pow(attn2, 4) * extrapolate2(sb.x + 0, sb.y + 1, d2, perm, seed);
+    }
 
     if (inSum <= 1) { // We're inside the triangle (2-Simplex) at (0,0)
-        double zins = 1 - inSum;
+        real zins = 1 - inSum;
         if (zins > ins.x || zins > ins.y) { // (0,0) is one of the closest two triangular vertices
             if (ins.x > ins.y) {
                 sv_ext = sb + (int2)(1, -1);
-                d_ext = d0 + (double2)(-1, 1);
+                d_ext = d0 + (real2)(-1, 1);
             } else {
                 sv_ext = sb + (int2)(-1, 1);
-                d_ext = d0 + (double2)(1, -1);
+                d_ext = d0 + (real2)(1, -1);
             }
         } else { // (1,0) and (0,1) are the closest two vertices.
             sv_ext = sb + (int2)(1, 1);
-            d_ext = d0 + (double2)(-1, -1) - 2 * SQUISH_CONSTANT_2D;
+            d_ext = d0 + (real2)(-1, -1) - 2 * SQUISH_CONSTANT_2D;
         }
     } else { // We're inside the triangle (2-Simplex) at (1,1)
-        double zins = 2 - inSum;
+        real zins = 2 - inSum;
         if (zins < ins.x || zins < ins.y) { // (0,0) is one of the closest two triangular vertices
             if (ins.x > ins.y) {
                 sv_ext = sb + (int2)(2,0);
-                d_ext = d0 + (double2)(-2, 0) - 2 * SQUISH_CONSTANT_2D;
+                d_ext = d0 + (real2)(-2, 0) - 2 * SQUISH_CONSTANT_2D;
             } else {
                 sv_ext = sb + (int2)(0, 2);
-                d_ext = d0 + (double2)(0, -2) - 2 * SQUISH_CONSTANT_2D;
+                d_ext = d0 + (real2)(0, -2) - 2 * SQUISH_CONSTANT_2D;
             }
         } else { // (1,0) and (0,1) are the closest two vertices.
             d_ext = d0;
@@ -499,56 +1028,68 @@ double p_opensimplex (double2 p, uint seed)
     }
 
     // Contribution (0,0) or (1,1)
-    double attn0 = 2.0 - dot(d0, d0);
-    if (attn0 > 0)
-        value += pow(attn0, 4) * extrapolate2(sb.x, sb.y, d0, seed);
+    real attn0 = 2.0 - dot(d0, d0);
+    if (attn0 > 0) {
+        add_slope2(gradient, attn0, gradient_os2(sb.x, sb.y, perm, seed), d0);
+        value += pow(attn0, 4) * extrapolate2(sb.x, sb.y, d0, perm, seed);
+    }
 
     // Extra Vertex
-    double attn_ext = 2.0 - dot(d_ext, d_ext);
-    if (attn_ext > 0)
-        value += pow(attn_ext, 4) * extrapolate2(sv_ext.x, sv_ext.y, d_ext, seed);
+    real attn_ext = 2.0 - dot(d_ext, d_ext);
+    if (attn_ext > 0) {
+        add_slope2(gradient, attn_ext, gradient_os2(sv_ext.x, sv_ext.y, perm, seed), d_ext);
+        value += pow(attn_ext, 4) * extrapolate2(sv_ext.x, sv_ext.y, d_ext, perm, seed);
+    }
+
+    if (gradient)
+        *gradient *= 1.152 / NORM_CONSTANT_2D;
 
     return (value / NORM_CONSTANT_2D) * 1.152;
 }
 
-double p_opensimplex3 (double3 p, uint seed)
+)xxxxy"  /* Split in half so MSVC can handle it */
+R"xxxyy(
+real opensimplex3 (real3 p, __constant int* perm, uint seed,
+                   real3* gradient)
 {
-    const double STRETCH_CONSTANT_3D = -1.0 / 6.0; // (1 / sqrt(3 + 1) - 1) / 3;
-    const double SQUISH_CONSTANT_3D = 1.0 / 3.0; // (sqrt(3+1)-1)/3;
-    const double NORM_CONSTANT_3D = 103.0;
+    const real STRETCH_CONSTANT_3D = -1.0 / 6.0; // (1 / sqrt(3 + 1) - 1) / 3;
+    const real SQUISH_CONSTANT_3D = 1.0 / 3.0; // (sqrt(3+1)-1)/3;
+    const real NORM_CONSTANT_3D = 103.0;
 
     // Place input coordinates on simplectic honeycomb.
-    double stretchOffset = (p.x + p.y + p.z) * STRETCH_CONSTANT_3D;
-    double3 s = p + stretchOffset;
+    real stretchOffset = (p.x + p.y + p.z) * STRETCH_CONSTANT_3D;
+    real3 s = p + stretchOffset;
 
     // Floor to get grid coordinates of rhombohedron (stretched cube) super-cell origin.
     int3 sb = (int3)(floor(s.x), floor(s.y), floor(s.z));
 
     // Skew out to get actual coordinates of rhombohedron origin. We'll need these later.
-    double3 dsb = (double3)(sb.x, sb.y, sb.z);
-    double squishOffset = (dsb.x + dsb.y + dsb.z) * SQUISH_CONSTANT_3D;
-    double3 b = dsb + squishOffset;
+    real3 dsb = (real3)(sb.x, sb.y, sb.z);
+    real squishOffset = (dsb.x + dsb.y + dsb.z) * SQUISH_CONSTANT_3D;
+    real3 b = dsb + squishOffset;
 
     // Compute grid coordinates relative to rhombus origin.
-    double3 ins = s - dsb;
+    real3 ins = s - dsb;
 
     // Sum those together to get a value that determines which region we're in.
-    double inSum = ins.x + ins.y + ins.z;
+    real inSum = ins.x + ins.y + ins.z;
 
     // Positions relative to origin point.
-    double3 d0 = p - b;
+    real3 d0 = p - b;
 
     // We'll be defining these inside the next block and using them afterwards.
-    double3 d_ext0, d_ext1;
+    real3 d_ext0, d_ext1;
     int3 sv_ext0, sv_ext1;
-    double value = 0.0;
+    real value = 0.0;
+    if (gradient)
+        *gradient = (real3)(0.0);
 
     if (inSum <= 1) { // We're inside the tetrahedron (3-Simplex) at (0,0,0)
         // Determine which two of (0,0,1), (0,1,0), (1,0,0) are closest.
         uchar aPoint = 0x01;
-        double aScore = ins.x;
+        real aScore = ins.x;
         uchar bPoint = 0x02;
-        double bScore = ins.y;
+        real bScore = ins.y;
         if (aScore >= bScore && ins.z > bScore) {
             bScore = ins.z;
             bPoint = 0x04;
@@ -559,7 +1100,7 @@ double p_opensimplex3 (double3 p, uint seed)
 
         // Now we determine the two lattice points not part of the tetrahedron that may contribute.
         // This depends on the closest two tetrahedral vertices, including (0,0,0)
-        double wins = 1 - inSum;
+        real wins = 1 - inSum;
         if (wins > aScore || wins > bScore) { // (0,0,0) is one of the closest two tetrahedral vertices.
             uchar c = (bScore > aScore ? bPoint : aPoint); // Our other closest vertex is the closest out of a and b.
             if ((c & 0x01) == 0) {
@@ -633,35 +1174,43 @@ double p_opensimplex3 (double3 p, uint seed)
         }
 
         // Contribution (0,0,0)
-        double attn0 = 2.0 - dot(d0, d0);
-        if (attn0 > 0)
-            value += pow(attn0, 4) * extrapolate3(sb.x + 0, sb.y + 0, sb.z + 0, d0, seed);
+        real attn0 = 2.0 - dot(d0, d0);
+        if (attn0 > 0) {
+            add_slope3(gradient, attn0, gradient_os3(sb.x + 0, sb.y + 0, sb.z + 0, perm, seed), d0);
+            value += pow(attn0, 4) * extrapolate3(sb.x + 0, sb.y + 0, sb.z + 0, d0, perm, seed);
+        }
 
         // Contribution (1,0,0)
-        double3 d1 = (d0 + (double3)(-1,0,0)) - SQUISH_CONSTANT_3D;
-        double attn1 = 2.0 - dot(d1, d1);
-        if (attn1 > 0)
-            value += pow(attn1, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 0, d1, seed);
+        real3 d1 = (d0 + (real3)(-1,0,0)) - SQUISH_CONSTANT_3D;
+        real attn1 = 2.0 - dot(d1, d1);
+        if (attn1 > 0) {
+            add_slope3(gradient, attn1, gradient_os3(sb.x + 1, sb.y + 0, sb.z + 0, perm, seed), d1);
+            value += pow(attn1, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 0, d1, perm, seed);
+        }
 
         // Contribution (0,1,0)
-        double3 d2 = (double3)(d0.x - SQUISH_CONSTANT_3D, d0.y - 1 - SQUISH_CONSTANT_3D, d1.z);
-        double attn2 = 2.0 - dot(d2, d2);
-        if (attn2 > 0)
-            value += pow(attn2, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 0, d2, seed);
+        real3 d2 = (real3)(d0.x - SQUISH_CONSTANT_3D, d0.y - 1 - SQUISH_CONSTANT_3D, d1.z);
+        real attn2 = 2.0 - dot(d2, d2);
+        if (attn2 > 0) {
+            add_slope3(gradient, attn2, gradient_os3(sb.x + 0, sb.y + 1, sb.z + 0, perm, seed), d2);
+            value += pow(attn2, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 0, d2, perm, seed);
+        }
 
         // Contribution (0,0,1)
-        double3 d3 = (double3)(d2.x, d1.y, d0.z - 1 - SQUISH_CONSTANT_3D);
-        double attn3 = 2.0 - dot(d3, d3);
-        if (attn3 > 0)
-            value += pow(attn3, 4) * extrapolate3(sb.x + 0, sb.y + 0, sb.z + 1, d3, seed);
+        real3 d3 = (real3)(d2.x, d1.y, d0.z - 1 - SQUISH_CONSTANT_3D);
+        real attn3 = 2.0 - dot(d3, d3);
+        if (attn3 > 0) {
+            add_slope3(gradient, attn3, gradient_os3(sb.x + 0, sb.y + 0, sb.z + 1, perm, seed), d3);
+            value += pow(attn3, 4) * extrapolate3(sb.x + 0, sb.y + 0, sb.z + 1, d3, perm, seed);
+        }
 
     } else if (inSum >= 2) { // We're inside the tetrahedron (3-Simplex) at (1,1,1)
 
         // Determine which two tetrahedral vertices are the closest, out of (1,1,0), (1,0,1), (0,1,1) but not (1,1,1).
         uchar aPoint = 0x06;
-        double aScore = ins.x;
+        real aScore = ins.x;
         uchar bPoint = 0x05;
-        double bScore = ins.y;
+        real bScore = ins.y;
         if (aScore <= bScore && ins.z < bScore) {
             bScore = ins.z;
             bPoint = 0x03;
@@ -672,7 +1221,7 @@ double p_opensimplex3 (double3 p, uint seed)
 
         // Now we determine the two lattice points not part of the tetrahedron that may contribute.
         // This depends on the closest two tetrahedral vertices, including (1,1,1)
-        double wins = 3 - inSum;
+        real wins = 3 - inSum;
         if (wins < aScore || wins < bScore) { // (1,1,1) is one of the closest two tetrahedral vertices.
             uchar c = (bScore < aScore ? bPoint : aPoint); // Our other closest vertex is the closest out of a and b.
             if ((c & 0x01) != 0) {
@@ -747,41 +1296,49 @@ double p_opensimplex3 (double3 p, uint seed)
         }
 
         // Contribution (1,1,0)
-        double3 d3 = (double3)(d0 + (double3)(-1,-1,0)) - 2 * SQUISH_CONSTANT_3D;
-        double attn3 = 2.0 - dot(d3, d3);
-        if (attn3 > 0)
-            value += pow(attn3,4) * extrapolate3(sb.x + 1, sb.y + 1, sb.z + 0, d3, seed);
+        real3 d3 = (real3)(d0 + (real3)(-1,-1,0)) - 2 * SQUISH_CONSTANT_3D;
+        real attn3 = 2.0 - dot(d3, d3);
+        if (attn3 > 0) {
+            add_slope3(gradient, attn3, gradient_os3(sb.x + 1, sb.y + 1, sb.z + 0, perm, seed), d3);
+            value += pow(attn3,4) * extrapolate3(sb.x + 1, sb.y + 1, sb.z + 0, d3, perm, seed);
+        }
 
         // Contribution (1,0,1)
-        double3 d2 = (double3)(d3.x, d0.y - 0 - 2 * SQUISH_CONSTANT_3D, d0.z - 1 - 2 * SQUISH_CONSTANT_3D);
-        double attn2 = 2.0 - dot(d2, d2);
-        if (attn2 > 0)
-            value += pow(attn2, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 1, d2, seed);
+        real3 d2 = (real3)(d3.x, d0.y - 0 - 2 * SQUISH_CONSTANT_3D, d0.z - 1 - 2 * SQUISH_CONSTANT_3D);
+        real attn2 = 2.0 - dot(d2, d2);
+        if (attn2 > 0) {
+            add_slope3(gradient, attn2, gradient_os3(sb.x + 1, sb.y + 0, sb.z + 1, perm, seed), d2);
+            value += pow(attn2, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 1, d2, perm, seed);
+        }
 
         // Contribution (0,1,1)
-        double3 d1 = (double3)(d0.x - 0 - 2 * SQUISH_CONSTANT_3D, d3.y, d2.z);
-        double attn1 = 2.0 - dot(d1, d1);
-        if (attn1 > 0)
-            value += pow(attn1, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 1, d1, seed);
+        real3 d1 = (real3)(d0.x - 0 - 2 * SQUISH_CONSTANT_3D, d3.y, d2.z);
+        real attn1 = 2.0 - dot(d1, d1);
+        if (attn1 > 0) {
+            add_slope3(gradient, attn1, gradient_os3(sb.x + 0, sb.y + 1, sb.z + 1, perm, seed), d1);
+            value += pow(attn1, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 1, d1, perm, seed);
+        }
 
         // Contribution (1,1,1)
         d0 -= 1 + 3 * SQUISH_CONSTANT_3D;
-        double attn0 = 2.0 - dot(d0, d0);
-        if (attn0 > 0)
-            value += pow(attn0, 4) * extrapolate3(sb.x + 1, sb.y + 1, sb.z + 1, d0, seed);
+        real attn0 = 2.0 - dot(d0, d0);
+        if (attn0 > 0) {
+            add_slope3(gradient, attn0, gradient_os3(sb.x + 1, sb.y + 1, sb.z + 1, perm, seed), d0);
+            value += pow(attn0, 4) * extrapolate3(sb.x + 1, sb.y + 1, sb.z + 1, d0, perm, seed);
+        }
 
     } else { // We're inside the octahedron (Rectified 3-Simplex) in between.
 
-        double aScore;
+        real aScore;
         uchar aPoint;
         bool aIsFurtherSide;
-        double bScore;
+        real bScore;
         uchar bPoint;
         bool bIsFurtherSide;
-)xxxxy"  /* Split in half so MSVC can handle it */
+)xxxyy"  /* Split in half so MSVC can handle it */
 R"xxxxz(
         // Decide between point (0,0,1) and (1,1,0) as closest
-        double p1 = ins.x + ins.y;
+        real p1 = ins.x + ins.y;
         if (p1 > 1) {
             aScore = p1 - 1;
             aPoint = 0x03;
@@ -793,7 +1350,7 @@ R"xxxxz(
         }
 
         // Decide between point (0,1,0) and (1,0,1) as closest
-        double p2 = ins.x + ins.z;
+        real p2 = ins.x + ins.z;
         if (p2 > 1) {
             bScore = p2 - 1;
             bPoint = 0x05;
@@ -805,9 +1362,9 @@ R"xxxxz(
         }
 
         // The closest out of the two (1,0,0) and (0,1,1) will replace the furthest out of the two decided above, if closer.
-        double p3 = ins.y + ins.z;
+        real p3 = ins.y + ins.z;
         if (p3 > 1) {
-            double score = p3 - 1;
+            real score = p3 - 1;
             if (aScore <= bScore && aScore < score) {
                 aScore = score;
                 aPoint = 0x06;
@@ -818,7 +1375,7 @@ R"xxxxz(
                 bIsFurtherSide = true;
             }
         } else {
-            double score = 1 - p3;
+            real score = 1 - p3;
             if (aScore <= bScore && aScore < score) {
                 aScore = score;
                 aPoint = 0x01;
@@ -841,13 +1398,13 @@ R"xxxxz(
                 // Other extra point is based on the shared axis.
                 uchar c = (aPoint & bPoint);
                 if ((c & 0x01) != 0) {
-                    d_ext1 = d0 + (double3)(-2,0,0) - 2 * SQUISH_CONSTANT_3D;
+                    d_ext1 = d0 + (real3)(-2,0,0) - 2 * SQUISH_CONSTANT_3D;
                     sv_ext1 = sb + (int3)(2,0,0);
                 } else if ((c & 0x02) != 0) {
-                    d_ext1 = d0 + (double3)(0,-2,0) - 2 * SQUISH_CONSTANT_3D;
+                    d_ext1 = d0 + (real3)(0,-2,0) - 2 * SQUISH_CONSTANT_3D;
                     sv_ext1 = sb + (int3)(0,2,0);
                 } else {
-                    d_ext1 = d0 + (double3)(0,0,-2) - 2 * SQUISH_CONSTANT_3D;
+                    d_ext1 = d0 + (real3)(0,0,-2) - 2 * SQUISH_CONSTANT_3D;
                     sv_ext1 = sb + (int3)(0,0,2);
                 }
             } else { // Both closest points on (0,0,0) side
@@ -858,13 +1415,13 @@ R"xxxxz(
                 // Other extra point is based on the omitted axis.
                 uchar c = (aPoint | bPoint);
                 if ((c & 0x01) == 0) {
-                    d_ext1 = d0 + (double3)(1,-1,-1) - SQUISH_CONSTANT_3D;
+                    d_ext1 = d0 + (real3)(1,-1,-1) - SQUISH_CONSTANT_3D;
                     sv_ext1 = sb + (int3)(-1,1,1);
                 } else if ((c & 0x02) == 0) {
-                    d_ext1 = d0 + (double3)(-1,1,-1) - SQUISH_CONSTANT_3D;
+                    d_ext1 = d0 + (real3)(-1,1,-1) - SQUISH_CONSTANT_3D;
                     sv_ext1 = sb + (int3)(1,-1,1);
                 } else {
-                    d_ext1 = d0 + (double3)(-1,-1,1) - SQUISH_CONSTANT_3D;
+                    d_ext1 = d0 + (real3)(-1,-1,1) - SQUISH_CONSTANT_3D;
                     sv_ext1 = sb + (int3)(1,1,-1);
                 }
             }
@@ -880,13 +1437,13 @@ R"xxxxz(
 
             // One contribution is a permutation of (1,1,-1)
             if ((c1 & 0x01) == 0) {
-                d_ext0 = d0 + (double3)(1,-1,-1) - SQUISH_CONSTANT_3D;
+                d_ext0 = d0 + (real3)(1,-1,-1) - SQUISH_CONSTANT_3D;
                 sv_ext0 = sb + (int3)(-1,1,1);
             } else if ((c1 & 0x02) == 0) {
-                d_ext0 = d0 + (double3)(-1,1,-1) - SQUISH_CONSTANT_3D;
+                d_ext0 = d0 + (real3)(-1,1,-1) - SQUISH_CONSTANT_3D;
                 sv_ext0 = sb + (int3)(1,-1,1);
             } else {
-                d_ext0 = d0 + (double3)(-1,-1,1) - SQUISH_CONSTANT_3D;
+                d_ext0 = d0 + (real3)(-1,-1,1) - SQUISH_CONSTANT_3D;
                 sv_ext0 = sb + (int3)(1,1,-1);
             }
 
@@ -906,64 +1463,147 @@ R"xxxxz(
         }
 
         // Contribution (1,0,0)
-        double3 d1 = (double3)(d0 + (double3)(-1,0,0)) - SQUISH_CONSTANT_3D;
-        double attn1 = 2.0 - dot(d1, d1);
-        if (attn1 > 0)
-            value += pow(attn1, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 0, d1, seed);
+        real3 d1 = (real3)(d0 + (real3)(-1,0,0)) - SQUISH_CONSTANT_3D;
+        real attn1 = 2.0 - dot(d1, d1);
+        if (attn1 > 0) {
+            add_slope3(gradient, attn1, gradient_os3(sb.x + 1, sb.y + 0, sb.z + 0, perm, seed), d1);
+            value += pow(attn1, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 0, d1, perm, seed);
+        }
 
         // Contribution (0,1,0)
-        double3 d2 = (double3)(d0.x - SQUISH_CONSTANT_3D, d0.y - 1 - SQUISH_CONSTANT_3D, d1.z);
-        double attn2 = 2.0 - dot(d2, d2);
-        if (attn2 > 0)
-            value += pow(attn2, 4)* extrapolate3(sb.x + 0, sb.y + 1, sb.z + 0, d2, seed);
+        real3 d2 = (real3)(d0.x - SQUISH_CONSTANT_3D, d0.y - 1 - SQUISH_CONSTANT_3D, d1.z);
+        real attn2 = 2.0 - dot(d2, d2);
+        if (attn2 > 0) {
+            add_slope3(gradient, attn2, gradient_os3(sb.x + 0, sb.y + 1, sb.z + 0, perm, seed), d2);
+            value += pow(attn2, 4)* extrapolate3(sb.x + 0, sb.y + 1, sb.z + 0, d2, perm, seed);
+        }
 
         // Contribution (0,0,1)
-        double3 d3 = (double3)(d2.x, d1.y, d0.z - 1 - SQUISH_CONSTANT_3D);
-        double attn3 = 2.0 - dot(d3, d3);
-        if (attn3 > 0)
-            value += pow(attn3, 4)* extrapolate3(sb.x + 0, sb.y + 0, sb.z + 1, d3, seed);
+        real3 d3 = (real3)(d2.x, d1.y, d0.z - 1 - SQUISH_CONSTANT_3D);
+        real attn3 = 2.0 - dot(d3, d3);
+        if (attn3 > 0) {
+            add_slope3(gradient, attn3, gradient_os3(sb.x + 0, sb.y + 0, sb.z + 1, perm, seed), d3);
+            value += pow(attn3, 4)* extrapolate3(sb.x + 0, sb.y + 0, sb.z + 1, d3, perm, seed);
+        }
 
         // Contribution (1,1,0)
-        double3 d4 = d0 - (double3)(1,1,0) - 2 * SQUISH_CONSTANT_3D;
-        double attn4 = 2.0 - dot(d4, d4);
-        if (attn4 > 0)
-            value += pow(attn4, 4)* extrapolate3(sb.x + 1, sb.y + 1, sb.z + 0, d4, seed);
+        real3 d4 = d0 - (real3)(1,1,0) - 2 * SQUISH_CONSTANT_3D;
+        real attn4 = 2.0 - dot(d4, d4);
+        if (attn4 > 0) {
+            add_slope3(gradient, attn4, gradient_os3(sb.x + 1, sb.y + 1, sb.z + 0, perm, seed), d4);
+            value += pow(attn4, 4)* extrapolate3(sb.x + 1, sb.y + 1, sb.z + 0, d4, perm, seed);
+        }
 
         // Contribution (1,0,1)
-        double3 d5 = (double3)(d4.x, d0.y - 2 * SQUISH_CONSTANT_3D, d0.z - 1 - 2 * SQUISH_CONSTANT_3D);
-        double attn5 = 2.0 - dot(d5, d5);
-        if (attn5 > 0)
-            value += pow(attn5, 4)* extrapolate3(sb.x + 1, sb.y + 0, sb.z + 1, d5, seed);
+        real3 d5 = (real3)(d4.x, d0.y - 2 * SQUISH_CONSTANT_3D, d0.z - 1 - 2 * SQUISH_CONSTANT_3D);
+        real attn5 = 2.0 - dot(d5, d5);
+        if (attn5 > 0) {
+            add_slope3(gradient, attn5, gradient_os3(sb.x + 1, sb.y + 0, sb.z + 1, perm, seed), d5);
+            value += pow(attn5, 4)* extrapolate3(sb.x + 1, sb.y + 0, sb.z + 1, d5, perm, seed);
+        }
 
         // Contribution (0,1,1)
-        double3 d6 = (double3)(d0.x - 2 * SQUISH_CONSTANT_3D, d4.y, d5.z);
-        double attn6 = 2.0 - dot(d6, d6);
-        if (attn6 > 0)
-            value += pow(attn6, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 1, d6, seed);
+        real3 d6 = (real3)(d0.x - 2 * SQUISH_CONSTANT_3D, d4.y, d5.z);
+        real attn6 = 2.0 - dot(d6, d6);
+        if (attn6 > 0) {
+            add_slope3(gradient, attn6, gradient_os3(sb.x + 0, sb.y + 1, sb.z + 1, perm, seed), d6);
+            value += pow(attn6, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 1, d6, perm, seed);
+        }
     }
     // First extra vertex
-    double attn_ext0 = 2.0 - dot(d_ext0, d_ext0);
-    if (attn_ext0 > 0)
-        value += pow(attn_ext0, 4) * extrapolate3(sv_ext0.x, sv_ext0.y, sv_ext0.z, d_ext0, seed);
+    real attn_ext0 = 2.0 - dot(d_ext0, d_ext0);
+    if (attn_ext0 > 0) {
+        add_slope3(gradient, attn_ext0, gradient_os3(sv_ext0.x, sv_ext0.y, sv_ext0.z, perm, seed), d_ext0);
+        value += pow(attn_ext0, 4) * extrapolate3(sv_ext0.x, sv_ext0.y, sv_ext0.z, d_ext0, perm, seed);
+    }
 
     // Second extra vertex
-    double attn_ext1 = 2.0 - dot(d_ext1, d_ext1);
-    if (attn_ext1 > 0)
-        value += pow(attn_ext1, 4) * extrapolate3(sv_ext1.x, sv_ext1.y, sv_ext1.z, d_ext1, seed);
+    real attn_ext1 = 2.0 - dot(d_ext1, d_ext1);
+    if (attn_ext1 > 0) {
+        add_slope3(gradient, attn_ext1, gradient_os3(sv_ext1.x, sv_ext1.y, sv_ext1.z, perm, seed), d_ext1);
+        value += pow(attn_ext1, 4) * extrapolate3(sv_ext1.x, sv_ext1.y, sv_ext1.z, d_ext1, perm, seed);
+    }
+
+    if (gradient)
+        *gradient /= NORM_CONSTANT_3D;
 
     return value / NORM_CONSTANT_3D;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-double2 p_worley (const double2 p, uint seed)
+// The seed is either added to the lattice coordinates, with the built-in
+// permutation table, or the script has a table for every seed.
+real p_perlin (real2 xy, uint seed)
 {
-    double2 t = floor(p);
+    return perlin(xy, P, seed, 0);
+}
+
+real p_perlin_table (real2 xy, __constant int* perm)
+{
+    return perlin(xy, perm, 0, 0);
+}
+
+real p_perlin3 (real3 xyz, uint seed)
+{
+    return perlin3(xyz, P, seed, 0);
+}
+
+real p_perlin3_table (real3 xyz, __constant int* perm)
+{
+    return perlin3(xyz, perm, 0, 0);
+}
+
+real p_simplex (real2 xy, uint seed)
+{
+    return simplex(xy, P, seed, 0);
+}
+
+real p_simplex_table (real2 xy, __constant int* perm)
+{
+    return simplex(xy, perm, 0, 0);
+}
+
+real p_simplex3 (real3 p, uint seed)
+{
+    return simplex3(p, P, seed, 0);
+}
+
+real p_simplex3_table (real3 p, __constant int* perm)
+{
+    return simplex3(p, perm, 0, 0);
+}
+
+real p_opensimplex (real2 p, uint seed)
+{
+    return opensimplex(p, P, seed, 0);
+}
+
+real p_opensimplex_table (real2 p, __constant int* perm)
+{
+    return opensimplex(p, perm, 0, 0);
+}
+
+real p_opensimplex3 (real3 p, uint seed)
+{
+    return opensimplex3(p, P, seed, 0);
+}
+
+real p_opensimplex3_table (real3 p, __constant int* perm)
+{
+    return opensimplex3(p, perm, 0, 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+real2 p_worley (const real2 p, uint seed)
+{
+    real2 t = floor(p);
     int2 xy0 = (int2)((int)t.x, (int)t.y);
-    double2 xyf = p - t;
+    real2 xyf = p - t;
 
-    double f0 = 9999.9;
-    double f1 = 9999.9;
+    real f0 = 9999.9;
+    real f1 = 9999.9;
 
     for (int i = -1; i < 2; ++i)
     {
@@ -972,12 +1612,12 @@ double2 p_worley (const double2 p, uint seed)
             int2 square = xy0 + (int2)(i,j);
             uint h = rng(hash(square.x + seed, square.y));
 
-            double2 rnd_pt;
-            rnd_pt.x = (double)i + ((double)(h & 0xFFFF) / (double)0x10000);
+            real2 rnd_pt;
+            rnd_pt.x = (real)i + ((real)(h & 0xFFFF) / (real)0x10000);
             h = rng(h);
-            rnd_pt.y = (double)j + ((double)(h & 0xFFFF) / (double)0x10000);
+            rnd_pt.y = (real)j + ((real)(h & 0xFFFF) / (real)0x10000);
 
-            double dist = distance(xyf, rnd_pt);
+            real dist = distance(xyf, rnd_pt);
             if (dist < f0)
             {
                 f1 = f0;
@@ -989,17 +1629,17 @@ double2 p_worley (const double2 p, uint seed)
             }
         }
     }
-    return (double2)(f0, f1);
+    return (real2)(f0, f1);
 }
 
-double2 p_worley3 (const double3 p, uint seed)
+real2 p_worley3 (const real3 p, uint seed)
 {
-    double3 t = floor(p);
+    real3 t = floor(p);
     int3 xyz0 = (int3)((int)t.x, (int)t.y, (int)t.z);
-    double3 xyzf = p - t;
+    real3 xyzf = p - t;
 
-    double f0 = 9999.9;
-    double f1 = 9999.9;
+    real f0 = 9999.9;
+    real f1 = 9999.9;
 
     for (int i = -1; i < 2; ++i)
     {
@@ -1010,14 +1650,14 @@ double2 p_worley3 (const double3 p, uint seed)
                 int3 square = xyz0 + (int3)(i,j,k);
                 uint h = rng(hash3(square.x + seed, square.y, square.z));
 
-                double3 rnd_pt;
-                rnd_pt.x = (double)i + ((double)(h & 0xFFFF) / (double)0x10000);
+                real3 rnd_pt;
+                rnd_pt.x = (real)i + ((real)(h & 0xFFFF) / (real)0x10000);
                 h = rng(h);
-                rnd_pt.y = (double)j + ((double)(h & 0xFFFF) / (double)0x10000);
+                rnd_pt.y = (real)j + ((real)(h & 0xFFFF) / (real)0x10000);
                 h = rng(h);
-                rnd_pt.z = (double)k + ((double)(h & 0xFFFF) / (double)0x10000);
+                rnd_pt.z = (real)k + ((real)(h & 0xFFFF) / (real)0x10000);
 
-                double dist = distance(xyzf, rnd_pt);
+                real dist = distance(xyzf, rnd_pt);
                 if (dist < f0)
                 {
                     f1 = f0;
@@ -1030,19 +1670,19 @@ double2 p_worley3 (const double3 p, uint seed)
             }
         }
     }
-    return (double2)(f0, f1);
+    return (real2)(f0, f1);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-double2 p_voronoi (const double2 p, uint seed)
+real2 p_voronoi (const real2 p, uint seed)
 {
-    double2 t = floor(p);
+    real2 t = floor(p);
     int2 xy0 = (int2)((int)t.x, (int)t.y);
-    double2 xyf = p - t;
+    real2 xyf = p - t;
 
-    double f0 = 9999.9;
-    double2 nearest;
+    real f0 = 9999.9;
+    real2 nearest;
 
     for (int i = -1; i < 2; ++i)
     {
@@ -1051,12 +1691,12 @@ double2 p_voronoi (const double2 p, uint seed)
             int2 square = xy0 + (int2)(i,j);
             uint h = rng(hash(square.x + seed, square.y));
 
-            double2 rnd_pt;
-            rnd_pt.x = (double)i + ((double)(h & 0xFFFF) / (double)0x10000);
+            real2 rnd_pt;
+            rnd_pt.x = (real)i + ((real)(h & 0xFFFF) / (real)0x10000);
             h = rng(h);
-            rnd_pt.y = (double)j + ((double)(h & 0xFFFF) / (double)0x10000);
+            rnd_pt.y = (real)j + ((real)(h & 0xFFFF) / (real)0x10000);
 
-            double dist = distance(xyf, rnd_pt);
+            real dist = distance(xyf, rnd_pt);
             if (dist < f0)
             {
                 nearest = rnd_pt;
@@ -1067,122 +1707,88 @@ double2 p_voronoi (const double2 p, uint seed)
     return t + nearest;
 }
 
-//////////////////////////////////////////////////////////////////////////
-
-inline double2 p_rotate (double2 p, double a)
-{
-    double t = a * M_PI;
-    return (double2)(p.x * cos(t) - p.y * sin(t), p.x * sin(t) + p.y * cos(t));
-}
-
-inline double16 rotMatrix(double3 a, double angle)
-{
-    const double u2 = a.x * a.x;
-    const double v2 = a.y * a.y;
-    const double w2 = a.z * a.z;
-    const double l = u2 + v2 + w2;
-    const double sl = sqrt(l);
-    const double sa = sin(angle);
-    const double ca = cos(angle);
-
-    return (double16)(
-
-    (u2 + (v2 + w2) * ca) / l,
-    (a.x * a.y * (1.0 - ca) - a.z * sl * sa) / l,
-    (a.x * a.z * (1.0 - ca) + a.y * sl * sa) / l,
-    0.0,
-
-    (a.x * a.y * (1.0 - ca) + a.z * sl * sa) / l,
-    (v2 + (u2 + w2) * ca) / l,
-    (a.y * a.z * (1.0 - ca) - a.x * sl * sa) / l,
-    0.0,
-
-    (a.x * a.z * (1.0 - ca) - a.y * sl * sa) / l,
-    (a.y * a.z * (1.0 - ca) + a.x * sl * sa) / l,
-    (w2 + (u2 + v2) * ca) / l,
-    0.0,
-
-    0.0, 0.0, 0.0, 1.0
-    );
-}
-
-inline double3 p_rotate3 (double3 p, double3 axis, double a)
-{
-    double4 h = (double4)(p, 1);
-    double16 m = rotMatrix(axis, a * M_PI);
-    return (double3)(
-                dot(m.s048C, h),
-                dot(m.s159D, h),
-                dot(m.s26AE, h)
-                );
-}
-
-inline double2 p_swap (double2 p)
+dual p_perlin_d (dual2 p, uint seed)
 {
-    return (double2)(p.y, p.x);
+    real2 g;
+    real v = perlin(d2_value(p), P, seed, &g);
+    return d_chain2(v, g, p);
 }
 
-inline double p_angle (double2 p)
+dual p_perlin_d_table (dual2 p, __constant int* perm)
 {
-    return atan2pi(p.y, p.x);
+    real2 g;
+    real v = perlin(d2_value(p), perm, 0, &g);
+    return d_chain2(v, g, p);
 }
 
-inline double p_chebyshev (double2 p)
+dual p_perlin3_d (dual3 p, uint seed)
 {
-    return fmax(fabs(p.x), fabs(p.y));
+    real3 g;
+    real v = perlin3(d3_value(p), P, seed, &g);
+    return d_chain3(v, g, p);
 }
 
-inline double p_chebyshev3 (double3 p)
+dual p_perlin3_d_table (dual3 p, __constant int* perm)
 {
-    return fmax(fmax(fabs(p.x), fabs(p.y)), fabs(p.z));
+    real3 g;
+    real v = perlin3(d3_value(p), perm, 0, &g);
+    return d_chain3(v, g, p);
 }
 
-inline double p_saw (double n)
+dual p_simplex_d (dual2 p, uint seed)
 {
-    return n - floor(n);
+    real2 g;
+    real v = simplex(d2_value(p), P, seed, &g);
+    return d_chain2(v, g, p);
 }
 
-inline double p_checkerboard (double2 p)
+dual p_simplex_d_table (dual2 p, __constant int* perm)
 {
-    double2 sp = p - floor(p);
-    return (sp.x < 0.5) ^ (sp.y < 0.5) ? 1.0 : -1.0;
+    real2 g;
+    real v = simplex(d2_value(p), perm, 0, &g);
+    return d_chain2(v, g, p);
 }
 
-inline double p_checkerboard3 (double3 p)
+dual p_simplex3_d (dual3 p, uint seed)
 {
-    double3 sp = p - floor(p);
-    return (sp.x < 0.5) ^ (sp.y < 0.5) ^ (sp.z < 0.5) ? 1.0 : -1.0;
+    real3 g;
+    real v = simplex3(d3_value(p), P, seed, &g);
+    return d_chain3(v, g, p);
 }
 
-inline double p_manhattan (double2 p)
+dual p_simplex3_d_table (dual3 p, __constant int* perm)
 {
-    return fabs(p.x) + fabs(p.y);
-}
-
-inline double p_manhattan3 (double3 p)
-{
-    return fabs(p.x) + fabs(p.y) + fabs(p.z);
+    real3 g;
+    real v = simplex3(d3_value(p), perm, 0, &g);
+    return d_chain3(v, g, p);
 }
 
-inline double p_blend (double x, double a, double b)
+dual p_opensimplex_d (dual2 p, uint seed)
 {
-    x = (clamp(x, -1.0, 1.0) + 1.0) / 2.0;
-    return lerp(x, a, b);
+    real2 g;
+    real v = opensimplex(d2_value(p), P, seed, &g);
+    return d_chain2(v, g, p);
 }
 
-inline double p_range (double x, double a, double b)
+dual p_opensimplex_d_table (dual2 p, __constant int* perm)
 {
-    return clamp((a * 0.5 + x + 1.0) * ((b - a) * 0.5), a, b);
+    real2 g;
+    real v = opensimplex(d2_value(p), perm, 0, &g);
+    return d_chain2(v, g, p);
 }
 
-inline bool p_is_in_circle (double2 p, double r)
+dual p_opensimplex3_d (dual3 p, uint seed)
 {
-    return length(p) <= r;
+    real3 g;
+    real v = opensimplex3(d3_value(p), P, seed, &g);
+    return d_chain3(v, g, p);
 }
 
-inline bool p_is_in_rectangle (double2 p, double x1, double y1, double x2, double y2)
+dual p_opensimplex3_d_table (dual3 p, __constant int* perm)
 {
-    return p.x >= x1 && p.y >= y1 && p.x <= x2 && p.y <= y2;
+    real3 g;
+    real v = opensimplex3(d3_value(p), perm, 0, &g);
+    return d_chain3(v, g, p);
 }
 
 
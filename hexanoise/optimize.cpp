@@ -0,0 +1,500 @@
+//---------------------------------------------------------------------------
+// hexanoise/optimize.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "optimize.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "bounds.hpp"
+#include "generator_context.hpp"
+#include "generator_slowinterpreter.hpp"
+#include "node.hpp"
+#include "octaves.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+namespace
+{
+
+bool is_value(const node& n)
+{
+    return n.type == node::const_var || n.type == node::const_bool;
+}
+
+bool is_foldable(const node& n)
+{
+    if (n.return_type != var_t::var && n.return_type != var_t::boolean)
+        return false;
+
+    // These refer to data outside the expression tree.
+    if (n.type == node::external_ || n.type == node::png_lookup)
+        return false;
+
+    return !n.input.empty()
+           && std::all_of(n.input.begin(), n.input.end(), is_value);
+}
+
+// Replace a node by one of its inputs.
+void replace(node& n, size_t i)
+{
+    node tmp{std::move(n.input[i])};
+    n = tmp;
+}
+
+const double unknown = std::numeric_limits<double>::infinity();
+
+bool is_number(const node& n)
+{
+    return n.type == node::const_var;
+}
+
+bool all_numbers(const node& n, size_t first)
+{
+    return std::all_of(n.input.begin() + first, n.input.end(), is_number);
+}
+
+double largest(const glm::dvec3& v)
+{
+    return std::max(v.x, std::max(v.y, v.z));
+}
+
+node make(node::func_t type, var_t return_type, std::vector<node> input)
+{
+    node result{type, false, return_type};
+    result.input = std::move(input);
+    return result;
+}
+
+// Get the parameters of a fractal, the way the generators read them.
+// Returns false if they are not constant.
+bool fractal_params(const node& n, int& octaves, double& lacunarity,
+                    double& persistence)
+{
+    if (!all_numbers(n, 2) || !(n.input[2].aux_var >= 1.0))
+        return false;
+
+    octaves = static_cast<int>(
+        std::min(n.input[2].aux_var, double(INTERPRETER_OCTAVES_LIMIT)));
+    lacunarity = n.input[3].aux_var;
+    persistence = n.input[4].aux_var;
+    return true;
+}
+
+// The range of the noise function of a fractal.
+interval noise_range(const node& n, const generator_context& ctx)
+{
+    double z = n.type == node::fractal ? 0.0 : unknown;
+    return bounds(n.input[1], ctx, glm::dvec3{-unknown, -unknown, -z},
+                  glm::dvec3{unknown, unknown, z});
+}
+
+// How far apart the samples are at the end of a chain of coordinate
+// functions, given their spacing at the entry point.  Returns infinity if
+// the chain distorts space in a way that is not known up front.
+glm::dvec3 spread(const node& n, const glm::dvec3& s)
+{
+    if (n.type == node::entry_point)
+        return s;
+
+    if (n.input.empty() || !all_numbers(n, 1))
+        return glm::dvec3{unknown};
+
+    auto p = spread(n.input[0], s);
+    switch (n.type) {
+    case node::scale:
+    case node::scale3:
+        if (n.input[1].aux_var == 0.0)
+            return glm::dvec3{unknown};
+        return p / std::abs(n.input[1].aux_var);
+
+    case node::shift:
+    case node::shift3:
+        return p;
+
+    case node::swap:
+        return glm::dvec3{p.y, p.x, 0.0};
+
+    case node::rotate: {
+        double m = std::max(p.x, p.y);
+        return glm::dvec3{m, m, 0.0};
+    }
+
+    case node::rotate3:
+        return glm::dvec3{largest(p)};
+
+    case node::xy:
+    case node::zplane:
+        return glm::dvec3{p.x, p.y, 0.0};
+
+    case node::xplane:
+        return glm::dvec3{0.0, p.y, p.x};
+
+    case node::yplane:
+        return glm::dvec3{p.x, 0.0, p.y};
+
+    default:
+        return glm::dvec3{unknown};
+    }
+}
+
+// The largest distance between two samples, in lattice cells, at any of
+// the noise functions in f, if the positions f gets are s apart.  This is
+// 0 if f does not use noise, and infinity if it is not known.
+double sample_distance(const node& f, const glm::dvec3& s)
+{
+    switch (f.type) {
+    case node::const_var:
+    case node::const_bool:
+        return 0.0;
+
+    case node::perlin:
+    case node::perlin3:
+    case node::simplex:
+    case node::simplex3:
+    case node::opensimplex:
+    case node::opensimplex3:
+        if (!is_number(f.input[1]))
+            return unknown;
+        return largest(spread(f.input[0], s));
+
+    default:
+        break;
+    }
+
+    // Everything else is fine as long as it only combines values.
+    bool combines_values
+        = (f.type > node::funcdef_v_v && f.type < node::funcdef_xy_bool)
+          || f.type == node::then_else;
+
+    if (!combines_values)
+        return unknown;
+
+    double result = 0.0;
+    for (auto& i : f.input)
+        result = std::max(result, sample_distance(i, s));
+
+    return result;
+}
+
+// A fractal, and what is known about the place it is used.
+struct fractal_use
+{
+    const node* n;
+    // The spacing of the samples
+    glm::dvec3 spacing;
+    // How much the result of the script changes if the result of the
+    // fractal changes by 1, or infinity if not known
+    double gain;
+};
+
+// Finds the fractals in depth-first order.  The spacing is only known
+// as long as the position is not moved around by the script, and the
+// gain only as long as the results are added up and scaled.
+void find_fractals(const node& n, const glm::dvec3& s, double gain,
+                   std::vector<fractal_use>& found)
+{
+    const glm::dvec3 lost{unknown};
+
+    switch (n.type) {
+    case node::fractal:
+    case node::fractal3:
+        found.push_back(fractal_use{&n, s, gain});
+        // fall through
+
+    case node::map:
+    case node::map3:
+    case node::turbulence:
+    case node::turbulence3:
+    case node::worley:
+    case node::worley3:
+    case node::voronoi:
+    case node::lambda_:
+        // Only the first input is evaluated at the same position.
+        find_fractals(n.input[0], s, unknown, found);
+        for (size_t i = 1; i < n.input.size(); ++i)
+            find_fractals(n.input[i], lost, unknown, found);
+        return;
+
+    case node::add:
+    case node::sub:
+    case node::neg:
+        for (auto& i : n.input)
+            find_fractals(i, s, gain, found);
+        return;
+
+    case node::mul:
+        for (size_t i = 0; i < 2; ++i) {
+            auto& other = n.input[1 - i];
+            find_fractals(n.input[i], s,
+                          is_number(other) ? gain * std::abs(other.aux_var)
+                                           : unknown,
+                          found);
+        }
+        return;
+
+    case node::div:
+        find_fractals(n.input[0], s,
+                      is_number(n.input[1])
+                          ? gain / std::abs(n.input[1].aux_var)
+                          : unknown,
+                      found);
+        find_fractals(n.input[1], s, unknown, found);
+        return;
+
+    default:
+        for (auto& i : n.input)
+            find_fractals(i, s, unknown, found);
+    }
+}
+
+double octave_limit(const fractal_use& use, const generator_context& ctx,
+                    double tolerance, bool fade)
+{
+    auto& n = *use.n;
+    auto& f = n.input[1];
+    int octaves;
+    double lacunarity, persistence;
+    if (!fractal_params(n, octaves, lacunarity, persistence))
+        return unknown;
+
+    double result = octaves;
+
+    // Every octave halves (for a lacunarity of 2) the size of the
+    // features.  Once two samples are more than half a lattice cell
+    // apart, the noise is undersampled.  The fade starts one octave
+    // earlier, so at most one octave is partially visible.
+    double d = sample_distance(f, spread(n.input[0], use.spacing));
+    if (lacunarity > 1.0 && std::isfinite(d)) {
+        auto type = n.type == node::fractal ? var_t::xy : var_t::xyz;
+        bool can_fade = fade && f.input_type() == type;
+
+        for (int i = 0; i < octaves; ++i, d *= lacunarity) {
+            double w = d < 0.5 ? 1.0 : 0.0;
+            if (can_fade)
+                w = (0.5 - d) / (0.5 - 0.5 / lacunarity);
+
+            if (w < 1.0) {
+                result = i + std::floor(std::max(w, 0.0) * 16.0) / 16.0;
+                break;
+            }
+        }
+    }
+
+    // The octaves at the end that together stay below the tolerance
+    // are not needed either.
+    if (tolerance > 0.0 && std::isfinite(use.gain)) {
+        auto range = noise_range(n, ctx);
+        double div = 0.0, mul = 1.0;
+        for (int i = 0; i < octaves; ++i) {
+            div += mul;
+            mul *= persistence;
+        }
+
+        if (range.is_finite() && div != 0.0) {
+            double half = (range.hi - range.lo) * 0.5 * use.gain
+                          / std::abs(div);
+            double error = 0.0;
+            int keep = octaves;
+            for (; keep > 0; --keep) {
+                error += half * std::abs(std::pow(persistence, keep - 1));
+                if (error > tolerance)
+                    break;
+            }
+            result = std::min(result, double(keep));
+        }
+    }
+
+    return result < octaves ? result : unknown;
+}
+
+// Add up the terms of a rewritten fractal.
+node sum(std::vector<node> terms, double constant)
+{
+    if (terms.empty())
+        return node(constant);
+
+    node result{std::move(terms[0])};
+    for (size_t i = 1; i < terms.size(); ++i)
+        result = make(node::add, var_t::var, {result, terms[i]});
+
+    if (constant != 0.0)
+        result = make(node::add, var_t::var, {result, node(constant)});
+
+    return result;
+}
+
+node scaled(node n, double factor)
+{
+    if (factor == 1.0)
+        return n;
+
+    return make(node::mul, var_t::var, {std::move(n), node(factor)});
+}
+
+// Replace a fractal by its first octaves, and the middle of the range of
+// the noise function for the rest.
+node fewer_octaves(const node& n, const generator_context& ctx, int octaves,
+                   double limit)
+{
+    bool is_3d = n.type == node::fractal3;
+    int full = static_cast<int>(limit);
+    double fade = limit - full;
+    double lacunarity = n.input[3].aux_var;
+    double persistence = n.input[4].aux_var;
+
+    // Follow the loop in the generators, so the weights come out the
+    // same.  After i octaves, the position is p * stretch + offset.
+    double div = 0.0, mul = 1.0, div_full = 0.0, mul_full = 1.0;
+    double stretch = 1.0, offset = 0.0;
+    for (int i = 0; i < octaves; ++i) {
+        if (i == full) {
+            div_full = div;
+            mul_full = mul;
+        }
+        div += mul;
+        mul *= persistence;
+        if (i < full) {
+            stretch *= lacunarity;
+            offset = offset * lacunarity + 12345.0;
+        }
+    }
+
+    auto range = noise_range(n, ctx);
+    double middle = range.is_finite() ? (range.lo + range.hi) * 0.5 : 0.0;
+
+    std::vector<node> terms;
+    if (full > 0) {
+        node head{n};
+        head.input[2] = node(double(full));
+        terms.push_back(scaled(std::move(head), div_full / div));
+    }
+    if (fade > 0.0) {
+        node p{n.input[0]};
+        if (full > 0 && is_3d) {
+            p = make(node::scale3, var_t::xyz, {p, node(1.0 / stretch)});
+            p = make(node::shift3, var_t::xyz,
+                     {p, node(offset), node(0.0), node(0.0)});
+        } else if (full > 0) {
+            p = make(node::scale, var_t::xy, {p, node(1.0 / stretch)});
+            p = make(node::shift, var_t::xy, {p, node(offset), node(0.0)});
+        }
+        node octave{make(node::lambda_, var_t::var, {p, n.input[1]})};
+        terms.push_back(scaled(std::move(octave), fade * mul_full / div));
+    }
+
+    return sum(std::move(terms),
+               middle * (div - div_full - fade * mul_full) / div);
+}
+
+void limit_octaves(node& n, const generator_context& ctx,
+                   const std::vector<double>& limits, size_t& next)
+{
+    bool is_fractal = n.type == node::fractal || n.type == node::fractal3;
+    double limit = is_fractal ? limits.at(next++) : unknown;
+
+    for (auto& i : n.input)
+        limit_octaves(i, ctx, limits, next);
+
+    int octaves;
+    double lacunarity, persistence;
+    if (std::isfinite(limit) && fractal_params(n, octaves, lacunarity,
+                                               persistence)
+        && limit < octaves) {
+        n = fewer_octaves(n, ctx, octaves, limit);
+    }
+}
+
+void fold(node& n, const generator_slowinterpreter& interpreter)
+{
+    for (auto& i : n.input)
+        fold(i, interpreter);
+
+    switch (n.type) {
+    case node::then_else:
+        if (n.input[0].type == node::const_bool) {
+            replace(n, n.input[0].aux_bool ? 1 : 2);
+            return;
+        }
+        break;
+
+    // None of the functions have side effects, so it doesn't matter
+    // that the other operand is never evaluated.
+    case node::band:
+    case node::bor: {
+        bool absorbing = n.type == node::bor;
+        for (size_t i = 0; i < 2; ++i) {
+            if (n.input[i].type != node::const_bool)
+                continue;
+
+            if (n.input[i].aux_bool == absorbing)
+                n = node(absorbing);
+            else
+                replace(n, 1 - i);
+
+            return;
+        }
+    } break;
+
+    default:
+        break;
+    }
+
+    if (!is_foldable(n))
+        return;
+
+    if (n.return_type == var_t::boolean)
+        n = node(interpreter.condition(n));
+    else
+        n = node(interpreter.value(n));
+}
+
+} // anonymous namespace
+
+void fold_constants(node& n, const generator_context& ctx)
+{
+    // The constant parts are evaluated one node at a time, so a single
+    // interpreter does for the whole script.  A script that is folded is
+    // not worth keeping in the tile cache or store.
+    generator_slowinterpreter interpreter{ctx, n, false};
+    fold(n, interpreter);
+}
+
+std::vector<double> octave_limits(const node& n, const generator_context& ctx,
+                                  const glm::dvec3& spacing, double tolerance,
+                                  bool fade)
+{
+    std::vector<fractal_use> found;
+    find_fractals(n, spacing, 1.0, found);
+
+    // The errors of the fractals add up, so they have to share the
+    // tolerance.
+    auto shared = std::count_if(found.begin(), found.end(),
+                                [](const fractal_use& u) {
+        return std::isfinite(u.gain);
+    });
+    if (shared > 1)
+        tolerance /= shared;
+
+    std::vector<double> result;
+    for (auto& use : found)
+        result.push_back(octave_limit(use, ctx, tolerance, fade));
+
+    return result;
+}
+
+void limit_octaves(node& n, const generator_context& ctx,
+                   const std::vector<double>& limits)
+{
+    size_t next = 0;
+    limit_octaves(n, ctx, limits, next);
+}
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,74 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/optimize.hpp
+/// \brief  Simplify compiled scripts before they are run
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace hexa
+{
+namespace noise
+{
+
+class generator_context;
+class node;
+
+/** Evaluate everything that does not depend on the input coordinates.
+ *  Functions of which all parameters are constants (literals or global
+ *  variables) are replaced by their value, starting at the leaves, so
+ *  whole constant subexpressions collapse into a single constant.
+ *  A then_else with a constant condition is replaced by the branch that
+ *  is taken, and 'and' and 'or' with a constant operand are simplified.
+ *
+ *  Values are computed with generator_slowinterpreter, so the script
+ *  gives exactly the same results as before.
+ * @param n    The compiled script, modified in place
+ * @param ctx  Shared data (for the global seed) */
+void fold_constants(node& n, const generator_context& ctx);
+
+/** Decide how many octaves of every fractal() and fractal3() in a script
+ *  are worth computing, given how far apart the samples are, and how
+ *  much error is allowed in the result.  Octaves are dropped for two
+ *  reasons:
+ *   - Aliasing: once the samples are more than half a lattice cell of
+ *     the noise function apart, the octave only adds aliasing noise.
+ *     This is only checked if the position is transformed by scale,
+ *     shift, rotate, swap, xy and the planes, with constant parameters,
+ *     and the noise functions take a constant seed.  Anything else
+ *     (map, turbulence, worley, ...) keeps all octaves.
+ *   - Amplitude: if the root of the script is a sum of fractals, scaled
+ *     by constants, the octaves that together can change the result by
+ *     at most 'tolerance' are dropped.
+ *
+ *  With 'fade', an octave that is close to the aliasing limit is not
+ *  dropped at once, but faded out, so a terrain does not pop when the
+ *  level of detail changes.  The weight is a multiple of 1/16.
+ * @param n          The script
+ * @param ctx        Used to find the range of the noise functions
+ * @param spacing    The distance between samples along each axis, or 0
+ *                   if only one sample is taken in that direction
+ * @param tolerance  The largest change in the result that is allowed
+ * @param fade       Fade octaves out instead of dropping them
+ * @return For every fractal and fractal3, in the order they are found by
+ *         a depth-first walk, the number of octaves to compute.  The
+ *         fractional part is the weight of the last one.  Fractals that
+ *         are not affected get infinity. */
+std::vector<double> octave_limits(const node& n, const generator_context& ctx,
+                                  const glm::dvec3& spacing, double tolerance,
+                                  bool fade);
+
+/** Rewrite the fractals in a script to use fewer octaves.  The octaves
+ *  that are dropped are replaced by the middle of the range of the
+ *  noise function, so the results stay in the same range.
+ * @param n       The script, modified in place
+ * @param ctx     Used to find the range of the noise functions
+ * @param limits  The result of octave_limits() for this script */
+void limit_octaves(node& n, const generator_context& ctx,
+                   const std::vector<double>& limits);
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,2217 @@
+//---------------------------------------------------------------------------
+// hexanoise/primitives.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "primitives.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+
+namespace hexa
+{
+namespace noise
+{
+
+namespace
+{
+
+
+#define ONE_F1 (1.0)
+#define ZERO_F1 (0.0)
+
+// Ken Perlin's permutation table.
+const int P_MASK = 255;
+const int P_SIZE = 256;
+static const int P[512] = {
+    151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233, 7,
+    225, 140, 36,  103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,  190,
+    6,   148, 247, 120, 234, 75,  0,   26,  197, 62,  94,  252, 219, 203, 117,
+    35,  11,  32,  57,  177, 33,  88,  237, 149, 56,  87,  174, 20,  125, 136,
+    171, 168, 68,  175, 74,  165, 71,  134, 139, 48,  27,  166, 77,  146, 158,
+    231, 83,  111, 229, 122, 60,  211, 133, 230, 220, 105, 92,  41,  55,  46,
+    245, 40,  244, 102, 143, 54,  65,  25,  63,  161, 1,   216, 80,  73,  209,
+    76,  132, 187, 208, 89,  18,  169, 200, 196, 135, 130, 116, 188, 159, 86,
+    164, 100, 109, 198, 173, 186, 3,   64,  52,  217, 226, 250, 124, 123, 5,
+    202, 38,  147, 118, 126, 255, 82,  85,  212, 207, 206, 59,  227, 47,  16,
+    58,  17,  182, 189, 28,  42,  223, 183, 170, 213, 119, 248, 152, 2,   44,
+    154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,   129, 22,  39,  253,
+    19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104, 218, 246, 97,
+    228, 251, 34,  242, 193, 238, 210, 144, 12,  191, 179, 162, 241, 81,  51,
+    145, 235, 249, 14,  239, 107, 49,  192, 214, 31,  181, 199, 106, 157, 184,
+    84,  204, 176, 115, 121, 50,  45,  127, 4,   150, 254, 138, 236, 205, 93,
+    222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,  156,
+    180, 151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233,
+    7,   225, 140, 36,  103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,
+    190, 6,   148, 247, 120, 234, 75,  0,   26,  197, 62,  94,  252, 219, 203,
+    117, 35,  11,  32,  57,  177, 33,  88,  237, 149, 56,  87,  174, 20,  125,
+    136, 171, 168, 68,  175, 74,  165, 71,  134, 139, 48,  27,  166, 77,  146,
+    158, 231, 83,  111, 229, 122, 60,  211, 133, 230, 220, 105, 92,  41,  55,
+    46,  245, 40,  244, 102, 143, 54,  65,  25,  63,  161, 1,   216, 80,  73,
+    209, 76,  132, 187, 208, 89,  18,  169, 200, 196, 135, 130, 116, 188, 159,
+    86,  164, 100, 109, 198, 173, 186, 3,   64,  52,  217, 226, 250, 124, 123,
+    5,   202, 38,  147, 118, 126, 255, 82,  85,  212, 207, 206, 59,  227, 47,
+    16,  58,  17,  182, 189, 28,  42,  223, 183, 170, 213, 119, 248, 152, 2,
+    44,  154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,   129, 22,  39,
+    253, 19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104, 218, 246,
+    97,  228, 251, 34,  242, 193, 238, 210, 144, 12,  191, 179, 162, 241, 81,
+    51,  145, 235, 249, 14,  239, 107, 49,  192, 214, 31,  181, 199, 106, 157,
+    184, 84,  204, 176, 115, 121, 50,  45,  127, 4,   150, 254, 138, 236, 205,
+    93,  222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,
+    156, 180
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+const int G_MASK = 15;
+const int G_SIZE = 16;
+const int G_VECSIZE = 4;
+static const double G[16 * 4]
+    = {+ONE_F1,  +ONE_F1,  +ZERO_F1, +ZERO_F1, -ONE_F1,  +ONE_F1,  +ZERO_F1,
+       +ZERO_F1, +ONE_F1,  -ONE_F1,  +ZERO_F1, +ZERO_F1, -ONE_F1,  -ONE_F1,
+       +ZERO_F1, +ZERO_F1, +ONE_F1,  +ZERO_F1, +ONE_F1,  +ZERO_F1, -ONE_F1,
+       +ZERO_F1, +ONE_F1,  +ZERO_F1, +ONE_F1,  +ZERO_F1, -ONE_F1,  +ZERO_F1,
+       -ONE_F1,  +ZERO_F1, -ONE_F1,  +ZERO_F1, +ZERO_F1, +ONE_F1,  +ONE_F1,
+       +ZERO_F1, +ZERO_F1, -ONE_F1,  +ONE_F1,  +ZERO_F1, +ZERO_F1, +ONE_F1,
+       -ONE_F1,  +ZERO_F1, +ZERO_F1, -ONE_F1,  -ONE_F1,  +ZERO_F1, +ONE_F1,
+       +ONE_F1,  +ZERO_F1, +ZERO_F1, -ONE_F1,  +ONE_F1,  +ZERO_F1, +ZERO_F1,
+       +ZERO_F1, -ONE_F1,  +ONE_F1,  +ZERO_F1, +ZERO_F1, -ONE_F1,  -ONE_F1,
+       +ZERO_F1};
+
+// Entry i of G, as a vector.
+inline glm::dvec2 g_vec2(int i)
+{
+    return glm::dvec2{G[i * G_VECSIZE], G[i * G_VECSIZE + 1]};
+}
+
+inline glm::dvec3 g_vec3(int i)
+{
+    return glm::dvec3{G[i * G_VECSIZE], G[i * G_VECSIZE + 1],
+                      G[i * G_VECSIZE + 2]};
+}
+
+inline double clamp(double x, double min, double max)
+{
+    return std::min(std::max(x, min), max);
+}
+
+inline double lerp(double x, double a, double b)
+{
+    return a + x * (b - a);
+}
+
+inline double blend5(const double a)
+{
+    return a * a * a * (a * (a * 6.0 - 15.0) + 10.0);
+}
+
+// The derivative of blend5().
+inline double blend5_slope(const double a)
+{
+    return 30.0 * a * a * (a - 1.0) * (a - 1.0);
+}
+
+// Add the derivative of t^4 * (g . d) to a gradient, where t = r - |d|^2.
+// This is the shape of every corner's share in (Open)Simplex noise.
+inline void add_slope(glm::dvec2* gradient, double t, const glm::dvec2& g,
+                      const glm::dvec2& d)
+{
+    if (gradient)
+        *gradient += (g * t - d * (8.0 * glm::dot(g, d))) * (t * t * t);
+}
+
+inline void add_slope(glm::dvec3* gradient, double t, const glm::dvec3& g,
+                      const glm::dvec3& d)
+{
+    if (gradient)
+        *gradient += (g * t - d * (8.0 * glm::dot(g, d))) * (t * t * t);
+}
+
+inline double interp_cubic(double v0, double v1, double v2, double v3,
+                           double a)
+{
+    const double x = v3 - v2 - v0 + v1;
+    const double a2 = a * a;
+    const double a3 = a2 * a;
+    return x * a3 + (v0 - v1 - x) * a2 + (v2 - v0) * a + v1;
+}
+
+inline glm::dvec2 lerp2d(const double x, const glm::dvec2& a,
+                         const glm::dvec2& b)
+{
+    return a + x * (b - a);
+}
+
+inline glm::dvec4 lerp4d(const double x, const glm::dvec4& a,
+                         const glm::dvec4& b)
+{
+    return a + x * (b - a);
+}
+
+inline double dot(const double* p, double x, double y)
+{
+    return p[0] * x + p[1] * y;
+}
+
+inline double dot(const double* p, double x, double y, double z)
+{
+    return p[0] * x + p[1] * y + p[2] * z;
+}
+
+inline uint32_t hash(uint32_t x, uint32_t y)
+{
+    return ((uint32_t)x * 2120969693) ^ ((uint32_t)y * 915488749) ^ ((uint32_t)(x + 1103515245) * (uint32_t)(y + 1234567));
+}
+
+inline uint32_t hash(uint32_t x, uint32_t y, uint32_t z)
+{
+    return ((uint32_t)x * 2120969693)
+            ^ ((uint32_t)y * 915488749)
+            ^ ((uint32_t)z * 22695477)
+            ^ ((uint32_t)(x + 1103515245) * (uint32_t)(y + 1234567) * (uint32_t)(z + 134775813));
+}
+
+inline uint32_t rng(uint32_t last)
+{
+    return (1103515245 * last + 12345) & 0x7FFFFFFF;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Perlin
+
+inline glm::dvec2 gradient2d(glm::ivec2 ixy, const int* perm, uint32_t seed)
+{
+    ixy.x += seed * 1013;
+    ixy.y += seed * 1619;
+    ixy &= P_MASK;
+
+    int index = (perm[ixy.x + perm[ixy.y]] & G_MASK) * G_VECSIZE;
+    return glm::dvec2{G[index], G[index + 1]};
+}
+
+inline glm::dvec3 gradient3d(glm::ivec3 ixyz, const int* perm, uint32_t seed)
+{
+    ixyz.x += seed * 1013;
+    ixyz.y += seed * 1619;
+    ixyz.z += seed * 997;
+    ixyz &= P_MASK;
+
+    int index
+        = (perm[ixyz.x + perm[ixyz.y + perm[ixyz.z]]] & G_MASK) * G_VECSIZE;
+    return glm::dvec3{G[index], G[index + 1], G[index + 2]};
+}
+
+inline double gradient_noise2d(const glm::dvec2& xy, glm::ivec2 ixy,
+                               const int* perm, uint32_t seed)
+{
+    return glm::dot(xy, gradient2d(ixy, perm, seed));
+}
+
+inline double gradient_noise3d(glm::ivec3 ixyz, const glm::dvec3& xyz,
+                               const int* perm, uint32_t seed)
+{
+    return glm::dot(xyz, gradient3d(ixyz, perm, seed));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// OpenSimplex
+
+// Gradients for 2D. They approximate the directions to the
+// vertices of an octagon from the center.
+static const int8_t gradients2D[] = {
+    5, 2, 2, 5,
+    -5, 2, -2, 5,
+    5, -2, 2, -5,
+    -5, -2, -2, -5
+};
+
+inline double extrapolate2(int xsb, int ysb, const glm::dvec2& d,
+                           const int* perm, uint32_t seed)
+{
+    int index = perm[(perm[(xsb + seed) & 0xFF] + (ysb + seed * 23)) & 0xFF] & 0x0E;
+    return gradients2D[index] * d.x + gradients2D[index + 1] * d.y;
+}
+
+// The gradient that extrapolate2() takes the dot product with.
+inline glm::dvec2 gradient_os2(int xsb, int ysb, const int* perm,
+                               uint32_t seed)
+{
+    int index = perm[(perm[(xsb + seed) & 0xFF] + (ysb + seed * 23)) & 0xFF] & 0x0E;
+    return glm::dvec2{gradients2D[index], gradients2D[index + 1]};
+}
+
+inline double attn (const glm::dvec2& p)
+{
+    return 2.0 - glm::dot(p, p);
+}
+
+// Gradients for 3D. They approximate the directions to the
+// vertices of a rhombicuboctahedron from the center, skewed so
+// that the triangular and square facets can be inscribed inside
+// circles of the same radius.
+static const glm::dvec3 gradients3D[] = {
+    glm::dvec3(-11., 4., 4.),   glm::dvec3(-4., 11., 4.),   glm::dvec3(-4., 4., 11.),
+    glm::dvec3(11., 4., 4.),    glm::dvec3(4., 11., 4.),    glm::dvec3(4., 4., 11.),
+    glm::dvec3(-11., -4., 4.),  glm::dvec3(-4., -11., 4.),  glm::dvec3(-4., -4., 11.),
+    glm::dvec3(11., -4., 4.),   glm::dvec3(4., -11., 4.),   glm::dvec3(4., -4., 11.),
+    glm::dvec3(-11., 4., -4.),  glm::dvec3(-4., 11., -4.),  glm::dvec3(-4., 4., -11.),
+    glm::dvec3(11., 4., -4.),   glm::dvec3(4., 11., -4.),   glm::dvec3(4., 4., -11.),
+    glm::dvec3(-11., -4., -4.), glm::dvec3(-4., -11., -4.), glm::dvec3(-4., -4., -11.),
+    glm::dvec3(11., -4., -4.),  glm::dvec3(4., -11., -4.),  glm::dvec3(4., -4., -11.)
+};
+
+inline double extrapolate3(int xsb, int ysb, int zsb, const glm::dvec3& d,
+                           const int* perm, uint32_t seed)
+{
+    int index = perm[(perm[(perm[(xsb + seed) & 0xFF] + (ysb + seed * 23)) & 0xFF] + (zsb + seed * 27)) & 0xFF] % 24;
+    return glm::dot(gradients3D[index], d);
+}
+
+inline glm::dvec3 gradient_os3(int xsb, int ysb, int zsb, const int* perm,
+                               uint32_t seed)
+{
+    int index = perm[(perm[(perm[(xsb + seed) & 0xFF] + (ysb + seed * 23)) & 0xFF] + (zsb + seed * 27)) & 0xFF] % 24;
+    return gradients3D[index];
+}
+
+inline double attn (const glm::dvec3& p)
+{
+    return 2.0 - glm::dot(p, p);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Perlin
+
+// If gradient is not null, it receives the derivatives of the noise along
+// x and y.  The same goes for the other noise functions below.
+double perlin(const glm::dvec2& xy, const int* perm, uint32_t seed,
+              glm::dvec2* gradient = nullptr)
+{
+    glm::dvec2 t{glm::floor(xy)};
+    glm::ivec2 xy0{(int)t.x, (int)t.y};
+    glm::dvec2 xyf{xy - t};
+
+    const glm::ivec2 I01{0, 1};
+    const glm::ivec2 I10{1, 0};
+    const glm::ivec2 I11{1, 1};
+
+    const glm::dvec2 F01{0.0, 1.0};
+    const glm::dvec2 F10{1.0, 0.0};
+    const glm::dvec2 F11{1.0, 1.0};
+
+    const double n00 = gradient_noise2d(xyf, xy0, perm, seed);
+    const double n10 = gradient_noise2d(xyf - F10, xy0 + I10, perm, seed);
+    const double n01 = gradient_noise2d(xyf - F01, xy0 + I01, perm, seed);
+    const double n11 = gradient_noise2d(xyf - F11, xy0 + I11, perm, seed);
+
+    const glm::dvec2 n0001{n00, n01};
+    const glm::dvec2 n1011{n10, n11};
+    const glm::dvec2 n2 = lerp2d(blend5(xyf.x), n0001, n1011);
+
+    if (gradient) {
+        // Sum up the gradients of the corners, weighted by the blend
+        // factors, and the corner values, weighted by the slopes of the
+        // blend factors.
+        glm::dvec2 w{blend5(xyf.x), blend5(xyf.y)};
+        glm::dvec2 dw{blend5_slope(xyf.x), blend5_slope(xyf.y)};
+        glm::dvec2 g;
+        for (int i = 0; i < 2; ++i) {
+            for (int j = 0; j < 2; ++j) {
+                glm::ivec2 c{i, j};
+                glm::dvec2 cg{gradient2d(xy0 + c, perm, seed)};
+                double n = glm::dot(xyf - glm::dvec2{c}, cg);
+                double wx = i ? w.x : 1.0 - w.x, dwx = i ? dw.x : -dw.x;
+                double wy = j ? w.y : 1.0 - w.y, dwy = j ? dw.y : -dw.y;
+                g += cg * (wx * wy) + glm::dvec2{dwx * wy, wx * dwy} * n;
+            }
+        }
+        *gradient = g * 1.227;
+    }
+
+    return lerp(blend5(xyf.y), n2.x, n2.y) * 1.227;
+}
+
+double perlin3(const glm::dvec3& xyz, const int* perm, uint32_t seed,
+               glm::dvec3* gradient = nullptr)
+{
+    glm::dvec3 t {glm::floor(xyz)};
+    glm::ivec3 xyz0 {(int)t.x, (int)t.y, (int)t.z};
+    glm::dvec3 xyzf {xyz - t};
+
+    const glm::ivec3 I001 {0, 0, 1};
+    const glm::ivec3 I010 {0, 1, 0};
+    const glm::ivec3 I011 {0, 1, 1};
+    const glm::ivec3 I100 {1, 0, 0};
+    const glm::ivec3 I101 {1, 0, 1};
+    const glm::ivec3 I110 {1, 1, 0};
+    const glm::ivec3 I111 {1, 1, 1};
+
+    const glm::dvec3 F001 {0.0, 0.0, 1.0};
+    const glm::dvec3 F010 {0.0, 1.0, 0.0};
+    const glm::dvec3 F011 {0.0, 1.0, 1.0};
+    const glm::dvec3 F100 {1.0, 0.0, 0.0};
+    const glm::dvec3 F101 {1.0, 0.0, 1.0};
+    const glm::dvec3 F110 {1.0, 1.0, 0.0};
+    const glm::dvec3 F111 {1.0, 1.0, 1.0};
+
+    const double n000 = gradient_noise3d(xyz0       , xyzf       , perm, seed);
+    const double n001 = gradient_noise3d(xyz0 + I001, xyzf - F001, perm, seed);
+    const double n010 = gradient_noise3d(xyz0 + I010, xyzf - F010, perm, seed);
+    const double n011 = gradient_noise3d(xyz0 + I011, xyzf - F011, perm, seed);
+    const double n100 = gradient_noise3d(xyz0 + I100, xyzf - F100, perm, seed);
+    const double n101 = gradient_noise3d(xyz0 + I101, xyzf - F101, perm, seed);
+    const double n110 = gradient_noise3d(xyz0 + I110, xyzf - F110, perm, seed);
+    const double n111 = gradient_noise3d(xyz0 + I111, xyzf - F111, perm, seed);
+
+    glm::dvec4 n40 {n000, n001, n010, n011};
+    glm::dvec4 n41 {n100, n101, n110, n111};
+
+    auto n4 = lerp4d(blend5(xyzf.x), n40, n41);
+    auto n2 = lerp2d(blend5(xyzf.y), {n4.x, n4.y}, {n4.z, n4.w});
+    auto n1 = lerp(blend5(xyzf.z), n2.x, n2.y);
+
+    if (gradient) {
+        glm::dvec3 w{blend5(xyzf.x), blend5(xyzf.y), blend5(xyzf.z)};
+        glm::dvec3 dw{blend5_slope(xyzf.x), blend5_slope(xyzf.y),
+                      blend5_slope(xyzf.z)};
+        glm::dvec3 g;
+        for (int i = 0; i < 2; ++i) {
+            for (int j = 0; j < 2; ++j) {
+                for (int k = 0; k < 2; ++k) {
+                    glm::ivec3 c{i, j, k};
+                    glm::dvec3 cg{gradient3d(xyz0 + c, perm, seed)};
+                    double n = glm::dot(xyzf - glm::dvec3{c}, cg);
+                    double wx = i ? w.x : 1.0 - w.x, dwx = i ? dw.x : -dw.x;
+                    double wy = j ? w.y : 1.0 - w.y, dwy = j ? dw.y : -dw.y;
+                    double wz = k ? w.z : 1.0 - w.z, dwz = k ? dw.z : -dw.z;
+                    g += cg * (wx * wy * wz)
+                         + glm::dvec3{dwx * wy * wz, wx * dwy * wz,
+                                      wx * wy * dwz} * n;
+                }
+            }
+        }
+        *gradient = g * 1.216;
+    }
+
+    return n1 * 1.216;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Simplex
+
+double simplex(const glm::dvec2& xy, const int* perm, uint32_t seed,
+               glm::dvec2* gradient = nullptr)
+{
+    double n0, n1, n2;
+
+    // Skew the input space to determine which simplex cell we're in
+    const double F2 = 0.5 * (std::sqrt(3.0) - 1.0);
+    const double G2 = (3.0 - std::sqrt(3.0)) / 6.0;
+
+    double s = (xy.x + xy.y) * F2;
+    int i = std::floor(xy.x + s);
+    int j = std::floor(xy.y + s);
+
+    // Unskew the cell origin back to (x,y) space
+    double t = (i + j) * G2;
+    double X0 = i - t;
+    double Y0 = j - t;
+
+    // The x,y distances from the cell origin
+    double x0 = xy.x - X0;
+    double y0 = xy.y - Y0;
+
+    // For the 2D case, the simplex shape is an equilateral triangle.
+    // Determine which simplex we are in.
+    int i1, j1; // Offsets for second (middle) corner in (i,j) coords
+    if (x0 > y0) {
+        i1 = 1; // lower triangle, XY order: (0,0)->(1,0)->(1,1)
+        j1 = 0;
+    } else {
+        i1 = 0; // upper triangle, YX order: (0,0)->(0,1)->(1,1)
+        j1 = 1;
+    }
+
+    double x1 = x0 - i1 + G2;
+    double y1 = y0 - j1 + G2;
+    double x2 = x0 - 1.0 + 2.0 * G2;
+    double y2 = y0 - 1.0 + 2.0 * G2;
+
+    int ii = (i + seed * 1063) & 0xFF;
+    int jj = j & 0xFF;
+    int gi0 = perm[ii + perm[jj]] & G_MASK;
+    int gi1 = perm[ii + i1 + perm[jj + j1]] & G_MASK;
+    int gi2 = perm[ii + 1 + perm[jj + 1]] & G_MASK;
+
+    if (gradient)
+        *gradient = glm::dvec2{0.0, 0.0};
+
+    double t0 = 0.5 - x0 * x0 - y0 * y0;
+    if (t0 < 0) {
+        n0 = 0.0;
+    } else {
+        add_slope(gradient, t0, g_vec2(gi0), glm::dvec2{x0, y0});
+        t0 *= t0;
+        n0 = t0 * t0 * dot(&G[gi0 * G_VECSIZE], x0, y0);
+    }
+
+    double t1 = 0.5 - x1 * x1 - y1 * y1;
+    if (t1 < 0) {
+        n1 = 0.0;
+    } else {
+        add_slope(gradient, t1, g_vec2(gi1), glm::dvec2{x1, y1});
+        t1 *= t1;
+        n1 = t1 * t1 * dot(&G[gi1 * G_VECSIZE], x1, y1);
+    }
+
+    double t2 = 0.5 - x2 * x2 - y2 * y2;
+    if (t2 < 0) {
+        n2 = 0.0;
+    } else {
+        add_slope(gradient, t2, g_vec2(gi2), glm::dvec2{x2, y2});
+        t2 *= t2;
+        n2 = t2 * t2 * dot(&G[gi2 * G_VECSIZE], x2, y2);
+    }
+
+    if (gradient)
+        *gradient *= 70.0;
+
+    return 70.0 * (n0 + n1 + n2);
+}
+
+double simplex3(const glm::dvec3& p, const int* perm, uint32_t seed,
+                glm::dvec3* gradient = nullptr)
+{
+    // Skew the input space to determine which simplex cell we're in
+    const double F3 = 1.0 / 3.0;
+    double s = (p.x + p.y + p.z) * F3;
+    int i = std::floor(p.x + s);
+    int j = std::floor(p.y + s);
+    int k = std::floor(p.z + s);
+
+    // Unskew the cell origin back to (x,y) space
+    const double G3 = 1.0 / 6.0;
+    double t = (i + j + k) * G3;
+    double X0 = i - t;
+    double Y0 = j - t;
+    double Z0 = k - t;
+
+    // The x,y distances from the cell origin
+    double x0 = p.x - X0;
+    double y0 = p.y - Y0;
+    double z0 = p.z - Z0;
+
+    // For the 3D case, the simplex shape is a slightly irregular tetrahedron.
+    // Determine which simplex we are in.
+    int i1, j1, k1; // Offsets for second corner of simplex in (i,j,k) coords
+    int i2, j2, k2; // Offsets for third corner
+
+    if (x0 >= y0) {
+        if (y0 >= z0) {
+            i1 = 1;
+            j1 = 0;
+            k1 = 0;
+            i2 = 1;
+            j2 = 1;
+            k2 = 0;
+        } else if (x0 >= z0) {
+            i1 = 1;
+            j1 = 0;
+            k1 = 0;
+            i2 = 1;
+            j2 = 0;
+            k2 = 1;
+        } else {
+            i1 = 0;
+            j1 = 0;
+            k1 = 1;
+            i2 = 1;
+            j2 = 0;
+            k2 = 1;
+        }
+    } else { // x0 < y0
+        if (y0 < z0) {
+            i1 = 0;
+            j1 = 0;
+            k1 = 1;
+            i2 = 0;
+            j2 = 1;
+            k2 = 1;
+        } else if (x0 < z0) {
+            i1 = 0;
+            j1 = 1;
+            k1 = 0;
+            i2 = 0;
+            j2 = 1;
+            k2 = 1;
+        } else {
+            i1 = 0;
+            j1 = 1;
+            k1 = 0;
+            i2 = 1;
+            j2 = 1;
+            k2 = 0;
+        }
+    }
+
+    double x1 = x0 - i1 + G3;
+    double y1 = y0 - j1 + G3;
+    double z1 = z0 - k1 + G3;
+    double x2 = x0 - i2 + 2.0 * G3;
+    double y2 = y0 - j2 + 2.0 * G3;
+    double z2 = z0 - k2 + 2.0 * G3;
+    double x3 = x0 - 1.0 + 3.0 * G3;
+    double y3 = y0 - 1.0 + 3.0 * G3;
+    double z3 = z0 - 1.0 + 3.0 * G3;
+
+    int ii = (i + seed * 1063) & 0xFF;
+    int jj = j & 0xFF;
+    int kk = k & 0xFF;
+
+    int gi0 = perm[ii + perm[jj + perm[kk]]] & G_MASK;
+    int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] & G_MASK;
+    int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] & G_MASK;
+    int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] & G_MASK;
+
+    // Calculate the contribution from the four corners
+    double n0, n1, n2, n3;
+    if (gradient)
+        *gradient = glm::dvec3{0.0, 0.0, 0.0};
+
+    double t0 = 0.6 - x0 * x0 - y0 * y0 - z0 * z0;
+    if (t0 < 0) {
+        n0 = 0.0;
+    } else {
+        add_slope(gradient, t0, g_vec3(gi0), glm::dvec3{x0, y0, z0});
+        n0 = std::pow(t0, 4) * dot(&G[gi0 * G_VECSIZE], x0, y0, z0);
+    }
+
+    double t1 = 0.6 - x1 * x1 - y1 * y1 - z1 * z1;
+    if (t1 < 0) {
+        n1 = 0.0;
+    } else {
+        add_slope(gradient, t1, g_vec3(gi1), glm::dvec3{x1, y1, z1});
+        n1 = std::pow(t1, 4) * dot(&G[gi1 * G_VECSIZE], x1, y1, z1);
+    }
+
+    double t2 = 0.6 - x2 * x2 - y2 * y2 - z2 * z2;
+    if (t2 < 0) {
+        n2 = 0.0;
+    } else {
+        add_slope(gradient, t2, g_vec3(gi2), glm::dvec3{x2, y2, z2});
+        n2 = std::pow(t2, 4) * dot(&G[gi2 * G_VECSIZE], x2, y2, z2);
+    }
+
+    double t3 = 0.6 - x3 * x3 - y3 * y3 - z3 * z3;
+    if (t3 < 0) {
+        n3 = 0.0;
+    } else {
+        add_slope(gradient, t3, g_vec3(gi3), glm::dvec3{x3, y3, z3});
+        n3 = std::pow(t3, 4) * dot(&G[gi3 * G_VECSIZE], x3, y3, z3);
+    }
+
+    if (gradient)
+        *gradient *= 32.0;
+
+    return 32.0 * (n0 + n1 + n2 + n3);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// OpenSimplex
+
+// Implementation of the OpenSimplex algorithm by Kurt Spencer.
+double opensimplex(const glm::dvec2& p, const int* perm, uint32_t seed,
+                   glm::dvec2* gradient = nullptr)
+{
+    constexpr double STRETCH_CONSTANT_2D = -0.211324865405187; // (1 / sqrt(2 + 1) - 1 ) / 2;
+    constexpr double SQUISH_CONSTANT_2D = 0.366025403784439; // (sqrt(2 + 1) -1) / 2;
+    constexpr double NORM_CONSTANT_2D = 47.0;
+
+    // Place input coordinates onto grid.
+    double stretchOffset = (p.x + p.y) * STRETCH_CONSTANT_2D;
+    glm::dvec2 s {p + stretchOffset};
+
+    // Floor to get grid coordinates of rhombus (stretched square) super-cell origin.
+    glm::ivec2 sb {glm::floor(s)};
+
+    // Skew out to get actual coordinates of rhombus origin. We'll need these later.
+    double squishOffset = (sb.x + sb.y) * SQUISH_CONSTANT_2D;
+    glm::dvec2 b {glm::dvec2{sb} + squishOffset};
+
+    // Compute grid coordinates relative to rhombus origin.
+    glm::dvec2 ins {s - glm::dvec2{sb}};
+
+    // Sum those together to get a value that determines which region we're in.
+    double inSum = ins.x + ins.y;
+
+    // Positions relative to origin point.
+    glm::dvec2 d0 {p - b};
+
+    // We'll be defining these inside the next block and using them afterwards.
+    glm::dvec2 d_ext;
+    glm::ivec2 sv_ext;
+    double value = 0;
+    if (gradient)
+        *gradient = glm::dvec2{0.0, 0.0};
+
+    // Contribution (1,0)
+    glm::dvec2 d1 {(d0 + glm::dvec2{-1,0}) - SQUISH_CONSTANT_2D};
+    double attn1 = attn(d1);
+
+    if (attn1 > 0) {
+        add_slope(gradient, attn1, gradient_os2(sb.x + 1, sb.y + 0, perm, seed), d1);
+        attn1 *= attn1;
+        value += attn1 * attn1 * extrapolate2(sb.x + 1, sb.y + 0, d1, perm, seed);
+    }
+
+    // Contribution (0,1)
+    glm::dvec2 d2 {(d0 + glm::dvec2(0,-1)) - SQUISH_CONSTANT_2D};
+    double attn2 = attn(d2);
+    if (attn2 > 0) {
+        add_slope(gradient, attn2, gradient_os2(sb.x + 0, sb.y + 1, perm, seed), d2);
+        attn2 *= attn2;
+        value += attn2 * attn2 * extrapolate2(sb.x + 0, sb.y + 1, d2, perm, seed);
+    }
+
+    if (inSum <= 1) { // We're inside the triangle (2-Simplex) at (0,0)
+        double zins = 1 - inSum;
+        if (zins > ins.x || zins > ins.y) { // (0,0) is one of the closest two triangular vertices
+            if (ins.x > ins.y) {
+                sv_ext = sb + glm::ivec2{1, -1};
+                d_ext = d0 + glm::dvec2{-1, 1};
+            } else {
+                sv_ext = sb + glm::ivec2{-1, 1};
+                d_ext = d0 + glm::dvec2{1, -1};
+            }
+        } else { // (1,0) and (0,1) are the closest two vertices.
+            sv_ext = sb + glm::ivec2{1, 1};
+            d_ext = (d0 + glm::dvec2{-1, -1}) - 2 * SQUISH_CONSTANT_2D;
+        }
+    } else { // We're inside the triangle (2-Simplex) at (1,1)
+        double zins = 2 - inSum;
+        if (zins < ins.x || zins < ins.y) { // (0,0) is one of the closest two triangular vertices
+            if (ins.x > ins.y) {
+                sv_ext = sb + glm::ivec2{2,0};
+                d_ext = (d0 + glm::dvec2{-2, 0}) - 2 * SQUISH_CONSTANT_2D;
+            } else {
+                sv_ext = sb + glm::ivec2{0, 2};
+                d_ext = (d0 + glm::dvec2{0, -2}) - 2 * SQUISH_CONSTANT_2D;
+            }
+        } else { // (1,0) and (0,1) are the closest two vertices.
+            d_ext = d0;
+            sv_ext = sb;
+        }
+        sb += 1;
+        d0 = d0 - 1.0 - 2 * SQUISH_CONSTANT_2D;
+    }
+
+    // Contribution (0,0) or (1,1)
+    double attn0 = attn(d0);
+    if (attn0 > 0) {
+        add_slope(gradient, attn0, gradient_os2(sb.x, sb.y, perm, seed), d0);
+        value += std::pow(attn0, 4) * extrapolate2(sb.x, sb.y, d0, perm, seed);
+    }
+
+    // Extra Vertex
+    double attn_ext = attn(d_ext);
+    if (attn_ext > 0) {
+        add_slope(gradient, attn_ext, gradient_os2(sv_ext.x, sv_ext.y, perm, seed), d_ext);
+        value += std::pow(attn_ext, 4) * extrapolate2(sv_ext.x, sv_ext.y, d_ext, perm, seed);
+    }
+
+    if (gradient)
+        *gradient /= NORM_CONSTANT_2D;
+
+    return value / NORM_CONSTANT_2D;
+}
+
+double opensimplex3(const glm::dvec3& p, const int* perm, uint32_t seed,
+                    glm::dvec3* gradient = nullptr)
+{
+    constexpr double STRETCH_CONSTANT_3D = -1.0 / 6.0; // (1 / sqrt(3 + 1) - 1) / 3;
+    constexpr double SQUISH_CONSTANT_3D = 1.0 / 3.0; // (sqrt(3+1)-1)/3;
+    constexpr double NORM_CONSTANT_3D = 103.0;
+
+    // Place input coordinates on simplectic honeycomb.
+    double stretchOffset = (p.x + p.y + p.z) * STRETCH_CONSTANT_3D;
+    glm::dvec3 s {p + stretchOffset};
+
+    // Floor to get grid coordinates of rhombohedron (stretched cube) super-cell origin.
+    glm::ivec3 sb {glm::floor(s)};
+
+    // Skew out to get actual coordinates of rhombohedron origin. We'll need these later.
+    double squishOffset = (sb.x + sb.y + sb.z) * SQUISH_CONSTANT_3D;
+    glm::dvec3 b {glm::dvec3{sb} + squishOffset};
+
+    // Compute grid coordinates relative to rhombus origin.
+    glm::dvec3 ins {s - glm::dvec3{sb}};
+
+    // Sum those together to get a value that determines which region we're in.
+    double inSum = ins.x + ins.y + ins.z;
+
+    // Positions relative to origin point.
+    glm::dvec3 d0 = p - b;
+
+    // We'll be defining these inside the next block and using them afterwards.
+    glm::dvec3 d_ext0, d_ext1;
+    glm::ivec3 sv_ext0, sv_ext1;
+    double value = 0;
+    if (gradient)
+        *gradient = glm::dvec3{0.0, 0.0, 0.0};
+
+    if (inSum <= 1) { // We're inside the tetrahedron (3-Simplex) at (0,0,0)
+        // Determine which two of (0,0,1), (0,1,0), (1,0,0) are closest.
+        uint8_t aPoint = 0x01;
+        double aScore = ins.x;
+        uint8_t bPoint = 0x02;
+        double bScore = ins.y;
+        if (aScore >= bScore && ins.z > bScore) {
+            bScore = ins.z;
+            bPoint = 0x04;
+        } else if (aScore < bScore && ins.z > aScore) {
+            aScore = ins.z;
+            aPoint = 0x04;
+        }
+
+        // Now we determine the two lattice points not part of the tetrahedron that may contribute.
+        // This depends on the closest two tetrahedral vertices, including (0,0,0)
+        double wins = 1 - inSum;
+        if (wins > aScore || wins > bScore) { // (0,0,0) is one of the closest two tetrahedral vertices.
+            uint8_t c = (bScore > aScore ? bPoint : aPoint); // Our other closest vertex is the closest out of a and b.
+            if ((c & 0x01) == 0) {
+                sv_ext0.x = sb.x - 1;
+                sv_ext1.x = sb.x;
+                d_ext0.x = d0.x + 1;
+                d_ext1.x = d0.x;
+            } else {
+                sv_ext0.x = sv_ext1.x = sb.x + 1;
+                d_ext0.x = d_ext1.x = d0.x - 1;
+            }
+
+            if ((c & 0x02) == 0) {
+                sv_ext0.y = sv_ext1.y = sb.y;
+                d_ext0.y = d_ext1.y = d0.y;
+                if ((c & 0x01) == 0) {
+                    sv_ext1.y -= 1;
+                    d_ext1.y += 1;
+                } else {
+                    sv_ext0.y -= 1;
+                    d_ext0.y += 1;
+                }
+            } else {
+                sv_ext0.y = sv_ext1.y = sb.y + 1;
+                d_ext0.y = d_ext1.y = d0.y - 1;
+            }
+
+            if ((c & 0x04) == 0) {
+                sv_ext0.z = sb.z;
+                sv_ext1.z = sb.z - 1;
+                d_ext0.z = d0.z;
+                d_ext1.z = d0.z + 1;
+            } else {
+                sv_ext0.z = sv_ext1.z = sb.z + 1;
+                d_ext0.z = d_ext1.z = d0.z - 1;
+            }
+        } else { // (0,0,0) is not one of the closest two tetrahedral vertices.
+            uint8_t c = (aPoint | bPoint); // Our two extra vertices are determined by the closest two.
+            if ((c & 0x01) == 0) {
+                sv_ext0.x = sb.x;
+                sv_ext1.x = sb.x - 1;
+                d_ext0.x = d0.x - 2 * SQUISH_CONSTANT_3D;
+                d_ext1.x = d0.x + 1 - SQUISH_CONSTANT_3D;
+            } else {
+                sv_ext0.x = sv_ext1.x = sb.x + 1;
+                d_ext0.x = d0.x - 1 - 2 * SQUISH_CONSTANT_3D;
+                d_ext1.x = d0.x - 1 - SQUISH_CONSTANT_3D;
+            }
+
+            if ((c & 0x02) == 0) {
+                sv_ext0.y = sb.y;
+                sv_ext1.y = sb.y - 1;
+                d_ext0.y = d0.y - 2 * SQUISH_CONSTANT_3D;
+                d_ext1.y = d0.y + 1 - SQUISH_CONSTANT_3D;
+            } else {
+                sv_ext0.y = sv_ext1.y = sb.y + 1;
+                d_ext0.y = d0.y - 1 - 2 * SQUISH_CONSTANT_3D;
+                d_ext1.y = d0.y - 1 - SQUISH_CONSTANT_3D;
+            }
+
+            if ((c & 0x04) == 0) {
+                sv_ext0.z = sb.z;
+                sv_ext1.z = sb.z - 1;
+                d_ext0.z = d0.z - 2 * SQUISH_CONSTANT_3D;
+                d_ext1.z = d0.z + 1 - SQUISH_CONSTANT_3D;
+            } else {
+                sv_ext0.z = sv_ext1.z = sb.z + 1;
+                d_ext0.z = d0.z - 1 - 2 * SQUISH_CONSTANT_3D;
+                d_ext1.z = d0.z - 1 - SQUISH_CONSTANT_3D;
+            }
+        }
+
+        // Contribution (0,0,0)
+        double attn0 = attn(d0);
+        if (attn0 > 0) {
+            add_slope(gradient, attn0, gradient_os3(sb.x + 0, sb.y + 0, sb.z + 0, perm, seed), d0);
+            value += std::pow(attn0, 4) * extrapolate3(sb.x + 0, sb.y + 0, sb.z + 0, d0, perm, seed);
+        }
+
+        // Contribution (1,0,0)
+        glm::dvec3 d1 = (d0 + glm::dvec3{-1,0,0}) - SQUISH_CONSTANT_3D;
+        double attn1 = attn(d1);
+        if (attn1 > 0) {
+            add_slope(gradient, attn1, gradient_os3(sb.x + 1, sb.y + 0, sb.z + 0, perm, seed), d1);
+            value += std::pow(attn1, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 0, d1, perm, seed);
+        }
+
+        // Contribution (0,1,0)
+        glm::dvec3 d2  {d0.x - SQUISH_CONSTANT_3D, d0.y - 1 - SQUISH_CONSTANT_3D, d1.z};
+        double attn2 = attn(d2);
+        if (attn2 > 0) {
+            add_slope(gradient, attn2, gradient_os3(sb.x + 0, sb.y + 1, sb.z + 0, perm, seed), d2);
+            value += std::pow(attn2, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 0, d2, perm, seed);
+        }
+
+        // Contribution (0,0,1)
+        glm::dvec3 d3 {d2.x, d1.y, d0.z - 1 - SQUISH_CONSTANT_3D};
+        double attn3 = attn(d3);
+        if (attn3 > 0) {
+            add_slope(gradient, attn3, gradient_os3(sb.x + 0, sb.y + 0, sb.z + 1, perm, seed), d3);
+            value += std::pow(attn3, 4) * extrapolate3(sb.x + 0, sb.y + 0, sb.z + 1, d3, perm, seed);
+        }
+
+    } else if (inSum >= 2) { // We're inside the tetrahedron (3-Simplex) at (1,1,1)
+
+        // Determine which two tetrahedral vertices are the closest, out of (1,1,0), (1,0,1), (0,1,1) but not (1,1,1).
+        uint8_t aPoint = 0x06;
+        double aScore = ins.x;
+        uint8_t bPoint = 0x05;
+        double bScore = ins.y;
+        if (aScore <= bScore && ins.z < bScore) {
+            bScore = ins.z;
+            bPoint = 0x03;
+        } else if (aScore > bScore && ins.z < aScore) {
+            aScore = ins.z;
+            aPoint = 0x03;
+        }
+
+        // Now we determine the two lattice points not part of the tetrahedron that may contribute.
+        // This depends on the closest two tetrahedral vertices, including (1,1,1)
+        double wins = 3 - inSum;
+        if (wins < aScore || wins < bScore) { // (1,1,1) is one of the closest two tetrahedral vertices.
+            uint8_t c = (bScore < aScore ? bPoint : aPoint); // Our other closest vertex is the closest out of a and b.
+            if ((c & 0x01) != 0) {
+                sv_ext0.x = sb.x + 2;
+                sv_ext1.x = sb.x + 1;
+                d_ext0.x = d0.x - 2 - 3 * SQUISH_CONSTANT_3D;
+                d_ext1.x = d0.x - 1 - 3 * SQUISH_CONSTANT_3D;
+            } else {
+                sv_ext0.x = sv_ext1.x = sb.x;
+                d_ext0.x = d_ext1.x = d0.x - 3 * SQUISH_CONSTANT_3D;
+            }
+
+            if ((c & 0x02) != 0) {
+                sv_ext0.y = sv_ext1.y = sb.y + 1;
+                d_ext0.y = d_ext1.y = d0.y - 1 - 3 * SQUISH_CONSTANT_3D;
+                if ((c & 0x01) != 0) {
+                    sv_ext1.y += 1;
+                    d_ext1.y -= 1;
+                } else {
+                    sv_ext0.y += 1;
+                    d_ext0.y -= 1;
+                }
+            } else {
+                sv_ext0.y = sv_ext1.y = sb.y;
+                d_ext0.y = d_ext1.y = d0.y - 3 * SQUISH_CONSTANT_3D;
+            }
+
+            if ((c & 0x04) != 0) {
+                sv_ext0.z = sb.z + 1;
+                sv_ext1.z = sb.z + 2;
+                d_ext0.z = d0.z - 1 - 3 * SQUISH_CONSTANT_3D;
+                d_ext1.z = d0.z - 2 - 3 * SQUISH_CONSTANT_3D;
+            } else {
+                sv_ext0.z = sv_ext1.z = sb.z;
+                d_ext0.z = d_ext1.z = d0.z - 3 * SQUISH_CONSTANT_3D;
+            }
+        } else { // (1,1,1) is not one of the closest two tetrahedral vertices.
+
+            uint8_t c = (aPoint & bPoint); // Our two extra vertices are determined by the closest two.
+            if ((c & 0x01) != 0) {
+                sv_ext0.x = sb.x + 1;
+                sv_ext1.x = sb.x + 2;
+                d_ext0.x = d0.x - 1 - SQUISH_CONSTANT_3D;
+                d_ext1.x = d0.x - 2 - 2 * SQUISH_CONSTANT_3D;
+            } else {
+                sv_ext0.x = sv_ext1.x = sb.x;
+                d_ext0.x = d0.x - SQUISH_CONSTANT_3D;
+                d_ext1.x = d0.x - 2 * SQUISH_CONSTANT_3D;
+            }
+
+            if ((c & 0x02) != 0) {
+                sv_ext0.y = sb.y + 1;
+                sv_ext1.y = sb.y + 2;
+                d_ext0.y = d0.y - 1 - SQUISH_CONSTANT_3D;
+                d_ext1.y = d0.y - 2 - 2 * SQUISH_CONSTANT_3D;
+            } else {
+                sv_ext0.y = sv_ext1.y = sb.y;
+                d_ext0.y = d0.y - SQUISH_CONSTANT_3D;
+                d_ext1.y = d0.y - 2 * SQUISH_CONSTANT_3D;
+            }
+
+            if ((c & 0x04) != 0) {
+                sv_ext0.z = sb.z + 1;
+                sv_ext1.z = sb.z + 2;
+                d_ext0.z = d0.z - 1 - SQUISH_CONSTANT_3D;
+                d_ext1.z = d0.z - 2 - 2 * SQUISH_CONSTANT_3D;
+            } else {
+                sv_ext0.z = sv_ext1.z = sb.z;
+                d_ext0.z = d0.z - SQUISH_CONSTANT_3D;
+                d_ext1.z = d0.z - 2 * SQUISH_CONSTANT_3D;
+            }
+        }
+
+        // Contribution (1,1,0)
+        glm::dvec3 d3 = (d0 + glm::dvec3{-1,-1,0}) - 2 * SQUISH_CONSTANT_3D;
+        double attn3 = attn(d3);
+        if (attn3 > 0) {
+            add_slope(gradient, attn3, gradient_os3(sb.x + 1, sb.y + 1, sb.z + 0, perm, seed), d3);
+            value += std::pow(attn3, 4) * extrapolate3(sb.x + 1, sb.y + 1, sb.z + 0, d3, perm, seed);
+        }
+
+        // Contribution (1,0,1)
+        glm::dvec3 d2 {d3.x, d0.y - 0 - 2 * SQUISH_CONSTANT_3D, d0.z - 1 - 2 * SQUISH_CONSTANT_3D};
+        double attn2 = attn(d2);
+        if (attn2 > 0) {
+            add_slope(gradient, attn2, gradient_os3(sb.x + 1, sb.y + 0, sb.z + 1, perm, seed), d2);
+            value += std::pow(attn2, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 1, d2, perm, seed);
+        }
+
+        // Contribution (0,1,1)
+        glm::dvec3 d1 {d0.x - 0 - 2 * SQUISH_CONSTANT_3D, d3.y, d2.z};
+        double attn1 = attn(d1);
+        if (attn1 > 0) {
+            add_slope(gradient, attn1, gradient_os3(sb.x + 0, sb.y + 1, sb.z + 1, perm, seed), d1);
+            value += std::pow(attn1, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 1, d1, perm, seed);
+        }
+
+        // Contribution (1,1,1)
+        d0 -= 1 + 3 * SQUISH_CONSTANT_3D;
+        double attn0 = attn(d0);
+        if (attn0 > 0) {
+            add_slope(gradient, attn0, gradient_os3(sb.x + 1, sb.y + 1, sb.z + 1, perm, seed), d0);
+            value += std::pow(attn0, 4) * extrapolate3(sb.x + 1, sb.y + 1, sb.z + 1, d0, perm, seed);
+        }
+
+    } else { // We're inside the octahedron (Rectified 3-Simplex) in between.
+
+        double aScore;
+        uint8_t aPoint;
+        bool aIsFurtherSide;
+        double bScore;
+        uint8_t bPoint;
+        bool bIsFurtherSide;
+
+        // Decide between point (0,0,1) and (1,1,0) as closest
+        double p1 = ins.x + ins.y;
+        if (p1 > 1) {
+            aScore = p1 - 1;
+            aPoint = 0x03;
+            aIsFurtherSide = true;
+        } else {
+            aScore = 1 - p1;
+            aPoint = 0x04;
+            aIsFurtherSide = false;
+        }
+
+        // Decide between point (0,1,0) and (1,0,1) as closest
+        double p2 = ins.x + ins.z;
+        if (p2 > 1) {
+            bScore = p2 - 1;
+            bPoint = 0x05;
+            bIsFurtherSide = true;
+        } else {
+            bScore = 1 - p2;
+            bPoint = 0x02;
+            bIsFurtherSide = false;
+        }
+
+        // The closest out of the two (1,0,0) and (0,1,1) will replace the furthest out of the two decided above, if closer.
+        double p3 = ins.y + ins.z;
+        if (p3 > 1) {
+            double score = p3 - 1;
+            if (aScore <= bScore && aScore < score) {
+                aScore = score;
+                aPoint = 0x06;
+                aIsFurtherSide = true;
+            } else if (aScore > bScore && bScore < score) {
+                bScore = score;
+                bPoint = 0x06;
+                bIsFurtherSide = true;
+            }
+        } else {
+            double score = 1 - p3;
+            if (aScore <= bScore && aScore < score) {
+                aScore = score;
+                aPoint = 0x01;
+                aIsFurtherSide = false;
+            } else if (aScore > bScore && bScore < score) {
+                bScore = score;
+                bPoint = 0x01;
+                bIsFurtherSide = false;
+            }
+        }
+
+        // Where each of the two closest points are determines how the extra two vertices are calculated.
+        if (aIsFurtherSide == bIsFurtherSide) {
+            if (aIsFurtherSide) { // Both closest points on (1,1,1) side
+
+                // One of the two extra points is (1,1,1)
+                d_ext0 = d0 - 1.0 - 3 * SQUISH_CONSTANT_3D;
+                sv_ext0 = sb + 1;
+
+                // Other extra point is based on the shared axis.
+                uint8_t c = (aPoint & bPoint);
+                if ((c & 0x01) != 0) {
+                    d_ext1 = d0 + glm::dvec3{-2,0,0} - 2 * SQUISH_CONSTANT_3D;
+                    sv_ext1 = sb + glm::ivec3{2,0,0};
+                } else if ((c & 0x02) != 0) {
+                    d_ext1 = d0 + glm::dvec3{0,-2,0} - 2 * SQUISH_CONSTANT_3D;
+                    sv_ext1 = sb + glm::ivec3{0,2,0};
+                } else {
+                    d_ext1 = d0 + glm::dvec3{0,0,-2} - 2 * SQUISH_CONSTANT_3D;
+                    sv_ext1 = sb + glm::ivec3{0,0,2};
+                }
+            } else { // Both closest points on (0,0,0) side
+                // One of the two extra points is (0,0,0)
+                d_ext0 = d0;
+                sv_ext0 = sb;
+
+                // Other extra point is based on the omitted axis.
+                uint8_t c = (aPoint | bPoint);
+                if ((c & 0x01) == 0) {
+                    d_ext1 = d0 + glm::dvec3{1,-1,-1} - SQUISH_CONSTANT_3D;
+                    sv_ext1 = sb + glm::ivec3{-1,1,1};
+                } else if ((c & 0x02) == 0) {
+                    d_ext1 = d0 + glm::dvec3{-1,1,-1} - SQUISH_CONSTANT_3D;
+                    sv_ext1 = sb + glm::ivec3{1,-1,1};
+                } else {
+                    d_ext1 = d0 + glm::dvec3{-1,-1,1} - SQUISH_CONSTANT_3D;
+                    sv_ext1 = sb + glm::ivec3{1,1,-1};
+                }
+            }
+        } else { // One point on (0,0,0) side, one point on (1,1,1) side
+            uint8_t c1, c2;
+            if (aIsFurtherSide) {
+                c1 = aPoint;
+                c2 = bPoint;
+            } else {
+                c1 = bPoint;
+                c2 = aPoint;
+            }
+            // One contribution is a permutation of (1,1,-1)
+            if ((c1 & 0x01) == 0) {
+                d_ext0 = d0 + glm::dvec3{1,-1,-1} - SQUISH_CONSTANT_3D;
+                sv_ext0 = sb + glm::ivec3{-1,1,1};
+            } else if ((c1 & 0x02) == 0) {
+                d_ext0 = d0 + glm::dvec3{-1,1,-1} - SQUISH_CONSTANT_3D;
+                sv_ext0 = sb + glm::ivec3{1,-1,1};
+            } else {
+                d_ext0 = d0 + glm::dvec3{-1,-1,1} - SQUISH_CONSTANT_3D;
+                sv_ext0 = sb + glm::ivec3{1,1,-1};
+            }
+
+            // One contribution is a permutation of (0,0,2)
+            d_ext1 = d0 - 2 * SQUISH_CONSTANT_3D;
+            sv_ext1 = sb;
+            if ((c2 & 0x01) != 0) {
+                d_ext1.x -= 2;
+                sv_ext1.x += 2;
+            } else if ((c2 & 0x02) != 0) {
+                d_ext1.y -= 2;
+                sv_ext1.y += 2;
+            } else {
+                d_ext1.z -= 2;
+                sv_ext1.z += 2;
+            }
+        }
+
+        // Contribution (1,0,0)
+        glm::dvec3 d1 = (d0 + glm::dvec3{-1,0,0}) - SQUISH_CONSTANT_3D;
+        double attn1 = attn(d1);
+        if (attn1 > 0) {
+            add_slope(gradient, attn1, gradient_os3(sb.x + 1, sb.y + 0, sb.z + 0, perm, seed), d1);
+            value += std::pow(attn1, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 0, d1, perm, seed);
+        }
+
+        // Contribution (0,1,0)
+        glm::dvec3 d2 {d0.x - SQUISH_CONSTANT_3D, d0.y - 1 - SQUISH_CONSTANT_3D, d1.z};
+        double attn2 = attn(d2);
+        if (attn2 > 0) {
+            add_slope(gradient, attn2, gradient_os3(sb.x + 0, sb.y + 1, sb.z + 0, perm, seed), d2);
+            value += std::pow(attn2, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 0, d2, perm, seed);
+        }
+
+
+        // Contribution (0,0,1)
+        glm::dvec3 d3 {d2.x, d1.y, d0.z - 1 - SQUISH_CONSTANT_3D};
+        double attn3 = attn(d3);
+        if (attn3 > 0) {
+            add_slope(gradient, attn3, gradient_os3(sb.x + 0, sb.y + 0, sb.z + 1, perm, seed), d3);
+            value += std::pow(attn3, 4) * extrapolate3(sb.x + 0, sb.y + 0, sb.z + 1, d3, perm, seed);
+        }
+
+        // Contribution (1,1,0)
+        glm::dvec3 d4 = d0 - glm::dvec3{1,1,0} - 2 * SQUISH_CONSTANT_3D;
+        double attn4 = attn(d4);
+        if (attn4 > 0) {
+            add_slope(gradient, attn4, gradient_os3(sb.x + 1, sb.y + 1, sb.z + 0, perm, seed), d4);
+            value += std::pow(attn4, 4) * extrapolate3(sb.x + 1, sb.y + 1, sb.z + 0, d4, perm, seed);
+        }
+
+        // Contribution (1,0,1)
+        glm::dvec3 d5 {d4.x, d0.y - 2 * SQUISH_CONSTANT_3D, d0.z - 1 - 2 * SQUISH_CONSTANT_3D};
+        double attn5 = attn(d5);
+        if (attn5 > 0) {
+            add_slope(gradient, attn5, gradient_os3(sb.x + 1, sb.y + 0, sb.z + 1, perm, seed), d5);
+            value += std::pow(attn5, 4) * extrapolate3(sb.x + 1, sb.y + 0, sb.z + 1, d5, perm, seed);
+        }
+
+        // Contribution (0,1,1)
+        glm::dvec3 d6 {d0.x - 2 * SQUISH_CONSTANT_3D, d4.y, d5.z};
+        double attn6 = attn(d6);
+        if (attn6 > 0) {
+            add_slope(gradient, attn6, gradient_os3(sb.x + 0, sb.y + 1, sb.z + 1, perm, seed), d6);
+            value += std::pow(attn6, 4) * extrapolate3(sb.x + 0, sb.y + 1, sb.z + 1, d6, perm, seed);
+        }
+    }
+    // First extra vertex
+    double attn_ext0 = attn(d_ext0);
+    if (attn_ext0 > 0) {
+        add_slope(gradient, attn_ext0, gradient_os3(sv_ext0.x, sv_ext0.y, sv_ext0.z, perm, seed), d_ext0);
+        value += std::pow(attn_ext0, 4) * extrapolate3(sv_ext0.x, sv_ext0.y, sv_ext0.z, d_ext0, perm, seed);
+    }
+
+    // Second extra vertex
+    double attn_ext1 = attn(d_ext1);
+    if (attn_ext1 > 0) {
+        add_slope(gradient, attn_ext1, gradient_os3(sv_ext1.x, sv_ext1.y, sv_ext1.z, perm, seed), d_ext1);
+        value += std::pow(attn_ext1, 4) * extrapolate3(sv_ext1.x, sv_ext1.y, sv_ext1.z, d_ext1, perm, seed);
+    }
+
+    if (gradient)
+        *gradient /= NORM_CONSTANT_3D;
+
+    return value / NORM_CONSTANT_3D;
+}
+
+} // anonymous namespace
+
+double p_perlin(const glm::dvec2& xy, uint32_t seed)
+{
+    return perlin(xy, P, seed);
+}
+
+double p_perlin(const glm::dvec2& xy, const generator_context::permutation& perm)
+{
+    return perlin(xy, perm.p, 0);
+}
+
+double p_perlin(const glm::dvec2& xy, uint32_t seed, glm::dvec2& gradient)
+{
+    return perlin(xy, P, seed, &gradient);
+}
+
+double p_perlin(const glm::dvec2& xy, const generator_context::permutation& perm,
+                glm::dvec2& gradient)
+{
+    return perlin(xy, perm.p, 0, &gradient);
+}
+
+double p_perlin3(const glm::dvec3& xyz, uint32_t seed)
+{
+    return perlin3(xyz, P, seed);
+}
+
+double p_perlin3(const glm::dvec3& xyz, const generator_context::permutation& perm)
+{
+    return perlin3(xyz, perm.p, 0);
+}
+
+double p_perlin3(const glm::dvec3& xyz, uint32_t seed, glm::dvec3& gradient)
+{
+    return perlin3(xyz, P, seed, &gradient);
+}
+
+double p_perlin3(const glm::dvec3& xyz, const generator_context::permutation& perm,
+                 glm::dvec3& gradient)
+{
+    return perlin3(xyz, perm.p, 0, &gradient);
+}
+
+double p_simplex(const glm::dvec2& xy, uint32_t seed)
+{
+    return simplex(xy, P, seed);
+}
+
+double p_simplex(const glm::dvec2& xy, const generator_context::permutation& perm)
+{
+    return simplex(xy, perm.p, 0);
+}
+
+double p_simplex(const glm::dvec2& xy, uint32_t seed, glm::dvec2& gradient)
+{
+    return simplex(xy, P, seed, &gradient);
+}
+
+double p_simplex(const glm::dvec2& xy, const generator_context::permutation& perm,
+                 glm::dvec2& gradient)
+{
+    return simplex(xy, perm.p, 0, &gradient);
+}
+
+double p_simplex3(const glm::dvec3& p, uint32_t seed)
+{
+    return simplex3(p, P, seed);
+}
+
+double p_simplex3(const glm::dvec3& p, const generator_context::permutation& perm)
+{
+    return simplex3(p, perm.p, 0);
+}
+
+double p_simplex3(const glm::dvec3& p, uint32_t seed, glm::dvec3& gradient)
+{
+    return simplex3(p, P, seed, &gradient);
+}
+
+double p_simplex3(const glm::dvec3& p, const generator_context::permutation& perm,
+                  glm::dvec3& gradient)
+{
+    return simplex3(p, perm.p, 0, &gradient);
+}
+
+double p_opensimplex(const glm::dvec2& p, uint32_t seed)
+{
+    return opensimplex(p, P, seed);
+}
+
+double p_opensimplex(const glm::dvec2& p, const generator_context::permutation& perm)
+{
+    return opensimplex(p, perm.p, 0);
+}
+
+double p_opensimplex(const glm::dvec2& p, uint32_t seed, glm::dvec2& gradient)
+{
+    return opensimplex(p, P, seed, &gradient);
+}
+
+double p_opensimplex(const glm::dvec2& p, const generator_context::permutation& perm,
+                     glm::dvec2& gradient)
+{
+    return opensimplex(p, perm.p, 0, &gradient);
+}
+
+double p_opensimplex3(const glm::dvec3& p, uint32_t seed)
+{
+    return opensimplex3(p, P, seed);
+}
+
+double p_opensimplex3(const glm::dvec3& p, const generator_context::permutation& perm)
+{
+    return opensimplex3(p, perm.p, 0);
+}
+
+double p_opensimplex3(const glm::dvec3& p, uint32_t seed, glm::dvec3& gradient)
+{
+    return opensimplex3(p, P, seed, &gradient);
+}
+
+double p_opensimplex3(const glm::dvec3& p, const generator_context::permutation& perm,
+                      glm::dvec3& gradient)
+{
+    return opensimplex3(p, perm.p, 0, &gradient);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Batched versions
+//
+// The kernels below do the same math as the functions above, but without
+// branches, so the compiler can turn every loop into vector code (the
+// table lookups become gathers).  Each kernel is compiled several times,
+// once for every instruction set, and the best one is picked at runtime.
+
+#if (defined(__GNUC__) || defined(__clang__))                               \
+    && (defined(__x86_64__) || defined(__i386__))
+#define HEXANOISE_SIMD_DISPATCH 1
+#define HEXANOISE_KERNEL inline __attribute__((always_inline))
+#define HEXANOISE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define HEXANOISE_KERNEL inline
+#endif
+
+namespace
+{
+
+// The gradient tables again, but as integers.  The compiler will happily
+// gather integers and convert them to doubles, but it will not gather
+// doubles directly.
+static const int G_I[16 * 4] = {
+    1,  1,  0, 0, -1, 1,  0,  0, 1,  -1, 0,  0, -1, -1, 0,  0,
+    1,  0,  1, 0, -1, 0,  1,  0, 1,  0,  -1, 0, -1, 0,  -1, 0,
+    0,  1,  1, 0, 0,  -1, 1,  0, 0,  1,  -1, 0, 0,  -1, -1, 0,
+    1,  1,  0, 0, -1, 1,  0,  0, 0,  -1, 1,  0, 0,  -1, -1, 0
+};
+
+static const int gradients2D_i[] = {
+    5, 2, 2, 5,
+    -5, 2, -2, 5,
+    5, -2, 2, -5,
+    -5, -2, -2, -5
+};
+
+HEXANOISE_KERNEL double pow4(double x)
+{
+    x *= x;
+    return x * x;
+}
+
+// The contribution of a simplex corner, zero if t is not positive.  The
+// gradient g is always looked up, and clamping t avoids a branch.
+HEXANOISE_KERNEL double falloff(double t, double g)
+{
+    return pow4(std::max(t, 0.0)) * g;
+}
+
+HEXANOISE_KERNEL double grad2(const int* perm, uint32_t ix, uint32_t iy,
+                              double x, double y)
+{
+    int index = (perm[(ix & P_MASK) + perm[iy & P_MASK]] & G_MASK) * G_VECSIZE;
+    return x * G_I[index] + y * G_I[index + 1];
+}
+
+HEXANOISE_KERNEL double grad3(const int* perm, uint32_t ix, uint32_t iy,
+                              uint32_t iz, double x, double y, double z)
+{
+    int index
+        = (perm[(ix & P_MASK) + perm[(iy & P_MASK) + perm[iz & P_MASK]]]
+           & G_MASK) * G_VECSIZE;
+    return x * G_I[index] + y * G_I[index + 1] + z * G_I[index + 2];
+}
+
+HEXANOISE_KERNEL double dot_i(int index, double x, double y)
+{
+    return G_I[index] * x + G_I[index + 1] * y;
+}
+
+HEXANOISE_KERNEL double dot_i(int index, double x, double y, double z)
+{
+    return G_I[index] * x + G_I[index + 1] * y + G_I[index + 2] * z;
+}
+
+HEXANOISE_KERNEL double extrapolate2_i(const int* perm, uint32_t xsb,
+                                       uint32_t ysb, double dx, double dy,
+                                       uint32_t seed)
+{
+    int index
+        = perm[(perm[(xsb + seed) & 0xFF] + (ysb + seed * 23)) & 0xFF] & 0x0E;
+    return gradients2D_i[index] * dx + gradients2D_i[index + 1] * dy;
+}
+
+HEXANOISE_KERNEL void perlin_kernel(size_t n, const double* __restrict x,
+                                    const double* __restrict y,
+                                    const int* __restrict perm,
+                                    const uint32_t* __restrict seed,
+                                    double* __restrict out)
+{
+    for (size_t j = 0; j < n; ++j) {
+        double tx = std::floor(x[j]);
+        double ty = std::floor(y[j]);
+        double xf = x[j] - tx;
+        double yf = y[j] - ty;
+        uint32_t x0 = (uint32_t)(int)tx + seed[j] * 1013;
+        uint32_t y0 = (uint32_t)(int)ty + seed[j] * 1619;
+
+        double n00 = grad2(perm, x0, y0, xf, yf);
+        double n10 = grad2(perm, x0 + 1, y0, xf - 1.0, yf);
+        double n01 = grad2(perm, x0, y0 + 1, xf, yf - 1.0);
+        double n11 = grad2(perm, x0 + 1, y0 + 1, xf - 1.0, yf - 1.0);
+
+        double bx = blend5(xf);
+        double n0 = lerp(bx, n00, n10);
+        double n1 = lerp(bx, n01, n11);
+
+        out[j] = lerp(blend5(yf), n0, n1) * 1.227;
+    }
+}
+
+HEXANOISE_KERNEL void perlin3_kernel(size_t n, const double* __restrict x,
+                                     const double* __restrict y,
+                                     const double* __restrict z,
+                                     const int* __restrict perm,
+                                     const uint32_t* __restrict seed,
+                                     double* __restrict out)
+{
+    for (size_t j = 0; j < n; ++j) {
+        double tx = std::floor(x[j]);
+        double ty = std::floor(y[j]);
+        double tz = std::floor(z[j]);
+        double xf = x[j] - tx;
+        double yf = y[j] - ty;
+        double zf = z[j] - tz;
+        uint32_t x0 = (uint32_t)(int)tx + seed[j] * 1013;
+        uint32_t y0 = (uint32_t)(int)ty + seed[j] * 1619;
+        uint32_t z0 = (uint32_t)(int)tz + seed[j] * 997;
+
+        double n000 = grad3(perm, x0, y0, z0, xf, yf, zf);
+        double n001 = grad3(perm, x0, y0, z0 + 1, xf, yf, zf - 1.0);
+        double n010 = grad3(perm, x0, y0 + 1, z0, xf, yf - 1.0, zf);
+        double n011 = grad3(perm, x0, y0 + 1, z0 + 1, xf, yf - 1.0, zf - 1.0);
+        double n100 = grad3(perm, x0 + 1, y0, z0, xf - 1.0, yf, zf);
+        double n101 = grad3(perm, x0 + 1, y0, z0 + 1, xf - 1.0, yf, zf - 1.0);
+        double n110 = grad3(perm, x0 + 1, y0 + 1, z0, xf - 1.0, yf - 1.0, zf);
+        double n111
+            = grad3(perm, x0 + 1, y0 + 1, z0 + 1, xf - 1.0, yf - 1.0, zf - 1.0);
+
+        double bx = blend5(xf);
+        double n00 = lerp(bx, n000, n100);
+        double n01 = lerp(bx, n001, n101);
+        double n10 = lerp(bx, n010, n110);
+        double n11 = lerp(bx, n011, n111);
+
+        double by = blend5(yf);
+        double n0 = lerp(by, n00, n10);
+        double n1 = lerp(by, n01, n11);
+
+        out[j] = lerp(blend5(zf), n0, n1) * 1.216;
+    }
+}
+
+HEXANOISE_KERNEL void simplex_kernel(size_t n, const double* __restrict x,
+                                     const double* __restrict y,
+                                     const int* __restrict perm,
+                                     const uint32_t* __restrict seed,
+                                     double* __restrict out)
+{
+    const double F2 = 0.5 * (std::sqrt(3.0) - 1.0);
+    const double G2 = (3.0 - std::sqrt(3.0)) / 6.0;
+
+    for (size_t k = 0; k < n; ++k) {
+        double s = (x[k] + y[k]) * F2;
+        int i = std::floor(x[k] + s);
+        int j = std::floor(y[k] + s);
+
+        double t = (i + j) * G2;
+        double x0 = x[k] - (i - t);
+        double y0 = y[k] - (j - t);
+
+        int i1 = x0 > y0 ? 1 : 0;
+        int j1 = 1 - i1;
+
+        double x1 = x0 - i1 + G2;
+        double y1 = y0 - j1 + G2;
+        double x2 = x0 - 1.0 + 2.0 * G2;
+        double y2 = y0 - 1.0 + 2.0 * G2;
+
+        int ii = (i + seed[k] * 1063) & 0xFF;
+        int jj = j & 0xFF;
+        int gi0 = (perm[ii + perm[jj]] & G_MASK) * G_VECSIZE;
+        int gi1 = (perm[ii + i1 + perm[jj + j1]] & G_MASK) * G_VECSIZE;
+        int gi2 = (perm[ii + 1 + perm[jj + 1]] & G_MASK) * G_VECSIZE;
+
+        double t0 = 0.5 - x0 * x0 - y0 * y0;
+        double t1 = 0.5 - x1 * x1 - y1 * y1;
+        double t2 = 0.5 - x2 * x2 - y2 * y2;
+
+        double n0 = falloff(t0, dot_i(gi0, x0, y0));
+        double n1 = falloff(t1, dot_i(gi1, x1, y1));
+        double n2 = falloff(t2, dot_i(gi2, x2, y2));
+
+        out[k] = 70.0 * (n0 + n1 + n2);
+    }
+}
+
+HEXANOISE_KERNEL void simplex3_kernel(size_t n, const double* __restrict x,
+                                      const double* __restrict y,
+                                      const double* __restrict z,
+                                      const int* __restrict perm,
+                                      const uint32_t* __restrict seed,
+                                      double* __restrict out)
+{
+    const double F3 = 1.0 / 3.0;
+    const double G3 = 1.0 / 6.0;
+
+    for (size_t l = 0; l < n; ++l) {
+        double s = (x[l] + y[l] + z[l]) * F3;
+        int i = std::floor(x[l] + s);
+        int j = std::floor(y[l] + s);
+        int k = std::floor(z[l] + s);
+
+        double t = (i + j + k) * G3;
+        double x0 = x[l] - (i - t);
+        double y0 = y[l] - (j - t);
+        double z0 = z[l] - (k - t);
+
+        // The same corner ordering as the if/else tree in p_simplex3.
+        int i1 = x0 >= y0 && x0 >= z0;
+        int j1 = x0 < y0 && y0 >= z0;
+        int k1 = 1 - i1 - j1;
+        int i2 = x0 >= y0 || x0 >= z0;
+        int j2 = x0 < y0 || y0 >= z0;
+        int k2 = 2 - i2 - j2;
+
+        double x1 = x0 - i1 + G3;
+        double y1 = y0 - j1 + G3;
+        double z1 = z0 - k1 + G3;
+        double x2 = x0 - i2 + 2.0 * G3;
+        double y2 = y0 - j2 + 2.0 * G3;
+        double z2 = z0 - k2 + 2.0 * G3;
+        double x3 = x0 - 1.0 + 3.0 * G3;
+        double y3 = y0 - 1.0 + 3.0 * G3;
+        double z3 = z0 - 1.0 + 3.0 * G3;
+
+        int ii = (i + seed[l] * 1063) & 0xFF;
+        int jj = j & 0xFF;
+        int kk = k & 0xFF;
+
+        int gi0 = (perm[ii + perm[jj + perm[kk]]] & G_MASK) * G_VECSIZE;
+        int gi1 = (perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] & G_MASK)
+                  * G_VECSIZE;
+        int gi2 = (perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] & G_MASK)
+                  * G_VECSIZE;
+        int gi3 = (perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] & G_MASK)
+                  * G_VECSIZE;
+
+        double t0 = 0.6 - x0 * x0 - y0 * y0 - z0 * z0;
+        double t1 = 0.6 - x1 * x1 - y1 * y1 - z1 * z1;
+        double t2 = 0.6 - x2 * x2 - y2 * y2 - z2 * z2;
+        double t3 = 0.6 - x3 * x3 - y3 * y3 - z3 * z3;
+
+        double n0 = falloff(t0, dot_i(gi0, x0, y0, z0));
+        double n1 = falloff(t1, dot_i(gi1, x1, y1, z1));
+        double n2 = falloff(t2, dot_i(gi2, x2, y2, z2));
+        double n3 = falloff(t3, dot_i(gi3, x3, y3, z3));
+
+        out[l] = 32.0 * (n0 + n1 + n2 + n3);
+    }
+}
+
+HEXANOISE_KERNEL void opensimplex_kernel(size_t n,
+                                         const double* __restrict x,
+                                         const double* __restrict y,
+                                         const int* __restrict perm,
+                                         const uint32_t* __restrict seed,
+                                         double* __restrict out)
+{
+    const double STRETCH_CONSTANT_2D = -0.211324865405187;
+    const double SQUISH_CONSTANT_2D = 0.366025403784439;
+    const double NORM_CONSTANT_2D = 47.0;
+    const double SQ2 = 2 * SQUISH_CONSTANT_2D;
+
+    for (size_t j = 0; j < n; ++j) {
+        double stretchOffset = (x[j] + y[j]) * STRETCH_CONSTANT_2D;
+        double sx = x[j] + stretchOffset;
+        double sy = y[j] + stretchOffset;
+
+        int sbx = std::floor(sx);
+        int sby = std::floor(sy);
+
+        double squishOffset = (sbx + sby) * SQUISH_CONSTANT_2D;
+        double insx = sx - sbx;
+        double insy = sy - sby;
+        double inSum = insx + insy;
+
+        double d0x = x[j] - (sbx + squishOffset);
+        double d0y = y[j] - (sby + squishOffset);
+        double value = 0;
+
+        // Contribution (1,0)
+        double d1x = (d0x - 1) - SQUISH_CONSTANT_2D;
+        double d1y = d0y - SQUISH_CONSTANT_2D;
+        double attn1 = 2.0 - (d1x * d1x + d1y * d1y);
+        value += falloff(attn1, extrapolate2_i(perm, sbx + 1, sby, d1x, d1y, seed[j]));
+
+        // Contribution (0,1)
+        double d2x = d0x - SQUISH_CONSTANT_2D;
+        double d2y = (d0y - 1) - SQUISH_CONSTANT_2D;
+        double attn2 = 2.0 - (d2x * d2x + d2y * d2y);
+        value += falloff(attn2, extrapolate2_i(perm, sbx, sby + 1, d2x, d2y, seed[j]));
+
+        // The extra vertex, see p_opensimplex for the region logic.  All
+        // four cases are folded into selects, so there are no branches.
+        bool lower = inSum <= 1;
+        bool x_gt_y = insx > insy;
+        double zins = lower ? 1 - inSum : 2 - inSum;
+        double side = lower ? 1.0 : -1.0;
+        bool near = (side * (zins - insx) > 0) | (side * (zins - insy) > 0);
+
+        // Written as arithmetic; nested selects would be turned into a
+        // table lookup, which does not vectorize.
+        int lo = lower, nr = near, xg = x_gt_y;
+        int ex = nr * (2 * xg - lo) + (1 - nr) * lo;
+        int ey = nr * (2 - lo - 2 * xg) + (1 - nr) * lo;
+        double squish = lower == near ? 0.0 : SQ2;
+        double dx = (d0x - ex) - squish;
+        double dy = (d0y - ey) - squish;
+        ex += sbx;
+        ey += sby;
+
+        int up = lower ? 0 : 1;
+        sbx += up;
+        sby += up;
+        d0x = lower ? d0x : d0x - 1.0 - SQ2;
+        d0y = lower ? d0y : d0y - 1.0 - SQ2;
+
+        // Contribution (0,0) or (1,1)
+        double attn0 = 2.0 - (d0x * d0x + d0y * d0y);
+        value += falloff(attn0, extrapolate2_i(perm, sbx, sby, d0x, d0y, seed[j]));
+
+        // Extra vertex
+        double attn_ext = 2.0 - (dx * dx + dy * dy);
+        value += falloff(attn_ext, extrapolate2_i(perm, ex, ey, dx, dy, seed[j]));
+
+        out[j] = value / NORM_CONSTANT_2D;
+    }
+}
+
+// 3-D OpenSimplex picks its lattice points through a deep tree of
+// decisions that does not map well onto vector lanes, so this one is
+// simply the scalar version, compiled for each instruction set.
+HEXANOISE_KERNEL void opensimplex3_kernel(size_t n,
+                                          const double* __restrict x,
+                                          const double* __restrict y,
+                                          const double* __restrict z,
+                                          const int* __restrict perm,
+                                          const uint32_t* __restrict seed,
+                                          double* __restrict out)
+{
+    for (size_t j = 0; j < n; ++j)
+        out[j] = opensimplex3(glm::dvec3{x[j], y[j], z[j]}, perm, seed[j]);
+}
+
+typedef void (*kernel2)(size_t, const double*, const double*, const int*,
+                        const uint32_t*, double*);
+typedef void (*kernel3)(size_t, const double*, const double*,
+                        const double*, const int*, const uint32_t*, double*);
+
+struct kernel_table
+{
+    const char* name;
+    kernel2 perlin;
+    kernel3 perlin3;
+    kernel2 simplex;
+    kernel3 simplex3;
+    kernel2 opensimplex;
+    kernel3 opensimplex3;
+};
+
+#define HEXANOISE_KERNEL_SET(isa, attr)                                     \
+    attr void perlin_##isa(size_t n, const double* x, const double* y,      \
+                           const int* p, const uint32_t* s, double* o)      \
+    {                                                                       \
+        perlin_kernel(n, x, y, p, s, o);                                    \
+    }                                                                       \
+    attr void perlin3_##isa(size_t n, const double* x, const double* y,     \
+                            const double* z, const int* p,                  \
+                            const uint32_t* s, double* o)                   \
+    {                                                                       \
+        perlin3_kernel(n, x, y, z, p, s, o);                                \
+    }                                                                       \
+    attr void simplex_##isa(size_t n, const double* x, const double* y,     \
+                            const int* p, const uint32_t* s, double* o)     \
+    {                                                                       \
+        simplex_kernel(n, x, y, p, s, o);                                   \
+    }                                                                       \
+    attr void simplex3_##isa(size_t n, const double* x, const double* y,    \
+                             const double* z, const int* p,                 \
+                             const uint32_t* s, double* o)                  \
+    {                                                                       \
+        simplex3_kernel(n, x, y, z, p, s, o);                               \
+    }                                                                       \
+    attr void opensimplex_##isa(size_t n, const double* x, const double* y, \
+                                const int* p, const uint32_t* s, double* o) \
+    {                                                                       \
+        opensimplex_kernel(n, x, y, p, s, o);                               \
+    }                                                                       \
+    attr void opensimplex3_##isa(size_t n, const double* x,                 \
+                                 const double* y, const double* z,          \
+                                 const int* p, const uint32_t* s,           \
+                                 double* o)                                 \
+    {                                                                       \
+        opensimplex3_kernel(n, x, y, z, p, s, o);                           \
+    }                                                                       \
+    const kernel_table isa##_kernels                                        \
+        = {#isa,           perlin_##isa,      perlin3_##isa, simplex_##isa, \
+           simplex3_##isa, opensimplex_##isa, opensimplex3_##isa};
+
+HEXANOISE_KERNEL_SET(generic, )
+
+#ifdef HEXANOISE_SIMD_DISPATCH
+HEXANOISE_KERNEL_SET(sse41, HEXANOISE_TARGET("sse4.1"))
+HEXANOISE_KERNEL_SET(avx2, HEXANOISE_TARGET("avx2"))
+HEXANOISE_KERNEL_SET(avx512, HEXANOISE_TARGET("avx512f"))
+#endif
+
+const kernel_table& select_kernels()
+{
+#ifdef HEXANOISE_SIMD_DISPATCH
+    std::string limit;
+    if (const char* env = std::getenv("HEXANOISE_SIMD"))
+        limit = env;
+
+    if (limit == "none")
+        return generic_kernels;
+
+    __builtin_cpu_init();
+    if (limit.empty() && __builtin_cpu_supports("avx512f"))
+        return avx512_kernels;
+
+    if ((limit.empty() || limit == "avx2") && __builtin_cpu_supports("avx2"))
+        return avx2_kernels;
+
+    if (__builtin_cpu_supports("sse4.1"))
+        return sse41_kernels;
+#endif
+    return generic_kernels;
+}
+
+const kernel_table& kernels()
+{
+    static const kernel_table& table = select_kernels();
+    return table;
+}
+
+// With a permutation table, the seed is not added to the coordinates.
+// The kernels are called in chunks, so they can be given an array of
+// zeros as the seeds.
+const size_t chunk_size = 256;
+static const uint32_t zero_seeds[chunk_size] = {};
+
+template <typename Kernel>
+void run_chunks(size_t n, Kernel kernel)
+{
+    for (size_t i = 0; i < n; i += chunk_size)
+        kernel(i, std::min(chunk_size, n - i));
+}
+
+} // anonymous namespace
+
+void p_perlin(size_t n, const double* x, const double* y,
+              const uint32_t* seed, double* out)
+{
+    kernels().perlin(n, x, y, P, seed, out);
+}
+
+void p_perlin(size_t n, const double* x, const double* y,
+              const generator_context::permutation& perm, double* out)
+{
+    run_chunks(n, [&](size_t i, size_t m) {
+        kernels().perlin(m, x + i, y + i, perm.p, zero_seeds, out + i);
+    });
+}
+
+void p_perlin3(size_t n, const double* x, const double* y, const double* z,
+               const uint32_t* seed, double* out)
+{
+    kernels().perlin3(n, x, y, z, P, seed, out);
+}
+
+void p_perlin3(size_t n, const double* x, const double* y, const double* z,
+               const generator_context::permutation& perm, double* out)
+{
+    run_chunks(n, [&](size_t i, size_t m) {
+        kernels().perlin3(m, x + i, y + i, z + i, perm.p, zero_seeds,
+                          out + i);
+    });
+}
+
+void p_simplex(size_t n, const double* x, const double* y,
+               const uint32_t* seed, double* out)
+{
+    kernels().simplex(n, x, y, P, seed, out);
+}
+
+void p_simplex(size_t n, const double* x, const double* y,
+               const generator_context::permutation& perm, double* out)
+{
+    run_chunks(n, [&](size_t i, size_t m) {
+        kernels().simplex(m, x + i, y + i, perm.p, zero_seeds, out + i);
+    });
+}
+
+void p_simplex3(size_t n, const double* x, const double* y, const double* z,
+                const uint32_t* seed, double* out)
+{
+    kernels().simplex3(n, x, y, z, P, seed, out);
+}
+
+void p_simplex3(size_t n, const double* x, const double* y, const double* z,
+                const generator_context::permutation& perm, double* out)
+{
+    run_chunks(n, [&](size_t i, size_t m) {
+        kernels().simplex3(m, x + i, y + i, z + i, perm.p, zero_seeds,
+                           out + i);
+    });
+}
+
+void p_opensimplex(size_t n, const double* x, const double* y,
+                   const uint32_t* seed, double* out)
+{
+    kernels().opensimplex(n, x, y, P, seed, out);
+}
+
+void p_opensimplex(size_t n, const double* x, const double* y,
+                   const generator_context::permutation& perm, double* out)
+{
+    run_chunks(n, [&](size_t i, size_t m) {
+        kernels().opensimplex(m, x + i, y + i, perm.p, zero_seeds, out + i);
+    });
+}
+
+void p_opensimplex3(size_t n, const double* x, const double* y,
+                    const double* z, const uint32_t* seed, double* out)
+{
+    kernels().opensimplex3(n, x, y, z, P, seed, out);
+}
+
+void p_opensimplex3(size_t n, const double* x, const double* y,
+                    const double* z,
+                    const generator_context::permutation& perm, double* out)
+{
+    run_chunks(n, [&](size_t i, size_t m) {
+        kernels().opensimplex3(m, x + i, y + i, z + i, perm.p, zero_seeds,
+                               out + i);
+    });
+}
+
+const char* simd_instruction_set()
+{
+    return kernels().name;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Worley
+
+namespace
+{
+
+// The feature points of the 3x3 cells around xy0, relative to xy0.
+void feature_points(const glm::ivec2& xy0, uint32_t seed, glm::dvec2* out)
+{
+    for (int i = -1; i < 2; ++i) {
+        for (int j = -1; j < 2; ++j) {
+            glm::ivec2 square{xy0 + glm::ivec2{i, j}};
+            auto rnglast = rng(hash(square.x + seed, square.y));
+
+            glm::dvec2& rnd_pt = *out++;
+            rnd_pt.x = i + (double)(rnglast & 0xFFFF) / (double)0x10000;
+            rnglast = rng(rnglast);
+            rnd_pt.y = j + (double)(rnglast & 0xFFFF) / (double)0x10000;
+        }
+    }
+}
+
+// The feature points of the 3x3x3 cells around p0, relative to p0.
+void feature_points(const glm::ivec3& p0, uint32_t seed, glm::dvec3* out)
+{
+    for (int i = -1; i < 2; ++i) {
+        for (int j = -1; j < 2; ++j) {
+            for (int k = -1; k < 2; ++k) {
+                glm::ivec3 square = p0 + glm::ivec3{i, j, k};
+                auto rnglast = rng(hash(square.x + seed, square.y, square.z));
+
+                glm::dvec3& rnd_pt = *out++;
+                rnd_pt.x = i + (double)(rnglast & 0xFFFF) / (double)0x10000;
+                rnglast = rng(rnglast);
+                rnd_pt.y = j + (double)(rnglast & 0xFFFF) / (double)0x10000;
+                rnglast = rng(rnglast);
+                rnd_pt.z = k + (double)(rnglast & 0xFFFF) / (double)0x10000;
+            }
+        }
+    }
+}
+
+// The distances are compared squared, the square root is only taken of
+// the two that are returned.  If which is not null, it receives the
+// indices of the two points.
+template <typename Vec>
+glm::dvec2 closest_two(const Vec& pf, const Vec* points, int count,
+                       int* which = nullptr)
+{
+    auto f0 = std::numeric_limits<double>::max();
+    auto f1 = std::numeric_limits<double>::max();
+    int i0 = 0, i1 = 0;
+
+    for (int i = 0; i < count; ++i) {
+        Vec d{pf - points[i]};
+        auto dist = glm::dot(d, d);
+        if (dist < f0) {
+            f1 = f0;
+            i1 = i0;
+            f0 = dist;
+            i0 = i;
+        } else if (dist < f1) {
+            f1 = dist;
+            i1 = i;
+        }
+    }
+    if (which) {
+        which[0] = i0;
+        which[1] = i1;
+    }
+    return glm::dvec2{std::sqrt(f0), std::sqrt(f1)};
+}
+
+// The gradient of the distance to a point.
+template <typename Vec>
+Vec distance_gradient(const Vec& pf, const Vec& point, double dist)
+{
+    return dist > 0.0 ? (pf - point) / dist : Vec{0.0};
+}
+
+glm::dvec3 closest_point(const glm::dvec2& t, const glm::dvec2& xyf,
+                         const glm::dvec2* points)
+{
+    auto f0 = std::numeric_limits<double>::max();
+    glm::dvec2 result;
+
+    for (int i = 0; i < 9; ++i) {
+        glm::dvec2 d{xyf - points[i]};
+        auto dist = glm::dot(d, d);
+        if (dist < f0) {
+            f0 = dist;
+            result = points[i];
+        }
+    }
+    result += t;
+    return glm::dvec3{result.x, result.y, 0.0};
+}
+
+const size_t cache_slots = 16;
+
+} // anonymous namespace
+
+cell_cache::cell_cache()
+    : slots2_(cache_slots)
+    , slots3_(cache_slots)
+{
+}
+
+const glm::dvec2* cell_cache::points(const glm::ivec2& cell, uint32_t seed)
+{
+    auto& slot = slots2_[hash(cell.x + seed, cell.y) % cache_slots];
+    if (!slot.used || slot.seed != seed || slot.cell.x != cell.x
+        || slot.cell.y != cell.y) {
+        feature_points(cell, seed, slot.points);
+        slot.cell = cell;
+        slot.seed = seed;
+        slot.used = true;
+    }
+    return slot.points;
+}
+
+const glm::dvec3* cell_cache::points(const glm::ivec3& cell, uint32_t seed)
+{
+    auto& slot = slots3_[hash(cell.x + seed, cell.y, cell.z) % cache_slots];
+    if (!slot.used || slot.seed != seed || slot.cell.x != cell.x
+        || slot.cell.y != cell.y || slot.cell.z != cell.z) {
+        feature_points(cell, seed, slot.points);
+        slot.cell = cell;
+        slot.seed = seed;
+        slot.used = true;
+    }
+    return slot.points;
+}
+
+glm::dvec2 p_worley(const glm::dvec2& xy, uint32_t seed)
+{
+    glm::dvec2 t{glm::floor(xy)};
+    glm::dvec2 points[9];
+    feature_points(glm::ivec2{(int)t.x, (int)t.y}, seed, points);
+    return closest_two(xy - t, points, 9);
+}
+
+glm::dvec2 p_worley(const glm::dvec2& xy, uint32_t seed, cell_cache& cache)
+{
+    glm::dvec2 t{glm::floor(xy)};
+    return closest_two(xy - t, cache.points(glm::ivec2{(int)t.x, (int)t.y},
+                                            seed), 9);
+}
+
+glm::dvec2 p_worley(const glm::dvec2& xy, uint32_t seed, glm::dvec2& grad0,
+                    glm::dvec2& grad1)
+{
+    glm::dvec2 t{glm::floor(xy)};
+    glm::dvec2 points[9];
+    feature_points(glm::ivec2{(int)t.x, (int)t.y}, seed, points);
+
+    int which[2];
+    auto result = closest_two(xy - t, points, 9, which);
+    grad0 = distance_gradient(xy - t, points[which[0]], result.x);
+    grad1 = distance_gradient(xy - t, points[which[1]], result.y);
+    return result;
+}
+
+glm::dvec2 p_worley3(const glm::dvec3& p, uint32_t seed)
+{
+    glm::dvec3 t{glm::floor(p)};
+    glm::dvec3 points[27];
+    feature_points(glm::ivec3{(int)t.x, (int)t.y, (int)t.z}, seed, points);
+    return closest_two(p - t, points, 27);
+}
+
+glm::dvec2 p_worley3(const glm::dvec3& p, uint32_t seed, cell_cache& cache)
+{
+    glm::dvec3 t{glm::floor(p)};
+    glm::ivec3 p0{(int)t.x, (int)t.y, (int)t.z};
+    return closest_two(p - t, cache.points(p0, seed), 27);
+}
+
+glm::dvec2 p_worley3(const glm::dvec3& p, uint32_t seed, glm::dvec3& grad0,
+                     glm::dvec3& grad1)
+{
+    glm::dvec3 t{glm::floor(p)};
+    glm::dvec3 points[27];
+    feature_points(glm::ivec3{(int)t.x, (int)t.y, (int)t.z}, seed, points);
+
+    int which[2];
+    auto result = closest_two(p - t, points, 27, which);
+    grad0 = distance_gradient(p - t, points[which[0]], result.x);
+    grad1 = distance_gradient(p - t, points[which[1]], result.y);
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Voronoi
+
+glm::dvec3 p_voronoi(const glm::dvec2& xy, uint32_t seed)
+{
+    glm::dvec2 t{glm::floor(xy)};
+    glm::dvec2 points[9];
+    feature_points(glm::ivec2{(int)t.x, (int)t.y}, seed, points);
+    return closest_point(t, xy - t, points);
+}
+
+glm::dvec3 p_voronoi(const glm::dvec2& xy, uint32_t seed, cell_cache& cache)
+{
+    glm::dvec2 t{glm::floor(xy)};
+    return closest_point(t, xy - t,
+                         cache.points(glm::ivec2{(int)t.x, (int)t.y}, seed));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+double curve_linear(double x, const std::vector<node::control_point>& curve)
+{
+    auto i = curve.begin();
+    if (x < i->in)
+        return i->out;
+
+    for (; i != curve.end(); ++i) {
+        if (x < i->in) {
+            --i;
+            double deltax = (i + 1)->in - i->in;
+            return lerp((x - i->in) / deltax, i->out, (i + 1)->out);
+        }
+    }
+    return std::prev(i)->out;
+}
+
+double curve_linear(double x, const std::vector<node::control_point>& curve,
+                    double& slope)
+{
+    slope = 0.0;
+    auto i = curve.begin();
+    if (x < i->in)
+        return i->out;
+
+    for (; i != curve.end(); ++i) {
+        if (x < i->in) {
+            --i;
+            double deltax = (i + 1)->in - i->in;
+            slope = ((i + 1)->out - i->out) / deltax;
+            return lerp((x - i->in) / deltax, i->out, (i + 1)->out);
+        }
+    }
+    return std::prev(i)->out;
+}
+
+double curve_spline(double x, const std::vector<node::control_point>& curve)
+{
+    int index = 0;
+    for (; index < (int)curve.size(); ++index) {
+        if (x < curve[index].in)
+            break;
+    }
+
+    const int lim = curve.size() - 1;
+    const int index0 = clamp(index - 2, 0, lim);
+    const int index1 = clamp(index - 1, 0, lim);
+    const int index2 = clamp(index, 0, lim);
+    const int index3 = clamp(index + 1, 0, lim);
+
+    if (index1 == index2)
+        return curve[index1].out;
+
+    const double in0 = curve[index1].in;
+    const double in1 = curve[index2].in;
+    const double a = (x - in0) / (in1 - in0);
+
+    const double out0 = curve[index0].out;
+    const double out1 = curve[index1].out;
+    const double out2 = curve[index2].out;
+    const double out3 = curve[index3].out;
+
+    return interp_cubic(out0, out1, out2, out3, a);
+}
+
+double curve_spline(double x, const std::vector<node::control_point>& curve,
+                    double& slope)
+{
+    int index = 0;
+    for (; index < (int)curve.size(); ++index) {
+        if (x < curve[index].in)
+            break;
+    }
+
+    const int lim = curve.size() - 1;
+    const int index0 = clamp(index - 2, 0, lim);
+    const int index1 = clamp(index - 1, 0, lim);
+    const int index2 = clamp(index, 0, lim);
+    const int index3 = clamp(index + 1, 0, lim);
+
+    slope = 0.0;
+    if (index1 == index2)
+        return curve[index1].out;
+
+    const double in0 = curve[index1].in;
+    const double in1 = curve[index2].in;
+    const double a = (x - in0) / (in1 - in0);
+
+    const double out0 = curve[index0].out;
+    const double out1 = curve[index1].out;
+    const double out2 = curve[index2].out;
+    const double out3 = curve[index3].out;
+
+    // The derivative of interp_cubic() along a, and of a along x.
+    const double c = out3 - out2 - out0 + out1;
+    slope = (3.0 * c * a * a + 2.0 * (out0 - out1 - c) * a + (out2 - out0))
+            / (in1 - in0);
+
+    return interp_cubic(out0, out1, out2, out3, a);
+}
+
+double png(const glm::dvec2& p, const generator_context::image& img)
+{
+    glm::dvec2 fl{glm::floor(p)};
+    glm::dvec2 fr{p - fl};
+    glm::ivec2 i{fr.x * img.width, fr.y * img.height};
+
+    return ((double)img.buffer[i.y * img.width + i.x] - 127.5) / 127.5;
+}
+
+} // namespace noise
+} // namespace hexa
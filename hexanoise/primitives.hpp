@@ -0,0 +1,255 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/primitives.hpp
+/// \brief  CPU implementations of the noise functions
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "generator_context.hpp"
+#include "node.hpp"
+
+namespace hexa
+{
+namespace noise
+{
+
+/** 2-D gradient noise. */
+double p_perlin(const glm::dvec2& xy, uint32_t seed);
+
+/** 3-D gradient noise. */
+double p_perlin3(const glm::dvec3& xyz, uint32_t seed);
+
+/** 2-D simplex noise. */
+double p_simplex(const glm::dvec2& xy, uint32_t seed);
+
+/** 3-D simplex noise. */
+double p_simplex3(const glm::dvec3& p, uint32_t seed);
+
+/** 2-D OpenSimplex noise. */
+double p_opensimplex(const glm::dvec2& p, uint32_t seed);
+
+/** 3-D OpenSimplex noise. */
+double p_opensimplex3(const glm::dvec3& p, uint32_t seed);
+
+/** @name Noise functions with a permutation table
+ *  These use the given table instead of the built-in one, and don't
+ *  take a seed.  See generator_context::set_seed_tables(). */
+///@{
+double p_perlin(const glm::dvec2& xy,
+                const generator_context::permutation& perm);
+
+double p_perlin3(const glm::dvec3& xyz,
+                 const generator_context::permutation& perm);
+
+double p_simplex(const glm::dvec2& xy,
+                 const generator_context::permutation& perm);
+
+double p_simplex3(const glm::dvec3& p,
+                  const generator_context::permutation& perm);
+
+double p_opensimplex(const glm::dvec2& p,
+                     const generator_context::permutation& perm);
+
+double p_opensimplex3(const glm::dvec3& p,
+                      const generator_context::permutation& perm);
+///@}
+
+/** @name Noise functions with their gradient
+ *  These return the same value as the functions above, and also store
+ *  the derivatives of the noise along each axis in gradient. */
+///@{
+double p_perlin(const glm::dvec2& xy, uint32_t seed, glm::dvec2& gradient);
+
+double p_perlin(const glm::dvec2& xy,
+                const generator_context::permutation& perm,
+                glm::dvec2& gradient);
+
+double p_perlin3(const glm::dvec3& xyz, uint32_t seed, glm::dvec3& gradient);
+
+double p_perlin3(const glm::dvec3& xyz,
+                 const generator_context::permutation& perm,
+                 glm::dvec3& gradient);
+
+double p_simplex(const glm::dvec2& xy, uint32_t seed, glm::dvec2& gradient);
+
+double p_simplex(const glm::dvec2& xy,
+                 const generator_context::permutation& perm,
+                 glm::dvec2& gradient);
+
+double p_simplex3(const glm::dvec3& p, uint32_t seed, glm::dvec3& gradient);
+
+double p_simplex3(const glm::dvec3& p,
+                  const generator_context::permutation& perm,
+                  glm::dvec3& gradient);
+
+double p_opensimplex(const glm::dvec2& p, uint32_t seed,
+                     glm::dvec2& gradient);
+
+double p_opensimplex(const glm::dvec2& p,
+                     const generator_context::permutation& perm,
+                     glm::dvec2& gradient);
+
+double p_opensimplex3(const glm::dvec3& p, uint32_t seed,
+                      glm::dvec3& gradient);
+
+double p_opensimplex3(const glm::dvec3& p,
+                      const generator_context::permutation& perm,
+                      glm::dvec3& gradient);
+///@}
+
+/** @name Batched noise functions
+ *  These evaluate n points at once, with the coordinates, seeds and
+ *  results in separate arrays.  The output array must not overlap any
+ *  of the inputs.  Depending on the CPU, the work is done with AVX-512,
+ *  AVX2 or SSE 4.1 instructions; the results match the single point
+ *  versions above to within rounding errors.  The versions that take a
+ *  permutation table use it for all n points.
+ *
+ *  The instruction set is chosen the first time one of these functions
+ *  is called.  It can be limited with the environment variable
+ *  HEXANOISE_SIMD, set to "avx2", "sse4.1", or "none". */
+///@{
+void p_perlin(size_t n, const double* x, const double* y,
+              const uint32_t* seed, double* out);
+
+void p_perlin(size_t n, const double* x, const double* y,
+              const generator_context::permutation& perm, double* out);
+
+void p_perlin3(size_t n, const double* x, const double* y, const double* z,
+               const uint32_t* seed, double* out);
+
+void p_perlin3(size_t n, const double* x, const double* y, const double* z,
+               const generator_context::permutation& perm, double* out);
+
+void p_simplex(size_t n, const double* x, const double* y,
+               const uint32_t* seed, double* out);
+
+void p_simplex(size_t n, const double* x, const double* y,
+               const generator_context::permutation& perm, double* out);
+
+void p_simplex3(size_t n, const double* x, const double* y, const double* z,
+                const uint32_t* seed, double* out);
+
+void p_simplex3(size_t n, const double* x, const double* y, const double* z,
+                const generator_context::permutation& perm, double* out);
+
+void p_opensimplex(size_t n, const double* x, const double* y,
+                   const uint32_t* seed, double* out);
+
+void p_opensimplex(size_t n, const double* x, const double* y,
+                   const generator_context::permutation& perm, double* out);
+
+void p_opensimplex3(size_t n, const double* x, const double* y,
+                    const double* z, const uint32_t* seed, double* out);
+
+void p_opensimplex3(size_t n, const double* x, const double* y,
+                    const double* z,
+                    const generator_context::permutation& perm, double* out);
+
+/** The name of the instruction set used by the batched functions. */
+const char* simd_instruction_set();
+///@}
+
+/** Remembers the feature points that the cell noise functions looked at
+ *  last.  All samples in a cell need the same 9 (or 27) feature points
+ *  around it, and on a grid with a small step, many samples in a row
+ *  fall in the same cell.  The cache has a few slots, picked by a hash
+ *  of the cell and the seed, so the octaves of a fractal, or several
+ *  cell noise functions in one script, don't keep evicting each other.
+ *
+ *  A cache must not be used by several threads at once. */
+class cell_cache
+{
+public:
+    cell_cache();
+
+    /** Get the feature points of the 3x3 cells around a cell, relative
+     *  to the corner of that cell. */
+    const glm::dvec2* points(const glm::ivec2& cell, uint32_t seed);
+
+    /** Get the feature points of the 3x3x3 cells around a cell, relative
+     *  to the corner of that cell. */
+    const glm::dvec3* points(const glm::ivec3& cell, uint32_t seed);
+
+private:
+    struct slot2
+    {
+        slot2() : used(false) {}
+        bool used;
+        uint32_t seed;
+        glm::ivec2 cell;
+        glm::dvec2 points[9];
+    };
+
+    struct slot3
+    {
+        slot3() : used(false) {}
+        bool used;
+        uint32_t seed;
+        glm::ivec3 cell;
+        glm::dvec3 points[27];
+    };
+
+    std::vector<slot2> slots2_;
+    std::vector<slot3> slots3_;
+};
+
+/** 2-D cell noise.
+ * @return The distances to the closest and the second closest feature
+ *         point */
+glm::dvec2 p_worley(const glm::dvec2& xy, uint32_t seed);
+
+/** 2-D cell noise, with the feature points taken from a cache. */
+glm::dvec2 p_worley(const glm::dvec2& xy, uint32_t seed, cell_cache& cache);
+
+/** 2-D cell noise, and the gradients of both distances.
+ * @param grad0  Receives the gradient of the distance to the closest point
+ * @param grad1  Receives the gradient of the distance to the second
+ *               closest point */
+glm::dvec2 p_worley(const glm::dvec2& xy, uint32_t seed, glm::dvec2& grad0,
+                    glm::dvec2& grad1);
+
+/** 3-D cell noise.
+ * @return The distances to the closest and the second closest feature
+ *         point */
+glm::dvec2 p_worley3(const glm::dvec3& p, uint32_t seed);
+
+/** 3-D cell noise, and the gradients of both distances. */
+glm::dvec2 p_worley3(const glm::dvec3& p, uint32_t seed, glm::dvec3& grad0,
+                     glm::dvec3& grad1);
+
+/** 3-D cell noise, with the feature points taken from a cache. */
+glm::dvec2 p_worley3(const glm::dvec3& p, uint32_t seed, cell_cache& cache);
+
+/** Voronoi cells.
+ * @return The position of the closest feature point (z is always 0) */
+glm::dvec3 p_voronoi(const glm::dvec2& xy, uint32_t seed);
+
+/** Voronoi cells, with the feature points taken from a cache. */
+glm::dvec3 p_voronoi(const glm::dvec2& xy, uint32_t seed, cell_cache& cache);
+
+/** Piecewise linear adjustment curve. */
+double curve_linear(double x, const std::vector<node::control_point>& curve);
+
+/** Piecewise linear adjustment curve, and its slope at x. */
+double curve_linear(double x, const std::vector<node::control_point>& curve,
+                    double& slope);
+
+/** Catmull-Rom spline adjustment curve. */
+double curve_spline(double x, const std::vector<node::control_point>& curve);
+
+/** Catmull-Rom spline adjustment curve, and its slope at x. */
+double curve_spline(double x, const std::vector<node::control_point>& curve,
+                    double& slope);
+
+/** Look up a pixel in an image that is tiled over the unit square. */
+double png(const glm::dvec2& p, const generator_context::image& img);
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,62 @@
+//---------------------------------------------------------------------------
+// hexanoise/quantize.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "quantize.hpp"
+
+#include <limits>
+
+namespace hexa
+{
+namespace noise
+{
+
+// Rounding is done by nearbyint(), which rounds halfway cases to even,
+// just like the conversions on the GPU.
+uint16_t to_half(double v)
+{
+    uint16_t sign = std::signbit(v) ? 0x8000 : 0;
+    if (std::isnan(v))
+        return sign | 0x7e00;
+
+    double a = std::fabs(v);
+    if (a >= 65520.0)
+        return sign | 0x7c00;
+
+    // Subnormals are multiples of 2^-24.  If this rounds up to 1024, the
+    // result is the smallest normal number, which happens to have the
+    // same bit pattern.
+    if (a < 6.103515625e-05)
+        return sign | static_cast<uint16_t>(std::nearbyint(a * 16777216.0));
+
+    int e;
+    double f = std::frexp(a, &e);
+    double m = std::nearbyint((f * 2.0 - 1.0) * 1024.0);
+    int exponent = e + 14;
+    if (m == 1024.0) {
+        m = 0.0;
+        ++exponent;
+    }
+    return sign | static_cast<uint16_t>(exponent << 10)
+           | static_cast<uint16_t>(m);
+}
+
+double from_half(uint16_t h)
+{
+    double sign = (h & 0x8000) ? -1.0 : 1.0;
+    int exponent = (h >> 10) & 0x1f;
+    int m = h & 0x3ff;
+
+    if (exponent == 0)
+        return sign * std::ldexp(m, -24);
+    if (exponent == 31) {
+        return m ? std::numeric_limits<double>::quiet_NaN()
+                 : sign * std::numeric_limits<double>::infinity();
+    }
+    return sign * std::ldexp(m + 1024, exponent - 25);
+}
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,126 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/quantize.hpp
+/// \brief  Compact integer and half precision output formats
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace hexa
+{
+namespace noise
+{
+
+/** The compact formats results can be stored in.  half is an IEEE 754
+ *  half precision float, stored as an uint16_t. */
+enum class quantized { int16, uint16, uint8, half };
+
+/** Returns the size of a sample in the given format, in bytes. */
+inline size_t sample_size(quantized format)
+{
+    return format == quantized::uint8 ? 1 : 2;
+}
+
+/** Converts a number to the bits of the nearest half precision float.
+ *  Numbers outside the range of a half become infinity. */
+uint16_t to_half(double v);
+
+/** Converts the bits of a half precision float back to a double. */
+double from_half(uint16_t h);
+
+/** Describes how results are turned into a compact format.  Every result
+ *  v is stored as v * scale + offset, clamped to [low, high].  For the
+ *  integer formats, this is then rounded to the nearest integer. */
+struct quantizer
+{
+    /** Set up a quantizer that clamps to the full range of the format.
+     * @param f  The output format
+     * @param s  The scale
+     * @param o  The offset, added after scaling */
+    quantizer(quantized f, double s = 1.0, double o = 0.0)
+        : format(f)
+        , scale(s)
+        , offset(o)
+        , low(0.0)
+        , high(0.0)
+    {
+        limits(low, high);
+    }
+
+    /** Get the range of the format.  (For half precision, this is the
+     *  range of the finite numbers.) */
+    void limits(double& lo, double& hi) const
+    {
+        switch (format) {
+        case quantized::int16:
+            lo = -32768.0, hi = 32767.0;
+            break;
+        case quantized::uint16:
+            lo = 0.0, hi = 65535.0;
+            break;
+        case quantized::uint8:
+            lo = 0.0, hi = 255.0;
+            break;
+        default:
+            lo = -65504.0, hi = 65504.0;
+        }
+    }
+
+    /** Get the clamp range, limited to the range of the format. */
+    void bounds(double& lo, double& hi) const
+    {
+        limits(lo, hi);
+        lo = low > lo ? low : lo;
+        hi = high < hi ? high : hi;
+    }
+
+    /** Scale and clamp a value.  NaN becomes the lower bound. */
+    double apply(double v) const
+    {
+        double lo, hi;
+        bounds(lo, hi);
+
+        v = v * scale + offset;
+        if (!(v >= lo))
+            return lo;
+        if (v > hi)
+            return hi;
+
+        return v;
+    }
+
+    /** Store a result at element i of a buffer in this format. */
+    void store(void* output, size_t i, double v) const
+    {
+        v = apply(v);
+        switch (format) {
+        case quantized::int16:
+            static_cast<int16_t*>(output)[i]
+                = static_cast<int16_t>(std::floor(0.5 + v));
+            break;
+        case quantized::uint16:
+            static_cast<uint16_t*>(output)[i]
+                = static_cast<uint16_t>(std::floor(0.5 + v));
+            break;
+        case quantized::uint8:
+            static_cast<uint8_t*>(output)[i]
+                = static_cast<uint8_t>(std::floor(0.5 + v));
+            break;
+        default:
+            static_cast<uint16_t*>(output)[i] = to_half(v);
+        }
+    }
+
+    quantized format;
+    double scale;
+    double offset;
+    double low;
+    double high;
+};
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,126 @@
+//---------------------------------------------------------------------------
+// hexanoise/thread_pool.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+namespace hexa
+{
+namespace noise
+{
+
+thread_pool::thread_pool(unsigned int threads)
+    : stop_(false)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned int i = 1; i < threads; ++i)
+        workers_.emplace_back([this] { worker(); });
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : workers_)
+        t.join();
+}
+
+void thread_pool::worker()
+{
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty())
+                return;
+
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+void thread_pool::parallel_for(size_t total, size_t grain,
+                               const std::function<void(size_t, size_t)>& f)
+{
+    if (total == 0)
+        return;
+
+    grain = std::max<size_t>(grain, 1);
+    size_t chunks = (total + grain - 1) / grain;
+    size_t helpers = std::min(workers_.size(), chunks - 1);
+    if (helpers == 0) {
+        f(0, total);
+        return;
+    }
+
+    // Chunks are claimed through a shared counter, so a thread that got
+    // the cheap parts of the image simply takes more of them.
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+    std::mutex done_mutex;
+    std::condition_variable done;
+    size_t running = helpers;
+
+    auto work = [&] {
+        for (;;) {
+            size_t chunk = next++;
+            if (chunk >= chunks)
+                break;
+
+            size_t begin = chunk * grain;
+            try {
+                f(begin, std::min(total, begin + grain));
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(done_mutex);
+                if (!error)
+                    error = std::current_exception();
+
+                next = chunks;
+            }
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < helpers; ++i) {
+            tasks_.emplace_back([&] {
+                work();
+                std::lock_guard<std::mutex> lock(done_mutex);
+                if (--running == 0)
+                    done.notify_one();
+            });
+        }
+    }
+    wake_.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done.wait(lock, [&] { return running == 0; });
+    if (error)
+        std::rethrow_exception(error);
+}
+
+size_t thread_pool::grain(size_t total, size_t align) const
+{
+    align = std::max<size_t>(align, 1);
+    size_t chunk = total / (size() * 8) + 1;
+    return (chunk + align - 1) / align * align;
+}
+
+} // namespace noise
+} // namespace hexa
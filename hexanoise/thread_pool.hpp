@@ -0,0 +1,74 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/thread_pool.hpp
+/// \brief  A fixed set of worker threads for the CPU generators
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hexa
+{
+namespace noise
+{
+
+/** A pool of worker threads.
+ *  The CPU generators use this to split up the output range of a single
+ *  run() call.  Every chunk of work writes to its own part of the output
+ *  buffer, so the results do not depend on the number of threads. */
+class thread_pool
+{
+public:
+    /** Start the worker threads.
+     * @param threads  The total number of threads that work on a job,
+     *                 including the calling thread.  0 means one for
+     *                 every hardware thread. */
+    explicit thread_pool(unsigned int threads);
+
+    /** Stops and joins the worker threads. */
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /** The number of threads that work on a job. */
+    unsigned int size() const
+    {
+        return static_cast<unsigned int>(workers_.size() + 1);
+    }
+
+    /** Call \a f(begin, end) for consecutive ranges of length \a grain
+     *  (the last one may be shorter) that together cover [0, total).
+     *  The ranges are handed out to the worker threads and the calling
+     *  thread.  This function returns when all of them are done.
+     *  If \a f throws, the first exception is rethrown here.
+     *  \a f must not call parallel_for on the same pool. */
+    void parallel_for(size_t total, size_t grain,
+                      const std::function<void(size_t, size_t)>& f);
+
+    /** Pick a chunk size for parallel_for that gives every thread a few
+     *  chunks, so they finish at roughly the same time.
+     * @param total  The size of the job
+     * @param align  The chunk size will be a multiple of this */
+    size_t grain(size_t total, size_t align) const;
+
+private:
+    void worker();
+
+private:
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_;
+};
+
+} // namespace noise
+} // namespace hexa
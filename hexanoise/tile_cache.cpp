@@ -0,0 +1,140 @@
+//---------------------------------------------------------------------------
+// hexanoise/tile_cache.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "tile_cache.hpp"
+
+#include <cstring>
+#include <iterator>
+
+namespace hexa
+{
+namespace noise
+{
+
+namespace
+{
+
+// The key is stored twice, in the list and in the index.
+size_t cost(const std::string& key, size_t samples)
+{
+    return samples + 2 * key.size();
+}
+
+} // anonymous namespace
+
+void pack_tile(const glm::ivec3& count, size_t sample_size, const void* input,
+               size_t row_pitch, size_t slice_pitch, void* output)
+{
+    size_t row = count.x * sample_size;
+    auto src = static_cast<const uint8_t*>(input);
+    auto dst = static_cast<uint8_t*>(output);
+    for (int z = 0; z < count.z; ++z) {
+        for (int y = 0; y < count.y; ++y) {
+            std::memcpy(dst,
+                        src + (y * row_pitch + z * slice_pitch) * sample_size,
+                        row);
+            dst += row;
+        }
+    }
+}
+
+void unpack_tile(const glm::ivec3& count, size_t sample_size,
+                 const void* input, void* output, size_t row_pitch,
+                 size_t slice_pitch)
+{
+    size_t row = count.x * sample_size;
+    auto src = static_cast<const uint8_t*>(input);
+    auto dst = static_cast<uint8_t*>(output);
+    for (int z = 0; z < count.z; ++z) {
+        for (int y = 0; y < count.y; ++y) {
+            std::memcpy(dst + (y * row_pitch + z * slice_pitch) * sample_size,
+                        src, row);
+            src += row;
+        }
+    }
+}
+
+tile_cache::tile_cache(size_t budget)
+    : budget_(budget)
+    , size_(0)
+    , hits_(0)
+    , misses_(0)
+{
+}
+
+bool tile_cache::find(const std::string& key, const glm::ivec3& count,
+                      size_t sample_size, void* output, size_t row_pitch,
+                      size_t slice_pitch)
+{
+    std::shared_ptr<const tile> samples;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(key);
+        if (found == index_.end()) {
+            ++misses_;
+            return false;
+        }
+        lru_.splice(lru_.begin(), lru_, found->second);
+        samples = found->second->samples;
+        ++hits_;
+    }
+
+    // The tile stays alive while it is copied, even if another thread
+    // throws it out of the cache.
+    unpack_tile(count, sample_size, samples->data(), output, row_pitch,
+                slice_pitch);
+    return true;
+}
+
+void tile_cache::insert(const std::string& key, const glm::ivec3& count,
+                        size_t sample_size, const void* input,
+                        size_t row_pitch, size_t slice_pitch)
+{
+    size_t bytes = size_t(count.x) * count.y * count.z * sample_size;
+    if (cost(key, bytes) > budget_)
+        return;
+
+    auto samples = std::make_shared<tile>(bytes);
+    pack_tile(count, sample_size, input, row_pitch, slice_pitch,
+              samples->data());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Two threads can miss the same tile at the same time.
+    auto found = index_.find(key);
+    if (found != index_.end())
+        erase(found->second);
+
+    while (!lru_.empty() && size_ + cost(key, bytes) > budget_)
+        erase(std::prev(lru_.end()));
+
+    lru_.push_front(entry{key, std::move(samples)});
+    index_[key] = lru_.begin();
+    size_ += cost(key, bytes);
+}
+
+void tile_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    lru_.clear();
+    size_ = 0;
+}
+
+size_t tile_cache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+}
+
+void tile_cache::erase(std::list<entry>::iterator i)
+{
+    size_ -= cost(i->key, i->samples->size());
+    index_.erase(i->key);
+    lru_.erase(i);
+}
+
+} // namespace noise
+} // namespace hexa
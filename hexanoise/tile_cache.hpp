@@ -0,0 +1,120 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/tile_cache.hpp
+/// \brief  Keeps the results of recent runs around
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace hexa
+{
+namespace noise
+{
+
+/** Copy samples from a buffer with row and slice pitches (both counted
+ *  in samples) to a buffer without padding. */
+void pack_tile(const glm::ivec3& count, size_t sample_size, const void* input,
+               size_t row_pitch, size_t slice_pitch, void* output);
+
+/** Copy samples from a buffer without padding to one with row and slice
+ *  pitches.  The elements between the rows are not touched. */
+void unpack_tile(const glm::ivec3& count, size_t sample_size,
+                 const void* input, void* output, size_t row_pitch,
+                 size_t slice_pitch);
+
+/** A cache for the results of run() calls, with a limit on the memory it
+ *  uses.  When a new tile does not fit, the tiles that were used least
+ *  recently are thrown out.
+ *
+ *  Tiles are identified by a key, which the generators make from a hash
+ *  of the script, the generator type, the output format, and the
+ *  region (see generator_context::set_tile_cache()).  The samples are
+ *  stored without padding; find() and insert() convert from and to a
+ *  buffer with row and slice pitches.
+ *
+ *  All functions can be called from several threads at once.  The
+ *  samples are copied out after the lock is released, so readers only
+ *  hold it for the lookup. */
+class tile_cache
+{
+public:
+    /** Set up an empty cache.
+     * @param budget  The most memory the tiles may use, in bytes.  This
+     *                counts the samples and the keys. */
+    explicit tile_cache(size_t budget);
+
+    tile_cache(const tile_cache&) = delete;
+    tile_cache& operator=(const tile_cache&) = delete;
+
+    /** Look up a tile, and copy it to a buffer.
+     * @param key          The key of the tile
+     * @param count        The number of samples along every axis
+     * @param sample_size  The size of a sample, in bytes
+     * @param output       Receives the samples
+     * @param row_pitch    The distance between two rows, in samples
+     * @param slice_pitch  The distance between two slices, in samples
+     * @return True if the tile was found, false if the output was not
+     *         touched */
+    bool find(const std::string& key, const glm::ivec3& count,
+              size_t sample_size, void* output, size_t row_pitch,
+              size_t slice_pitch);
+
+    /** Store a copy of a tile.  A tile that is larger than the whole
+     *  budget is not stored.  The arguments are the same as for
+     *  find(). */
+    void insert(const std::string& key, const glm::ivec3& count,
+                size_t sample_size, const void* input, size_t row_pitch,
+                size_t slice_pitch);
+
+    /** Throw out all tiles.  The counters are not reset. */
+    void clear();
+
+    /** The number of calls to find() that found their tile. */
+    size_t hits() const { return hits_; }
+
+    /** The number of calls to find() that did not. */
+    size_t misses() const { return misses_; }
+
+    /** The memory used by the tiles, in bytes. */
+    size_t size() const;
+
+    /** The most memory the tiles may use, in bytes. */
+    size_t budget() const { return budget_; }
+
+private:
+    typedef std::vector<uint8_t> tile;
+
+    struct entry
+    {
+        std::string key;
+        std::shared_ptr<const tile> samples;
+    };
+
+    // Must be called with the lock held.
+    void erase(std::list<entry>::iterator i);
+
+private:
+    const size_t budget_;
+    size_t size_;
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+
+    mutable std::mutex mutex_;
+    /** The most recently used tile is at the front. */
+    std::list<entry> lru_;
+    std::unordered_map<std::string, std::list<entry>::iterator> index_;
+};
+
+} // namespace noise
+} // namespace hexa
@@ -0,0 +1,426 @@
+//---------------------------------------------------------------------------
+// hexanoise/tile_store.cpp
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include "tile_store.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "fnv1a.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace hexa
+{
+namespace noise
+{
+
+namespace
+{
+
+const char file_magic[8] = {'H', 'X', 'N', 'T', 'I', 'L', 'E', 'S'};
+const uint32_t file_version = 1;
+const uint32_t record_magic = 0x454c4954; // "TILE"
+
+struct file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    /** The end of the records that were synced to disk */
+    uint64_t synced;
+    uint8_t reserved[40];
+};
+
+struct record_header
+{
+    uint32_t magic;
+    uint32_t key_size;
+    uint64_t payload_size;
+    /** FNV-1a of the key and the payload */
+    uint64_t checksum;
+    uint64_t reserved;
+};
+
+static_assert(sizeof(file_header) == 64, "file header must be 64 bytes");
+static_assert(sizeof(record_header) == 32, "record header must be 32 bytes");
+
+uint64_t pad(uint64_t size)
+{
+    return (size + 7) & ~uint64_t(7);
+}
+
+uint64_t record_size(uint64_t key_size, uint64_t payload_size)
+{
+    return sizeof(record_header) + pad(key_size) + pad(payload_size);
+}
+
+uint64_t checksum(const void* key, size_t key_size, const void* data,
+                  size_t size)
+{
+    return fnv1a(data, size, fnv1a(key, key_size));
+}
+
+#ifndef _WIN32
+void write_all(int fd, const void* data, size_t size, uint64_t offset)
+{
+    auto p = static_cast<const char*>(data);
+    while (size > 0) {
+        auto written = pwrite(fd, p, size, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            throw std::runtime_error("cannot write to tile store");
+
+        p += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+void write_header(int fd, uint64_t synced)
+{
+    file_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, file_magic, sizeof(file_magic));
+    h.version = file_version;
+    h.header_size = sizeof(file_header);
+    h.synced = synced;
+    write_all(fd, &h, sizeof(h), 0);
+}
+#endif
+
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+
+struct tile_store::mapping
+{
+    mapping(int fd, uint64_t size)
+        : base(nullptr)
+        , length(size)
+    {
+#ifndef _WIN32
+        void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            throw std::runtime_error("cannot map tile store");
+
+        base = static_cast<const uint8_t*>(p);
+#endif
+    }
+
+    ~mapping()
+    {
+#ifndef _WIN32
+        munmap(const_cast<uint8_t*>(base), length);
+#endif
+    }
+
+    mapping(const mapping&) = delete;
+    mapping& operator=(const mapping&) = delete;
+
+    const uint8_t* base;
+    uint64_t length;
+};
+
+//---------------------------------------------------------------------------
+
+tile_store::tile_store(const std::string& file, size_t budget)
+    : file_(file)
+    , budget_(budget)
+    , fd_(-1)
+    , end_(sizeof(file_header))
+    , synced_(sizeof(file_header))
+    , clock_(0)
+    , hits_(0)
+    , misses_(0)
+{
+#ifdef _WIN32
+    throw std::runtime_error("tile_store requires mmap()");
+#else
+    try {
+        open();
+    } catch (...) {
+        close();
+        throw;
+    }
+#endif
+}
+
+tile_store::~tile_store()
+{
+    try {
+        sync();
+    } catch (...) {
+    }
+    close();
+}
+
+void tile_store::open()
+{
+#ifndef _WIN32
+    fd_ = ::open(file_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+        throw std::runtime_error("cannot open tile store " + file_);
+
+    if (flock(fd_, LOCK_EX | LOCK_NB) != 0)
+        throw std::runtime_error("tile store " + file_ + " is in use");
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0)
+        throw std::runtime_error("cannot read tile store " + file_);
+
+    uint64_t size = st.st_size;
+    if (size == 0) {
+        write_header(fd_, sizeof(file_header));
+        size = sizeof(file_header);
+    }
+
+    file_header h;
+    if (size < sizeof(h) || pread(fd_, &h, sizeof(h), 0) != sizeof(h)
+        || std::memcmp(h.magic, file_magic, sizeof(file_magic)) != 0
+        || h.version != file_version || h.header_size != sizeof(h)) {
+        throw std::runtime_error(file_ + " is not a tile store");
+    }
+    synced_ = std::max<uint64_t>(h.synced, sizeof(h));
+
+    remap(size);
+    end_ = sizeof(h);
+    while (end_ + sizeof(record_header) <= size) {
+        record_header r;
+        std::memcpy(&r, mapping_->base + end_, sizeof(r));
+        if (r.magic != record_magic || r.payload_size > size)
+            break;
+
+        uint64_t length = record_size(r.key_size, r.payload_size);
+        if (end_ + length > size)
+            break;
+
+        auto key = mapping_->base + end_ + sizeof(r);
+        auto payload = key + pad(r.key_size);
+        if (end_ >= synced_
+            && checksum(key, r.key_size, payload, r.payload_size)
+                   != r.checksum) {
+            break;
+        }
+
+        index_[std::string(key, key + r.key_size)]
+            = entry{end_, length, ++clock_};
+        end_ += length;
+    }
+
+    // Whatever follows is the remains of an append that did not finish.
+    if (end_ < size && ftruncate(fd_, static_cast<off_t>(end_)) != 0)
+        throw std::runtime_error("cannot repair tile store " + file_);
+
+    synced_ = std::min(synced_, end_);
+#endif
+}
+
+void tile_store::close()
+{
+#ifndef _WIN32
+    mapping_.reset();
+    if (fd_ >= 0)
+        ::close(fd_);
+
+    fd_ = -1;
+#endif
+}
+
+// The mapping is made larger than the file, so the records that are
+// appended later are covered as well.  Views keep the old mapping alive.
+void tile_store::remap(uint64_t length) const
+{
+    uint64_t page = 1 << 16;
+    uint64_t reserve = std::max<uint64_t>(length * 2, 1 << 20);
+    mapping_ = std::make_shared<mapping>(fd_, (reserve + page - 1) / page
+                                                  * page);
+}
+
+tile_store::view tile_store::find(const std::string& key) const
+{
+    view result;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(key);
+    if (found == index_.end()) {
+        ++misses_;
+        return result;
+    }
+
+    auto& e = found->second;
+    e.used = ++clock_;
+    if (e.offset + e.size > mapping_->length)
+        remap(end_);
+
+    record_header r;
+    std::memcpy(&r, mapping_->base + e.offset, sizeof(r));
+    result.mapping_ = mapping_;
+    result.data_ = mapping_->base + e.offset + sizeof(r) + pad(r.key_size);
+    result.size_ = r.payload_size;
+    ++hits_;
+    return result;
+}
+
+void tile_store::insert(const std::string& key, const void* data,
+                        size_t size)
+{
+#ifndef _WIN32
+    uint64_t length = record_size(key.size(), size);
+    if (sizeof(file_header) + length > budget_)
+        return;
+
+    record_header r;
+    std::memset(&r, 0, sizeof(r));
+    r.magic = record_magic;
+    r.key_size = static_cast<uint32_t>(key.size());
+    r.payload_size = size;
+    r.checksum = checksum(key.data(), key.size(), data, size);
+
+    std::vector<uint8_t> record(length, 0);
+    std::memcpy(record.data(), &r, sizeof(r));
+    std::memcpy(record.data() + sizeof(r), key.data(), key.size());
+    std::memcpy(record.data() + sizeof(r) + pad(key.size()), data, size);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (end_ + length > budget_) {
+        uint64_t keep = budget_ / 4 * 3;
+        rewrite(keep > length ? keep - length : 0);
+    }
+
+    try {
+        write_all(fd_, record.data(), length, end_);
+    } catch (...) {
+        if (ftruncate(fd_, static_cast<off_t>(end_)) != 0) {
+            // The broken record is cut off when the store is opened.
+        }
+        throw;
+    }
+    index_[key] = entry{end_, length, ++clock_};
+    end_ += length;
+#endif
+}
+
+void tile_store::sync()
+{
+#ifndef _WIN32
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0 || synced_ == end_)
+        return;
+
+    // The records have to be on disk before the header says so.
+    if (fsync(fd_) != 0)
+        throw std::runtime_error("cannot sync tile store " + file_);
+
+    write_header(fd_, end_);
+    if (fsync(fd_) != 0)
+        throw std::runtime_error("cannot sync tile store " + file_);
+
+    synced_ = end_;
+#endif
+}
+
+void tile_store::compact()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    rewrite(std::numeric_limits<uint64_t>::max());
+}
+
+// Copy the most recently used tiles, up to 'limit' bytes of records, to a
+// new file, and move it in place of the old one.  If anything goes wrong,
+// the old file is still there.
+void tile_store::rewrite(uint64_t limit)
+{
+#ifndef _WIN32
+    std::vector<std::unordered_map<std::string, entry>::iterator> live;
+    for (auto i = index_.begin(); i != index_.end(); ++i)
+        live.push_back(i);
+
+    std::sort(live.begin(), live.end(), [](decltype(live[0]) a,
+                                           decltype(live[0]) b) {
+        return a->second.used > b->second.used;
+    });
+
+    uint64_t total = 0;
+    size_t kept = 0;
+    for (; kept < live.size(); ++kept) {
+        if (total + live[kept]->second.size > limit)
+            break;
+
+        total += live[kept]->second.size;
+    }
+    auto dropped = live.begin() + kept;
+    std::sort(live.begin(), dropped, [](decltype(live[0]) a,
+                                        decltype(live[0]) b) {
+        return a->second.offset < b->second.offset;
+    });
+
+    if (mapping_->length < end_)
+        remap(end_);
+
+    auto tmp = file_ + ".tmp";
+    int out = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     0644);
+    if (out < 0)
+        throw std::runtime_error("cannot create " + tmp);
+
+    uint64_t pos = sizeof(file_header);
+    try {
+        if (flock(out, LOCK_EX | LOCK_NB) != 0)
+            throw std::runtime_error("cannot lock " + tmp);
+
+        std::vector<uint64_t> offsets;
+        for (auto i = live.begin(); i != dropped; ++i) {
+            auto& e = (*i)->second;
+            write_all(out, mapping_->base + e.offset, e.size, pos);
+            offsets.push_back(pos);
+            pos += e.size;
+        }
+        write_header(out, pos);
+        if (fsync(out) != 0 || std::rename(tmp.c_str(), file_.c_str()) != 0)
+            throw std::runtime_error("cannot replace " + file_);
+
+        for (size_t i = 0; i < kept; ++i)
+            live[i]->second.offset = offsets[i];
+        for (auto i = dropped; i != live.end(); ++i)
+            index_.erase(*i);
+    } catch (...) {
+        ::close(out);
+        std::remove(tmp.c_str());
+        throw;
+    }
+
+    ::close(fd_);
+    fd_ = out;
+    end_ = synced_ = pos;
+    remap(end_);
+#endif
+}
+
+size_t tile_store::count() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.size();
+}
+
+size_t tile_store::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return end_;
+}
+
+} // namespace noise
+} // namespace hexa
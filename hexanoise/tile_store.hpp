@@ -0,0 +1,162 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/tile_store.hpp
+/// \brief  Keeps the results of runs in a file, across restarts
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace hexa
+{
+namespace noise
+{
+
+/** A persistent store for tiles, in a single file that is mapped into
+ *  memory.  The file starts with a fixed header, followed by a log of
+ *  records.  Every record has a small header (with the size of its key
+ *  and payload, and a checksum), the key, and the payload, which starts
+ *  at a multiple of 8 bytes.  New tiles are appended; a tile that is
+ *  stored again replaces the older record.  The keys the generators
+ *  use are about a hundred bytes (a hash of the script, the format,
+ *  and the region), so the records are not much larger than the tiles.
+ *
+ *  When the store is opened, the record headers are read to build the
+ *  index in memory.  The header of the file holds the end of the part
+ *  that was synced to disk; only the records after that are verified
+ *  with their checksum, and everything after the first broken record
+ *  (from a crash in the middle of an append) is cut off.  So opening a
+ *  large store only touches the pages with record headers, and reading
+ *  a tile only touches the pages of its payload.
+ *
+ *  When the file would grow beyond its budget, it is compacted: the
+ *  tiles that were used most recently are copied to a new file, up to
+ *  three quarters of the budget, and the new file replaces the old one.
+ *  compact() does the same without dropping anything.
+ *
+ *  The file is in the byte order of the machine that wrote it, and can
+ *  only be opened by one store at a time; other processes get an
+ *  exception.  All functions can be called from several threads at
+ *  once.  Only available on POSIX systems. */
+class tile_store
+{
+public:
+    struct mapping;
+
+    /** A tile in the store.  The samples are read straight from the
+     *  mapped file.  The view keeps the mapping alive, so it stays valid
+     *  even if the tile is replaced, or the store is compacted or
+     *  closed. */
+    class view
+    {
+    public:
+        view()
+            : data_(nullptr)
+            , size_(0)
+        {
+        }
+
+        /** The payload; aligned to 8 bytes. */
+        const void* data() const { return data_; }
+
+        /** The size of the payload, in bytes. */
+        size_t size() const { return size_; }
+
+        /** Returns true if the tile was found. */
+        explicit operator bool() const { return data_ != nullptr; }
+
+    private:
+        friend class tile_store;
+
+        std::shared_ptr<const mapping> mapping_;
+        const void* data_;
+        size_t size_;
+    };
+
+public:
+    /** Open a store, or create a new one.
+     * @param file    The file name
+     * @param budget  The largest size the file may grow to, in bytes
+     * @throw std::runtime_error if the file could not be opened, is not a
+     *                           tile store, or is in use */
+    tile_store(const std::string& file, size_t budget);
+
+    /** Syncs the file and closes it. */
+    ~tile_store();
+
+    tile_store(const tile_store&) = delete;
+    tile_store& operator=(const tile_store&) = delete;
+
+    /** Look up a tile.
+     * @return A view of the tile, or an empty view if it is not in the
+     *         store */
+    view find(const std::string& key) const;
+
+    /** Store a tile.  A tile that is larger than the budget is not
+     *  stored.  The data is written to the file right away, but it is
+     *  only sure to survive a crash of the machine after sync(). */
+    void insert(const std::string& key, const void* data, size_t size);
+
+    /** Make sure everything that was stored so far is on disk. */
+    void sync();
+
+    /** Rewrite the file with only the latest version of every tile. */
+    void compact();
+
+    /** The number of tiles in the store. */
+    size_t count() const;
+
+    /** The size of the file, in bytes. */
+    size_t size() const;
+
+    /** The most space the file may use, in bytes. */
+    size_t budget() const { return budget_; }
+
+    /** The number of calls to find() that found their tile. */
+    size_t hits() const { return hits_; }
+
+    /** The number of calls to find() that did not. */
+    size_t misses() const { return misses_; }
+
+private:
+    struct entry
+    {
+        /** Where the record starts in the file */
+        uint64_t offset;
+        /** The size of the record, including padding */
+        uint64_t size;
+        /** When the tile was used last */
+        mutable uint64_t used;
+    };
+
+    void open();
+    void close();
+    void remap(uint64_t length) const;
+    void rewrite(uint64_t limit);
+
+private:
+    const std::string file_;
+    const size_t budget_;
+    int fd_;
+    /** The end of the last record */
+    uint64_t end_;
+    /** The end of the records that are known to be on disk */
+    uint64_t synced_;
+    mutable uint64_t clock_;
+    mutable std::atomic<size_t> hits_;
+    mutable std::atomic<size_t> misses_;
+
+    mutable std::mutex mutex_;
+    mutable std::shared_ptr<const mapping> mapping_;
+    std::unordered_map<std::string, entry> index_;
+};
+
+} // namespace noise
+} // namespace hexa
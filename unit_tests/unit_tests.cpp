@@ -7,16 +7,30 @@
 #define BOOST_TEST_MODULE hexanoise_unittests test
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
 #include <iostream>
 #include <fstream>
+#include <future>
+#include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/tokenizer.hpp>
+#include <hexanoise/fnv1a.hpp>
 #include <hexanoise/generator_context.hpp>
+#include <hexanoise/generator_hybrid.hpp>
+#include <hexanoise/generator_lod.hpp>
+#include <hexanoise/generator_native.hpp>
 #include <hexanoise/generator_opencl.hpp>
 #include <hexanoise/generator_slowinterpreter.hpp>
+#include <hexanoise/generator_vm.hpp>
+#include <hexanoise/primitives.hpp>
 #include <hexanoise/simple_global_variables.hpp>
 
 #ifdef WIN32
@@ -30,6 +44,37 @@
 using namespace hexa::noise;
 using namespace boost::algorithm;
 
+// Find a device for the OpenCL tests.  Unlike test_full, they are skipped
+// on machines without OpenCL.
+bool find_opencl(cl::Context& context, cl::Device& device)
+{
+    if (clewInit(OPENCL_DLL_NAME) < 0)
+        return false;
+
+    std::vector<cl::Platform> platform_list;
+    try {
+        cl::Platform::get(&platform_list);
+    } catch (cl::Error&) {
+        return false;
+    }
+    for (auto& pl : platform_list) {
+        try {
+            std::vector<cl::Device> devices;
+            pl.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+            if (devices.empty())
+                continue;
+
+            cl_context_properties properties[]
+                = {CL_CONTEXT_PLATFORM, (cl_context_properties)(pl)(), 0};
+            context = cl::Context{CL_DEVICE_TYPE_ALL, properties};
+            device = devices[0];
+            return true;
+        } catch (cl::Error&) {
+        }
+    }
+    return false;
+}
+
 BOOST_AUTO_TEST_CASE(test_full)
 {
     BOOST_REQUIRE(clewInit(OPENCL_DLL_NAME) >= 0);
@@ -68,6 +113,8 @@ BOOST_AUTO_TEST_CASE(test_full)
         auto& test = ctx.get_script("test");
         generator_slowinterpreter gl_gen{ctx, test};
         generator_opencl cl_gen{ctx, opencl_context, devices[0], test};
+        generator_vm vm_gen{ctx, test};
+        generator_native native_gen{ctx, test};
         
         for (;;) {
             std::getline(str, input);
@@ -86,7 +133,7 @@ BOOST_AUTO_TEST_CASE(test_full)
                 v.emplace_back(std::stod(value));
             }
             
-            double result1, result2;
+            double result1, result2, result3, result4;
             if (v.size() == 2) {
                 result1 = gl_gen.run(glm::dvec2{v[0], v[1]}, 
                                      glm::dvec2{1.0, 1.0},
@@ -95,6 +142,22 @@ BOOST_AUTO_TEST_CASE(test_full)
                 result2 = cl_gen.run(glm::dvec2{v[0], v[1]}, 
                                     glm::dvec2{1.0, 1.0},
                                     glm::ivec2{1, 1})[0];                
+
+                if (cl_gen.has_fp64()) {
+                    auto view = cl_gen.run_mapped(glm::dvec2{v[0], v[1]},
+                                                  glm::dvec2{1.0, 1.0},
+                                                  glm::ivec2{1, 1});
+                    BOOST_CHECK_EQUAL(view.size(), 1);
+                    BOOST_CHECK_EQUAL(view[0], result2);
+                }
+
+                result3 = vm_gen.run(glm::dvec2{v[0], v[1]},
+                                     glm::dvec2{1.0, 1.0},
+                                     glm::ivec2{1, 1})[0];
+
+                result4 = native_gen.run(glm::dvec2{v[0], v[1]},
+                                         glm::dvec2{1.0, 1.0},
+                                         glm::ivec2{1, 1})[0];
             } else if (v.size() == 3) {
                 result1 = gl_gen.run(glm::dvec3{v[0], v[1], v[2]}, 
                                     glm::dvec3{1.0, 1.0, 1.0},
@@ -103,19 +166,1241 @@ BOOST_AUTO_TEST_CASE(test_full)
                 result2 = cl_gen.run(glm::dvec3{v[0], v[1], v[2]}, 
                                     glm::dvec3{1.0, 1.0, 1.0},
                                     glm::ivec3{1, 1, 1})[0];                                
+
+                result3 = vm_gen.run(glm::dvec3{v[0], v[1], v[2]},
+                                     glm::dvec3{1.0, 1.0, 1.0},
+                                     glm::ivec3{1, 1, 1})[0];
+
+                result4 = native_gen.run(glm::dvec3{v[0], v[1], v[2]},
+                                         glm::dvec3{1.0, 1.0, 1.0},
+                                         glm::ivec3{1, 1, 1})[0];
             } else {
                 throw std::runtime_error(input + " is not a valid position");
             }
             
             bool succ1 = std::abs(result1 - expected) < 0.0001;
             bool succ2 = std::abs(result2 - expected) < 0.0001;
-            if (!succ1 || !succ2) {
+            bool succ3 = std::abs(result3 - expected) < 0.0001;
+            bool succ4 = std::abs(result4 - expected) < 0.0001;
+            if (!succ1 || !succ2 || !succ3 || !succ4) {
                 std::cerr << "Failed function: " << line 
                           << "\nExpected: " << expected << "\nResult: "
-                          << result1 << " / " << result2 << std::endl;
+                          << result1 << " / " << result2 << " / "
+                          << result3 << " / " << result4 << std::endl;
+            }
+
+            BOOST_CHECK(succ1 && succ2 && succ3 && succ4);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent)
+{
+    // Several threads share a single generator.  Map, fractal and worley
+    // evaluate their inputs at another position, so they would break if
+    // the generators kept that position in a member.
+    generator_context ctx;
+    auto& n = ctx.set_script("test", "scale(3):map(fractal(perlin, 3), "
+                                     "worley(x, 1)):fractal(simplex, 2)");
+    generator_slowinterpreter gl_gen{ctx, n};
+    generator_vm vm_gen{ctx, n};
+
+    std::vector<const generator_i*> generators{&gl_gen, &vm_gen};
+    for (auto gen : generators) {
+        auto run = [&](int i) {
+            return gen->run(glm::dvec2{i * 100.0, 0.0}, glm::dvec2{0.1, 0.1},
+                            glm::ivec2{64, 64});
+        };
+
+        std::vector<std::vector<double>> expected, result(8);
+        for (int i = 0; i < 8; ++i)
+            expected.emplace_back(run(i));
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 8; ++i)
+            threads.emplace_back([&, i] { result[i] = run(i); });
+
+        for (auto& t : threads)
+            t.join();
+
+        BOOST_CHECK(result == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_float)
+{
+    // The CPU generators compute in double precision, so run_float() must
+    // return exactly the rounded results of run().
+    generator_context ctx;
+    auto& n = ctx.set_script("test", "scale(3):fractal(perlin, 4)");
+    generator_slowinterpreter gl_gen{ctx, n};
+    generator_vm vm_gen{ctx, n};
+
+    std::vector<const generator_i*> generators{&gl_gen, &vm_gen};
+    for (auto gen : generators) {
+        glm::dvec2 corner{-10.5, 3.25}, step{0.37, 0.11};
+        glm::ivec2 count{33, 17};
+
+        auto expected = gen->run(corner, step, count);
+        auto result = gen->run_float(corner, step, count);
+        BOOST_REQUIRE(result.size() == expected.size());
+
+        bool same = true;
+        for (size_t i = 0; i < result.size(); ++i)
+            same &= result[i] == static_cast<float>(expected[i]);
+
+        BOOST_CHECK(same);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_stride)
+{
+    // Write a block into the middle of a larger buffer; everything around
+    // it must stay untouched.
+    generator_context ctx;
+    auto& n = ctx.set_script("test", "scale(3):fractal(perlin, 2)");
+    generator_slowinterpreter gl_gen{ctx, n};
+    generator_vm vm_gen{ctx, n};
+    generator_native native_gen{ctx, n};
+
+    const double marker = 1234.5;
+    glm::ivec3 count{13, 7, 3};
+    size_t row_pitch = 20, slice_pitch = 200, offset = 21;
+
+    std::vector<const generator_i*> generators{&gl_gen, &vm_gen,
+                                               &native_gen};
+    for (auto gen : generators) {
+        glm::dvec3 corner{-1.5, 2.25, 0.5}, step{0.3, 0.2, 0.7};
+        auto expected = gen->run(corner, step, count);
+
+        std::vector<double> buffer(700, marker);
+        gen->run(corner, step, count, &buffer[offset],
+                 buffer.size() - offset, row_pitch, slice_pitch);
+
+        auto expected2 = gen->run(glm::dvec2{corner}, glm::dvec2{step},
+                                  glm::ivec2{count});
+        std::vector<int16_t> buffer2(200, 999);
+        gen->run_int16(glm::dvec2{corner}, glm::dvec2{step},
+                       glm::ivec2{count}, &buffer2[offset],
+                       buffer2.size() - offset, row_pitch);
+
+        bool same = true;
+        size_t written = 0, written2 = 0;
+        for (size_t i = 0; i < buffer.size(); ++i) {
+            size_t x = (i - offset) % row_pitch;
+            size_t y = (i - offset) % slice_pitch / row_pitch;
+            size_t z = (i - offset) / slice_pitch;
+            if (i >= offset && x < 13 && y < 7 && z < 3) {
+                same &= buffer[i] == expected[x + 13 * (y + 7 * z)];
+                ++written;
+                if (z == 0 && i < buffer2.size()) {
+                    same &= buffer2[i]
+                            == std::floor(0.5 + expected2[x + 13 * y]);
+                    ++written2;
+                }
+            } else {
+                same &= buffer[i] == marker;
+                same &= i >= buffer2.size() || buffer2[i] == 999;
+            }
+        }
+        BOOST_CHECK(same);
+        BOOST_CHECK_EQUAL(written, expected.size());
+        BOOST_CHECK_EQUAL(written2, expected2.size());
+    }
+
+    std::vector<double> small(100);
+    BOOST_CHECK_THROW(vm_gen.run(glm::dvec2{0, 0}, glm::dvec2{1, 1},
+                                 glm::ivec2{10, 10}, &small[0], 99, 10),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(vm_gen.run(glm::dvec2{0, 0}, glm::dvec2{1, 1},
+                                 glm::ivec2{10, 10}, &small[0], 100, 9),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_points)
+{
+    // Evaluating a list of points gives the same results as sampling a
+    // grid at the same positions.
+    generator_context ctx;
+    auto& n = ctx.set_script("test", "scale(3):map(fractal(perlin, 3), "
+                                     "worley(x, 1)):fractal(simplex, 2)");
+    generator_slowinterpreter gl_gen{ctx, n};
+    generator_vm vm_gen{ctx, n};
+    generator_native native_gen{ctx, n};
+
+    glm::ivec3 count{17, 9, 2};
+    glm::dvec3 corner{-5.5, 3.25, 1.0}, step{0.7, 1.1, 0.3};
+    std::vector<glm::dvec2> points2;
+    std::vector<glm::dvec3> points3;
+    for (int z = 0; z < count.z; ++z) {
+        for (int y = 0; y < count.y; ++y) {
+            for (int x = 0; x < count.x; ++x) {
+                points3.emplace_back(corner + glm::dvec3{x, y, z} * step);
+                if (z == 0)
+                    points2.emplace_back(points3.back());
+            }
+        }
+    }
+
+    std::vector<const generator_i*> generators{&gl_gen, &vm_gen,
+                                               &native_gen};
+    for (auto gen : generators) {
+        std::vector<double> result2(points2.size()), result3(points3.size());
+        gen->run(&points2[0], points2.size(), &result2[0]);
+        gen->run(&points3[0], points3.size(), &result3[0]);
+
+        // The native code may contract the grid position into an FMA.
+        auto expected2 = gen->run(glm::dvec2{corner}, glm::dvec2{step},
+                                  glm::ivec2{count});
+        auto expected3 = gen->run(corner, step, count);
+        for (size_t i = 0; i < result2.size(); ++i)
+            BOOST_CHECK_SMALL(result2[i] - expected2[i], 1e-9);
+        for (size_t i = 0; i < result3.size(); ++i)
+            BOOST_CHECK_SMALL(result3[i] - expected3[i], 1e-9);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_quantized)
+{
+    BOOST_CHECK_EQUAL(to_half(1.0), 0x3c00);
+    BOOST_CHECK_EQUAL(to_half(-2.0), 0xc000);
+    BOOST_CHECK_EQUAL(to_half(65504.0), 0x7bff);
+    BOOST_CHECK_EQUAL(to_half(1e6), 0x7c00);
+    BOOST_CHECK_EQUAL(to_half(std::ldexp(1.0, -24)), 0x0001);
+    BOOST_CHECK_EQUAL(to_half(1.0 + std::ldexp(1.0, -11)), 0x3c00);
+    BOOST_CHECK_EQUAL(to_half(1.0 + 3 * std::ldexp(1.0, -11)), 0x3c02);
+    for (double v : {0.0, 0.1, -0.333, 1234.5, 7e-5})
+        BOOST_CHECK_CLOSE(from_half(to_half(v)), v, 0.1);
+
+    generator_context ctx;
+    auto& n = ctx.set_script("test", "scale(3):fractal(perlin, 3)");
+    generator_slowinterpreter gl_gen{ctx, n};
+    generator_vm vm_gen{ctx, n};
+    generator_native native_gen{ctx, n};
+
+    glm::dvec3 corner{-2.5, 1.25, 0.5}, step{0.3, 0.2, 0.7};
+    glm::ivec3 count{11, 6, 3};
+
+    std::vector<quantizer> formats{
+        quantizer{quantized::int16, 1000.0},
+        quantizer{quantized::uint16, 30000.0, 32768.0},
+        quantizer{quantized::uint8, 127.5, 127.5},
+        quantizer{quantized::half, 0.5, 0.25}};
+    formats[2].low = 10.0;
+    formats[2].high = 200.0;
+
+    std::vector<const generator_i*> generators{&gl_gen, &vm_gen,
+                                               &native_gen};
+    for (auto gen : generators) {
+        auto expected = gen->run(corner, step, count);
+        for (auto& q : formats) {
+            std::vector<uint16_t> result(expected.size());
+            std::vector<uint16_t> check(expected.size());
+            gen->run_quantized(corner, step, count, q, &result[0],
+                               result.size(), count.x, count.x * count.y);
+            for (size_t i = 0; i < expected.size(); ++i)
+                q.store(&check[0], i, expected[i]);
+            if (q.format == quantized::uint8) {
+                auto bytes = reinterpret_cast<const uint8_t*>(&result[0]);
+                BOOST_CHECK(std::equal(bytes, bytes + expected.size(),
+                                       reinterpret_cast<uint8_t*>(&check[0])));
+            } else {
+                BOOST_CHECK(result == check);
+            }
+        }
+
+        // 3-D int16 output is rounded, just like 2-D.
+        auto ints = gen->run_int16(corner, step * 1000.0, count);
+        auto doubles = gen->run(corner, step * 1000.0, count);
+        bool same = true;
+        for (size_t i = 0; i < ints.size(); ++i)
+            same &= ints[i] == std::floor(0.5 + doubles[i]);
+        BOOST_CHECK(same);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_bounds)
+{
+    // Every result in a block must fall inside its bounds.
+    std::vector<std::string> scripts{
+        "scale(3):worley(x:mul(y:sub(1)))",
+        "scale(2):voronoi(x:add(y):sin)",
+        "scale3(4):rotate3(1, 2, 3, 0.3):fractal3(perlin3, 3):sub(z)",
+        "x:div(3):cos:curve_spline(-1, 0, -0.5, 1, 0.5, -1, 1, 0)",
+        "y:curve_linear(-1, 5, 0, -2, 2, 1):pow(2)",
+        "rotate(0.3):angle:tan",
+        "map3(x:saw, y:round, z:abs):checkerboard3",
+        "scale(0.5):opensimplex:blend(x, y:sqrt)",
+        "fractal3(opensimplex3:pow(3), 5, 2.5, 0.5)"};
+
+    std::ifstream str{"tests"};
+    BOOST_REQUIRE(str);
+    std::string line;
+    bool script = true;
+    while (std::getline(str, line)) {
+        trim(line);
+        if (line.empty() || line[0] == '#') {
+            script = true;
+            continue;
+        }
+        if (script)
+            scripts.emplace_back(line);
+
+        script = false;
+    }
+
+    simple_global_variables gv;
+    gv["one"] = 1.0;
+    gv["two"] = 2.0;
+
+    glm::dvec3 corner{-2.3, -1.7, -0.9}, step{0.37, 0.29, 0.41};
+    glm::ivec3 count{9, 9, 5};
+    for (auto& s : scripts) {
+        generator_context ctx{gv};
+        auto& n = ctx.set_script("test", s);
+        generator_slowinterpreter gen{ctx, n};
+
+        auto inside = [&](const interval& b, const std::vector<double>& r) {
+            for (double v : r) {
+                double slack = 1e-9 * (1.0 + std::abs(v));
+                if (std::isnan(v) ? b.is_finite()
+                                  : v < b.lo - slack || v > b.hi + slack)
+                    return false;
+            }
+            return true;
+        };
+        BOOST_CHECK_MESSAGE(inside(gen.bounds(corner, step, count),
+                                   gen.run(corner, step, count)),
+                            s);
+        BOOST_CHECK_MESSAGE(
+            inside(gen.bounds(glm::dvec2{corner}, glm::dvec2{step},
+                              glm::ivec2{count}),
+                   gen.run(glm::dvec2{corner}, glm::dvec2{step},
+                           glm::ivec2{count})),
+            s);
+    }
+
+    generator_context ctx;
+    auto& n = ctx.set_script("test", "scale(10):fractal(simplex, 4):add(z)");
+    generator_vm gen{ctx, n};
+
+    // Far below zero, a chunk can be skipped.  Above z = 2, every sample
+    // clamps to the same value.  In between, the chunk has to be
+    // generated.
+    glm::ivec3 chunk{16, 16, 16};
+    quantizer q{quantized::uint8, 100.0};
+    q.high = 50.0;
+    BOOST_CHECK_LT(gen.bounds(glm::dvec3{0, 0, -20}, step, chunk).hi, 0.0);
+
+    std::vector<uint8_t> block(chunk.x * chunk.y * chunk.z, 7);
+    std::vector<uint8_t> check(block.size());
+    BOOST_CHECK(gen.fill_uniform(glm::dvec3{0, 0, 2}, step, chunk, q,
+                                 &block[0], block.size(), chunk.x,
+                                 chunk.x * chunk.y));
+    gen.run_quantized(glm::dvec3{0, 0, 2}, step, chunk, q, &check[0],
+                      check.size(), chunk.x, chunk.x * chunk.y);
+    BOOST_CHECK(block == check);
+
+    block.assign(block.size(), 7);
+    BOOST_CHECK(!gen.fill_uniform(glm::dvec3{0, 0, -1}, step, chunk, q,
+                                  &block[0], block.size(), chunk.x,
+                                  chunk.x * chunk.y));
+    BOOST_CHECK(block == std::vector<uint8_t>(block.size(), 7));
+}
+
+BOOST_AUTO_TEST_CASE(test_noise_bounds)
+{
+    // The ranges of the noise functions are found by bounding every term
+    // separately.  Sample them densely, for several seeds and with seed
+    // tables, to check that they hold.
+    std::vector<std::string> noise2{"perlin", "simplex", "opensimplex"};
+    std::vector<std::string> noise3{"perlin3", "simplex3", "opensimplex3"};
+
+    for (int tables = 0; tables < 2; ++tables) {
+        for (int seed = 0; seed < 4; ++seed) {
+            generator_context ctx;
+            ctx.set_seed_tables(tables != 0);
+            auto seed_str = std::to_string(seed * 1237);
+
+            for (auto& f : noise2) {
+                auto& n = ctx.set_script(f + seed_str,
+                                         f + "(" + seed_str + ")");
+                generator_vm gen{ctx, n};
+                glm::dvec2 corner{-7.9, -8.3}, step{0.031, 0.029};
+                glm::ivec2 count{512, 512};
+                auto range = gen.bounds(corner, step, count);
+                auto result = gen.run(corner, step, count);
+                auto minmax
+                    = std::minmax_element(result.begin(), result.end());
+                BOOST_CHECK_MESSAGE(range.contains(*minmax.first)
+                                        && range.contains(*minmax.second),
+                                    n.type << " seed " << seed_str);
             }
+            for (auto& f : noise3) {
+                auto& n = ctx.set_script(f + seed_str,
+                                         f + "(" + seed_str + ")");
+                generator_vm gen{ctx, n};
+                glm::dvec3 corner{-2.1, -2.3, -1.9}, step{0.071, 0.067, 0.073};
+                glm::ivec3 count{64, 64, 64};
+                auto range = gen.bounds(corner, step, count);
+                auto result = gen.run(corner, step, count);
+                auto minmax
+                    = std::minmax_element(result.begin(), result.end());
+                BOOST_CHECK_MESSAGE(range.contains(*minmax.first)
+                                        && range.contains(*minmax.second),
+                                    n.type << " seed " << seed_str);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_branches)
+{
+    // The samples in a batch disagree on the condition, so the VM packs
+    // the samples that take the expensive branches together.
+    std::vector<std::string> scripts{
+        "scale(0.7):perlin:is_greaterthan(0.3)"
+        ":then_else(scale(3):fractal(opensimplex, 3), x)",
+        "x:saw:is_lessthan(0.5):then_else(y:saw:is_lessthan(0.3)"
+        ":then_else(perlin:add(simplex), worley(x)), perlin:mul(y))",
+        "perlin:is_greaterthan(0)"
+        ":then_else(perlin:mul(simplex), simplex:add(perlin))",
+        "scale(2):fractal(perlin:is_gte(0)"
+        ":then_else(simplex, opensimplex:neg), 3)",
+        "map3(x:saw, y, z):perlin3:is_lessthan(0.2)"
+        ":then_else(perlin3:add(z), opensimplex3)",
+        // The number of octaves is not known when the script is compiled.
+        "x:is_greaterthan(0)"
+        ":then_else(fractal(perlin, y:abs:round:add(1)), simplex)"};
+
+    for (auto& s : scripts) {
+        generator_context ctx;
+        auto& n = ctx.set_script("test", s);
+        generator_slowinterpreter gl_gen{ctx, n};
+        generator_vm vm_gen{ctx, n};
+
+        glm::dvec3 corner{-3.1, 2.3, 0.7}, step{0.37, 0.43, 0.29};
+        glm::ivec3 count{23, 11, 3};
+        auto expected = gl_gen.run(corner, step, count);
+        auto result = vm_gen.run(corner, step, count);
+        BOOST_CHECK_EQUAL(result.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+            BOOST_CHECK_MESSAGE(std::abs(result[i] - expected[i]) < 1e-9,
+                                s << " at " << i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_seed_tables)
+{
+    generator_context plain;
+    generator_context tables;
+    tables.set_seed_tables(true);
 
-            BOOST_CHECK(succ1 && succ2);
+    // Every seed gets a different shuffle of 0..255, and the same seed
+    // always gets the same one.
+    auto& perm = tables.get_permutation(7);
+    std::vector<int> sorted(perm.p, perm.p + 256);
+    std::sort(sorted.begin(), sorted.end());
+    for (int i = 0; i < 256; ++i)
+        BOOST_CHECK_EQUAL(sorted[i], i);
+    BOOST_CHECK(std::equal(perm.p, perm.p + 256, perm.p + 256));
+    BOOST_CHECK(&perm == &tables.get_permutation(7));
+    BOOST_CHECK(!std::equal(perm.p, perm.p + 256,
+                            tables.get_permutation(8).p));
+    generator_context::permutation again{7};
+    BOOST_CHECK(std::equal(perm.p, perm.p + 512, again.p));
+
+    // All CPU backends agree with seed tables enabled.  The seed of the
+    // last noise function is not a constant, so it falls back to adding
+    // the seed to the coordinates.
+    std::string script{"scale(3):perlin(3):add(simplex(4))"
+                       ":add(opensimplex(5)):add(perlin(y:round))"};
+    std::string script3{"scale3(3):perlin3(3):add(simplex3(4))"
+                        ":add(opensimplex3(5))"};
+    for (auto& s : {script, script3}) {
+        auto& n = tables.set_script("test", s);
+        generator_slowinterpreter gl_gen{tables, n};
+        generator_vm vm_gen{tables, n};
+        generator_native native_gen{tables, n};
+
+        glm::dvec3 corner{-5.5, 3.25, 1.0}, step{0.7, 1.1, 0.3};
+        glm::ivec3 count{33, 9, 2};
+        auto expected = gl_gen.run(corner, step, count);
+        auto result_vm = vm_gen.run(corner, step, count);
+        auto result_native = native_gen.run(corner, step, count);
+        for (size_t i = 0; i < expected.size(); ++i) {
+            BOOST_CHECK_SMALL(result_vm[i] - expected[i], 1e-9);
+            BOOST_CHECK_SMALL(result_native[i] - expected[i], 1e-9);
         }
+
+        // The tables change the noise.
+        generator_vm plain_gen{plain, plain.set_script("test", s)};
+        auto other = plain_gen.run(corner, step, count);
+        size_t same = 0;
+        for (size_t i = 0; i < expected.size(); ++i)
+            same += std::abs(other[i] - expected[i]) < 1e-9;
+        BOOST_CHECK_LT(same, expected.size() / 10);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_opencl_seed_tables)
+{
+    cl::Context opencl_context;
+    cl::Device device;
+    if (!find_opencl(opencl_context, device)) {
+        BOOST_TEST_MESSAGE("no OpenCL device, test skipped");
+        return;
+    }
+
+    // The tables are also used in the functions that are generated for
+    // fractal and map.  Without double precision, the positions are
+    // rounded to floats.
+    generator_context tables;
+    tables.set_seed_tables(true);
+    auto check = [&](const std::vector<double>& result,
+                     const std::vector<double>& expected, bool fp64) {
+        BOOST_REQUIRE_EQUAL(result.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+            BOOST_CHECK_SMALL(result[i] - expected[i], fp64 ? 1e-6 : 1e-2);
+    };
+
+    for (auto& s : {"scale(3):perlin(3):add(simplex(4)):add(opensimplex(5))"
+                    ":add(perlin(y:round))",
+                    "scale(2):fractal(perlin(6), 3)"
+                    ":add(map(x, y:mul(2)):simplex(7))"}) {
+        auto& n = tables.set_script(s, s);
+        generator_slowinterpreter gl_gen{tables, n};
+        generator_opencl cl_gen{tables, opencl_context, device, n};
+        glm::dvec2 corner{-5.5, 3.25}, step{0.7, 1.1};
+        glm::ivec2 count{33, 9};
+        check(cl_gen.run(corner, step, count), gl_gen.run(corner, step, count),
+              cl_gen.has_fp64());
+    }
+    for (auto& s : {"scale3(3):perlin3(3):add(simplex3(4))"
+                    ":add(opensimplex3(5))",
+                    "scale3(2):fractal3(opensimplex3(8), 3)"}) {
+        auto& n = tables.set_script(s, s);
+        generator_slowinterpreter gl_gen{tables, n};
+        generator_opencl cl_gen{tables, opencl_context, device, n};
+        glm::dvec3 corner{-5.5, 3.25, 1.0}, step{0.7, 1.1, 0.3};
+        glm::ivec3 count{33, 9, 2};
+        check(cl_gen.run(corner, step, count), gl_gen.run(corner, step, count),
+              cl_gen.has_fp64());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_opencl_link)
+{
+    cl::Context opencl_context;
+    cl::Device device;
+    if (!find_opencl(opencl_context, device)) {
+        BOOST_TEST_MESSAGE("no OpenCL device, test skipped");
+        return;
+    }
+
+    // On devices with a linker, the scripts are compiled on their own and
+    // linked against the noise functions.  The constant keeps the program
+    // out of the binary cache of earlier test runs.
+    cl_bool linker = CL_FALSE;
+    if (clGetDeviceInfo(device(), CL_DEVICE_LINKER_AVAILABLE, sizeof(linker),
+                        &linker, nullptr) != CL_SUCCESS
+        || clLinkProgram == nullptr) {
+        linker = CL_FALSE;
+    }
+    auto now = std::chrono::system_clock::now().time_since_epoch().count();
+    std::string unique{"0." + std::to_string(now % 1000003)};
+
+    generator_context ctx;
+    for (auto& s : {"scale(3):fractal(perlin,3):add(worley(x)):add(",
+                    "scale(2):opensimplex:mul(simplex):add("}) {
+        auto& n = ctx.set_script(s, s + unique + ")");
+        generator_slowinterpreter gl_gen{ctx, n};
+        generator_opencl cl_gen{ctx, opencl_context, device, n};
+        BOOST_CHECK_EQUAL(cl_gen.linked(), linker == CL_TRUE);
+
+        glm::dvec2 corner{-1.5, 2.5}, step{0.13, 0.11};
+        glm::ivec2 count{20, 20};
+        auto expected = gl_gen.run(corner, step, count);
+        auto result = cl_gen.run_float(corner, step, count);
+        for (size_t i = 0; i < expected.size(); ++i)
+            BOOST_CHECK_SMALL(result[i] - expected[i], 1e-2);
     }
 }
+
+BOOST_AUTO_TEST_CASE(test_opencl_buffers)
+{
+    cl::Context opencl_context;
+    cl::Device device;
+    if (!find_opencl(opencl_context, device)) {
+        BOOST_TEST_MESSAGE("no OpenCL device, test skipped");
+        return;
+    }
+
+    generator_context ctx;
+    auto& n = ctx.set_script("test", "scale(3):fractal(perlin,3)");
+    generator_opencl gen{ctx, opencl_context, device, n};
+    glm::dvec2 step{0.1, 0.1};
+
+    // Runs of different sizes take turns using the pooled buffers.
+    std::map<int, std::vector<float>> first;
+    for (int i = 0; i < 3; ++i) {
+        for (int size : {16, 200, 40}) {
+            auto result = gen.run_float(glm::dvec2{1.0, 2.0}, step,
+                                        glm::ivec2{size, size});
+            BOOST_CHECK_EQUAL(result.size(), size_t(size * size));
+            if (i == 0)
+                first[size] = result;
+            else
+                BOOST_CHECK(result == first[size]);
+        }
+    }
+
+    // Mapped views hold the same results, also while several are in use
+    // at once.  A buffer can be used again after its view is released.
+    glm::ivec2 count{64, 48};
+    auto expected = gen.run_float(glm::dvec2{0.0, 0.0}, step, count);
+    auto other = gen.run_float(glm::dvec2{9.0, 9.0}, step, count);
+    for (int i = 0; i < 2; ++i) {
+        auto a = gen.run_float_mapped(glm::dvec2{0.0, 0.0}, step, count);
+        auto b = gen.run_float_mapped(glm::dvec2{9.0, 9.0}, step, count);
+        BOOST_REQUIRE_EQUAL(a.size(), expected.size());
+        BOOST_CHECK(std::equal(a.begin(), a.end(), expected.begin()));
+        BOOST_CHECK(std::equal(b.begin(), b.end(), other.begin()));
+
+        auto moved = std::move(a);
+        BOOST_CHECK_EQUAL(a.size(), 0);
+        BOOST_CHECK(std::equal(moved.begin(), moved.end(), expected.begin()));
+        moved.release();
+        BOOST_CHECK_EQUAL(moved.size(), 0);
+    }
+    if (gen.has_fp64()) {
+        auto view = gen.run_mapped(glm::dvec2{0.0, 0.0}, step, count);
+        auto result = gen.run(glm::dvec2{0.0, 0.0}, step, count);
+        BOOST_CHECK(std::equal(view.begin(), view.end(), result.begin()));
+    } else {
+        BOOST_CHECK_THROW(gen.run_mapped(glm::dvec2{0.0, 0.0}, step, count),
+                          std::runtime_error);
+    }
+
+    // Results written to the caller's memory leave the padding alone.
+    std::vector<float> padded(70 * 48, -7.0f);
+    gen.run_float(glm::dvec2{0.0, 0.0}, step, count, padded.data(),
+                  padded.size(), 70);
+    for (int y = 0; y < count.y; ++y) {
+        for (int x = 0; x < 70; ++x) {
+            BOOST_CHECK_EQUAL(padded[y * 70 + x],
+                              x < count.x ? expected[y * count.x + x] : -7.0f);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_cell_cache)
+{
+    // The cached feature points give exactly the same results, also when
+    // several seeds and cells compete for the same slots.
+    cell_cache cache;
+    for (int i = 0; i < 2000; ++i) {
+        glm::dvec3 p{(i % 37) * 0.31 - 5.0, (i % 23) * 0.27 - 3.0,
+                     (i % 11) * 0.53 - 2.0};
+        uint32_t seed = i % 5;
+        glm::dvec2 xy{p.x, p.y};
+        auto w = p_worley(xy, seed), wc = p_worley(xy, seed, cache);
+        BOOST_CHECK(w.x == wc.x && w.y == wc.y);
+        auto w3 = p_worley3(p, seed), w3c = p_worley3(p, seed, cache);
+        BOOST_CHECK(w3.x == w3c.x && w3.y == w3c.y);
+        auto v = p_voronoi(xy, seed), vc = p_voronoi(xy, seed, cache);
+        BOOST_CHECK(v.x == vc.x && v.y == vc.y && v.z == vc.z);
+    }
+
+    std::vector<std::string> scripts{
+        "worley(x):sub(worley(y))",
+        "scale(0.3):voronoi(x):add(voronoi(y, 3))",
+        "scale(0.5):fractal(worley(y), 4)",
+        "perlin:is_greaterthan(0):then_else(worley(x), voronoi(y, 2))"};
+
+    for (auto& s : scripts) {
+        generator_context ctx;
+        auto& n = ctx.set_script("test", s);
+        generator_slowinterpreter gl_gen{ctx, n};
+        generator_vm vm_gen{ctx, n};
+        generator_native native_gen{ctx, n};
+
+        glm::dvec3 corner{-4.1, 2.3, 0.7}, step{0.05, 0.13, 0.29};
+        glm::ivec3 count{150, 9, 3};
+        auto expected = gl_gen.run(corner, step, count);
+        auto result_vm = vm_gen.run(corner, step, count);
+        auto result_native = native_gen.run(corner, step, count);
+        for (size_t i = 0; i < expected.size(); ++i) {
+            BOOST_CHECK_SMALL(result_vm[i] - expected[i], 1e-9);
+            BOOST_CHECK_SMALL(result_native[i] - expected[i], 1e-9);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_gradient)
+{
+    generator_context ctx;
+
+    // The values are exactly those of run(), and the derivatives agree
+    // with central differences.
+    std::vector<std::string> scripts{
+        "scale(2.5):perlin:mul(3):add(x)",
+        "shift(0.3,-0.7):rotate(0.2):simplex:pow(2)",
+        "scale(3):opensimplex:abs:sqrt:sin",
+        "scale(4):fractal(simplex,4,2.1,0.4)",
+        "scale(3):turbulence(perlin(1):mul(0.4),perlin(2):mul(0.4)):distance",
+        "scale(2):map(x:add(y:mul(0.5)),perlin):angle",
+        "scale(3):worley(x:sub(y)):curve_spline(-1,-1,-0.5,0,0.5,0.4,1,1)",
+    };
+    for (auto& s : scripts) {
+        auto& n = ctx.set_script("test", s);
+        generator_slowinterpreter gen{ctx, n};
+
+        glm::dvec2 corner{-1.37, 2.11}, step{0.173, 0.091};
+        glm::ivec2 count{17, 13};
+        auto value = gen.run(corner, step, count);
+        auto grad = gen.run_with_gradient(corner, step, count);
+        BOOST_REQUIRE_EQUAL(grad.size(), value.size());
+
+        const double h = 1e-6;
+        for (size_t i = 0; i < value.size(); ++i) {
+            BOOST_CHECK_EQUAL(grad[i].x, value[i]);
+
+            glm::dvec2 p{corner + glm::dvec2{i % count.x, i / count.x} * step};
+            auto dx = gen.run(p + glm::dvec2{h, 0}, step, {1, 1})[0]
+                      - gen.run(p - glm::dvec2{h, 0}, step, {1, 1})[0];
+            auto dy = gen.run(p + glm::dvec2{0, h}, step, {1, 1})[0]
+                      - gen.run(p - glm::dvec2{0, h}, step, {1, 1})[0];
+            BOOST_CHECK_SMALL(grad[i].y - dx / (2 * h), 1e-4);
+            BOOST_CHECK_SMALL(grad[i].z - dy / (2 * h), 1e-4);
+        }
+    }
+
+    std::vector<std::string> scripts3{
+        "scale3(2.5):perlin3:add(z)",
+        "rotate3(1,2,3,0.3):shift3(0.1,0.2,0.3):simplex3:mul(x)",
+        "scale3(3):fractal3(opensimplex3,3,2,0.5)",
+    };
+    for (auto& s : scripts3) {
+        auto& n = ctx.set_script("test", s);
+        generator_slowinterpreter gen{ctx, n};
+
+        glm::dvec3 corner{-1.37, 2.11, 0.45}, step{0.173, 0.091, 0.29};
+        glm::ivec3 count{7, 5, 3};
+        auto value = gen.run(corner, step, count);
+        auto grad = gen.run_with_gradient(corner, step, count);
+        BOOST_REQUIRE_EQUAL(grad.size(), value.size());
+
+        const double h = 1e-6;
+        for (size_t i = 0; i < value.size(); ++i) {
+            BOOST_CHECK_EQUAL(grad[i].x, value[i]);
+
+            glm::dvec3 p{corner
+                         + glm::dvec3{i % 7, (i / 7) % 5, i / 35} * step};
+            for (int a = 0; a < 3; ++a) {
+                glm::dvec3 d{0.0};
+                d[a] = h;
+                auto diff = gen.run(p + d, step, {1, 1, 1})[0]
+                            - gen.run(p - d, step, {1, 1, 1})[0];
+                BOOST_CHECK_SMALL(grad[i][a + 1] - diff / (2 * h), 1e-4);
+            }
+        }
+    }
+
+    // The VM has no dual numbers; it hands the run to the interpreter.
+    auto& n = ctx.set_script("vm", scripts[0]);
+    generator_slowinterpreter gen{ctx, n};
+    generator_vm vm_gen{ctx, n};
+    glm::dvec3 corner{-1.37, 2.11, 0.45}, step{0.173, 0.091, 0.29};
+    BOOST_CHECK(vm_gen.run_with_gradient(glm::dvec2{corner},
+                                         glm::dvec2{step}, {5, 4})
+                == gen.run_with_gradient(glm::dvec2{corner},
+                                         glm::dvec2{step}, {5, 4}));
+    BOOST_CHECK(vm_gen.run_with_gradient(corner, step, {5, 4, 3})
+                == gen.run_with_gradient(corner, step, {5, 4, 3}));
+}
+
+BOOST_AUTO_TEST_CASE(test_octave_limits)
+{
+    generator_context ctx;
+    auto make_vm = [&](const node& n) {
+        return std::unique_ptr<generator_i>(new generator_vm{ctx, n});
+    };
+    const double inf = std::numeric_limits<double>::infinity();
+
+    auto& n = ctx.set_script("test", "scale(10):fractal(perlin,8,2,0.5)");
+    generator_vm full{ctx, n};
+    generator_lod lod{ctx, n, make_vm, false};
+    generator_lod faded{ctx, n, make_vm};
+
+    // With a fine step, nothing changes.
+    glm::dvec2 corner{-3.1, 7.7};
+    glm::ivec2 count{19, 11};
+    BOOST_CHECK(lod.limits({0.01, 0.01, 0.0}, 0.0)
+                == std::vector<double>{inf});
+    auto expect = full.run(corner, {0.01, 0.01}, count);
+    auto result = lod.run(corner, {0.01, 0.01}, count);
+    BOOST_CHECK(result == expect);
+
+    // Samples 4 apart are 0.4 lattice cells apart in the first octave,
+    // and 0.8 in the second.  The fade starts at 0.25.
+    BOOST_CHECK(lod.limits({4.0, 4.0, 0.0}, 0.0)
+                == std::vector<double>{1.0});
+    BOOST_CHECK(faded.limits({4.0, 4.0, 0.0}, 0.0)
+                == std::vector<double>{0.375});
+    BOOST_CHECK(lod.limits({0.0, 4.0, 0.0}, 0.0)
+                == std::vector<double>{1.0});
+
+    auto& first = ctx.set_script("first", "scale(10):fractal(perlin,1)");
+    generator_vm one{ctx, first};
+    expect = one.run(corner, {4, 4}, count);
+    result = lod.run(corner, {4, 4}, count);
+    BOOST_REQUIRE_EQUAL(result.size(), expect.size());
+    for (size_t i = 0; i < result.size(); ++i)
+        BOOST_CHECK_CLOSE_FRACTION(result[i], expect[i] / 1.9921875, 1e-12);
+
+    // The partial octave is scaled by its weight.
+    result = faded.run(corner, {4, 4}, count);
+    for (size_t i = 0; i < result.size(); ++i)
+        BOOST_CHECK_SMALL(result[i] - expect[i] * 0.375 / 1.9921875, 1e-12);
+
+    // The interpreter only keeps a reference to its script.
+    auto make_slow = [&](const node& n) {
+        return std::unique_ptr<generator_i>(
+            new generator_slowinterpreter{ctx, n});
+    };
+    generator_lod slow_lod{ctx, n, make_slow, false};
+    generator_slowinterpreter slow_one{ctx, first};
+    auto grad_expect = slow_one.run_with_gradient(corner, {4, 4}, count);
+    auto grad_result = slow_lod.run_with_gradient(corner, {4, 4}, count);
+    BOOST_REQUIRE_EQUAL(grad_result.size(), grad_expect.size());
+    for (size_t i = 0; i < grad_result.size(); ++i) {
+        for (int j = 0; j < 3; ++j)
+            BOOST_CHECK_SMALL(grad_result[i][j]
+                                  - grad_expect[i][j] / 1.9921875,
+                              1e-12);
+    }
+
+    // Runs that already have their generator don't wait for another one
+    // to be built.
+    std::promise<void> go;
+    auto gate = go.get_future().share();
+    std::atomic<int> builds{0};
+    auto make_gated = [&](const node& n) -> std::unique_ptr<generator_i> {
+        if (builds++ > 0)
+            gate.wait();
+        return make_vm(n);
+    };
+    generator_lod gated{ctx, n, make_gated, false};
+    auto fine = gated.run(corner, {0.01, 0.01}, count);
+    auto coarse = std::async(std::launch::async,
+                             [&] { return gated.run(corner, {4, 4}, count); });
+    while (builds < 2)
+        std::this_thread::yield();
+    BOOST_CHECK(gated.run(corner, {0.01, 0.01}, count) == fine);
+    go.set_value();
+    BOOST_CHECK(coarse.get() == lod.run(corner, {4, 4}, count));
+
+    // If building a generator fails, the next run tries again.
+    int attempts = 0;
+    auto make_flaky = [&](const node& n) -> std::unique_ptr<generator_i> {
+        if (attempts++ == 0)
+            throw std::runtime_error("cannot build");
+        return make_vm(n);
+    };
+    generator_lod flaky{ctx, n, make_flaky, false};
+    BOOST_CHECK_THROW(flaky.run(corner, {0.01, 0.01}, count),
+                      std::runtime_error);
+    BOOST_CHECK(flaky.run(corner, {0.01, 0.01}, count) == fine);
+
+    // Points are always done in full.
+    std::vector<glm::dvec2> points{{0.1, 0.2}, {3.3, -4.4}, {100, 2000}};
+    std::vector<double> a(points.size()), b(points.size());
+    full.run(points.data(), points.size(), a.data());
+    lod.run(points.data(), points.size(), b.data());
+    BOOST_CHECK(a == b);
+
+    // The last octave can change the result by 100 * 1.23 / 256 at most,
+    // so it is dropped from 16-bit output, and the results stay within
+    // one unit.
+    auto& big = ctx.set_script("big", "scale(10):fractal(perlin,8):mul(100)");
+    generator_vm big_full{ctx, big};
+    generator_lod big_lod{ctx, big, make_vm};
+    BOOST_CHECK(big_lod.limits({0.01, 0.01, 0.0}, 0.5)
+                == std::vector<double>{7.0});
+    auto q_expect = big_full.run_int16(corner, {0.01, 0.01}, count);
+    auto q_result = big_lod.run_int16(corner, {0.01, 0.01}, count);
+    BOOST_REQUIRE_EQUAL(q_result.size(), q_expect.size());
+    for (size_t i = 0; i < q_result.size(); ++i)
+        BOOST_CHECK_LE(std::abs(q_result[i] - q_expect[i]), 1);
+
+    // Unknown distortions keep every octave.
+    auto& warped = ctx.set_script(
+        "warped", "scale(10):turbulence(perlin,perlin):fractal(perlin,8)");
+    generator_lod warped_lod{ctx, warped, make_vm};
+    BOOST_CHECK(warped_lod.limits({4.0, 4.0, 0.0}, 0.0)
+                == std::vector<double>{inf});
+
+    // In 3-D, a single slice is not sampled along z.
+    auto& n3 = ctx.set_script("test3",
+                              "scale3(10):fractal3(simplex3,6,2,0.5)");
+    generator_vm full3{ctx, n3};
+    generator_lod lod3{ctx, n3, make_vm};
+    glm::dvec3 corner3{1.5, -2.5, 3.5};
+    auto expect3 = full3.run(corner3, {0.05, 0.05, 100.0}, {9, 9, 1});
+    auto result3 = lod3.run(corner3, {0.05, 0.05, 100.0}, {9, 9, 1});
+    BOOST_CHECK(result3 == expect3);
+
+    auto range = full3.bounds(corner3, {4.0, 4.0, 4.0}, {9, 9, 9});
+    result3 = lod3.run(corner3, {4.0, 4.0, 4.0}, {9, 9, 9});
+    for (auto v : result3)
+        BOOST_CHECK(range.contains(v));
+}
+
+BOOST_AUTO_TEST_CASE(test_fold_constants)
+{
+    // Constant conditions and the values in the branch that is taken
+    // collapse into a single constant.
+    generator_context ctx;
+    auto& n = ctx.set_script(
+        "test", "0:is_lte(1):xor(0:is_gte(1)):then_else(2:mul(3):add(1), x)");
+    BOOST_CHECK(n.type == node::const_var);
+    BOOST_CHECK_EQUAL(n.aux_var, 7.0);
+
+    auto& m = ctx.set_script("other", "x:is_lte(2:mul(3))");
+    BOOST_CHECK(m.input[1].type == node::const_var);
+    BOOST_CHECK_EQUAL(m.input[1].aux_var, 6.0);
+}
+
+BOOST_AUTO_TEST_CASE(test_tile_cache)
+{
+    generator_context ctx;
+    ctx.set_tile_cache(1 << 20);
+    auto& tiles = *ctx.tiles();
+
+    // Folding the constants of a script does not go through the cache.
+    ctx.set_script("folded", "add(2:mul(3))");
+    BOOST_CHECK_EQUAL(tiles.misses(), 0);
+    BOOST_CHECK_EQUAL(tiles.size(), 0);
+
+    auto& n = ctx.set_script("test", "scale(3):fractal(perlin,3):mul(2)");
+    generator_vm gen{ctx, n};
+
+    glm::dvec2 corner{-2.5, 1.25}, step{0.1, 0.1};
+    glm::ivec2 count{16, 16};
+    auto first = gen.run(corner, step, count);
+    auto second = gen.run(corner, step, count);
+    BOOST_CHECK(first == second);
+    BOOST_CHECK_EQUAL(tiles.misses(), 1);
+    BOOST_CHECK_EQUAL(tiles.hits(), 1);
+
+    // Other generators of the same type share the tiles.
+    generator_vm other{ctx, n};
+    std::vector<double> padded(20 * 16, -7.0);
+    other.run(corner, step, count, padded.data(), padded.size(), 20);
+    BOOST_CHECK_EQUAL(tiles.hits(), 2);
+    for (int y = 0; y < 16; ++y) {
+        for (int x = 0; x < 20; ++x) {
+            BOOST_CHECK_EQUAL(padded[y * 20 + x],
+                              x < 16 ? first[y * 16 + x] : -7.0);
+        }
+    }
+
+    // The output format, the region, and the generator type are all part
+    // of the key.
+    auto q = gen.run_int16(corner, step, count);
+    gen.run(corner, step, glm::ivec2{16, 15});
+    gen.run(glm::dvec3{corner, 0.0}, glm::dvec3{step, 0.1},
+            glm::ivec3{count, 1});
+    generator_slowinterpreter slow{ctx, n};
+    slow.run(corner, step, count);
+    BOOST_CHECK_EQUAL(tiles.hits(), 2);
+    BOOST_CHECK_EQUAL(tiles.misses(), 5);
+    BOOST_CHECK(gen.run_int16(corner, step, count) == q);
+    BOOST_CHECK_EQUAL(tiles.hits(), 3);
+
+    // Generators made before the cache was turned on don't use it.
+    generator_context plain;
+    auto& m = plain.set_script("test", "perlin");
+    generator_vm early{plain, m};
+    plain.set_tile_cache(1 << 20);
+    early.run(corner, step, count);
+    BOOST_CHECK_EQUAL(plain.tiles()->misses(), 0);
+
+    // The least recently used tiles are thrown out first.  There is room
+    // for two tiles, and their keys.
+    generator_context small;
+    small.set_tile_cache(2 * 16 * 16 * sizeof(double) + 2000);
+    auto& s = small.set_script("test", "perlin");
+    generator_vm small_gen{small, s};
+    for (int i : {0, 1, 0, 2, 0, 1}) {
+        small_gen.run(glm::dvec2{i * 10.0, 0.0}, step, count);
+        BOOST_CHECK_LE(small.tiles()->size(), small.tiles()->budget());
+    }
+    BOOST_CHECK_EQUAL(small.tiles()->hits(), 2);
+    BOOST_CHECK_EQUAL(small.tiles()->misses(), 4);
+
+    // Concurrent readers get the same results.
+    std::vector<std::vector<double>> results(8);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i)
+        threads.emplace_back([&, i] {
+            results[i] = gen.run(glm::dvec2{(i % 2) * 100.0, 0.0}, step,
+                                 count);
+        });
+    for (auto& t : threads)
+        t.join();
+    for (int i = 0; i < 8; ++i)
+        BOOST_CHECK(results[i] == results[i % 2]);
+}
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE(test_tile_store)
+{
+    std::string file{"test_tile_store.tiles"};
+    std::remove(file.c_str());
+
+    // Scripts are identified by a 128-bit FNV-1a hash.
+    auto digest = fnv1a_128("a");
+    BOOST_CHECK_EQUAL(digest.hi, 0xd228cb696f1a8cafull);
+    BOOST_CHECK_EQUAL(digest.lo, 0x78912b704e4a8964ull);
+
+    std::vector<double> a(100, 1.5), b(50, -2.0);
+    {
+        tile_store store{file, 1 << 20};
+        store.insert("a", a.data(), a.size() * sizeof(double));
+        store.insert("b", b.data(), b.size() * sizeof(double));
+        auto found = store.find("a");
+        BOOST_REQUIRE(found);
+        BOOST_CHECK_EQUAL(found.size(), a.size() * sizeof(double));
+        BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(found.data()) % 8, 0);
+        BOOST_CHECK(!store.find("c"));
+        BOOST_CHECK_EQUAL(store.hits(), 1);
+        BOOST_CHECK_EQUAL(store.misses(), 1);
+
+        // The store is locked while it is open.
+        BOOST_CHECK_THROW(tile_store(file, 1 << 20), std::runtime_error);
+    }
+
+    // The tiles survive a restart, even with junk from an unfinished
+    // write at the end.
+    {
+        std::ofstream junk{file, std::ios::binary | std::ios::app};
+        junk << std::string(100, 'x');
+    }
+    {
+        tile_store store{file, 1 << 20};
+        BOOST_CHECK_EQUAL(store.count(), 2);
+        auto found = store.find("b");
+        BOOST_REQUIRE(found);
+        auto p = static_cast<const double*>(found.data());
+        BOOST_CHECK(std::vector<double>(p, p + b.size()) == b);
+
+        // Storing a tile again replaces it; compaction drops the old copy.
+        store.insert("b", a.data(), a.size() * sizeof(double));
+        auto size = store.size();
+        store.compact();
+        BOOST_CHECK_LT(store.size(), size);
+        BOOST_CHECK_EQUAL(store.count(), 2);
+        BOOST_CHECK_EQUAL(store.find("b").size(), a.size() * sizeof(double));
+
+        // Views stay valid after compaction.
+        BOOST_CHECK_EQUAL(p[0], b[0]);
+    }
+
+    // The file does not grow beyond its budget; the least recently used
+    // tiles are thrown out.
+    {
+        tile_store store{file, 4000};
+        for (int i = 0; i < 20; ++i) {
+            store.insert(std::to_string(i), a.data(),
+                         a.size() * sizeof(double));
+            BOOST_CHECK_LE(store.size(), store.budget());
+        }
+        BOOST_CHECK(store.find("19"));
+        BOOST_CHECK(!store.find("0"));
+    }
+
+    // Generators read tiles from the store of an earlier context.
+    std::vector<double> first;
+    {
+        generator_context ctx;
+        ctx.set_tile_store(file, 1 << 20);
+        auto& n = ctx.set_script("test", "scale(3):fractal(perlin,3)");
+        generator_vm gen{ctx, n};
+        first = gen.run(glm::dvec2{1.0, 2.0}, glm::dvec2{0.1, 0.1},
+                        glm::ivec2{16, 16});
+        BOOST_CHECK_EQUAL(ctx.store()->misses(), 1);
+    }
+    {
+        generator_context ctx;
+        ctx.set_tile_store(file, 1 << 20);
+        ctx.set_tile_cache(1 << 20);
+        auto& n = ctx.set_script("test", "scale(3):fractal(perlin,3)");
+        generator_vm gen{ctx, n};
+        std::vector<double> padded(20 * 16, -7.0);
+        gen.run(glm::dvec2{1.0, 2.0}, glm::dvec2{0.1, 0.1},
+                glm::ivec2{16, 16}, padded.data(), padded.size(), 20);
+        BOOST_CHECK_EQUAL(ctx.store()->hits(), 1);
+        for (int y = 0; y < 16; ++y) {
+            for (int x = 0; x < 20; ++x) {
+                BOOST_CHECK_EQUAL(padded[y * 20 + x],
+                                  x < 16 ? first[y * 16 + x] : -7.0);
+            }
+        }
+
+        // The tile was also put in the tile cache.
+        gen.run(glm::dvec2{1.0, 2.0}, glm::dvec2{0.1, 0.1},
+                glm::ivec2{16, 16});
+        BOOST_CHECK_EQUAL(ctx.tiles()->hits(), 1);
+        BOOST_CHECK_EQUAL(ctx.store()->hits(), 1);
+    }
+
+    // Folding constants does not write to the store, and the size of a
+    // record does not depend on the size of the script.
+    std::remove(file.c_str());
+    {
+        generator_context ctx;
+        ctx.set_tile_store(file, 1 << 20);
+        auto& store = *ctx.store();
+        auto& small = ctx.set_script("small", "scale(2:mul(3)):perlin");
+        BOOST_CHECK_EQUAL(store.count(), 0);
+        BOOST_CHECK_EQUAL(store.misses(), 0);
+
+        std::string script{"scale(6):perlin"};
+        for (int i = 0; i < 100; ++i)
+            script += ":add(x:mul(0.5))";
+        auto& large = ctx.set_script("large", script);
+
+        auto empty = store.size();
+        generator_vm small_gen{ctx, small};
+        small_gen.run(glm::dvec2{1.0, 2.0}, glm::dvec2{0.1, 0.1},
+                      glm::ivec2{16, 16});
+        auto one = store.size();
+        generator_vm large_gen{ctx, large};
+        large_gen.run(glm::dvec2{1.0, 2.0}, glm::dvec2{0.1, 0.1},
+                      glm::ivec2{16, 16});
+        BOOST_CHECK_EQUAL(store.count(), 2);
+        BOOST_CHECK_EQUAL(store.size() - one, one - empty);
+    }
+
+    // Generators that were made before an image was replaced stop using
+    // the store, because their tiles are filed under the old image.
+    std::remove(file.c_str());
+    {
+        auto make_image = [](uint8_t value) {
+            generator_context::image img;
+            img.width = img.height = 2;
+            img.bitdepth = 8;
+            img.buffer.assign(4, value);
+            return img;
+        };
+        generator_context ctx;
+        ctx.set_tile_store(file, 1 << 20);
+        auto& store = *ctx.store();
+        ctx.set_image("img", make_image(0));
+        auto& n = ctx.set_script("test", "png_lookup(\"img\")");
+        generator_slowinterpreter old_gen{ctx, n};
+        auto before = old_gen.run(glm::dvec2{0.0, 0.0}, glm::dvec2{0.1, 0.1},
+                                  glm::ivec2{4, 4});
+        BOOST_CHECK_EQUAL(store.count(), 1);
+
+        ctx.set_image("img", make_image(255));
+        auto after = old_gen.run(glm::dvec2{0.0, 0.0}, glm::dvec2{0.1, 0.1},
+                                 glm::ivec2{4, 4});
+        BOOST_CHECK_EQUAL(store.count(), 1);
+        BOOST_CHECK_EQUAL(store.hits(), 0);
+        BOOST_CHECK_EQUAL(after[0], 1.0);
+        BOOST_CHECK(before != after);
+
+        generator_slowinterpreter new_gen{ctx, n};
+        BOOST_CHECK(new_gen.run(glm::dvec2{0.0, 0.0}, glm::dvec2{0.1, 0.1},
+                                glm::ivec2{4, 4})
+                    == after);
+        BOOST_CHECK_EQUAL(store.count(), 2);
+    }
+    std::remove(file.c_str());
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(test_hybrid)
+{
+    generator_context ctx;
+    auto& n = ctx.set_script("test", "scale(3):fractal(perlin,3)");
+    auto& other = ctx.set_script("other", "2");
+
+    // The build waits for a signal, so the switch can be observed.  The
+    // fallback runs another script, to tell the two apart.
+    std::promise<void> go;
+    std::shared_future<void> signal{go.get_future()};
+    generator_hybrid gen{ctx, n,
+                         std::unique_ptr<generator_i>{
+                             new generator_vm{ctx, other}},
+                         [&] {
+                             signal.wait();
+                             return std::unique_ptr<generator_i>{
+                                 new generator_vm{ctx, n}};
+                         }};
+
+    glm::dvec2 corner{1.0, 2.0}, step{0.1, 0.1};
+    glm::ivec2 count{8, 8};
+    BOOST_CHECK(!gen.ready());
+    BOOST_CHECK(gen.run(corner, step, count)
+                == std::vector<double>(64, 2.0));
+
+    go.set_value();
+    gen.wait();
+    BOOST_CHECK(gen.ready());
+    BOOST_CHECK(!gen.failed());
+    BOOST_CHECK(gen.error().empty());
+    BOOST_CHECK(gen.run(corner, step, count)
+                == generator_vm(ctx, n).run(corner, step, count));
+    BOOST_CHECK(gen.run_int16(corner, step, count)
+                == generator_vm(ctx, n).run_int16(corner, step, count));
+
+    // A failed build keeps the fallback, and the reason.
+    generator_hybrid broken{ctx, n,
+                            std::unique_ptr<generator_i>{
+                                new generator_vm{ctx, n}},
+                            []() -> std::unique_ptr<generator_i> {
+                                throw std::runtime_error("no device");
+                            }};
+    broken.wait();
+    BOOST_CHECK(broken.failed());
+    BOOST_CHECK_EQUAL(broken.error(), "no device");
+    BOOST_CHECK(broken.run(corner, step, count)
+                == generator_vm(ctx, n).run(corner, step, count));
+}
+
+BOOST_AUTO_TEST_CASE(test_run_async)
+{
+    generator_context ctx;
+    ctx.set_threads(2);
+    auto& n = ctx.set_script("test", "scale(3):fractal(perlin,3)");
+    auto& n3 = ctx.set_script("test3", "scale3(3):fractal3(perlin3,3)");
+    generator_vm gen{ctx, n}, gen3{ctx, n3};
+
+    // Several chunks in flight at once, picked up in order.
+    glm::dvec2 step{0.1, 0.1};
+    glm::ivec2 count{16, 16};
+    std::deque<std::future<std::vector<double>>> in_flight;
+    for (int i = 0; i < 6; ++i)
+        in_flight.push_back(gen.run_async(glm::dvec2{i * 1.6, 0.0}, step,
+                                          count));
+    for (int i = 0; i < 6; ++i) {
+        BOOST_CHECK(in_flight[i].get()
+                    == gen.run(glm::dvec2{i * 1.6, 0.0}, step, count));
+    }
+
+    glm::dvec3 corner3{1.0, 2.0, 3.0}, step3{0.2, 0.2, 0.2};
+    glm::ivec3 count3{6, 5, 4};
+    BOOST_CHECK(gen3.run_async(corner3, step3, count3).get()
+                == gen3.run(corner3, step3, count3));
+    BOOST_CHECK(gen.run_float_async(glm::dvec2{1.0, 2.0}, step, count).get()
+                == gen.run_float(glm::dvec2{1.0, 2.0}, step, count));
+    BOOST_CHECK(gen3.run_float_async(corner3, step3, count3).get()
+                == gen3.run_float(corner3, step3, count3));
+    BOOST_CHECK(gen.run_async(glm::dvec2{0.0, 0.0}, step, glm::ivec2{0, 4})
+                    .get()
+                    .empty());
+}
@@ -327,26 +327,17 @@ int main(int argc, char** argv)
                 gen->run(corner, step, pixel_size);
         }
         
-        std::vector<uint8_t> pixmap;
-        pixmap.resize(width * height);
-        
-        if (vm.count("direct")) {
-            auto result = gen->run_int16(corner, step, pixel_size);
-            
-            std::transform(result.begin(), result.end(), pixmap.begin(),
-                           [](int16_t i) {
-                return static_cast<uint8_t>(
-                    127 + std::min<int16_t>(128, std::max<int16_t>(-127, i)));
-            });
-        } else {
-            auto result = gen->run(corner, step, pixel_size);
-            
-            std::transform(result.begin(), result.end(), pixmap.begin(),
-                           [](double i) {
-                return static_cast<uint8_t>(
-                    127.0 + 127.0 * std::min(1.0, std::max(-1.0, i)));
-            });
-        }       
+        // Map [-1, 1] to [0, 254], or in direct mode, the integer part of
+        // the result to [0, 255] with 0 at 127.
+        quantizer q{quantized::uint8, 127.0, 127.0};
+        if (vm.count("direct"))
+            q.scale = 1.0;
+        else
+            q.high = 254.0;
+
+        std::vector<uint8_t> pixmap(width * height);
+        gen->run_quantized(corner, step, pixel_size, q, &pixmap[0],
+                           pixmap.size(), width);
         write_png_file(pixmap, width, height, vm["output"].as<std::string>(), script);
     } catch (cl::Error& e) {
         std::cerr << "Error in " << e.what() << ", code " << e.err()
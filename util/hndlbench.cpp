@@ -0,0 +1,416 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/util/hndlbench.cpp
+/// \brief  Compares the speed of the CPU backends on a list of HNDL
+///         scripts
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/program_options.hpp>
+
+#include <hexanoise/analysis.hpp>
+#include <hexanoise/generator_context.hpp>
+#include <hexanoise/generator_native.hpp>
+#include <hexanoise/generator_slowinterpreter.hpp>
+#include <hexanoise/generator_vm.hpp>
+#include <hexanoise/primitives.hpp>
+#include <hexanoise/simple_global_variables.hpp>
+#include <hexanoise/version.hpp>
+
+namespace po = boost::program_options;
+using namespace hexa::noise;
+
+// Read the scripts from a file in the same format as unit_tests/tests:
+// a script on a single line, followed by pairs of lines with test input
+// and output, and terminated by an empty line.
+std::vector<std::string> read_scripts(std::istream& in)
+{
+    std::vector<std::string> result;
+    std::string line;
+    bool in_block = false;
+    while (std::getline(in, line)) {
+        boost::algorithm::trim(line);
+        if (line.empty()) {
+            in_block = false;
+            continue;
+        }
+        if (line[0] == '#' || in_block)
+            continue;
+
+        result.push_back(line);
+        in_block = true;
+    }
+    return result;
+}
+
+struct timing
+{
+    double ms;
+    std::vector<double> result;
+};
+
+timing measure(generator_i& gen, bool is_3d, int size, unsigned int repeat)
+{
+    timing t;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < repeat; ++i) {
+        if (is_3d) {
+            t.result = gen.run(glm::dvec3{-0.5 * size, -0.5 * size, 0.0},
+                               glm::dvec3{0.93, 0.93, 0.93},
+                               glm::ivec3{size, size, size});
+        } else {
+            t.result = gen.run(glm::dvec2{-0.5 * size, -0.5 * size},
+                               glm::dvec2{0.93, 0.93},
+                               glm::ivec2{size, size});
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    t.ms = std::chrono::duration<double, std::milli>(end - start).count()
+           / repeat;
+    return t;
+}
+
+// Stands in for whatever a program does with a chunk once it has it.
+double post_process(const std::vector<double>& chunk)
+{
+    double lo = std::numeric_limits<double>::max(), hi = -lo, sum = 0.0;
+    for (double v : chunk) {
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+        sum += v;
+    }
+    return sum + lo + hi;
+}
+
+std::vector<double> run_chunk(const generator_i& gen, bool is_3d, int size,
+                              int i)
+{
+    double x = (i - 0.5) * size * 0.93;
+    if (is_3d) {
+        return gen.run(glm::dvec3{x, -0.5 * size, 0.0},
+                       glm::dvec3{0.93, 0.93, 0.93},
+                       glm::ivec3{size, size, size});
+    }
+    return gen.run(glm::dvec2{x, -0.5 * size}, glm::dvec2{0.93, 0.93},
+                   glm::ivec2{size, size});
+}
+
+std::future<std::vector<double>> start_chunk(const generator_i& gen,
+                                             bool is_3d, int size, int i)
+{
+    double x = (i - 0.5) * size * 0.93;
+    if (is_3d) {
+        return gen.run_async(glm::dvec3{x, -0.5 * size, 0.0},
+                             glm::dvec3{0.93, 0.93, 0.93},
+                             glm::ivec3{size, size, size});
+    }
+    return gen.run_async(glm::dvec2{x, -0.5 * size}, glm::dvec2{0.93, 0.93},
+                         glm::ivec2{size, size});
+}
+
+struct stream_timing
+{
+    double ms;
+    double checksum;
+};
+
+// Generate a row of chunks, and post-process every one of them.  With a
+// depth of 0, every chunk is generated with the blocking run(); otherwise
+// up to 'depth' chunks are in flight at once.
+stream_timing stream(const generator_i& gen, bool is_3d, int size,
+                     int chunks, unsigned int depth)
+{
+    stream_timing t{0.0, 0.0};
+    auto start = std::chrono::steady_clock::now();
+    if (depth == 0) {
+        for (int i = 0; i < chunks; ++i)
+            t.checksum += post_process(run_chunk(gen, is_3d, size, i));
+    } else {
+        std::deque<std::future<std::vector<double>>> in_flight;
+        for (int i = 0; i < chunks; ++i) {
+            in_flight.push_back(start_chunk(gen, is_3d, size, i));
+            if (in_flight.size() >= depth) {
+                t.checksum += post_process(in_flight.front().get());
+                in_flight.pop_front();
+            }
+        }
+        for (auto& f : in_flight)
+            t.checksum += post_process(f.get());
+    }
+    auto end = std::chrono::steady_clock::now();
+    t.ms = std::chrono::duration<double, std::milli>(end - start).count()
+           / std::max(chunks, 1);
+    return t;
+}
+
+double max_difference(const std::vector<double>& a,
+                      const std::vector<double>& b)
+{
+    double result = 0.0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (std::isnan(a[i]) && std::isnan(b[i]))
+            continue;
+
+        result = std::max(result, std::abs(a[i] - b[i]));
+    }
+    return result;
+}
+
+// Example use:
+//
+// $ hndlbench -i ../unit_tests/tests --size 512
+// $ hndlbench -i ../unit_tests/tests --scaling 64
+// $ hndlbench -i ../unit_tests/tests --stream 64 --depth 4
+//
+int main(int argc, char** argv)
+{
+    try {
+        po::variables_map vm;
+        po::options_description options;
+        options.add_options()("version,v", "print version string")(
+            "help", "show help message")
+
+            ("input,i", po::value<std::string>()->default_value("tests"),
+             "file with test scripts, in the same format as "
+             "unit_tests/tests")
+
+            ("size,s", po::value<int>()->default_value(256),
+             "number of samples along every axis for 2-D scripts")
+
+            ("size3", po::value<int>()->default_value(40),
+             "number of samples along every axis for 3-D scripts")
+
+            ("repeat,r", po::value<unsigned int>()->default_value(3),
+             "run every script n times and take the average")
+
+            ("threads,t", po::value<unsigned int>()->default_value(1),
+             "number of threads per run, 0 for one per hardware thread")
+
+            ("native,n", "also compile the scripts to native code")
+
+            ("seed-tables", "give every constant seed a permutation table")
+
+            ("scaling", po::value<unsigned int>()->default_value(0),
+             "also time all scripts at 1, 2, 4, ... up to n threads")
+
+            ("stream", po::value<int>()->default_value(0),
+             "also generate a row of n chunks with the bytecode VM, once "
+             "with run() and once with run_async(); this only gains "
+             "anything with more than one hardware thread")
+
+            ("depth", po::value<unsigned int>()->default_value(4),
+             "number of chunks in flight with run_async()")
+
+            ;
+
+        po::store(po::parse_command_line(argc, argv, options), vm);
+        po::notify(vm);
+
+        if (vm.count("help")) {
+            std::cout << options << std::endl;
+            return EXIT_SUCCESS;
+        }
+        if (vm.count("version")) {
+            std::cout << "hndlbench " << NOISE_VERSION << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        std::string file(vm["input"].as<std::string>());
+        std::ifstream str(file);
+        if (!str) {
+            std::cerr << "Cannot open file " << file << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        auto scripts = read_scripts(str);
+        auto size = vm["size"].as<int>();
+        auto size3 = vm["size3"].as<int>();
+        auto repeat = std::max(1u, vm["repeat"].as<unsigned int>());
+        auto threads = vm["threads"].as<unsigned int>();
+        bool native = vm.count("native") > 0;
+        bool seed_tables = vm.count("seed-tables") > 0;
+        auto max_threads = vm["scaling"].as<unsigned int>();
+        auto chunks = vm["stream"].as<int>();
+        auto depth = std::max(1u, vm["depth"].as<unsigned int>());
+
+        std::cout << "instruction set: " << simd_instruction_set()
+                  << "\nthreads: " << threads << "\n" << std::endl;
+
+        std::cout << std::left << std::setw(44) << "script" << std::right
+                  << std::setw(8) << "dedup" << std::setw(12) << "interp ms"
+                  << std::setw(12) << "vm ms"
+                  << std::setw(10) << "speedup" << std::setw(12) << "max diff";
+        if (native) {
+            std::cout << std::setw(12) << "native ms" << std::setw(10)
+                      << "speedup" << std::setw(12) << "max diff";
+        }
+        std::cout << std::endl;
+
+        double total_interp = 0.0, total_vm = 0.0, total_native = 0.0;
+        for (auto& script : scripts) {
+            simple_global_variables gv;
+            gv["one"] = 1.0;
+            gv["two"] = 2.0;
+
+            generator_context ctx{gv};
+            ctx.set_threads(threads);
+            ctx.set_seed_tables(seed_tables);
+            auto& n = ctx.set_script("bench", script);
+            bool is_3d = n.input_type() == var_t::xyz;
+            int samples = is_3d ? size3 : size;
+
+            generator_slowinterpreter interp{ctx, n};
+            generator_vm bytecode_vm{ctx, n};
+
+            auto t1 = measure(interp, is_3d, samples, repeat);
+            auto t2 = measure(bytecode_vm, is_3d, samples, repeat);
+            total_interp += t1.ms;
+            total_vm += t2.ms;
+
+            // The number of functions that only need to be evaluated once,
+            // because the same value is computed elsewhere in the script.
+            subexpressions shared{n};
+
+            std::cout << std::left << std::setw(44) << script.substr(0, 43)
+                      << std::right << std::setw(8) << shared.duplicates()
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(12) << t1.ms << std::setw(12) << t2.ms
+                      << std::setw(9) << t1.ms / t2.ms << "x"
+                      << std::scientific << std::setprecision(1)
+                      << std::setw(12) << max_difference(t1.result, t2.result);
+
+            if (native) {
+                generator_native native_gen{ctx, n};
+                auto t3 = measure(native_gen, is_3d, samples, repeat);
+                total_native += t3.ms;
+                std::cout << std::fixed << std::setprecision(2)
+                          << std::setw(12) << t3.ms << std::setw(9)
+                          << t1.ms / t3.ms << "x" << std::scientific
+                          << std::setprecision(1) << std::setw(12)
+                          << max_difference(t1.result, t3.result);
+            }
+            std::cout << std::endl;
+        }
+
+        std::cout << std::left << std::setw(52) << "total" << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(12)
+                  << total_interp << std::setw(12) << total_vm
+                  << std::setw(9) << total_interp / total_vm << "x";
+        if (native) {
+            std::cout << std::setw(12) << " " << std::setw(12) << total_native
+                      << std::setw(9) << total_interp / total_native << "x";
+        }
+        std::cout << std::endl;
+
+        if (max_threads > 0) {
+            std::cout << "\nscaling, " << std::thread::hardware_concurrency()
+                      << " hardware threads\n" << std::endl;
+            std::cout << std::setw(8) << "threads" << std::setw(12)
+                      << "interp ms" << std::setw(10) << "speedup"
+                      << std::setw(12) << "vm ms" << std::setw(10)
+                      << "speedup" << std::endl;
+        }
+
+        double base_interp = 0.0, base_vm = 0.0;
+        for (unsigned int t = 1; t <= max_threads; t *= 2) {
+            double sum_interp = 0.0, sum_vm = 0.0;
+            for (auto& script : scripts) {
+                simple_global_variables gv;
+                gv["one"] = 1.0;
+                gv["two"] = 2.0;
+
+                generator_context ctx{gv};
+                ctx.set_threads(t);
+                ctx.set_seed_tables(seed_tables);
+                auto& n = ctx.set_script("bench", script);
+                bool is_3d = n.input_type() == var_t::xyz;
+                int samples = is_3d ? size3 : size;
+
+                generator_slowinterpreter interp{ctx, n};
+                generator_vm bytecode_vm{ctx, n};
+                sum_interp += measure(interp, is_3d, samples, repeat).ms;
+                sum_vm += measure(bytecode_vm, is_3d, samples, repeat).ms;
+            }
+            if (t == 1) {
+                base_interp = sum_interp;
+                base_vm = sum_vm;
+            }
+            std::cout << std::setw(8) << t << std::fixed
+                      << std::setprecision(2) << std::setw(12) << sum_interp
+                      << std::setw(9) << base_interp / sum_interp << "x"
+                      << std::setw(12) << sum_vm << std::setw(9)
+                      << base_vm / sum_vm << "x" << std::endl;
+        }
+
+        if (chunks <= 0)
+            return EXIT_SUCCESS;
+
+        std::cout << "\nstreaming " << chunks << " chunks, " << depth
+                  << " in flight, " << std::thread::hardware_concurrency()
+                  << " hardware threads\n" << std::endl;
+        std::cout << std::left << std::setw(44) << "script" << std::right
+                  << std::setw(12) << "run ms" << std::setw(12) << "async ms"
+                  << std::setw(10) << "speedup" << std::setw(8) << "same"
+                  << std::endl;
+
+        double total_sync = 0.0, total_async = 0.0;
+        for (auto& script : scripts) {
+            simple_global_variables gv;
+            gv["one"] = 1.0;
+            gv["two"] = 2.0;
+
+            generator_context ctx{gv};
+            ctx.set_threads(threads);
+            ctx.set_seed_tables(seed_tables);
+            auto& n = ctx.set_script("bench", script);
+            bool is_3d = n.input_type() == var_t::xyz;
+            int samples = is_3d ? size3 : size;
+
+            generator_vm bytecode_vm{ctx, n};
+            auto t1 = stream(bytecode_vm, is_3d, samples, chunks, 0);
+            auto t2 = stream(bytecode_vm, is_3d, samples, chunks, depth);
+            total_sync += t1.ms;
+            total_async += t2.ms;
+
+            bool same = t1.checksum == t2.checksum
+                        || (std::isnan(t1.checksum)
+                            && std::isnan(t2.checksum));
+            std::cout << std::left << std::setw(44) << script.substr(0, 43)
+                      << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(12) << t1.ms << std::setw(12) << t2.ms
+                      << std::setw(9) << t1.ms / t2.ms << "x"
+                      << std::setw(8) << (same ? "yes" : "NO") << std::endl;
+        }
+
+        std::cout << std::left << std::setw(44) << "total" << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(12)
+                  << total_sync << std::setw(12) << total_async
+                  << std::setw(9) << total_sync / total_async << "x"
+                  << std::endl;
+
+    } catch (std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    } catch (...) {
+        std::cerr << "Unknown exception" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
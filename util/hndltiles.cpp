@@ -0,0 +1,81 @@
+//---------------------------------------------------------------------------
+/// \file   hexanoise/util/hndltiles.cpp
+/// \brief  Shows information about a tile store, and compacts it
+//
+// Copyright 2014-2015, nocte@hippie.nu       Released under the MIT License.
+//---------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include <hexanoise/tile_store.hpp>
+#include <hexanoise/version.hpp>
+
+namespace po = boost::program_options;
+using namespace hexa::noise;
+
+// Example:
+// $ hndltiles -i terrain.tiles --compact
+//
+int main(int argc, char** argv)
+{
+    try {
+        po::variables_map vm;
+        po::options_description options;
+        options.add_options()("version,v", "print version string")(
+            "help", "show help message")
+
+            ("input,i", po::value<std::string>(), "tile store")
+
+            ("compact,c", "drop the tiles that were stored again, and the "
+                          "remains of unfinished writes")
+
+            ;
+
+        po::positional_options_description positional;
+        positional.add("input", 1);
+        po::store(po::command_line_parser(argc, argv)
+                      .options(options)
+                      .positional(positional)
+                      .run(),
+                  vm);
+        po::notify(vm);
+
+        if (vm.count("help")) {
+            std::cout << options << std::endl;
+            return EXIT_SUCCESS;
+        }
+        if (vm.count("version")) {
+            std::cout << "hndltiles " << NOISE_VERSION << std::endl;
+            return EXIT_SUCCESS;
+        }
+        if (!vm.count("input")) {
+            std::cerr << "No tile store given" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // Nothing is added, so the budget does not matter.
+        tile_store store(vm["input"].as<std::string>(),
+                         std::numeric_limits<size_t>::max());
+
+        std::cout << "tiles: " << store.count()
+                  << "\nsize:  " << store.size() << " bytes" << std::endl;
+
+        if (vm.count("compact")) {
+            store.compact();
+            std::cout << "after compaction: " << store.size() << " bytes"
+                      << std::endl;
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    } catch (...) {
+        std::cerr << "Unknown exception" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}